@@ -0,0 +1,24 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// positions only, for depth and shadow passes fetching just the position stream
+
+layout(location = 0) in vec3 pos;
+
+// per instance
+layout(location = 3) in mat4 inst_M;
+
+// the depth pre-pass and the shading pass after it must agree on depth exactly
+invariant gl_Position;
+
+layout(binding = 0) uniform UniformBufferObject
+{
+	mat4 M;
+	mat4 V;
+	mat4 P;
+} ubo;
+
+void main ()
+{
+	gl_Position = ubo.P * ubo.V * inst_M * vec4 (pos, 1.0);
+}
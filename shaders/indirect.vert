@@ -0,0 +1,63 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Vertex shader for the GPU driven path. The object is found through the instance index,
+// which the cull pass sets to the object index.
+
+// set for quantized vertex formats, where the normal is octahedral encoded in xy
+layout(constant_id = 0) const bool OCT_NORMAL = false;
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 color;
+layout(location = 2) in vec2 tex_coord;
+layout(location = 8) in vec3 normal;
+
+layout(location = 0) out vec3 frag_color;
+layout(location = 1) out vec2 frag_tex_coord;
+layout(location = 2) flat out uint frag_tex;
+layout(location = 3) out vec3 frag_normal;
+
+layout(set = 0, binding = 0) uniform UniformBufferObject
+{
+	mat4 M;
+	mat4 V;
+	mat4 P;
+} ubo;
+
+struct Object
+{
+	mat4 M;
+	vec4 sphere;
+	uint n_indices;
+	uint first_index;
+	int vx_offset;
+	uint pad;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Objects
+{
+	vec4 planes[6];
+	uint count;
+	uint pad0, pad1, pad2;
+	Object objs[];
+};
+
+vec3 oct_decode (vec2 e)
+{
+	vec3 n = vec3 (e, 1.0 - abs (e.x) - abs (e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs (n.yx)) * vec2 (n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return n;
+}
+
+void main ()
+{
+	mat4 M = objs[gl_InstanceIndex].M;
+	gl_Position = ubo.P * ubo.V * M * vec4 (pos, 1.0);
+	frag_color = color;
+	frag_tex_coord = tex_coord;
+	frag_tex = 0;
+
+	vec3 n = OCT_NORMAL ? oct_decode (normal.xy) : normal;
+	frag_normal = normalize (mat3 (M) * n);
+}
@@ -0,0 +1,72 @@
+// Shared by the meshlet task and mesh shaders, see `Meshlet` and `MeshletConstants`.
+// Needs GL_EXT_mesh_shader and the extensions of vertex_pull.glsl.
+
+#include "vertex_pull.glsl"
+
+// meshlets culled by each task shader workgroup, MESHLET_TASK_SIZE
+#define TASK_SIZE 32
+
+struct Meshlet
+{
+	vec3 center; // bounding sphere, in the stored units of the mesh
+	float radius;
+	vec3 cone_axis; // normals of all triangles are within the cone
+	float cone_cutoff;
+	uint vertex_offset;   // in words from the start of the meshlets
+	uint triangle_offset;
+	uint vertex_count;
+	uint triangle_count;
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer Meshlets
+{
+	Meshlet m[];
+};
+
+layout(push_constant) uniform Draw
+{
+	// PullConstants of the mesh
+	uvec2 pos;
+	uvec2 attr;
+	uint pos_stride;
+	uint attr_stride;
+	uint fmt;
+
+	uvec2 meshlets;
+	uvec2 instances; // InstanceData of the frame, 17 words each
+	int base_vertex;
+	uint n_meshlets;
+	uint first_instance;
+} draw;
+
+// the meshlets of one workgroup of the task shader that survived culling
+struct Task
+{
+	uint instance;
+	uint meshlets[TASK_SIZE];
+};
+
+layout(binding = 0) uniform UniformBufferObject
+{
+	mat4 M;
+	mat4 V;
+	mat4 P;
+} ubo;
+
+mat4 instance_matrix (uint i)
+{
+	Words inst = Words (draw.instances);
+	uint w = i * 17;
+	return mat4
+	(
+		uintBitsToFloat (uvec4 (inst.w[w], inst.w[w + 1], inst.w[w + 2], inst.w[w + 3])),
+		uintBitsToFloat (uvec4 (inst.w[w + 4], inst.w[w + 5], inst.w[w + 6], inst.w[w + 7])),
+		uintBitsToFloat (uvec4 (inst.w[w + 8], inst.w[w + 9], inst.w[w + 10], inst.w[w + 11])),
+		uintBitsToFloat (uvec4 (inst.w[w + 12], inst.w[w + 13], inst.w[w + 14], inst.w[w + 15]))
+	);
+}
+
+uint instance_tex (uint i)
+{
+	return Words (draw.instances).w[i * 17 + 16];
+}
@@ -0,0 +1,17 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec4 frag_color;
+layout(location = 1) in vec2 frag_corner;
+
+layout(location = 0) out vec4 color;
+
+// round and soft towards the edge, blended additively
+void main ()
+{
+	float r2 = dot (frag_corner, frag_corner);
+	if (r2 > 1.0) discard;
+
+	float a = frag_color.a * (1.0 - r2);
+	color = vec4 (frag_color.rgb * a, a);
+}
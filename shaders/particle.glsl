@@ -0,0 +1,50 @@
+// Shared by the particle compute passes and the particle draw, see `Particle`,
+// `ParticleState` and `ParticleParams`. Define PARTICLE_SET to the descriptor set, and
+// PARTICLE_ACCESS to readonly where nothing is written.
+
+#ifndef PARTICLE_ACCESS
+#define PARTICLE_ACCESS
+#endif
+
+struct Particle
+{
+	vec4 pos; // xyz position, w age in seconds
+	vec4 vel; // xyz velocity, w lifetime in seconds
+};
+
+// both halves, the live one starts at cur * capacity
+layout(std430, set = PARTICLE_SET, binding = 0) PARTICLE_ACCESS buffer Particles
+{
+	Particle particles[];
+};
+
+layout(std430, set = PARTICLE_SET, binding = 1) PARTICLE_ACCESS buffer State
+{
+	// VkDrawIndirectCommand
+	uint draw_vertices;
+	uint n_live;
+	uint draw_first_vertex;
+	uint draw_first_instance;
+
+	// VkDispatchIndirectCommand of simulate and emit
+	uint simulate_x, simulate_y, simulate_z;
+	uint emit_x, emit_y, emit_z;
+
+	uint spawn;
+	uint cur;
+	uint next;
+	uint frame;
+};
+
+layout(std430, set = PARTICLE_SET, binding = 2) readonly buffer Params
+{
+	vec4 emitter; // xyz position, w radius
+	vec4 velocity; // xyz initial velocity, w random spread
+	vec4 gravity; // xyz acceleration, w drag
+	vec4 color;
+	float lifetime;
+	float dt;
+	float size;
+	uint emit;
+	uint capacity;
+};
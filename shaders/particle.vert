@@ -0,0 +1,39 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+// a camera facing quad per particle, one instance each with six vertices
+
+#define PARTICLE_SET 1
+#define PARTICLE_ACCESS readonly
+#include "particle.glsl"
+
+layout(set = 0, binding = 0) uniform UniformBufferObject
+{
+	mat4 M;
+	mat4 V;
+	mat4 P;
+} ubo;
+
+layout(location = 0) out vec4 frag_color;
+layout(location = 1) out vec2 frag_corner;
+
+const vec2 corners[6] = vec2[]
+(
+	vec2 (-1.0, -1.0), vec2 (1.0, -1.0), vec2 (1.0, 1.0),
+	vec2 (-1.0, -1.0), vec2 (1.0, 1.0), vec2 (-1.0, 1.0)
+);
+
+void main ()
+{
+	Particle p = particles[cur * capacity + gl_InstanceIndex];
+	vec2 corner = corners[gl_VertexIndex];
+
+	vec4 view = ubo.V * vec4 (p.pos.xyz, 1.0);
+	view.xy += size * corner;
+	gl_Position = ubo.P * view;
+
+	// fade out with age
+	frag_color = vec4 (color.rgb, color.a * (1.0 - p.pos.w / p.vel.w));
+	frag_corner = corner;
+}
@@ -0,0 +1,68 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_buffer_reference_uvec2 : require
+#extension GL_GOOGLE_include_directive : require
+
+// vertices are fetched from the geometry pools by address instead of through vertex input,
+// so one pipeline draws every vertex format and layout
+
+#include "vertex_pull.glsl"
+
+// where the vertices of the pool start, positions and attributes, and their strides in
+// words. Interleaved vertices have the attributes right after the position
+layout(push_constant) uniform Pull
+{
+	uvec2 pos;
+	uvec2 attr;
+	uint pos_stride;
+	uint attr_stride;
+	uint fmt;
+} pull;
+
+// per instance
+layout(location = 3) in mat4 inst_M;
+layout(location = 7) in uint inst_tex;
+
+layout(location = 0) out vec3 frag_color;
+layout(location = 1) out vec2 frag_tex_coord;
+layout(location = 2) flat out uint frag_tex;
+layout(location = 3) out vec3 frag_normal;
+
+// the depth pre-pass and the shading pass after it must agree on depth exactly
+invariant gl_Position;
+
+layout(binding = 0) uniform UniformBufferObject
+{
+	mat4 M;
+	mat4 V;
+	mat4 P;
+} ubo;
+
+void main ()
+{
+	// gl_VertexIndex has the vertex offset of the draw in it, the mesh's place in the pool
+	vec3 position, normal, color;
+	vec2 uv;
+	pull_vertex
+	(
+		pull.pos,
+		pull.attr,
+		pull.pos_stride,
+		pull.attr_stride,
+		pull.fmt,
+		uint (gl_VertexIndex),
+		position,
+		normal,
+		color,
+		uv
+	);
+
+	gl_Position = ubo.P * ubo.V * inst_M * vec4 (position, 1.0);
+	frag_color = color;
+	frag_tex_coord = uv;
+	frag_tex = inst_tex;
+
+	// inst_M has the dequantization folded in, which the stored normals account for
+	frag_normal = normalize (mat3 (inst_M) * normal);
+}
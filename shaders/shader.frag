@@ -3,12 +3,18 @@
 
 layout(location = 0) in vec3 frag_color;
 layout(location = 1) in vec2 frag_tex_coord;
+layout(location = 2) flat in uint frag_tex;
+layout(location = 3) in vec3 frag_normal;
 
-layout(binding = 1) uniform sampler2D texsampler;
+layout(binding = 1) uniform sampler2DArray texsampler;
 
 layout(location = 0) out vec4 color;
 
+// two sided light along the z axis
+const vec3 light = vec3 (0.0, 0.0, 1.0);
+
 void main ()
 {
-	color = texture (texsampler, frag_tex_coord) * vec4 (frag_color, 1.0);
+	float diffuse = 0.25 + 0.75 * abs (dot (normalize (frag_normal), light));
+	color = texture (texsampler, vec3 (frag_tex_coord, frag_tex)) * vec4 (frag_color * diffuse, 1.0);
 }
@@ -1,12 +1,25 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// set for quantized vertex formats, where the normal is octahedral encoded in xy
+layout(constant_id = 0) const bool OCT_NORMAL = false;
+
 layout(location = 0) in vec3 pos;
 layout(location = 1) in vec3 color;
 layout(location = 2) in vec2 tex_coord;
+layout(location = 8) in vec3 normal;
+
+// per instance
+layout(location = 3) in mat4 inst_M;
+layout(location = 7) in uint inst_tex;
 
 layout(location = 0) out vec3 frag_color;
 layout(location = 1) out vec2 frag_tex_coord;
+layout(location = 2) flat out uint frag_tex;
+layout(location = 3) out vec3 frag_normal;
+
+// the depth pre-pass and the shading pass after it must agree on depth exactly
+invariant gl_Position;
 
 layout(binding = 0) uniform UniformBufferObject
 {
@@ -15,9 +28,22 @@ layout(binding = 0) uniform UniformBufferObject
 	mat4 P;
 } ubo;
 
+vec3 oct_decode (vec2 e)
+{
+	vec3 n = vec3 (e, 1.0 - abs (e.x) - abs (e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs (n.yx)) * vec2 (n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return n;
+}
+
 void main ()
 {
-	gl_Position = ubo.P * ubo.V * ubo.M * vec4 (pos, 1.0);
+	gl_Position = ubo.P * ubo.V * inst_M * vec4 (pos, 1.0);
 	frag_color = color;
 	frag_tex_coord = tex_coord;
+	frag_tex = inst_tex;
+
+	// inst_M has the dequantization folded in, which the stored normals account for
+	vec3 n = OCT_NORMAL ? oct_decode (normal.xy) : normal;
+	frag_normal = normalize (mat3 (inst_M) * n);
 }
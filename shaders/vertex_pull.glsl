@@ -0,0 +1,63 @@
+// Vertex decoding for the shaders that fetch vertices themselves by buffer device address,
+// see `PullConstants`. Needs GL_EXT_buffer_reference and GL_EXT_buffer_reference_uvec2.
+
+#define VX_FMT_FLOAT 0
+#define VX_FMT_QUANT 1
+#define VX_FMT_QUANT_HALF_UV 2
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Words
+{
+	uint w[];
+};
+
+vec3 oct_decode (vec2 e)
+{
+	vec3 n = vec3 (e, 1.0 - abs (e.x) - abs (e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs (n.yx)) * vec2 (n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return n;
+}
+
+vec3 word3 (Words b, uint i)
+{
+	return uintBitsToFloat (uvec3 (b.w[i], b.w[i + 1], b.w[i + 2]));
+}
+
+// vertex `v` of the buffer whose positions and attributes start at `pos_addr` and
+// `attr_addr`, strides in words, decoded as the vertex input formats of `vx_attrib_desc`
+// would
+void pull_vertex
+(
+	uvec2 pos_addr,
+	uvec2 attr_addr,
+	uint pos_stride,
+	uint attr_stride,
+	uint fmt,
+	uint v,
+	out vec3 position,
+	out vec3 normal,
+	out vec3 color,
+	out vec2 uv
+)
+{
+	Words pos = Words (pos_addr);
+	Words attr = Words (attr_addr);
+	uint p = v * pos_stride, a = v * attr_stride;
+
+	if (fmt == VX_FMT_FLOAT)
+	{
+		position = word3 (pos, p);
+		normal = word3 (attr, a);
+		color = word3 (attr, a + 3);
+		uv = uintBitsToFloat (uvec2 (attr.w[a + 6], attr.w[a + 7]));
+	}
+	else
+	{
+		position = vec3 (unpackUnorm2x16 (pos.w[p]), unpackUnorm2x16 (pos.w[p + 1]).x);
+		normal = oct_decode (unpackSnorm2x16 (attr.w[a]));
+		color = unpackUnorm4x8 (attr.w[a + 1]).rgb;
+		uv = fmt == VX_FMT_QUANT_HALF_UV ?
+			unpackHalf2x16 (attr.w[a + 2]) :
+			unpackUnorm2x16 (attr.w[a + 2]);
+	}
+}
@@ -4,7 +4,18 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <stddef.h>
+#include <time.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -51,2065 +62,12803 @@ static const float tex_coords[8][2] =
 	{ 1.0f, 1.0f }
 };
 
+/**
+ *		Define vertex colors.
+ */
+static const float colors[8][3] =
+{
+	// first square
+	{ 1.0f, 0.0f, 0.0f },
+	{ 0.0f, 1.0f, 0.0f },
+	{ 0.0f, 0.0f, 1.0f },
+	{ 1.0f, 1.0f, 1.0f },
+	// second square
+	{ 1.0f, 0.0f, 0.0f },
+	{ 0.0f, 1.0f, 0.0f },
+	{ 0.0f, 0.0f, 1.0f },
+	{ 1.0f, 1.0f, 1.0f }
+};
+
 /**
  *		Define vertice indices.
  *
  * This should be changed for the applications.
  */
-static const uint16_t indices[12] =
+static const uint32_t indices[12] =
 {
 	0, 1, 2, 2, 3, 0,
 	4, 5, 6, 6, 7, 4
 };
 
-static const uint32_t WIDTH = 200;
-static const uint32_t HEIGHT = 150;
-static const int MAX_FRAMES_IN_FLIGHT = 2;
-
 /**
- *		read_file
+ *		Vertex formats.
  *
- * Helper function to read a file such as shader source.
+ * Meshes are given as `Vertex` and stored on the GPU in the format chosen for the mesh.
+ *
+ * VX_FMT_FLOAT keeps everything as 32 bit floats, 44 bytes per vertex.
+ *
+ * The quantized formats take 20 bytes:
+ *	- position as 16 bit unorm relative to the mesh bounds. The mapping back to model
+ *	  space is a scale and translation that is folded into the model matrix of each
+ *	  instance, see `mesh_model_matrix`.
+ *	- normal octahedral encoded in two 16 bit snorms, decoded in the vertex shader
+ *	- color as RGBA8 unorm
+ *	- texture coordinates as 16 bit unorm if they are all in [0, 1], half floats otherwise
  */
-static size_t read_file (const char *fname, char **data)
+typedef struct Vertex
 {
-	FILE* fp = fopen (fname, "rb");
-	if (!fp)
-	{
-		fprintf (stderr, "could not find file %s!\n", fname);
-		exit (1);
-	}
-
-	// get file size
-	fseek (fp, 0, SEEK_END);
-	size_t fsize = ftell (fp);
-	rewind (fp);
+	float pos[3];
+	float normal[3];
+	float color[3];
+	float uv[2];
+} Vertex;
 
-	// read
-	size_t result;
-	*data = (char *) malloc (fsize);
-	if ((result = fread (*data, 1, fsize, fp)) != fsize)
-	{
-		fprintf (stderr, "failed to read file contents!\n");
-		exit (1);
-	}
+typedef struct QVertex
+{
+	uint16_t pos[4]; // w is padding
+	int16_t normal[2];
+	uint8_t color[4];
+	uint16_t uv[2];
+} QVertex;
 
-	return result;
-}
+typedef enum VertexFormat
+{
+	VX_FMT_FLOAT,
+	VX_FMT_QUANT,         // unorm texture coordinates
+	VX_FMT_QUANT_HALF_UV, // half float texture coordinates
+	VX_FMT_COUNT
+} VertexFormat;
 
 /**
- * Validation layours.
+ * How the vertices of a mesh are laid out in its vertex buffer.
+ *
+ * VX_LAYOUT_INTERLEAVED keeps a whole vertex together at binding 0.
+ *
+ * VX_LAYOUT_SPLIT stores positions on their own at binding 0 and everything else in a
+ * second stream at binding 2 (binding 1 is the instances). Passes that only need positions,
+ * depth and shadows, then fetch 12 bytes per vertex as floats or 8 quantized instead of the
+ * whole vertex. Both streams live in the same buffer, the attributes from `attr_offset`.
  */
-#define N_VALIDATION_LAYERS 1
-static const const char *validation_layers[N_VALIDATION_LAYERS] =
+typedef enum VertexLayout
 {
-	"VK_LAYER_KHRONOS_validation"
-};
+	VX_LAYOUT_INTERLEAVED,
+	VX_LAYOUT_SPLIT,
+	VX_LAYOUT_COUNT
+} VertexLayout;
+
+/* second stream of VX_LAYOUT_SPLIT, per format */
+typedef struct VertexAttribs
+{
+	float normal[3];
+	float color[3];
+	float uv[2];
+} VertexAttribs;
+
+typedef struct QVertexAttribs
+{
+	int16_t normal[2];
+	uint8_t color[4];
+	uint16_t uv[2];
+} QVertexAttribs;
 
 /**
- * Device extensions.
+ * Component types vertex and index data is read from, as found in model files.
  */
-#define N_DEVICE_EXTENSIONS 1
-static const const char *device_extensions[N_DEVICE_EXTENSIONS] =
+typedef enum CompType
 {
-	VK_KHR_SWAPCHAIN_EXTENSION_NAME
-};
+	COMP_F32,
+	COMP_U8,
+	COMP_U16,
+	COMP_U32,
+	COMP_I8,
+	COMP_I16
+} CompType;
 
-typedef struct SwapChainSupportDetails
+/**
+ * One attribute of the source data of a mesh, read in place. Integer components are read
+ * as normalized values if `normalized` is set, and an attribute without `data` gets the
+ * default of `Vertex`: normal +z, white and texture coordinate zero.
+ */
+typedef struct VertexStream
 {
-	VkSurfaceCapabilitiesKHR capabilities;
-	VkSurfaceFormatKHR *fmts;
-	VkPresentModeKHR *present_modes;
-	int32_t nfmts;
-	int32_t npresmodes;
-} SwapChainSupportDetails;
+	const uint8_t *data; // first vertex
+	uint32_t stride;
+	CompType type;
+	uint32_t n_comp;
+	int normalized;
+} VertexStream;
 
-static void swapchain_support_details_free (SwapChainSupportDetails *details)
+/**
+ * Where `mesh_add_source` reads a mesh from. Without indices the vertices are drawn in
+ * order.
+ */
+typedef struct MeshSource
 {
-	if (details->fmts != NULL) free (details->fmts);
-	if (details->present_modes != NULL) free (details->present_modes);
-	details = NULL;
-}
+	uint32_t n_vertices;
+	VertexStream pos;
+	VertexStream normal;
+	VertexStream color;
+	VertexStream uv;
+	const uint8_t *idx;
+	CompType idx_type; // COMP_U8, COMP_U16 or COMP_U32
+	uint32_t n_indices;
+	int has_bounds; // min and max are given, which saves a pass over the positions
+	float min[3], max[3];
+} MeshSource;
+
+#define MESH_MAX_LODS 8
 
-typedef struct QueueFamilyIndices
+/**
+ * A level of detail of a mesh, a range of its index buffer over the same vertices.
+ * `error` is how far it may be off the full mesh, in stored position units.
+ */
+typedef struct MeshLod
 {
-	int32_t gfx_family;
-	int32_t present_family;
-} QueueFamilyIndices;
+	uint32_t first_index;
+	uint32_t n_indices;
+	float error;
+} MeshLod;
 
-void queue_family_indices_init (QueueFamilyIndices *idx)
-{
-	idx->gfx_family = idx->present_family = -1;
-}
+/**
+ * A cluster of the triangles of a mesh, culled as a whole by the task shader and drawn by
+ * a mesh shader workgroup, see `--meshlets`. The bounds are in the stored units of the
+ * mesh, like its positions: a sphere, and a cone all triangle normals fall in, such that
+ * every triangle faces away from an eye `e` if
+ *
+ *	dot (center - e, cone_axis) >= cone_cutoff * |center - e| + radius
+ *
+ * A cutoff of 1 never culls. The meshlets of a mesh are one blob: the meshlets, then the
+ * vertices of each as 32 bit indices into the mesh, then their triangles as three 8 bit
+ * indices into those, a word each. Offsets are in words from the start of the blob.
+ */
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_TASK_SIZE 32 // meshlets culled per task shader workgroup
 
-int queue_family_indices_is_complete (const QueueFamilyIndices *idx)
+typedef struct Meshlet
 {
-	// TODO is zero correct to check?
-	return (idx->gfx_family != -1) && (idx->present_family != -1);
-}
+	float center[3];
+	float radius;
+	float cone_axis[3];
+	float cone_cutoff;
+	uint32_t vertex_offset;
+	uint32_t triangle_offset;
+	uint32_t vertex_count;
+	uint32_t triangle_count;
+} Meshlet;
 
+/**
+ * Geometry uploaded to the GPU. Indices are 16 bit whenever the vertices allow it.
+ *
+ * The vertices and indices normally live in the geometry pools, at `base_vertex` and
+ * `base_index`, and the buffers are the pools'. The indices hold the full mesh, lods[0],
+ * followed by any coarser levels of detail, see `--lod`.
+ */
+typedef struct Mesh
+{
+	VkBuffer vx_buf;
+	VkDeviceMemory vx_buf_mem; // VK_NULL_HANDLE when pooled
+	VkBuffer idx_buf;
+	VkDeviceMemory idx_buf_mem;
+	int pooled;
+	int32_t base_vertex;
+	uint32_t base_index;
+	VertexFormat fmt;
+	VertexLayout layout;
+	VkIndexType idx_type;
+	VkDeviceSize attr_offset; // start of the attribute stream in vx_buf when split
+	uint32_t n_vertices;
+	uint32_t n_indices;
+	float min[3], max[3]; // bounds in model space
+	float dequant[16]; // stored position to model space
+	MeshLod lods[MESH_MAX_LODS];
+	uint32_t n_lods;
+	VkBuffer meshlet_buf; // meshlets of the full mesh, VK_NULL_HANDLE if it has none
+	VkDeviceMemory meshlet_mem;
+	VkDeviceSize meshlet_size;
+	uint32_t n_meshlets;
+} Mesh;
+
+#define MAX_MESH_FILES 16
 
-#ifdef DEBUG
 /**
- *		check_validation_layer_support
+ *		Draw list.
  *
- * Make sure the validation layers are supported.
+ * Indexed draws that make up the scene. Each command buffer is recorded from this list,
+ * so the application changes what is rendered by changing the list.
  */
-int check_validation_layer_support ()
+typedef struct DrawCmd
 {
-	uint32_t nlayers;
-	vkEnumerateInstanceLayerProperties (&nlayers, NULL);
-	VkLayerProperties *available_layers = (VkLayerProperties *) malloc (sizeof (VkLayerProperties) * nlayers);
-	vkEnumerateInstanceLayerProperties (&nlayers, available_layers);
+	uint32_t n_indices;
+	uint32_t n_instances;
+	uint32_t first_index;
+	int32_t vx_offset;
+	uint32_t first_instance;
+
+	// state, indices into the render queue tables
+	uint8_t pass;
+	uint16_t pipeline;
+	uint16_t material;
+	uint16_t mesh;
+	float depth; // normalized view depth, [0, 1]
+} DrawCmd;
 
-	for (int j = 0; j < N_VALIDATION_LAYERS; j ++)
-	{
-		const char *layer_name = validation_layers[j];
-		int found = 0;
+/**
+ *		Render queue.
+ *
+ * Draws are sorted on a packed 64 bit key before recording so that draws sharing state
+ * end up next to each other and only the binds that change are emitted. From the most
+ * significant bits:
+ *
+ *	pass (4) | pipeline (10) | material (14) | mesh (14) | depth (22)
+ *
+ * Opaque draws sort front to back, transparent ones back to front.
+ */
+#define RQ_PASS_BITS 4
+#define RQ_PIPELINE_BITS 10
+#define RQ_MATERIAL_BITS 14
+#define RQ_MESH_BITS 14
+#define RQ_DEPTH_BITS 22
 
-		for (int i = 0; i < nlayers; i ++)
-		{
-			VkLayerProperties layer = available_layers[i];
-			if (strcmp (layer.layerName, layer_name) == 0)
-			{
-				found = 1;
-				break;
-			}
-		}
+#define RQ_PASS_OPAQUE 0
+#define RQ_PASS_TRANSPARENT 1
 
-		if (!found) return 0;
-	}
+#define RQ_MAX_PIPELINES (1 << RQ_PIPELINE_BITS)
+#define RQ_MAX_MATERIALS (1 << RQ_MATERIAL_BITS)
+#define RQ_MAX_MESHES (1 << RQ_MESH_BITS)
 
-	free (available_layers);
-	return 1;
-}
-#endif
+/**
+ * Render queue tables. Entries point at the handles rather than copying them since
+ * pipelines and descriptor sets are recreated with the swapchain.
+ */
+typedef struct RqPipeline
+{
+	VkPipeline *pipe;
+	VkPipelineLayout *layout;
+	VkPipeline *depth; // depth pre-pass variant, NULL if draws skip the pre-pass
+	VkPipeline *equal; // shading after the pre-pass, depth equal and no depth writes
+	int pulls; // fetches vertices itself, from the push constants of the mesh
+	int meshlets; // task and mesh shaders drawing the meshlets of the whole mesh
+} RqPipeline;
 
 /**
- * Get required extensions from glfw to run.
+ * Which variant of their pipelines draws are recorded with. Without a depth pre-pass
+ * everything is RQ_DRAW_SHADED. With it opaque draws are first recorded depth only, and
+ * then shaded in a second render pass that tests against the depth they left so each
+ * pixel is shaded once.
  */
-static const char **get_required_extensions (uint32_t *n)
+typedef enum RqDrawVariant
 {
-	const char **ext = glfwGetRequiredInstanceExtensions (n);
+	RQ_DRAW_SHADED,
+	RQ_DRAW_DEPTH,
+	RQ_DRAW_EQUAL
+} RqDrawVariant;
 
-#ifdef DEBUG
-	// add validation layer for debugging
-	const char **ext_ = ext;
-	ext = malloc (((*n) + 1) * sizeof (char *));
-	memcpy (ext, ext_, (*n) * sizeof (char *));
-	ext[(*n)] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
-	*n += 1;
-#endif
+typedef struct RqMaterial
+{
+	VkDescriptorSet **sets; // one per swapchain image
+} RqMaterial;
 
-	return ext;
-}
+/**
+ * Push constants of the vertex pulling pipeline, see `--pull`: device addresses of the
+ * positions and attributes of the first vertex of the buffer, and their strides in 32 bit
+ * words. Interleaved vertices have the attributes right after the position.
+ */
+typedef struct PullConstants
+{
+	VkDeviceAddress pos;
+	VkDeviceAddress attr;
+	uint32_t pos_stride;
+	uint32_t attr_stride;
+	uint32_t fmt;
+} PullConstants;
 
 /**
- * Get supported extensions.
+ * Push constants of the meshlet pipeline, shared by its task and mesh shaders.
  */
-static const VkExtensionProperties *get_supported_extensions (uint32_t *n)
+typedef struct MeshletConstants
 {
-	vkEnumerateInstanceExtensionProperties (NULL, n, NULL);
-	VkExtensionProperties *ext = malloc ((*n) * sizeof (VkExtensionProperties));
-	vkEnumerateInstanceExtensionProperties (NULL, n, ext);
-	return ext;
-}
+	PullConstants pull;
+	VkDeviceAddress meshlets;
+	VkDeviceAddress instances; // instance buffer of the frame
+	int32_t base_vertex;
+	uint32_t n_meshlets;
+	uint32_t first_instance;
+} MeshletConstants;
+
+typedef struct RqMesh
+{
+	VkBuffer *vx_buf;
+	VkBuffer *idx_buf;
+	VkIndexType idx_type;
+	VkDeviceSize attr_offset; // attribute stream bound at binding 2, 0 when interleaved
+	int32_t base_vertex; // where the mesh starts in the buffers, added to each draw's
+	uint32_t base_index; // vertex offset and first index
+	const MeshLod *lods; // drawn per instance as `select_lods` picked when there are several
+	uint32_t n_lods;
+	PullConstants pull; // the same for every mesh of a pool
+	VkDeviceAddress meshlets; // 0 without
+	uint32_t n_meshlets;
+} RqMesh;
 
 /**
- * Function to find and load `vkCreateDebugUtilsMessengerEXT`.
+ * Bind counters from the last recording. A naive recording binds pipeline, descriptor
+ * set, vertex and index buffer for every draw; `binds_eliminated` is how many of those
+ * the sorted queue skipped.
  */
-VkResult myCreateDebugUtilsMessengerEXT
-(
-	VkInstance instance,
-	const VkDebugUtilsMessengerCreateInfoEXT *info,
-	const VkAllocationCallbacks *allocator,
-	VkDebugUtilsMessengerEXT *messenger
-)
+typedef struct RenderQueueStats
 {
-	PFN_vkCreateDebugUtilsMessengerEXT fn = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr
-	(
-		instance, "vkCreateDebugUtilsMessengerEXT"
-	);
-	if (!fn) return VK_ERROR_EXTENSION_NOT_PRESENT;
-	return fn (instance, info, allocator, messenger);
-}
+	uint32_t draws;
+	uint32_t pipeline_binds;
+	uint32_t descriptor_binds;
+	uint32_t vertex_binds;
+	uint32_t index_binds;
+	uint32_t binds_eliminated;
+} RenderQueueStats;
 
 /**
- * Function to find and load `vkDestroyDebugUtilsMessengerEXT`.
+ *		Instance data.
+ *
+ * Streamed through the second, per instance, vertex binding: a column major model matrix
+ * and the texture array layer to sample.
  */
-void myDestroyDebugUtilsMessengerEXT
-(
-	VkInstance instance,
-	VkDebugUtilsMessengerEXT messenger,
-	const VkAllocationCallbacks *allocator
-)
+typedef struct InstanceData
 {
-	PFN_vkDestroyDebugUtilsMessengerEXT fn = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr
-	(
-		instance, "vkDestroyDebugUtilsMessengerEXT"
-	);
-	if (fn) fn (instance, messenger, allocator);
-}
+	float M[16];
+	uint32_t tex;
+} InstanceData;
 
-static VkSurfaceFormatKHR choose_swap_surface_format (const VkSurfaceFormatKHR *fmts, size_t n) {
-	for (size_t i = 0; i < n; i ++)
-	{
-		VkSurfaceFormatKHR fmt = fmts[i];
-		if
-		(
-			fmt.format == VK_FORMAT_B8G8R8A8_SRGB &&
-			fmt.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR
-		)
-		{
-			return fmt;
-		}
-	}
+/**
+ *		Cooked scenes.
+ *
+ * Meshes and the draws of a scene stored exactly as they go to the GPU, so loading one is
+ * mapping the file and copying each blob into its buffer. The header and tables refer to
+ * everything by byte offset from the start of the file, which the loader turns into
+ * pointers, and every blob starts on a 256 byte boundary. Fields are native endian; a
+ * file cooked on a machine of the other endianness fails the magic check.
+ */
+#define COOKED_MAGIC 0x43534b56 // "VKSC"
+#define COOKED_VERSION 3
+#define COOKED_ALIGN 256
 
-	return fmts[0];
-}
+typedef struct CookedHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size; // of the whole file
+	uint32_t n_meshes;
+	uint32_t n_draws;
+	uint32_t n_instances;
+	uint32_t instance_size; // sizeof (InstanceData) when cooked
+	uint64_t meshes;    // CookedMesh[n_meshes]
+	uint64_t draws;     // CookedDraw[n_draws]
+	uint64_t instances; // InstanceData[n_instances]
+} CookedHeader;
+
+typedef struct CookedMesh
+{
+	uint32_t fmt;
+	uint32_t layout;
+	uint32_t idx_type;
+	uint32_t n_vertices;
+	uint32_t n_indices;
+	uint32_t n_lods;
+	uint32_t n_meshlets;
+	uint32_t pad;
+	uint64_t attr_offset;
+	float min[3], max[3];
+	float dequant[16];
+	MeshLod lods[MESH_MAX_LODS]; // ranges of the index blob
+	uint64_t vx, vx_size;   // vertex blob
+	uint64_t idx, idx_size; // index blob
+	uint64_t meshlets, meshlets_size; // meshlet blob, empty without
+} CookedMesh;
+
+typedef struct CookedDraw
+{
+	uint32_t mesh; // index into the file's meshes
+	uint32_t n_indices;
+	uint32_t n_instances;
+	uint32_t first_index;
+	int32_t vx_offset;
+	uint32_t first_instance; // index into the file's instances
+} CookedDraw;
+
+typedef struct Cooked
+{
+	uint8_t *map;
+	size_t size;
+	const CookedHeader *hdr;
+	const CookedMesh *meshes;
+	const CookedDraw *draws;
+	const InstanceData *instances;
+	uint32_t first_mesh; // render queue index of the file's first mesh once loaded
+} Cooked;
 
-static VkPresentModeKHR choose_swap_present_mode (const VkPresentModeKHR *modes, size_t n)
+/**
+ *		GPU driven objects.
+ *
+ * Objects live in a storage buffer read by both the cull compute shader and the vertex
+ * shader of the GPU driven path (shaders/cull.comp, shaders/indirect.vert). The layout
+ * matches std430: a header with the frustum and object count followed by the objects.
+ */
+typedef struct GpuObject
 {
-	for (size_t i = 0; i < n; i ++)
-	{
-		if (modes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
-			return modes[i];
-	}
+	float M[16];
+	float sphere[4]; // world space bounding sphere, xyz center and w radius
+	uint32_t n_indices;
+	uint32_t first_index;
+	int32_t vx_offset;
+	uint32_t pad;
+} GpuObject;
+
+typedef struct GpuObjectsHeader
+{
+	float planes[6][4];
+	uint32_t count;
+	uint32_t dispatch[3]; // VkDispatchIndirectCommand of the cull pass, for `count` objects
+} GpuObjectsHeader;
 
-	return VK_PRESENT_MODE_FIFO_KHR;
-}
+#define GPU_MAX_OBJECTS 65536
 
-static VkExtent2D choose_swap_extent (VkSurfaceCapabilitiesKHR capabilities)
+/**
+ *		GPU particles.
+ *
+ * Particles only ever exist on the GPU (shaders/particle.glsl). The particle buffer is
+ * split in two halves that take turns: each frame the live half is simulated into the
+ * other one, dropping the dead, new particles are appended after the survivors and the
+ * halves swap. The state holds the indirect arguments for the draw and for the next
+ * frame's dispatches, so the particle count never goes through the CPU.
+ */
+typedef struct Particle
 {
-	return capabilities.currentExtent;
-
-	// TODO check if below is needed
+	float pos[4]; // xyz position, w age in seconds
+	float vel[4]; // xyz velocity, w lifetime in seconds
+} Particle;
 
-	/*
-	if (capabilities.currentExtent.width != UINT32_MAX)
-		return capabilities.currentExtent;
-	else
-	{
-		int w, h;
-		glfwGetFramebufferSize (win, &w, &h);
+typedef struct ParticleState
+{
+	VkDrawIndirectCommand draw; // instance count is the number of live particles
+	VkDispatchIndirectCommand simulate;
+	VkDispatchIndirectCommand emit;
+	uint32_t spawn; // particles to emit, what fits in the free space
+	uint32_t cur; // the half with the live particles
+	uint32_t next; // particles written to the other half so far
+	uint32_t frame;
+} ParticleState;
 
-		VkExtent2D ext =
-		{
-			static_cast<uint32_t>(w),
-			static_cast<uint32_t>(h),
-		};
+/**
+ * What the emitter does, read by the compute passes every frame. Host visible and shared
+ * by the frames in flight like the GPU driven objects.
+ */
+typedef struct ParticleParams
+{
+	float emitter[4]; // xyz position, w radius
+	float velocity[4]; // xyz initial velocity, w random spread added to it
+	float gravity[4]; // xyz acceleration, w drag
+	float color[4];
+	float lifetime; // the longest, particles live between half and all of it
+	float dt; // seconds simulated per frame
+	float size; // half the side of the quads, in world units
+	uint32_t emit; // per frame
+	uint32_t capacity;
+	uint32_t pad[3];
+} ParticleParams;
 
-		ext.width = std::max
-		(
-			capabilities.minImageExtent.width,
-			std::min (capabilities.maxImageExtent.width, ext.width)
-		);
-		ext.height = std::max
-		(
-			capabilities.minImageExtent.height,
-			std::min (capabilities.maxImageExtent.height, ext.height)
-		);
+/**
+ * The compute passes of the particle update, constant 0 of shaders/particles.comp.
+ */
+typedef enum ParticleStep
+{
+	PARTICLE_SIMULATE,
+	PARTICLE_EMIT,
+	PARTICLE_SWAP,
+	N_PARTICLE_STEPS
+} ParticleStep;
 
-		return ext;
-	}
-	*/
-}
+#define PARTICLE_GROUP_SIZE 256
 
 /**
- *	VARIABLES --------------------------------------------------------------------------------------------------
+ *		Synchronization.
+ *
+ * Resources know how they were last used, and barriers are worked out from that and how
+ * they are used next. Barriers are gathered and recorded at once where work waits on
+ * other work, each with only the stages and accesses it involves. That takes
+ * VK_KHR_synchronization2, without it they are merged into one vkCmdPipelineBarrier.
  */
+#define MAX_BARRIERS 32
 
-static GLFWwindow* win; // TODO what about offscreen rendering?
-static VkInstance instance;
-static VkDebugUtilsMessengerEXT debug_messenger;
-static VkPhysicalDevice physical_device = VK_NULL_HANDLE;
-static VkDevice device; // logical device
-static VkQueue gfx_queue;
-static VkQueue present_queue;
-static VkSurfaceKHR surface;
-static VkRenderPass render_pass;
+/**
+ * What a use of a resource means for synchronization.
+ */
+typedef struct SyncUse
+{
+	VkPipelineStageFlags2KHR stage;
+	VkAccessFlags2KHR read;
+	VkAccessFlags2KHR write;
+	VkImageLayout layout;
+} SyncUse;
 
-/* swapchain */
-static VkSwapchainKHR swapchain;
-static VkImage *swapchain_imgs;
-static uint32_t n_swapchain_imgs;
-static VkFramebuffer *swapchain_framebufs;
-static VkFormat swapchain_img_fmt;
-static VkExtent2D swapchain_ext;
-static VkImageView *swapchain_img_views;
-static uint32_t n_swapchain_img_views;
+/**
+ * Where a resource or image subresource is at: the layout, what last wrote it and which
+ * reads have to finish before it is written again.
+ */
+typedef struct SyncState
+{
+	VkImageLayout layout;
+	VkPipelineStageFlags2KHR write_stage; // layout transitions count as writes
+	VkAccessFlags2KHR write_access;
+	VkPipelineStageFlags2KHR read_stage; // since the last write
+	VkPipelineStageFlags2KHR visible_stage; // that the last write has been made visible to
+	VkAccessFlags2KHR visible_access;
+	int written; // in this frame, for the render graph
+} SyncState;
 
-/* pipeline */
-static VkPipelineLayout pipeline_layout;
-static VkPipeline pipeline;
+/**
+ * The barrier going from one use to the next takes, between layouts if it is an image.
+ */
+typedef struct SyncBarrier
+{
+	VkPipelineStageFlags2KHR src_stage;
+	VkAccessFlags2KHR src_access;
+	VkPipelineStageFlags2KHR dst_stage;
+	VkAccessFlags2KHR dst_access;
+	VkImageLayout old_layout;
+	VkImageLayout new_layout;
+} SyncBarrier;
 
-/* commands */
-static VkCommandPool cmdpool;
-static VkCommandBuffer *cmdbufs;
-static VkSemaphore *img_available;
-static VkSemaphore *render_finished;
-static VkFence *in_flight_fences;
-static VkFence *imgs_in_flight;
+/**
+ * Barriers waiting to be recorded, see `barriers_flush`. Buffers share a global memory
+ * barrier.
+ */
+typedef struct Barriers
+{
+	VkMemoryBarrier2KHR mem;
+	int has_mem;
+	VkImageMemoryBarrier2KHR imgs[MAX_BARRIERS];
+	uint32_t n_imgs;
+} Barriers;
 
-/* vertex buffer */
-static VkBuffer vx_buf;
-static VkBuffer staging_buf;
-static VkDeviceMemory vx_buf_mem;
+/**
+ * The state of each subresource of an image used outside the frame graph, so whoever
+ * uses it next only says how.
+ */
+typedef struct TrackedImg
+{
+	VkImage img;
+	VkImageAspectFlags aspect;
+	uint32_t n_levels;
+	uint32_t n_layers;
+	SyncState *subs; // of each layer of each level
+} TrackedImg;
 
-/* index buffer */
-static VkBuffer idx_buf;
-static VkDeviceMemory idx_buf_mem;
+/**
+ *		Render graph.
+ *
+ * A frame is a list of passes, each declaring how it uses the graph's resources. From that
+ * the graph culls passes nothing needs, groups the rest in levels of passes that do not
+ * depend on each other, and works out the barriers, batched into one before each level.
+ * Images that live only within the frame are created by the graph, and share memory
+ * when no level uses both. Raster passes get their render pass and framebuffers from the
+ * graph, with load and store operations following what comes before and after them.
+ */
+#define RG_MAX_PASSES 32 // fits the dependency masks
+#define RG_MAX_RESOURCES 32
+#define RG_MAX_PASS_USES 8
 
-/* uniform buffer */
-static VkBuffer *unif_buf;
-static VkDeviceMemory *unif_buf_mem;
+/**
+ * How a pass uses a resource, combined with |. Attachments keep what earlier passes left
+ * in them and are cleared when nothing did.
+ */
+typedef enum RgUsage
+{
+	RG_COLOR = 1 << 0, // color attachment
+	RG_DEPTH = 1 << 1, // depth attachment, tested and written
+	RG_SAMPLED = 1 << 2, // sampled in fragment shaders
+	RG_STORAGE_READ = 1 << 3, // in compute shaders
+	RG_STORAGE_WRITE = 1 << 4,
+	RG_VERTEX_READ = 1 << 5, // storage buffers read by vertex shaders
+	RG_INDIRECT = 1 << 6, // indirect draw or dispatch arguments
+	RG_TRANSFER_SRC = 1 << 7,
+	RG_TRANSFER_DST = 1 << 8
+} RgUsage;
+
+typedef enum RgPassFlags
+{
+	RG_PASS_RASTER = 1 << 0, // runs inside a render pass on its attachments
+	RG_PASS_KEEP = 1 << 1 // has effects outside the graph, never culled
+} RgPassFlags;
 
-/* descriptor */
-static VkDescriptorPool descriptor_pool;
-static VkDescriptorSet *descriptor_sets;
-static VkDescriptorSetLayout descriptor_set_layout;
+typedef void (*RgRecordFn) (VkCommandBuffer cmdbuf, uint32_t img, void *user);
 
-/* texture */
-static VkImage tex_img;
-static VkDeviceMemory tex_img_mem;
-static VkImageView tex_img_view;
-static VkSampler tex_sampler;
+typedef struct RgUse
+{
+	uint32_t res;
+	uint32_t usage; // RgUsage
+} RgUse;
 
-/* depth buffer */
-static VkImage depth_img;
-static VkDeviceMemory depth_img_mem;
-static VkImageView depth_img_view;
+typedef struct RgPass
+{
+	const char *name;
+	uint32_t flags; // RgPassFlags
+	RgRecordFn record;
+	void *user;
+	VkSubpassContents contents; // of the render pass, can change between recordings
+	RgUse uses[RG_MAX_PASS_USES];
+	uint32_t n_uses;
+
+	// compiled
+	int kept;
+	uint32_t level;
+	uint32_t deps; // passes it has to run after
+	uint32_t producers; // passes whose writes it reads
+	VkAttachmentLoadOp load[RG_MAX_PASS_USES]; // of each use that is an attachment
+	VkRenderPass render_pass;
+	VkFramebuffer *framebufs; // one per swapchain image
+	VkClearValue clear[RG_MAX_PASS_USES];
+	uint32_t n_attachments;
+} RgPass;
+
+typedef struct RgResource
+{
+	const char *name;
+	int image;
+	int transient; // created by the graph and only valid within the frame
+	VkFormat fmt;
+	VkImageAspectFlags aspect;
+	const VkImage *imgs; // imported, one per swapchain image or one for all
+	const VkImageView *views;
+	uint32_t n_imgs;
+	VkBuffer buf;
+	SyncState initial; // of imported images at the start of each frame
+	VkImageLayout final; // imported images are left in this
+
+	// compiled
+	VkImageUsageFlags usage;
+	uint32_t first, last; // levels it is used in
+	int used;
+	VkImage img; // transient
+	VkImageView view;
+	VkMemoryRequirements mem_req;
+	uint32_t slot;
+} RgResource;
 
-/* state variables */
-static size_t current_frame = 0;
-static int framebuf_resized = 0;
+/**
+ * The barriers before a level, the image barriers name resources as the image can depend
+ * on the swapchain image of the frame.
+ */
+typedef struct RgImageBarrier
+{
+	uint32_t res;
+	SyncBarrier barrier;
+} RgImageBarrier;
+
+typedef struct RgBatch
+{
+	SyncBarrier mem; // global memory barrier, for buffers
+	int has_mem;
+	RgImageBarrier imgs[RG_MAX_RESOURCES];
+	uint32_t n_imgs;
+} RgBatch;
+
+typedef struct RenderGraph
+{
+	VkExtent2D ext; // of the transient images and render passes
+	uint32_t n_imgs; // swapchain images, framebuffers are made for each
+
+	RgPass passes[RG_MAX_PASSES];
+	uint32_t n_passes;
+	RgResource resources[RG_MAX_RESOURCES];
+	uint32_t n_resources;
+
+	// compiled
+	uint32_t order[RG_MAX_PASSES];
+	uint32_t n_order;
+	uint32_t n_levels;
+	RgBatch batches[RG_MAX_PASSES + 1]; // before each level, and one at the end
+	VkDeviceMemory slots[RG_MAX_RESOURCES]; // transient memory, shared by aliasing images
+	VkDeviceSize slot_size[RG_MAX_RESOURCES];
+	uint32_t slot_types[RG_MAX_RESOURCES];
+	uint32_t n_slots;
+	VkDeviceSize transient_size; // of all transient images, without aliasing
+	VkDeviceSize memory_size; // what they take with it
+} RenderGraph;
 
 /**
- * Queries queue families to find the one that supports the given device.
+ * How command buffers are recorded.
+ *
+ * RECORD_STATIC records one command buffer per framebuffer up front and only re-records
+ * when the swapchain is recreated. RECORD_DYNAMIC re-records the frame's command buffer
+ * from a transient per-frame pool whenever the draw list has changed.
  */
-static int query_queue_families (
-	VkPhysicalDevice dev,
-	uint32_t *gfx_family,
-	uint32_t *present_support
-)
+typedef enum RecordMode
 {
-	uint32_t n = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties (dev, &n, NULL);
-	VkQueueFamilyProperties families[n];
-	vkGetPhysicalDeviceQueueFamilyProperties (dev, &n, families);
-	uint8_t found_gfx_family = 0, found_present_support = 0;
+	RECORD_STATIC,
+	RECORD_DYNAMIC
+} RecordMode;
 
-	for (int i = 0; i < n; i ++)
-	{
-		VkQueueFamilyProperties family = families[i];
+/**
+ * Called with the pixels of a rendered frame once the fence of its submission has
+ * signaled. The pixels are tightly packed RGBA8 rows and only valid during the call.
+ */
+typedef void (*ReadbackFn) (const uint8_t *rgba, uint32_t w, uint32_t h, uint64_t frame, void *user);
 
-		if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT)
-		{
-			*gfx_family = i;
-			found_gfx_family = 1;
-		}
+/**
+ * A frame whose color image is being copied to the readback buffer of `img`.
+ */
+typedef struct ReadbackPending
+{
+	uint32_t img;
+	VkFence fence;
+	uint64_t frame;
+} ReadbackPending;
 
-		VkBool32 sup = 0;
-		vkGetPhysicalDeviceSurfaceSupportKHR (dev, i, surface, &sup);
+#define READBACK_MAX_PENDING 8
 
-		if (sup)
-		{
-			*present_support = i;
-			found_present_support = 1;
-		}
+/**
+ * Contents of the uniform buffer, matching `UniformBufferObject` in the vertex shader.
+ * Matrices are column major.
+ */
+typedef struct UniformBufferObject
+{
+	float M[16];
+	float V[16];
+	float P[16];
+} UniformBufferObject;
 
-		if (found_gfx_family && found_present_support) break;
+/**
+ * One job of a batch: render the scene from a camera at a size.
+ */
+typedef struct BatchJob
+{
+	uint32_t w, h;
+	float eye[3];
+	float center[3];
+	float fovy; // degrees
+	char out[256]; // PPM file to write, empty for none
+} BatchJob;
+
+/**
+ * A physical device considered by `pick_physical_device`.
+ */
+typedef struct DeviceCandidate
+{
+	VkPhysicalDevice dev;
+	VkPhysicalDeviceProperties props;
+	char uuid[2 * VK_UUID_SIZE + 1];
+	int suitable;
+	uint64_t score;
+	double probe_ms; // negative if not probed
+} DeviceCandidate;
+
+/**
+ * Format of the raw video stream written from the readback.
+ */
+typedef enum StreamFmt
+{
+	STREAM_NONE,
+	STREAM_RAW, // RGBA8 frames back to back
+	STREAM_Y4M  // YUV4MPEG2, 4:4:4
+} StreamFmt;
+
+static const uint32_t WIDTH = 200;
+static const uint32_t HEIGHT = 150;
+static const int MAX_FRAMES_IN_FLIGHT = 2;
+
+/**
+ *		read_file
+ *
+ * Helper function to read a file such as shader source.
+ */
+static size_t read_file (const char *fname, char **data)
+{
+	FILE* fp = fopen (fname, "rb");
+	if (!fp)
+	{
+		fprintf (stderr, "could not find file %s!\n", fname);
+		exit (1);
 	}
 
-	return found_gfx_family && found_present_support;
+	// get file size
+	fseek (fp, 0, SEEK_END);
+	size_t fsize = ftell (fp);
+	rewind (fp);
+
+	// read
+	size_t result;
+	*data = (char *) malloc (fsize);
+	if ((result = fread (*data, 1, fsize, fp)) != fsize)
+	{
+		fprintf (stderr, "failed to read file contents!\n");
+		exit (1);
+	}
+
+	return result;
 }
 
 /**
- * Callback when the framebuffer has been resized.
+ *		now_ms
  *
- * TODO this does not feel like it is needed. Or?
+ * Monotonic wall clock in milliseconds, used for timing.
  */
-static void framebuf_resize_cb (GLFWwindow *win, int w, int h)
+static double now_ms ()
 {
-	// auto app = reinterpret_cast<HelloTriangleApplication*> (glfwGetWindowUserPointer (win));
-	framebuf_resized = 1;
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
 }
 
 /**
- * Initialize GLFW window.
+ *		mat4_*
+ *
+ * Column major 4x4 matrix helpers for the camera.
  */
-static void init_window ()
+static void mat4_identity (float M[16])
 {
-	glfwInit ();
-	glfwWindowHint (GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint (GLFW_RESIZABLE, GLFW_FALSE);
-	win = glfwCreateWindow (WIDTH, HEIGHT, "Vulkan", NULL, NULL);
-	glfwSetFramebufferSizeCallback (win, framebuf_resize_cb);
+	memset (M, 0, 16 * sizeof (float));
+	M[0] = M[5] = M[10] = M[15] = 1.0f;
+}
+
+static void mat4_mul (float R[16], const float A[16], const float B[16])
+{
+	float T[16];
+	for (int c = 0; c < 4; c ++)
+		for (int r = 0; r < 4; r ++)
+			T[c * 4 + r] =
+				A[0 * 4 + r] * B[c * 4 + 0] +
+				A[1 * 4 + r] * B[c * 4 + 1] +
+				A[2 * 4 + r] * B[c * 4 + 2] +
+				A[3 * 4 + r] * B[c * 4 + 3];
+	memcpy (R, T, sizeof (T));
+}
+
+static void mat4_mul_vec4 (float r[4], const float M[16], const float v[4])
+{
+	for (int i = 0; i < 4; i ++)
+		r[i] = M[i] * v[0] + M[4 + i] * v[1] + M[8 + i] * v[2] + M[12 + i] * v[3];
+}
+
+static void vec3_normalize (float v[3])
+{
+	float l = sqrtf (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	if (l > 0.0f)
+	{
+		v[0] /= l;
+		v[1] /= l;
+		v[2] /= l;
+	}
+}
+
+static void vec3_cross (float r[3], const float a[3], const float b[3])
+{
+	r[0] = a[1] * b[2] - a[2] * b[1];
+	r[1] = a[2] * b[0] - a[0] * b[2];
+	r[2] = a[0] * b[1] - a[1] * b[0];
 }
 
 /**
- * No idea what goes on in this function.
+ * Right handed view matrix looking from `eye` at `center` with y up.
  */
-static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback
-(
-	VkDebugUtilsMessageSeverityFlagBitsEXT severity,
-	VkDebugUtilsMessageTypeFlagsEXT type,
-	const VkDebugUtilsMessengerCallbackDataEXT* data,
-	void* userd
-)
+static void mat4_look_at (float M[16], const float eye[3], const float center[3])
 {
-	fprintf (stderr, "validation layer: %s\n", data->pMessage);
-	return VK_FALSE;
+	float f[3] = { center[0] - eye[0], center[1] - eye[1], center[2] - eye[2] };
+	vec3_normalize (f);
+
+	float up[3] = { 0.0f, 1.0f, 0.0f };
+	if (fabsf (f[1]) > 0.999f)
+	{
+		up[1] = 0.0f;
+		up[2] = 1.0f;
+	}
+
+	float s[3], u[3];
+	vec3_cross (s, f, up);
+	vec3_normalize (s);
+	vec3_cross (u, s, f);
+
+	mat4_identity (M);
+	M[0] = s[0]; M[4] = s[1]; M[8] = s[2];
+	M[1] = u[0]; M[5] = u[1]; M[9] = u[2];
+	M[2] = -f[0]; M[6] = -f[1]; M[10] = -f[2];
+	M[12] = -(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]);
+	M[13] = -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]);
+	M[14] = f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2];
 }
 
-#ifdef DEBUG
 /**
- * Populate debug message with more info.
+ * Perspective projection to Vulkan clip space, which has y down and depth in [0, 1].
  */
-static void populate_debug_msg_info (VkDebugUtilsMessengerCreateInfoEXT *info)
+static void mat4_perspective (float M[16], float fovy, float aspect, float near, float far)
 {
-	info->sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-	info->messageSeverity =
-		VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-		VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-		VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-	info->messageType =
-		VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-		VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-		VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-	info->pfnUserCallback = debug_callback;
-	info->pUserData = NULL;
+	float f = 1.0f / tanf (fovy / 2.0f);
+
+	memset (M, 0, 16 * sizeof (float));
+	M[0] = f / aspect;
+	M[5] = -f;
+	M[10] = far / (near - far);
+	M[11] = -1.0f;
+	M[14] = near * far / (near - far);
 }
 
-static void setup_debugger ()
+/**
+ *		JSON.
+ *
+ * Just enough of a parser for glTF. The text is split into tokens in place, and objects
+ * and arrays know where their subtree ends so lookups skip over whole values.
+ */
+#define JSON_MAX_DEPTH 64
+
+typedef enum JsonType
 {
-	VkDebugUtilsMessengerCreateInfoEXT info = { 0 };
-	populate_debug_msg_info (&info);
-	VkResult res;
-	if ((res = myCreateDebugUtilsMessengerEXT (instance, &info, NULL, &debug_messenger)) != VK_SUCCESS)
-	{
-		fprintf (stderr, "failed to set up debug messenger: %d!\n", res);
-		exit (1);
-	}
-}
-#endif
+	JSON_OBJECT,
+	JSON_ARRAY,
+	JSON_STRING,
+	JSON_PRIMITIVE // number, true, false or null
+} JsonType;
 
-static void create_instance ()
+typedef struct JsonToken
 {
-	// application info
-	//
-	// TODO not sure there is 1.2
+	JsonType type;
+	uint32_t start, end; // byte range in the text, strings without their quotes
+	uint32_t size;       // direct children, keys and values both count in objects
+	uint32_t next;       // first token after this one's subtree
+} JsonToken;
 
-	VkApplicationInfo app_info = { 0 };
-	app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-	app_info.pApplicationName = "hello madafaka";
-	app_info.applicationVersion = VK_MAKE_VERSION (1, 2, 0);
-	app_info.pEngineName = "No Engine";
-	app_info.engineVersion = VK_MAKE_VERSION (1, 2, 0);
-	app_info.apiVersion = VK_API_VERSION_1_2;
+typedef struct Json
+{
+	const char *text;
+	JsonToken *tok;
+	uint32_t n;
+	uint32_t cap;
+} Json;
 
-	// instance create info
+static uint32_t json_token (Json *j, JsonType type, uint32_t start, const uint32_t *stack, uint32_t depth)
+{
+	if (j->n == j->cap)
+	{
+		j->cap = j->cap ? j->cap * 2 : 1024;
+		j->tok = realloc (j->tok, j->cap * sizeof (JsonToken));
+	}
 
-	VkInstanceCreateInfo create_info = { 0 };
-	create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-	create_info.pApplicationInfo = &app_info;
+	if (depth > 0)
+		j->tok[stack[depth - 1]].size ++;
 
-	// extensions
-	//
-	// get required extensions and make sure they are all supported
+	JsonToken *t = &j->tok[j->n];
+	t->type = type;
+	t->start = start;
+	t->end = start;
+	t->size = 0;
+	t->next = j->n + 1;
 
-	uint32_t n_ext;
-	const char **ext = get_required_extensions (&n_ext);
+	return j->n ++;
+}
 
-	uint32_t n_vk_ext;
-	const VkExtensionProperties *vk_ext = get_supported_extensions (&n_vk_ext);
+/**
+ * Tokenize `len` bytes of `text`, which must outlive `j`. Returns 0 on success.
+ */
+static int json_parse (Json *j, const char *text, size_t len)
+{
+	uint32_t stack[JSON_MAX_DEPTH];
+	uint32_t depth = 0;
 
-#ifdef DEBUG
-	printf ("%d extensions required\n", n_ext);
-#endif
+	memset (j, 0, sizeof (Json));
+	j->text = text;
 
-	for (int i = 0; i < n_ext; i ++)
+	for (size_t i = 0; i < len; i ++)
 	{
-#ifdef DEBUG
-		printf ("\t%s => ", ext[i]);
-#endif
-		int found = 0;
-		for (int j = 0; j < n_vk_ext; j ++)
+		char c = text[i];
+
+		if (c == '{' || c == '[')
 		{
-			if (strcmp (ext[i], vk_ext[j].extensionName) == 0)
-			{
-				found = 1;
-				break;
-			}
+			if (depth == JSON_MAX_DEPTH)
+				return -1;
+			stack[depth] = json_token (j, c == '{' ? JSON_OBJECT : JSON_ARRAY, i, stack, depth);
+			depth ++;
 		}
-		if (!found)
+		else if (c == '}' || c == ']')
 		{
-#ifdef DEBUG
-			printf ("not found!\n");
-#endif
-			fprintf (stderr, "not all extensions supported!\n");
-			exit (1);
+			if (depth == 0)
+				return -1;
+			JsonToken *t = &j->tok[stack[-- depth]];
+			// lookups take the token after each key as its value
+			if (t->type == JSON_OBJECT && t->size % 2 != 0)
+				return -1;
+			t->end = i + 1;
+			t->next = j->n;
+		}
+		else if (c == '"')
+		{
+			uint32_t t = json_token (j, JSON_STRING, i + 1, stack, depth);
+			for (i ++; i < len && text[i] != '"'; i ++)
+				if (text[i] == '\\')
+					i ++;
+			if (i >= len)
+				return -1;
+			j->tok[t].end = i;
+		}
+		else if (c == '-' || isalnum ((unsigned char) c))
+		{
+			uint32_t t = json_token (j, JSON_PRIMITIVE, i, stack, depth);
+			while (i < len && !strchr (",]} \t\r\n", text[i]))
+				i ++;
+			j->tok[t].end = i --;
 		}
-#ifdef DEBUG
-		else printf ("found\n");
-#endif
 	}
-	// all extensions supported
-	create_info.enabledExtensionCount = n_ext;
-	create_info.ppEnabledExtensionNames = ext;
-
-	// validation layers
 
-#ifdef DEBUG
-	VkDebugUtilsMessengerCreateInfoEXT debug_info = { 0 };
-	if (!check_validation_layer_support ())
-	{
-		fprintf (stderr, "validation layers requested but not supported!\n");
-		exit (1);
-	}
-	create_info.enabledLayerCount = N_VALIDATION_LAYERS;
-	create_info.ppEnabledLayerNames = validation_layers;
+	return depth == 0 && j->n > 0 ? 0 : -1;
+}
 
-	populate_debug_msg_info (&debug_info);
-	create_info.pNext = (VkDebugUtilsMessengerCreateInfoEXT *) &debug_info;
-#else
-	create_info.enabledLayerCount = 0;
-	create_info.pNext = NULL;
-#endif
+static void json_free (Json *j)
+{
+	free (j->tok);
+	memset (j, 0, sizeof (Json));
+}
 
-	// create the instance
+/**
+ * Value of `key` in the object at token `obj`, -1 if there is none.
+ */
+static int json_find (const Json *j, int obj, const char *key)
+{
+	if (obj < 0 || j->tok[obj].type != JSON_OBJECT)
+		return -1;
 
-	VkResult res = vkCreateInstance (&create_info, NULL, &instance);
-	if (res != VK_SUCCESS)
+	size_t len = strlen (key);
+	for (uint32_t i = obj + 1; i < j->tok[obj].next; i = j->tok[i + 1].next)
 	{
-		fprintf (stderr, "failed to create instance! error code: %d\n", res);
-		exit (1);
+		const JsonToken *k = &j->tok[i];
+		if (k->end - k->start == len && memcmp (j->text + k->start, key, len) == 0)
+			return i + 1;
 	}
 
-#ifdef DEBUG
-	// TODO this is ugly
-	free (ext);
-#endif
-	free ((void *) vk_ext);
+	return -1;
 }
 
-static void create_surface ()
+/**
+ * Tokens of the elements of the array at `arr` in `*out`, allocated, returning how many
+ * there are. Indexing arrays like this once saves walking them on every lookup.
+ */
+static uint32_t json_elements (const Json *j, int arr, uint32_t **out)
 {
-	if (glfwCreateWindowSurface (instance, win, NULL, &surface) != VK_SUCCESS)
-	{
-		fprintf (stderr, "failed to create window surface\n");
-		exit (1);
-	}
+	*out = NULL;
+	if (arr < 0 || j->tok[arr].type != JSON_ARRAY)
+		return 0;
+
+	uint32_t n = j->tok[arr].size;
+	*out = malloc ((n ? n : 1) * sizeof (uint32_t));
+	for (uint32_t i = 0, t = arr + 1; i < n; i ++, t = j->tok[t].next)
+		(*out)[i] = t;
+
+	return n;
 }
 
-int check_device_ext_support (VkPhysicalDevice dev)
+/**
+ * Element `i` of the array at `arr`, -1 if it is out of range.
+ */
+static int json_at (const Json *j, int arr, uint32_t i)
 {
-	uint32_t n;
-	vkEnumerateDeviceExtensionProperties (dev, NULL, &n, NULL);
-	VkExtensionProperties ext[n];
-	vkEnumerateDeviceExtensionProperties (dev, NULL, &n, ext);
+	if (arr < 0 || j->tok[arr].type != JSON_ARRAY || i >= j->tok[arr].size)
+		return -1;
 
-	// x will be the number of required device extrensions that we support
-	// - then we check later is the same as the number of actual required extensions
-	int x = 0;
+	uint32_t t = arr + 1;
+	while (i --)
+		t = j->tok[t].next;
+	return t;
+}
 
-	for (int j = 0; j < N_DEVICE_EXTENSIONS; j ++)
-	{
-		const char *req_ext = device_extensions[j];
-		for (int i = 0; i < n; i ++)
-		{
-			VkExtensionProperties e = ext[i];
-			if (strcmp(e.extensionName, req_ext) == 0)
-				x += 1;
-		}
-	}
+static double json_num (const Json *j, int t, double def)
+{
+	if (t < 0 || j->tok[t].type != JSON_PRIMITIVE)
+		return def;
+	return strtod (j->text + j->tok[t].start, NULL);
+}
 
-	return x == N_DEVICE_EXTENSIONS;
+static int json_str_eq (const Json *j, int t, const char *s)
+{
+	if (t < 0 || j->tok[t].type != JSON_STRING)
+		return 0;
+	size_t len = strlen (s);
+	return j->tok[t].end - j->tok[t].start == len && memcmp (j->text + j->tok[t].start, s, len) == 0;
 }
 
-SwapChainSupportDetails query_swapchain_support (VkPhysicalDevice dev)
+static int json_true (const Json *j, int t)
 {
-	SwapChainSupportDetails details;
+	return t >= 0 && j->tok[t].type == JSON_PRIMITIVE && j->text[j->tok[t].start] == 't';
+}
 
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR (dev, surface, &details.capabilities);
+/**
+ *		glTF binary.
+ *
+ * A .glb is mapped into memory as a whole. The JSON chunk is tokenized in place, and
+ * accessors are turned into `VertexStream`s pointing into the mapped BIN chunk, so
+ * geometry is read straight from the file into the staging buffer. Only the embedded BIN
+ * buffer is supported, not external ones.
+ */
+#define GLB_MAGIC 0x46546c67 // "glTF"
+#define GLB_CHUNK_JSON 0x4e4f534a
+#define GLB_CHUNK_BIN 0x004e4942
 
-	uint32_t n;
-	vkGetPhysicalDeviceSurfaceFormatsKHR (dev, surface, &n, NULL);
-	if (n != 0)
-	{
-		details.fmts = malloc (sizeof (VkSurfaceFormatKHR) * n);
-		vkGetPhysicalDeviceSurfaceFormatsKHR (dev, surface, &n, details.fmts);
-		details.nfmts = n;
-	}
+typedef struct Glb
+{
+	const char *fname;
+	uint8_t *map;
+	size_t size;
+	Json json;
+	const uint8_t *bin;
+	uint64_t bin_size;
+	uint32_t *accessors;
+	uint32_t n_accessors;
+	uint32_t *views;
+	uint32_t n_views;
+} Glb;
+
+static uint32_t glb_u32 (const uint8_t *p)
+{
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
 
-	vkGetPhysicalDeviceSurfacePresentModesKHR (dev, surface, &n, NULL);
-	if (n != 0)
-	{
-		details.present_modes = malloc (sizeof (VkPresentModeKHR) * n);
-		vkGetPhysicalDeviceSurfacePresentModesKHR (dev, surface, &n, details.present_modes);
-		details.npresmodes = n;
-	}
+static void glb_fail (const Glb *glb, const char *what)
+{
+	fprintf (stderr, "%s: %s!\n", glb->fname, what);
+	exit (1);
+}
 
-	return details;
+/**
+ * The number at token `t`, `def` if there is none, as an unsigned integer. Anything
+ * negative, fractional or above `max` fails the file.
+ */
+static uint64_t glb_uint (const Glb *glb, int t, uint64_t def, uint64_t max)
+{
+	double v = json_num (&glb->json, t, (double) def);
+	if (!(v >= 0.0 && v <= (double) max) || v != floor (v))
+		glb_fail (glb, "number out of range");
+	return (uint64_t) v;
 }
 
-static int is_device_suitable (VkPhysicalDevice dev)
+static void glb_open (const char *fname, Glb *glb)
 {
-	// Apparently this was just an example on how to do it.
-	VkPhysicalDeviceProperties props;
-	vkGetPhysicalDeviceProperties (dev, &props);
+	memset (glb, 0, sizeof (Glb));
+	glb->fname = fname;
 
-	VkPhysicalDeviceFeatures feats;
-	vkGetPhysicalDeviceFeatures (dev, &feats);
+	int fd = open (fname, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat (fd, &st) != 0)
+		glb_fail (glb, "could not open");
 
-	int gfx_family, present_support;
-	int qfound = query_queue_families (dev, &gfx_family, &present_support);
-	int ext_support = check_device_ext_support (dev);
+	glb->size = (size_t) st.st_size;
+	if (glb->size < 20)
+		glb_fail (glb, "too short to be glTF binary");
 
-	int swapchain_adequate = 1;
-	if (ext_support)
-	{
-		SwapChainSupportDetails sup = query_swapchain_support (dev);
-		swapchain_adequate = sup.fmts && sup.present_modes;
-		swapchain_support_details_free (&sup);
-	}
+	glb->map = mmap (NULL, glb->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (glb->map == MAP_FAILED)
+		glb_fail (glb, "could not map");
+	madvise (glb->map, glb->size, MADV_WILLNEED);
 
-#ifdef DEBUG
-	printf ("physical device: %s => ", props.deviceName);
-#endif
+	// header, then the JSON chunk and an optional BIN chunk
 
-	if (qfound && ext_support && swapchain_adequate && feats.samplerAnisotropy)
-	{
-#ifdef DEBUG
-		printf ("good!\n");
-#endif
-		return 0;
-	}
-	else
-	{
-#ifdef DEBUG
-		printf ("no good!\n");
-#endif
-		return 1;
-	}
-}
+	const uint8_t *p = glb->map;
+	if (glb_u32 (p) != GLB_MAGIC || glb_u32 (p + 4) != 2)
+		glb_fail (glb, "not glTF 2.0 binary");
 
-static void pick_physical_device ()
-{
-	uint32_t n;
-	vkEnumeratePhysicalDevices (instance, &n, NULL);
-	assert (n > 0);
+	uint32_t json_len = glb_u32 (p + 12);
+	if (glb_u32 (p + 16) != GLB_CHUNK_JSON || 20 + (uint64_t) json_len > glb->size)
+		glb_fail (glb, "malformed JSON chunk");
 
-	VkPhysicalDevice devices[n];
-	vkEnumeratePhysicalDevices (instance, &n, devices);
+	if (json_parse (&glb->json, (const char *) p + 20, json_len) != 0)
+		glb_fail (glb, "malformed JSON");
 
-	for (int i = 0; i < n; i ++)
+	uint64_t bin_at = 20 + (uint64_t) ((json_len + 3) & ~3u);
+	if (bin_at + 8 <= glb->size && glb_u32 (p + bin_at + 4) == GLB_CHUNK_BIN)
 	{
-		if (is_device_suitable (devices[i]) == 0)
-		{
-			physical_device = devices[i];
-			break;
-		}
+		glb->bin = p + bin_at + 8;
+		glb->bin_size = glb_u32 (p + bin_at);
+		if (bin_at + 8 + glb->bin_size > glb->size)
+			glb_fail (glb, "malformed BIN chunk");
 	}
 
-	assert (physical_device != VK_NULL_HANDLE);
+	int buf = json_at (&glb->json, json_find (&glb->json, 0, "buffers"), 0);
+	if (buf >= 0 && json_find (&glb->json, buf, "uri") >= 0)
+		glb_fail (glb, "external buffers are not supported");
+
+	glb->n_accessors = json_elements (&glb->json, json_find (&glb->json, 0, "accessors"), &glb->accessors);
+	glb->n_views = json_elements (&glb->json, json_find (&glb->json, 0, "bufferViews"), &glb->views);
 }
 
-static void create_logical_device ()
+static void glb_close (Glb *glb)
 {
-	uint32_t gfx_family, present_support;
-	query_queue_families (physical_device, &gfx_family, &present_support);
-
-	// I find this part with queue families very confusing and static.
-	// Can maybe be re-worked one day when I understand better what the hell is going on.
-
-	const uint32_t nfamilies = gfx_family == present_support ? 1 : 2;
-	float prio = 1.0f;
-	uint32_t families[2] = { gfx_family, present_support };
-	VkDeviceQueueCreateInfo qinfos[nfamilies];
-	memset(qinfos, 0, sizeof (VkDeviceQueueCreateInfo) * nfamilies);
-
-	for (int i = 0; i < nfamilies; i ++)
-	{
-		//VkDeviceQueueCreateInfo info = { 0 };
-		qinfos[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		qinfos[i].queueFamilyIndex = families[i];
-		qinfos[i].queueCount = 1;
-		qinfos[i].pQueuePriorities = &prio;
-		//qinfos[i] = info;
-	}
-
-	VkPhysicalDeviceFeatures feats = { 0 };
-	feats.samplerAnisotropy = VK_TRUE;
+	munmap (glb->map, glb->size);
+	json_free (&glb->json);
+	free (glb->accessors);
+	free (glb->views);
+	memset (glb, 0, sizeof (Glb));
+}
 
-	VkDeviceCreateInfo info = { 0 };
-	info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	info.pQueueCreateInfos = qinfos;
-	info.queueCreateInfoCount = nfamilies;
-	info.pEnabledFeatures = &feats;
-	info.enabledExtensionCount = N_DEVICE_EXTENSIONS;
-	info.ppEnabledExtensionNames = device_extensions;
+/**
+ * Bytes of buffer view `i` in the BIN chunk, and its stride, 0 if tightly packed.
+ */
+static const uint8_t *glb_view (const Glb *glb, uint32_t i, uint64_t *len, uint32_t *stride)
+{
+	if (i >= glb->n_views)
+		glb_fail (glb, "buffer view out of range");
 
-#ifdef DEBUG
-	info.enabledLayerCount = N_VALIDATION_LAYERS;
-	info.ppEnabledLayerNames = validation_layers;
-#else
-	info.enabledLayerCount = 0;
-#endif
+	const Json *j = &glb->json;
+	int v = glb->views[i];
+	uint64_t off = glb_uint (glb, json_find (j, v, "byteOffset"), 0, UINT32_MAX);
+	*len = glb_uint (glb, json_find (j, v, "byteLength"), 0, UINT32_MAX);
+	*stride = (uint32_t) glb_uint (glb, json_find (j, v, "byteStride"), 0, UINT32_MAX);
 
-	assert (vkCreateDevice (physical_device, &info, NULL, &device) == VK_SUCCESS);
+	if (json_num (j, json_find (j, v, "buffer"), 0) != 0 || !glb->bin || off + *len > glb->bin_size)
+		glb_fail (glb, "buffer view outside the BIN chunk");
 
-	vkGetDeviceQueue (device, gfx_family, 0, &gfx_queue);
-	vkGetDeviceQueue (device, present_support, 0, &present_queue);
+	return glb->bin + off;
 }
 
-static QueueFamilyIndices find_queue_families (VkPhysicalDevice dev)
+/**
+ * Accessor `i` as a stream over the BIN chunk, returning its element count. An accessor
+ * without a buffer view is all zeros, which is left to the default of the attribute.
+ */
+static uint32_t glb_accessor (const Glb *glb, uint32_t i, VertexStream *s)
 {
-	QueueFamilyIndices idx;
-	queue_family_indices_init (&idx);
+	if (i >= glb->n_accessors)
+		glb_fail (glb, "accessor out of range");
 
-	uint32_t count = 0;
+	const Json *j = &glb->json;
+	int a = glb->accessors[i];
+	uint32_t count = (uint32_t) glb_uint (glb, json_find (j, a, "count"), 0, UINT32_MAX);
 
-	vkGetPhysicalDeviceQueueFamilyProperties (dev, &count, NULL);
-	VkQueueFamilyProperties families[count];
-	vkGetPhysicalDeviceQueueFamilyProperties (dev, &count, families);
+	memset (s, 0, sizeof (VertexStream));
+	if (json_find (j, a, "sparse") >= 0)
+		glb_fail (glb, "sparse accessors are not supported");
 
-	int i = 0;
-	for (; i < count; i ++)
+	uint32_t comp_size;
+	switch (glb_uint (glb, json_find (j, a, "componentType"), 0, UINT32_MAX))
 	{
-		VkQueueFamilyProperties *family = &families[i];
-		if (family->queueFlags & VK_QUEUE_GRAPHICS_BIT)
-			idx.gfx_family = i;
-
-		VkBool32 present_support = VK_FALSE;
-		vkGetPhysicalDeviceSurfaceSupportKHR (dev, i, surface, &present_support);
-
-		if (present_support)
-			idx.present_family = i;
-
-		if (queue_family_indices_is_complete (&idx))
-			break;
+	case 5120: s->type = COMP_I8;  comp_size = 1; break;
+	case 5121: s->type = COMP_U8;  comp_size = 1; break;
+	case 5122: s->type = COMP_I16; comp_size = 2; break;
+	case 5123: s->type = COMP_U16; comp_size = 2; break;
+	case 5125: s->type = COMP_U32; comp_size = 4; break;
+	case 5126: s->type = COMP_F32; comp_size = 4; break;
+	default: glb_fail (glb, "unknown component type"); return 0;
 	}
 
-	return idx;
+	int type = json_find (j, a, "type");
+	s->n_comp =
+		json_str_eq (j, type, "SCALAR") ? 1 :
+		json_str_eq (j, type, "VEC2") ? 2 :
+		json_str_eq (j, type, "VEC3") ? 3 :
+		json_str_eq (j, type, "VEC4") ? 4 : 0;
+	if (s->n_comp == 0)
+		glb_fail (glb, "unsupported accessor type");
+
+	s->normalized = json_true (j, json_find (j, a, "normalized"));
+
+	int view = json_find (j, a, "bufferView");
+	if (view < 0 || count == 0)
+		return count;
+
+	uint64_t len;
+	uint32_t stride;
+	const uint8_t *data = glb_view (glb, (uint32_t) glb_uint (glb, view, 0, UINT32_MAX), &len, &stride);
+	uint64_t off = glb_uint (glb, json_find (j, a, "byteOffset"), 0, UINT32_MAX);
+	uint32_t elem = comp_size * s->n_comp;
+
+	s->data = data + off;
+	s->stride = stride ? stride : elem;
+	if (off + (uint64_t) s->stride * (count - 1) + elem > len)
+		glb_fail (glb, "accessor outside its buffer view");
+
+	return count;
 }
 
-static void create_swapchain ()
+/**
+ * The encoded image used as base color by the first material, or the first image if no
+ * material has one. Returns 0 if there are no embedded images.
+ */
+static int glb_base_color_image (const Glb *glb, const uint8_t **data, uint64_t *len)
 {
-	SwapChainSupportDetails sup = query_swapchain_support (physical_device);
+	const Json *j = &glb->json;
 
-	VkSurfaceFormatKHR fmt = choose_swap_surface_format (sup.fmts, sup.nfmts);
-	VkPresentModeKHR mode = choose_swap_present_mode (sup.present_modes, sup.npresmodes);
-	VkExtent2D ext = choose_swap_extent (sup.capabilities);
+	int mat = json_at (j, json_find (j, 0, "materials"), 0);
+	int pbr = json_find (j, mat, "pbrMetallicRoughness");
+	int tex = json_find (j, json_find (j, pbr, "baseColorTexture"), "index");
+	int src = json_find (j, json_at (j, json_find (j, 0, "textures"), (uint32_t) glb_uint (glb, tex, 0, UINT32_MAX)), "source");
 
-	uint32_t imcount = sup.capabilities.minImageCount + 1;
-	if (sup.capabilities.maxImageCount > 0 && imcount > sup.capabilities.maxImageCount)
-		imcount = sup.capabilities.maxImageCount;
+	int img = json_at (j, json_find (j, 0, "images"), (uint32_t) glb_uint (glb, src, 0, UINT32_MAX));
+	int view = json_find (j, img, "bufferView");
+	if (view < 0)
+		return 0;
 
-	VkSwapchainCreateInfoKHR info = { 0 };
-	info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-	info.surface = surface;
-	info.minImageCount = imcount;
-	info.imageFormat = fmt.format;
-	info.imageColorSpace = fmt.colorSpace;
-	info.imageExtent = ext;
-	info.imageArrayLayers = 1;
-	info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	uint32_t stride;
+	*data = glb_view (glb, (uint32_t) glb_uint (glb, view, 0, UINT32_MAX), len, &stride);
+	return 1;
+}
 
-	QueueFamilyIndices idx = find_queue_families (physical_device);
+/**
+ * Validation layours.
+ */
+#define N_VALIDATION_LAYERS 1
+static const const char *validation_layers[N_VALIDATION_LAYERS] =
+{
+	"VK_LAYER_KHRONOS_validation"
+};
+
+/**
+ * Device extensions.
+ */
+#define N_DEVICE_EXTENSIONS 1
+static const const char *device_extensions[N_DEVICE_EXTENSIONS] =
+{
+	VK_KHR_SWAPCHAIN_EXTENSION_NAME
+};
+
+/**
+ * Optional device extensions.
+ *
+ * These are enabled when the device supports them, and the code checks the matching
+ * has_* flag before using them.
+ */
+#define N_OPTIONAL_DEVICE_EXTENSIONS 1
+static const char *optional_device_extensions[N_OPTIONAL_DEVICE_EXTENSIONS] =
+{
+	VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME
+};
+
+/**
+ * Packed descriptor data for one descriptor set.
+ *
+ * The layout matches the bindings in `create_descriptor_set_layout` and is what the
+ * descriptor update templates read from, so a whole set is written from one struct.
+ */
+typedef struct DescriptorData
+{
+	VkDescriptorBufferInfo ubo;
+	VkDescriptorImageInfo tex;
+} DescriptorData;
+
+typedef struct SwapChainSupportDetails
+{
+	VkSurfaceCapabilitiesKHR capabilities;
+	VkSurfaceFormatKHR *fmts;
+	VkPresentModeKHR *present_modes;
+	int32_t nfmts;
+	int32_t npresmodes;
+} SwapChainSupportDetails;
+
+static void swapchain_support_details_free (SwapChainSupportDetails *details)
+{
+	if (details->fmts != NULL) free (details->fmts);
+	if (details->present_modes != NULL) free (details->present_modes);
+	details = NULL;
+}
+
+typedef struct QueueFamilyIndices
+{
+	int32_t gfx_family;
+	int32_t present_family;
+} QueueFamilyIndices;
+
+void queue_family_indices_init (QueueFamilyIndices *idx)
+{
+	idx->gfx_family = idx->present_family = -1;
+}
+
+int queue_family_indices_is_complete (const QueueFamilyIndices *idx)
+{
+	// TODO is zero correct to check?
+	return (idx->gfx_family != -1) && (idx->present_family != -1);
+}
+
+/**
+ * Formats we create images or vertex attributes with, and whose features are therefore
+ * part of the device capabilities.
+ */
+#define CAPS_FMT(f) { f, #f }
+static const struct { VkFormat fmt; const char *name; } caps_formats[] =
+{
+	CAPS_FMT (VK_FORMAT_R8G8B8A8_SRGB),
+	CAPS_FMT (VK_FORMAT_R8G8B8A8_UNORM),
+	CAPS_FMT (VK_FORMAT_B8G8R8A8_SRGB),
+	CAPS_FMT (VK_FORMAT_B8G8R8A8_UNORM),
+	CAPS_FMT (VK_FORMAT_D32_SFLOAT),
+	CAPS_FMT (VK_FORMAT_D32_SFLOAT_S8_UINT),
+	CAPS_FMT (VK_FORMAT_D24_UNORM_S8_UINT),
+	CAPS_FMT (VK_FORMAT_R32_UINT),
+	CAPS_FMT (VK_FORMAT_R32G32_SFLOAT),
+	CAPS_FMT (VK_FORMAT_R32G32B32_SFLOAT),
+	CAPS_FMT (VK_FORMAT_R32G32B32A32_SFLOAT),
+	CAPS_FMT (VK_FORMAT_R16G16B16A16_UNORM),
+	CAPS_FMT (VK_FORMAT_R16G16_SNORM),
+	CAPS_FMT (VK_FORMAT_R16G16_UNORM),
+	CAPS_FMT (VK_FORMAT_R16G16_SFLOAT),
+};
+#undef CAPS_FMT
+#define N_CAPS_FORMATS (sizeof (caps_formats) / sizeof (caps_formats[0]))
+
+#define CAPS_MAX_EXTENSIONS 16
+
+/**
+ * Snapshot of what the selected device supports, filled once after it has been picked so
+ * the rest of the code does not query the same things over and over.
+ */
+typedef struct DeviceCaps
+{
+	VkPhysicalDeviceProperties props;
+	char uuid[2 * VK_UUID_SIZE + 1];
+	VkPhysicalDeviceFeatures2 feats;
+	VkPhysicalDeviceVulkan12Features feats12;
+	VkPhysicalDeviceMemoryProperties mem;
+	VkQueueFamilyProperties *queue_families;
+	uint32_t n_queue_families;
+	QueueFamilyIndices queues;
+	VkFormatProperties fmts[N_CAPS_FORMATS];
+	const char *exts[CAPS_MAX_EXTENSIONS]; // enabled device extensions
+	uint32_t n_exts;
+} DeviceCaps;
+
+
+#ifdef DEBUG
+/**
+ *		check_validation_layer_support
+ *
+ * Make sure the validation layers are supported.
+ */
+int check_validation_layer_support ()
+{
+	uint32_t nlayers;
+	vkEnumerateInstanceLayerProperties (&nlayers, NULL);
+	VkLayerProperties *available_layers = (VkLayerProperties *) malloc (sizeof (VkLayerProperties) * nlayers);
+	vkEnumerateInstanceLayerProperties (&nlayers, available_layers);
+
+	for (int j = 0; j < N_VALIDATION_LAYERS; j ++)
+	{
+		const char *layer_name = validation_layers[j];
+		int found = 0;
+
+		for (int i = 0; i < nlayers; i ++)
+		{
+			VkLayerProperties layer = available_layers[i];
+			if (strcmp (layer.layerName, layer_name) == 0)
+			{
+				found = 1;
+				break;
+			}
+		}
+
+		if (!found) return 0;
+	}
+
+	free (available_layers);
+	return 1;
+}
+#endif
+
+/**
+ * Get required extensions from glfw to run, none if there is no window.
+ */
+static const char **get_required_extensions (uint32_t *n, int windowed)
+{
+	const char **ext = NULL;
+	*n = 0;
+	if (windowed)
+		ext = glfwGetRequiredInstanceExtensions (n);
+
+#ifdef DEBUG
+	// add validation layer for debugging
+	const char **ext_ = ext;
+	ext = malloc (((*n) + 1) * sizeof (char *));
+	memcpy (ext, ext_, (*n) * sizeof (char *));
+	ext[(*n)] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+	*n += 1;
+#endif
+
+	return ext;
+}
+
+/**
+ * Get supported extensions.
+ */
+static const VkExtensionProperties *get_supported_extensions (uint32_t *n)
+{
+	vkEnumerateInstanceExtensionProperties (NULL, n, NULL);
+	VkExtensionProperties *ext = malloc ((*n) * sizeof (VkExtensionProperties));
+	vkEnumerateInstanceExtensionProperties (NULL, n, ext);
+	return ext;
+}
+
+/**
+ * Function to find and load `vkCreateDebugUtilsMessengerEXT`.
+ */
+VkResult myCreateDebugUtilsMessengerEXT
+(
+	VkInstance instance,
+	const VkDebugUtilsMessengerCreateInfoEXT *info,
+	const VkAllocationCallbacks *allocator,
+	VkDebugUtilsMessengerEXT *messenger
+)
+{
+	PFN_vkCreateDebugUtilsMessengerEXT fn = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr
+	(
+		instance, "vkCreateDebugUtilsMessengerEXT"
+	);
+	if (!fn) return VK_ERROR_EXTENSION_NOT_PRESENT;
+	return fn (instance, info, allocator, messenger);
+}
+
+/**
+ * Function to find and load `vkDestroyDebugUtilsMessengerEXT`.
+ */
+void myDestroyDebugUtilsMessengerEXT
+(
+	VkInstance instance,
+	VkDebugUtilsMessengerEXT messenger,
+	const VkAllocationCallbacks *allocator
+)
+{
+	PFN_vkDestroyDebugUtilsMessengerEXT fn = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr
+	(
+		instance, "vkDestroyDebugUtilsMessengerEXT"
+	);
+	if (fn) fn (instance, messenger, allocator);
+}
+
+static VkSurfaceFormatKHR choose_swap_surface_format (const VkSurfaceFormatKHR *fmts, size_t n) {
+	for (size_t i = 0; i < n; i ++)
+	{
+		VkSurfaceFormatKHR fmt = fmts[i];
+		if
+		(
+			fmt.format == VK_FORMAT_B8G8R8A8_SRGB &&
+			fmt.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR
+		)
+		{
+			return fmt;
+		}
+	}
+
+	return fmts[0];
+}
+
+static VkPresentModeKHR choose_swap_present_mode (const VkPresentModeKHR *modes, size_t n)
+{
+	for (size_t i = 0; i < n; i ++)
+	{
+		if (modes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
+			return modes[i];
+	}
+
+	return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+static VkExtent2D choose_swap_extent (VkSurfaceCapabilitiesKHR capabilities)
+{
+	return capabilities.currentExtent;
+
+	// TODO check if below is needed
+
+	/*
+	if (capabilities.currentExtent.width != UINT32_MAX)
+		return capabilities.currentExtent;
+	else
+	{
+		int w, h;
+		glfwGetFramebufferSize (win, &w, &h);
+
+		VkExtent2D ext =
+		{
+			static_cast<uint32_t>(w),
+			static_cast<uint32_t>(h),
+		};
+
+		ext.width = std::max
+		(
+			capabilities.minImageExtent.width,
+			std::min (capabilities.maxImageExtent.width, ext.width)
+		);
+		ext.height = std::max
+		(
+			capabilities.minImageExtent.height,
+			std::min (capabilities.maxImageExtent.height, ext.height)
+		);
+
+		return ext;
+	}
+	*/
+}
+
+/**
+ *	VARIABLES --------------------------------------------------------------------------------------------------
+ */
+
+static GLFWwindow* win;
+static VkInstance instance;
+static VkDebugUtilsMessengerEXT debug_messenger;
+static VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+static VkDevice device; // logical device
+static VkQueue gfx_queue;
+static VkQueue present_queue;
+static VkSurfaceKHR surface;
+static VkRenderPass render_pass; // the frame graph's passes are compatible with these two
+static VkRenderPass depth_render_pass; // depth only, for the pipelines of the pre-pass
+
+/* swapchain */
+static VkSwapchainKHR swapchain;
+static VkImage *swapchain_imgs;
+static uint32_t n_swapchain_imgs;
+static VkFramebuffer *swapchain_framebufs; // of render_pass, for drawing outside the frame graph
+static VkFramebuffer depth_framebuf; // of depth_render_pass
+static VkFormat swapchain_img_fmt;
+static VkExtent2D swapchain_ext;
+static VkImageView *swapchain_img_views;
+static uint32_t n_swapchain_img_views;
+
+/* capabilities of the physical device */
+static DeviceCaps caps;
+
+/* device selection, see pick_physical_device */
+static const char *caps_json = NULL;
+static const char *device_override = NULL;
+static int probe_devices = 0;
+
+/* headless rendering, where the swapchain images are offscreen images we own */
+static int headless = 0;
+static VkExtent2D headless_ext = { 0 };
+static uint32_t headless_frames = 1;
+static VkDeviceMemory *offscreen_imgs_mem;
+
+/* frame readback, one host buffer per swapchain image */
+static int readback = 0;
+static VkBuffer *readback_bufs;
+static VkDeviceMemory *readback_bufs_mem;
+static uint8_t **readback_bufs_mapped;
+static uint8_t *readback_rgba; // swizzle space for BGRA images
+static ReadbackPending readback_queue[READBACK_MAX_PENDING];
+static uint32_t readback_head = 0;
+static uint32_t n_readback_pending = 0;
+static uint64_t readback_frame = 0;
+static ReadbackFn readback_fn;
+static void *readback_user;
+
+/* camera written to the uniform buffer of each frame */
+static UniformBufferObject camera =
+{
+	{ 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 },
+	{ 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 },
+	{ 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 }
+};
+
+/* batch of render jobs */
+static BatchJob *batch_jobs;
+static uint32_t n_batch_jobs = 0;
+static uint64_t batch_first_frame = 0;
+static double *batch_start_ms;
+static double *batch_latency_ms;
+static uint32_t n_batch_done = 0;
+
+/* video stream fed by the readback */
+static StreamFmt stream_fmt = STREAM_NONE;
+static int stream_fd = -1;
+static uint32_t stream_w = 0, stream_h = 0;
+static uint8_t *stream_planes;
+
+/* pipelines, one per vertex layout and format, and the same fetching only positions */
+static VkPipelineLayout pipeline_layout;
+static VkPipeline pipelines[VX_LAYOUT_COUNT][VX_FMT_COUNT];
+static VkPipeline depth_pipelines[VX_LAYOUT_COUNT][VX_FMT_COUNT];
+static VkPipeline equal_pipelines[VX_LAYOUT_COUNT][VX_FMT_COUNT];
+
+/* vertex pulling, one pipeline fetching every format and layout through buffer device addresses */
+static int vertex_pulling = 0; // see `--pull`
+static int has_bda = 0;
+static VkPipelineLayout pull_pipeline_layout;
+static VkPipeline pull_pipeline;
+static VkPipeline pull_depth_pipeline;
+static VkPipeline pull_equal_pipeline;
+static uint32_t rq_pull_pipeline;
+
+/* meshlets culled and drawn by task and mesh shaders (VK_EXT_mesh_shader) */
+static int use_meshlets = 0; // see `--meshlets`
+static int has_mesh_shader = 0;
+static VkPipelineLayout meshlet_pipeline_layout;
+static VkPipeline meshlet_pipeline;
+static uint32_t rq_meshlet_pipeline;
+static PFN_vkCmdDrawMeshTasksEXT cmd_draw_mesh_tasks;
+
+/* barriers with their own stages each (VK_KHR_synchronization2) */
+static int has_sync2 = 0;
+static PFN_vkCmdPipelineBarrier2KHR cmd_pipeline_barrier2;
+
+/* depth pre-pass and the shader invocations of each swapchain image's last frame */
+static int depth_prepass = 0;
+static int has_pipeline_stats = 0;
+static int has_inherited_queries = 0;
+static VkQueryPool frame_stats_pool = VK_NULL_HANDLE;
+static int *frame_stats_pending;
+static uint64_t frag_invocations = 0;
+static uint64_t vx_invocations = 0;
+
+/* commands */
+static VkCommandPool cmdpool;
+static VkCommandBuffer *cmdbufs;
+static VkSemaphore *img_available;
+static VkSemaphore *render_finished;
+static VkFence *in_flight_fences;
+static VkFence *imgs_in_flight;
+
+/* meshes, indexed like the render queue meshes */
+static Mesh *meshes[RQ_MAX_MESHES];
+static VertexFormat builtin_vx_fmt = VX_FMT_FLOAT;
+static VertexLayout builtin_vx_layout = VX_LAYOUT_SPLIT;
+static int optimize_meshes = 0; // reorder meshes for the vertex cache and overdraw, see `--optimize`
+static int use_lods = 0; // levels of detail, see `--lod`
+static const char *mesh_files[MAX_MESH_FILES];
+static uint32_t mesh_file_first[MAX_MESH_FILES]; // meshes of each file, a range of indices
+static uint32_t mesh_file_count[MAX_MESH_FILES];
+static uint32_t n_mesh_files = 0;
+static const char *scene_file = NULL; // cooked scene to load, see `--scene`
+static Cooked scene;
+static const char *cook_file = NULL; // where `--cook` writes the scene
+
+/* instance buffers, one per swapchain image so they can be written while others render */
+static InstanceData *instances;
+static uint8_t *inst_lods; // level of detail each instance is drawn with, see `select_lods`
+static uint32_t n_instances = 0;
+static uint32_t instances_cap = 0;
+static VkBuffer *inst_bufs;
+static VkDeviceMemory *inst_bufs_mem;
+static InstanceData **inst_bufs_mapped;
+static uint32_t inst_bufs_cap = 64; // in instances
+
+/* uniform buffer */
+static VkBuffer *unif_buf;
+static VkDeviceMemory *unif_buf_mem;
+
+/* descriptor */
+static VkDescriptorPool descriptor_pool;
+static VkDescriptorSet *descriptor_sets;
+static VkDescriptorSetLayout descriptor_set_layout;
+static VkDescriptorUpdateTemplate descriptor_update_tpl;
+
+/* push descriptors (VK_KHR_push_descriptor) */
+static int has_push_descriptor = 0;
+static VkDescriptorSetLayout push_descriptor_set_layout;
+static VkPipelineLayout push_pipeline_layout;
+static VkDescriptorUpdateTemplate push_descriptor_tpl;
+static PFN_vkCmdPushDescriptorSetWithTemplateKHR cmd_push_descriptor_set_with_tpl;
+
+/* texture */
+static VkImage tex_img;
+static VkDeviceMemory tex_img_mem;
+static TrackedImg tex_track;
+static VkImageView tex_img_view;
+static VkSampler tex_sampler;
+
+/* the frame as a render graph, rebuilt with the swapchain */
+static RenderGraph frame_graph;
+static uint32_t frame_depth; // resource of the depth buffer
+static uint32_t frame_pass_shading; // drawn inline or from secondaries
+static RenderQueueStats prepass_stats;
+
+/* dynamic command recording, one pool and command buffer per swapchain image */
+static RecordMode record_mode = RECORD_STATIC;
+static VkCommandPool *frame_cmdpools;
+static VkCommandBuffer *frame_cmdbufs;
+static uint64_t *frame_recorded_gen;
+
+/* parallel recording, one pool and secondary command buffer per thread per swapchain image */
+typedef struct RecordJob
+{
+	VkCommandPool pool;
+	VkCommandBuffer cmdbuf;
+	uint32_t img;
+	uint32_t first;
+	uint32_t count;
+	RenderQueueStats stats;
+} RecordJob;
+
+#define RECORD_MAX_THREADS 64
+
+static uint32_t n_record_threads = 0; // 0 records inline on the calling thread
+static pthread_t *record_threads;
+static RecordJob *record_jobs;
+static VkCommandPool *thread_cmdpools;
+static VkCommandBuffer *thread_cmdbufs;
+static pthread_mutex_t record_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t record_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t record_done = PTHREAD_COND_INITIALIZER;
+static uint64_t record_batch = 0;
+static uint32_t record_pending = 0;
+static int record_quit = 0;
+
+/* GPU driven rendering */
+static int gpu_driven = 0;
+static int has_gpu_driven = 0;
+static VkDescriptorSetLayout gpu_set_layout;
+static VkDescriptorPool gpu_descriptor_pool;
+static VkDescriptorSet gpu_descriptor_set;
+static VkPipelineLayout cull_pipeline_layout;
+static VkPipeline cull_pipeline;
+static VkPipelineLayout gpu_pipeline_layout;
+static VkPipeline gpu_pipeline;
+static VkBuffer gpu_obj_buf;
+static VkDeviceMemory gpu_obj_buf_mem;
+static GpuObjectsHeader *gpu_objs_header; // persistently mapped
+static GpuObject *gpu_objs;
+static VkBuffer gpu_indirect_buf;
+static VkDeviceMemory gpu_indirect_buf_mem;
+static VkBuffer gpu_count_buf;
+static VkDeviceMemory gpu_count_buf_mem;
+
+/* GPU particles */
+static uint32_t n_particles = 0; // capacity, none without --particles
+static VkBuffer particle_buf;
+static VkDeviceMemory particle_buf_mem;
+static VkBuffer particle_state_buf;
+static VkDeviceMemory particle_state_buf_mem;
+static VkBuffer particle_params_buf;
+static VkDeviceMemory particle_params_buf_mem;
+static ParticleParams *particle_params; // persistently mapped
+static VkDescriptorSetLayout particle_set_layout;
+static VkDescriptorPool particle_descriptor_pool;
+static VkDescriptorSet particle_descriptor_set;
+static VkPipelineLayout particle_compute_layout;
+static VkPipeline particle_steps[N_PARTICLE_STEPS];
+static VkPipelineLayout particle_pipeline_layout;
+static VkPipeline particle_pipeline;
+
+/* render queue */
+static RqPipeline rq_pipelines[RQ_MAX_PIPELINES];
+static uint32_t n_rq_pipelines = 0;
+static RqMaterial rq_materials[RQ_MAX_MATERIALS];
+static uint32_t n_rq_materials = 0;
+static RqMesh rq_meshes[RQ_MAX_MESHES];
+static uint32_t n_rq_meshes = 0;
+static uint64_t *draw_keys;
+static uint32_t *draw_order; // draw list indices in sorted order
+static uint64_t draw_sorted_gen = 0;
+static RenderQueueStats rq_stats;
+
+/* draw list */
+static DrawCmd *draw_list;
+static uint32_t n_draws = 0;
+static uint32_t draw_list_cap = 0;
+static uint64_t draw_list_gen = 1; // bumped whenever recorded command buffers become stale
+
+/* state variables */
+static size_t current_frame = 0;
+static int framebuf_resized = 0;
+
+/**
+ * Queries queue families to find the one that supports the given device.
+ */
+static int query_queue_families (
+	VkPhysicalDevice dev,
+	uint32_t *gfx_family,
+	uint32_t *present_support
+)
+{
+	uint32_t n = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties (dev, &n, NULL);
+	VkQueueFamilyProperties families[n];
+	vkGetPhysicalDeviceQueueFamilyProperties (dev, &n, families);
+	uint8_t found_gfx_family = 0, found_present_support = 0;
+
+	for (int i = 0; i < n; i ++)
+	{
+		VkQueueFamilyProperties family = families[i];
+
+		if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		{
+			*gfx_family = i;
+			found_gfx_family = 1;
+		}
+
+		// nothing is presented when headless, so the graphics queue will do
+		VkBool32 sup = 0;
+		if (headless)
+			sup = (family.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		else
+			vkGetPhysicalDeviceSurfaceSupportKHR (dev, i, surface, &sup);
+
+		if (sup)
+		{
+			*present_support = i;
+			found_present_support = 1;
+		}
+
+		if (found_gfx_family && found_present_support) break;
+	}
+
+	return found_gfx_family && found_present_support;
+}
+
+/**
+ * Callback when the framebuffer has been resized.
+ *
+ * TODO this does not feel like it is needed. Or?
+ */
+static void framebuf_resize_cb (GLFWwindow *win, int w, int h)
+{
+	// auto app = reinterpret_cast<HelloTriangleApplication*> (glfwGetWindowUserPointer (win));
+	framebuf_resized = 1;
+}
+
+/**
+ * Initialize GLFW window.
+ */
+static void init_window ()
+{
+	glfwInit ();
+	glfwWindowHint (GLFW_CLIENT_API, GLFW_NO_API);
+	glfwWindowHint (GLFW_RESIZABLE, GLFW_FALSE);
+	win = glfwCreateWindow (WIDTH, HEIGHT, "Vulkan", NULL, NULL);
+	glfwSetFramebufferSizeCallback (win, framebuf_resize_cb);
+}
+
+/**
+ * No idea what goes on in this function.
+ */
+static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback
+(
+	VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+	VkDebugUtilsMessageTypeFlagsEXT type,
+	const VkDebugUtilsMessengerCallbackDataEXT* data,
+	void* userd
+)
+{
+	fprintf (stderr, "validation layer: %s\n", data->pMessage);
+	return VK_FALSE;
+}
+
+#ifdef DEBUG
+/**
+ * Populate debug message with more info.
+ */
+static void populate_debug_msg_info (VkDebugUtilsMessengerCreateInfoEXT *info)
+{
+	info->sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+	info->messageSeverity =
+		VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+	info->messageType =
+		VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+	info->pfnUserCallback = debug_callback;
+	info->pUserData = NULL;
+}
+
+static void setup_debugger ()
+{
+	VkDebugUtilsMessengerCreateInfoEXT info = { 0 };
+	populate_debug_msg_info (&info);
+	VkResult res;
+	if ((res = myCreateDebugUtilsMessengerEXT (instance, &info, NULL, &debug_messenger)) != VK_SUCCESS)
+	{
+		fprintf (stderr, "failed to set up debug messenger: %d!\n", res);
+		exit (1);
+	}
+}
+#endif
+
+static void create_instance ()
+{
+	// application info
+	//
+	// TODO not sure there is 1.2
+
+	VkApplicationInfo app_info = { 0 };
+	app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	app_info.pApplicationName = "hello madafaka";
+	app_info.applicationVersion = VK_MAKE_VERSION (1, 2, 0);
+	app_info.pEngineName = "No Engine";
+	app_info.engineVersion = VK_MAKE_VERSION (1, 2, 0);
+	app_info.apiVersion = VK_API_VERSION_1_2;
+
+	// instance create info
+
+	VkInstanceCreateInfo create_info = { 0 };
+	create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	create_info.pApplicationInfo = &app_info;
+
+	// extensions
+	//
+	// get required extensions and make sure they are all supported
+
+	uint32_t n_ext;
+	const char **ext = get_required_extensions (&n_ext, !headless);
+
+	uint32_t n_vk_ext;
+	const VkExtensionProperties *vk_ext = get_supported_extensions (&n_vk_ext);
+
+#ifdef DEBUG
+	printf ("%d extensions required\n", n_ext);
+#endif
+
+	for (int i = 0; i < n_ext; i ++)
+	{
+#ifdef DEBUG
+		printf ("\t%s => ", ext[i]);
+#endif
+		int found = 0;
+		for (int j = 0; j < n_vk_ext; j ++)
+		{
+			if (strcmp (ext[i], vk_ext[j].extensionName) == 0)
+			{
+				found = 1;
+				break;
+			}
+		}
+		if (!found)
+		{
+#ifdef DEBUG
+			printf ("not found!\n");
+#endif
+			fprintf (stderr, "not all extensions supported!\n");
+			exit (1);
+		}
+#ifdef DEBUG
+		else printf ("found\n");
+#endif
+	}
+	// all extensions supported
+	create_info.enabledExtensionCount = n_ext;
+	create_info.ppEnabledExtensionNames = ext;
+
+	// validation layers
+
+#ifdef DEBUG
+	VkDebugUtilsMessengerCreateInfoEXT debug_info = { 0 };
+	if (!check_validation_layer_support ())
+	{
+		fprintf (stderr, "validation layers requested but not supported!\n");
+		exit (1);
+	}
+	create_info.enabledLayerCount = N_VALIDATION_LAYERS;
+	create_info.ppEnabledLayerNames = validation_layers;
+
+	populate_debug_msg_info (&debug_info);
+	create_info.pNext = (VkDebugUtilsMessengerCreateInfoEXT *) &debug_info;
+#else
+	create_info.enabledLayerCount = 0;
+	create_info.pNext = NULL;
+#endif
+
+	// create the instance
+
+	VkResult res = vkCreateInstance (&create_info, NULL, &instance);
+	if (res != VK_SUCCESS)
+	{
+		fprintf (stderr, "failed to create instance! error code: %d\n", res);
+		exit (1);
+	}
+
+#ifdef DEBUG
+	// TODO this is ugly
+	free (ext);
+#endif
+	free ((void *) vk_ext);
+}
+
+static void create_surface ()
+{
+	if (glfwCreateWindowSurface (instance, win, NULL, &surface) != VK_SUCCESS)
+	{
+		fprintf (stderr, "failed to create window surface\n");
+		exit (1);
+	}
+}
+
+int check_device_ext_support (VkPhysicalDevice dev)
+{
+	// the only required extension is the swapchain
+	if (headless)
+		return 1;
+
+	uint32_t n;
+	vkEnumerateDeviceExtensionProperties (dev, NULL, &n, NULL);
+	VkExtensionProperties ext[n];
+	vkEnumerateDeviceExtensionProperties (dev, NULL, &n, ext);
+
+	// x will be the number of required device extrensions that we support
+	// - then we check later is the same as the number of actual required extensions
+	int x = 0;
+
+	for (int j = 0; j < N_DEVICE_EXTENSIONS; j ++)
+	{
+		const char *req_ext = device_extensions[j];
+		for (int i = 0; i < n; i ++)
+		{
+			VkExtensionProperties e = ext[i];
+			if (strcmp(e.extensionName, req_ext) == 0)
+				x += 1;
+		}
+	}
+
+	return x == N_DEVICE_EXTENSIONS;
+}
+
+/**
+ * Check if the device supports a single extension.
+ */
+static int device_ext_supported (VkPhysicalDevice dev, const char *name)
+{
+	uint32_t n;
+	vkEnumerateDeviceExtensionProperties (dev, NULL, &n, NULL);
+	VkExtensionProperties ext[n];
+	vkEnumerateDeviceExtensionProperties (dev, NULL, &n, ext);
+
+	for (int i = 0; i < n; i ++)
+	{
+		if (strcmp (ext[i].extensionName, name) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+SwapChainSupportDetails query_swapchain_support (VkPhysicalDevice dev)
+{
+	SwapChainSupportDetails details;
+
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR (dev, surface, &details.capabilities);
+
+	uint32_t n;
+	vkGetPhysicalDeviceSurfaceFormatsKHR (dev, surface, &n, NULL);
+	if (n != 0)
+	{
+		details.fmts = malloc (sizeof (VkSurfaceFormatKHR) * n);
+		vkGetPhysicalDeviceSurfaceFormatsKHR (dev, surface, &n, details.fmts);
+		details.nfmts = n;
+	}
+
+	vkGetPhysicalDeviceSurfacePresentModesKHR (dev, surface, &n, NULL);
+	if (n != 0)
+	{
+		details.present_modes = malloc (sizeof (VkPresentModeKHR) * n);
+		vkGetPhysicalDeviceSurfacePresentModesKHR (dev, surface, &n, details.present_modes);
+		details.npresmodes = n;
+	}
+
+	return details;
+}
+
+static int is_device_suitable (VkPhysicalDevice dev)
+{
+	// Apparently this was just an example on how to do it.
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties (dev, &props);
+
+	VkPhysicalDeviceFeatures feats;
+	vkGetPhysicalDeviceFeatures (dev, &feats);
+
+	int gfx_family, present_support;
+	int qfound = query_queue_families (dev, &gfx_family, &present_support);
+	int ext_support = check_device_ext_support (dev);
+
+	int swapchain_adequate = 1;
+	if (ext_support && !headless)
+	{
+		SwapChainSupportDetails sup = query_swapchain_support (dev);
+		swapchain_adequate = sup.fmts && sup.present_modes;
+		swapchain_support_details_free (&sup);
+	}
+
+#ifdef DEBUG
+	printf ("physical device: %s => ", props.deviceName);
+#endif
+
+	if (qfound && ext_support && swapchain_adequate && feats.samplerAnisotropy)
+	{
+#ifdef DEBUG
+		printf ("good!\n");
+#endif
+		return 0;
+	}
+	else
+	{
+#ifdef DEBUG
+		printf ("no good!\n");
+#endif
+		return 1;
+	}
+}
+
+/**
+ * Score a device on how well it is expected to run the template. In order of weight:
+ * device type, size of the largest device local heap, optional features we make use of
+ * and a couple of limits.
+ */
+static uint64_t score_device (VkPhysicalDevice dev, const VkPhysicalDeviceProperties *props)
+{
+	uint64_t score = 0;
+
+	switch (props->deviceType)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   score += 4000000000ull; break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 3000000000ull; break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    score += 2000000000ull; break;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU:            score += 1000000000ull; break;
+	default: break;
+	}
+
+	// device local memory in MiB
+	VkPhysicalDeviceMemoryProperties mem;
+	vkGetPhysicalDeviceMemoryProperties (dev, &mem);
+	VkDeviceSize heap = 0;
+	for (uint32_t i = 0; i < mem.memoryHeapCount; i ++)
+	{
+		if ((mem.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && mem.memoryHeaps[i].size > heap)
+			heap = mem.memoryHeaps[i].size;
+	}
+	score += (heap >> 20) * 1000;
+
+	VkPhysicalDeviceVulkan12Features feats12 = { 0 };
+	feats12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 feats = { 0 };
+	feats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	feats.pNext = &feats12;
+	vkGetPhysicalDeviceFeatures2 (dev, &feats);
+
+	score += feats.features.multiDrawIndirect ? 100000 : 0;
+	score += feats.features.drawIndirectFirstInstance ? 100000 : 0;
+	score += feats12.drawIndirectCount ? 100000 : 0;
+	score += device_ext_supported (dev, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME) ? 100000 : 0;
+
+	score += props->limits.maxImageDimension2D / 16;
+	score += props->limits.maxComputeWorkGroupInvocations / 4;
+
+	return score;
+}
+
+static uint32_t find_mem_type_on (VkPhysicalDevice dev, uint32_t type_filter, VkMemoryPropertyFlags props)
+{
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceMemoryProperties (dev, &mem_props);
+
+	for (uint32_t i = 0; i < mem_props.memoryTypeCount; i ++)
+	{
+		if
+		(
+			(type_filter & (1 << i)) &&
+			(mem_props.memoryTypes[i].propertyFlags & props) == props
+		)
+			return i;
+	}
+
+	fprintf (stderr, "failed to find suitable memory type!");
+	exit (1);
+}
+
+#define PROBE_UPLOAD_SIZE (4 << 20)
+#define PROBE_IMG_SIZE 1024
+#define PROBE_RUNS 5
+
+/**
+ * Time a 4 MiB upload to device local memory followed by a clear of a 1024x1024 image
+ * on a throwaway logical device, returning the best of a few runs in milliseconds.
+ *
+ * This measures roughly what a frame costs in transfer and fill rate without needing a
+ * render pass and pipeline for every device.
+ */
+static double probe_device (VkPhysicalDevice dev)
+{
+	uint32_t family = 0, n_families = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties (dev, &n_families, NULL);
+	VkQueueFamilyProperties families[n_families];
+	vkGetPhysicalDeviceQueueFamilyProperties (dev, &n_families, families);
+	while (family < n_families && !(families[family].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+		family ++;
+	assert (family < n_families);
+
+	float prio = 1.0f;
+	VkDeviceQueueCreateInfo qinfo = { 0 };
+	qinfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	qinfo.queueFamilyIndex = family;
+	qinfo.queueCount = 1;
+	qinfo.pQueuePriorities = &prio;
+
+	VkDeviceCreateInfo dinfo = { 0 };
+	dinfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	dinfo.queueCreateInfoCount = 1;
+	dinfo.pQueueCreateInfos = &qinfo;
+
+	VkDevice d;
+	VkQueue q;
+	assert (vkCreateDevice (dev, &dinfo, NULL, &d) == VK_SUCCESS);
+	vkGetDeviceQueue (d, family, 0, &q);
+
+	// source and destination of the upload
+
+	VkBuffer bufs[2];
+	VkDeviceMemory bufs_mem[2];
+	VkBufferUsageFlags usage[2] = { VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_BUFFER_USAGE_TRANSFER_DST_BIT };
+	VkMemoryPropertyFlags props[2] =
+	{
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+	};
+
+	for (int i = 0; i < 2; i ++)
+	{
+		VkBufferCreateInfo info = { 0 };
+		info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		info.size = PROBE_UPLOAD_SIZE;
+		info.usage = usage[i];
+		info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		assert (vkCreateBuffer (d, &info, NULL, &bufs[i]) == VK_SUCCESS);
+
+		VkMemoryRequirements req;
+		vkGetBufferMemoryRequirements (d, bufs[i], &req);
+
+		VkMemoryAllocateInfo alloc = { 0 };
+		alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc.allocationSize = req.size;
+		alloc.memoryTypeIndex = find_mem_type_on (dev, req.memoryTypeBits, props[i]);
+		assert (vkAllocateMemory (d, &alloc, NULL, &bufs_mem[i]) == VK_SUCCESS);
+		vkBindBufferMemory (d, bufs[i], bufs_mem[i], 0);
+	}
+
+	void *data;
+	vkMapMemory (d, bufs_mem[0], 0, PROBE_UPLOAD_SIZE, 0, &data);
+	memset (data, 0x5a, PROBE_UPLOAD_SIZE);
+	vkUnmapMemory (d, bufs_mem[0]);
+
+	// image that gets cleared
+
+	VkImage img;
+	VkDeviceMemory img_mem;
+
+	VkImageCreateInfo iinfo = { 0 };
+	iinfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	iinfo.imageType = VK_IMAGE_TYPE_2D;
+	iinfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	iinfo.extent.width = PROBE_IMG_SIZE;
+	iinfo.extent.height = PROBE_IMG_SIZE;
+	iinfo.extent.depth = 1;
+	iinfo.mipLevels = 1;
+	iinfo.arrayLayers = 1;
+	iinfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	iinfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	iinfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	iinfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	iinfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	assert (vkCreateImage (d, &iinfo, NULL, &img) == VK_SUCCESS);
+
+	VkMemoryRequirements req;
+	vkGetImageMemoryRequirements (d, img, &req);
+	VkMemoryAllocateInfo alloc = { 0 };
+	alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc.allocationSize = req.size;
+	alloc.memoryTypeIndex = find_mem_type_on (dev, req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	assert (vkAllocateMemory (d, &alloc, NULL, &img_mem) == VK_SUCCESS);
+	vkBindImageMemory (d, img, img_mem, 0);
+
+	// record once, submit a few times
+
+	VkCommandPool pool;
+	VkCommandPoolCreateInfo pinfo = { 0 };
+	pinfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pinfo.queueFamilyIndex = family;
+	assert (vkCreateCommandPool (d, &pinfo, NULL, &pool) == VK_SUCCESS);
+
+	VkCommandBuffer cmdbuf;
+	VkCommandBufferAllocateInfo cinfo = { 0 };
+	cinfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cinfo.commandPool = pool;
+	cinfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cinfo.commandBufferCount = 1;
+	assert (vkAllocateCommandBuffers (d, &cinfo, &cmdbuf) == VK_SUCCESS);
+
+	VkCommandBufferBeginInfo begin = { 0 };
+	begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	assert (vkBeginCommandBuffer (cmdbuf, &begin) == VK_SUCCESS);
+
+	VkBufferCopy region = { 0 };
+	region.size = PROBE_UPLOAD_SIZE;
+	vkCmdCopyBuffer (cmdbuf, bufs[0], bufs[1], 1, &region);
+
+	VkImageMemoryBarrier barrier = { 0 };
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = img;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier
+	(
+		cmdbuf,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, NULL, 0, NULL, 1, &barrier
+	);
+
+	VkClearColorValue color = { { 0.25f, 0.5f, 0.75f, 1.0f } };
+	vkCmdClearColorImage (cmdbuf, img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &barrier.subresourceRange);
+
+	assert (vkEndCommandBuffer (cmdbuf) == VK_SUCCESS);
+
+	VkFence fence;
+	VkFenceCreateInfo finfo = { 0 };
+	finfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	assert (vkCreateFence (d, &finfo, NULL, &fence) == VK_SUCCESS);
+
+	VkSubmitInfo submit = { 0 };
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &cmdbuf;
+
+	// the first run pays for lazy allocation and shader caches, so it is not counted
+	double best = -1.0;
+	for (int i = 0; i <= PROBE_RUNS; i ++)
+	{
+		double t = now_ms ();
+		assert (vkQueueSubmit (q, 1, &submit, fence) == VK_SUCCESS);
+		vkWaitForFences (d, 1, &fence, VK_TRUE, UINT64_MAX);
+		t = now_ms () - t;
+		vkResetFences (d, 1, &fence);
+
+		if (i > 0 && (best < 0.0 || t < best))
+			best = t;
+	}
+
+	vkDestroyFence (d, fence, NULL);
+	vkDestroyCommandPool (d, pool, NULL);
+	vkDestroyImage (d, img, NULL);
+	vkFreeMemory (d, img_mem, NULL);
+	for (int i = 0; i < 2; i ++)
+	{
+		vkDestroyBuffer (d, bufs[i], NULL);
+		vkFreeMemory (d, bufs_mem[i], NULL);
+	}
+	vkDestroyDevice (d, NULL);
+
+	return best;
+}
+
+/**
+ * Whether `sel` picks the candidate at `idx`: either the index itself, the device UUID
+ * (dashes and case ignored) or a case insensitive part of the device name.
+ */
+static int device_matches (const DeviceCandidate *c, uint32_t idx, const char *sel)
+{
+	char *end;
+	unsigned long i = strtoul (sel, &end, 10);
+	if (*sel && *end == '\0')
+		return i == idx;
+
+	char uuid[2 * VK_UUID_SIZE + 1];
+	size_t n = 0;
+	for (const char *p = sel; *p && n < 2 * VK_UUID_SIZE; p ++)
+	{
+		if (*p != '-')
+			uuid[n ++] = tolower (*p);
+	}
+	uuid[n] = '\0';
+	if (n == 2 * VK_UUID_SIZE && strcmp (uuid, c->uuid) == 0)
+		return 1;
+
+	size_t len = strlen (sel);
+	for (const char *p = c->props.deviceName; *p; p ++)
+	{
+		if (strncasecmp (p, sel, len) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Order candidates best first: suitable ones, then by probe time if probed, then by
+ * score.
+ */
+static int cmp_candidates (const void *a, const void *b)
+{
+	const DeviceCandidate *x = a, *y = b;
+
+	if (x->suitable != y->suitable)
+		return y->suitable - x->suitable;
+	if (x->probe_ms >= 0.0 && y->probe_ms >= 0.0 && x->probe_ms != y->probe_ms)
+		return x->probe_ms < y->probe_ms ? -1 : 1;
+	if (x->score != y->score)
+		return x->score > y->score ? -1 : 1;
+	return 0;
+}
+
+/**
+ * Pick the best suitable device, or the one selected through `--device` or the
+ * TEMPLATE_DEVICE environment variable. `--probe-devices` or TEMPLATE_DEVICE_PROBE=1 adds
+ * a short benchmark of every suitable device to the ranking.
+ */
+static void pick_physical_device ()
+{
+	uint32_t n;
+	vkEnumeratePhysicalDevices (instance, &n, NULL);
+	assert (n > 0);
+
+	VkPhysicalDevice devices[n];
+	vkEnumeratePhysicalDevices (instance, &n, devices);
+
+	const char *sel = device_override ? device_override : getenv ("TEMPLATE_DEVICE");
+	const char *probe_env = getenv ("TEMPLATE_DEVICE_PROBE");
+	int probe = probe_devices || (probe_env && strcmp (probe_env, "1") == 0);
+
+	DeviceCandidate candidates[n];
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		DeviceCandidate *c = &candidates[i];
+		c->dev = devices[i];
+		vkGetPhysicalDeviceProperties (c->dev, &c->props);
+
+		VkPhysicalDeviceIDProperties id = { 0 };
+		id.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+		VkPhysicalDeviceProperties2 props2 = { 0 };
+		props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		props2.pNext = &id;
+		vkGetPhysicalDeviceProperties2 (c->dev, &props2);
+		for (int j = 0; j < VK_UUID_SIZE; j ++)
+			sprintf (&c->uuid[2 * j], "%02x", id.deviceUUID[j]);
+
+		c->suitable = is_device_suitable (c->dev) == 0;
+		c->score = score_device (c->dev, &c->props);
+		c->probe_ms = probe && c->suitable ? probe_device (c->dev) : -1.0;
+	}
+
+	// match the override against enumeration order, before sorting
+	int selected = -1;
+	if (sel)
+	{
+		for (uint32_t i = 0; i < n && selected < 0; i ++)
+		{
+			if (device_matches (&candidates[i], i, sel))
+				selected = i;
+		}
+
+		if (selected < 0)
+		{
+			fprintf (stderr, "no device matches '%s'!\n", sel);
+			exit (1);
+		}
+		if (!candidates[selected].suitable)
+		{
+			fprintf (stderr, "device %s is not suitable!\n", candidates[selected].props.deviceName);
+			exit (1);
+		}
+		physical_device = candidates[selected].dev;
+	}
+
+	qsort (candidates, n, sizeof (DeviceCandidate), cmp_candidates);
+
+	if (physical_device == VK_NULL_HANDLE && candidates[0].suitable)
+		physical_device = candidates[0].dev;
+
+#ifdef DEBUG
+	printf ("device ranking%s:\n", sel ? " (overridden)" : "");
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		const DeviceCandidate *c = &candidates[i];
+		printf
+		(
+			"\t%c %s [%s] score %llu",
+			c->dev == physical_device ? '*' : ' ',
+			c->props.deviceName,
+			c->uuid,
+			(unsigned long long) c->score
+		);
+		if (c->probe_ms >= 0.0)
+			printf (" probe %.3f ms", c->probe_ms);
+		printf ("%s\n", c->suitable ? "" : " (not suitable)");
+	}
+#endif
+
+	assert (physical_device != VK_NULL_HANDLE);
+
+	// the choice and why, also without DEBUG, on stderr to stay out of streamed frames
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		const DeviceCandidate *c = &candidates[i];
+		if (c->dev != physical_device)
+			continue;
+
+		fprintf
+		(
+			stderr,
+			"device: %s [%s] score %llu, %s",
+			c->props.deviceName,
+			c->uuid,
+			(unsigned long long) c->score,
+			sel ? "selected by override " : "highest score of the suitable devices"
+		);
+		if (sel)
+			fprintf (stderr, "'%s'", sel);
+		if (c->probe_ms >= 0.0)
+			fprintf (stderr, ", probe %.3f ms", c->probe_ms);
+		fprintf (stderr, "\n");
+	}
+}
+
+static void create_logical_device ()
+{
+	uint32_t gfx_family = caps.queues.gfx_family, present_support = caps.queues.present_family;
+
+	// I find this part with queue families very confusing and static.
+	// Can maybe be re-worked one day when I understand better what the hell is going on.
+
+	const uint32_t nfamilies = gfx_family == present_support ? 1 : 2;
+	float prio = 1.0f;
+	uint32_t families[2] = { gfx_family, present_support };
+	VkDeviceQueueCreateInfo qinfos[nfamilies];
+	memset(qinfos, 0, sizeof (VkDeviceQueueCreateInfo) * nfamilies);
+
+	for (int i = 0; i < nfamilies; i ++)
+	{
+		//VkDeviceQueueCreateInfo info = { 0 };
+		qinfos[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		qinfos[i].queueFamilyIndex = families[i];
+		qinfos[i].queueCount = 1;
+		qinfos[i].pQueuePriorities = &prio;
+		//qinfos[i] = info;
+	}
+
+	// query optional features
+
+	const VkPhysicalDeviceVulkan12Features sup12 = caps.feats12;
+	const VkPhysicalDeviceFeatures2 sup = caps.feats;
+
+	VkPhysicalDeviceVulkan12Features feats12 = { 0 };
+	feats12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+	VkPhysicalDeviceFeatures2 feats = { 0 };
+	feats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	feats.pNext = &feats12;
+	feats.features.samplerAnisotropy = VK_TRUE;
+
+	// GPU driven rendering draws many objects through one indirect count call
+	has_gpu_driven =
+		sup12.drawIndirectCount &&
+		sup.features.multiDrawIndirect &&
+		sup.features.drawIndirectFirstInstance;
+	if (has_gpu_driven)
+	{
+		feats12.drawIndirectCount = VK_TRUE;
+		feats.features.multiDrawIndirect = VK_TRUE;
+		feats.features.drawIndirectFirstInstance = VK_TRUE;
+	}
+
+	// fragment shader invocations are counted with and without the depth pre-pass
+	has_pipeline_stats = sup.features.pipelineStatisticsQuery;
+	has_inherited_queries = has_pipeline_stats && sup.features.inheritedQueries;
+	feats.features.pipelineStatisticsQuery = has_pipeline_stats;
+	feats.features.inheritedQueries = has_inherited_queries;
+
+	// vertex pulling reads the geometry pools by address
+	has_bda = sup12.bufferDeviceAddress;
+	feats12.bufferDeviceAddress = has_bda;
+
+	// meshlets are culled and drawn by task and mesh shaders, reading them by address
+	VkPhysicalDeviceMeshShaderFeaturesEXT mesh_feats = { 0 };
+	mesh_feats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+	if (has_bda && device_ext_supported (physical_device, VK_EXT_MESH_SHADER_EXTENSION_NAME))
+	{
+		VkPhysicalDeviceFeatures2 query = { 0 };
+		query.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		query.pNext = &mesh_feats;
+		vkGetPhysicalDeviceFeatures2 (physical_device, &query);
+		has_mesh_shader = mesh_feats.taskShader && mesh_feats.meshShader;
+
+		mesh_feats.pNext = NULL;
+		mesh_feats.multiviewMeshShader = VK_FALSE;
+		mesh_feats.primitiveFragmentShadingRateMeshShader = VK_FALSE;
+		mesh_feats.meshShaderQueries = VK_FALSE;
+	}
+	if (has_mesh_shader)
+		feats12.pNext = &mesh_feats;
+
+	// barriers each with their own stages, and stages and accesses finer than before
+	VkPhysicalDeviceSynchronization2FeaturesKHR sync2_feats = { 0 };
+	sync2_feats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+	if (device_ext_supported (physical_device, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME))
+	{
+		VkPhysicalDeviceFeatures2 query = { 0 };
+		query.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		query.pNext = &sync2_feats;
+		vkGetPhysicalDeviceFeatures2 (physical_device, &query);
+		has_sync2 = sync2_feats.synchronization2;
+	}
+	if (has_sync2)
+	{
+		sync2_feats.pNext = feats12.pNext;
+		feats12.pNext = &sync2_feats;
+	}
+
+	VkDeviceCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	info.pQueueCreateInfos = qinfos;
+	info.queueCreateInfoCount = nfamilies;
+	info.pNext = &feats;
+	info.pEnabledFeatures = NULL; // given through VkPhysicalDeviceFeatures2 instead
+
+	// required extensions followed by the optional ones the device supports
+
+	const char *ext[N_DEVICE_EXTENSIONS + N_OPTIONAL_DEVICE_EXTENSIONS + 2];
+	uint32_t n_ext = 0;
+	for (int i = 0; i < N_DEVICE_EXTENSIONS && !headless; i ++)
+		ext[n_ext ++] = device_extensions[i];
+
+	for (int i = 0; i < N_OPTIONAL_DEVICE_EXTENSIONS; i ++)
+	{
+		if (device_ext_supported (physical_device, optional_device_extensions[i]))
+		{
+			ext[n_ext ++] = optional_device_extensions[i];
+			if (strcmp (optional_device_extensions[i], VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME) == 0)
+				has_push_descriptor = 1;
+		}
+	}
+	if (has_mesh_shader)
+		ext[n_ext ++] = VK_EXT_MESH_SHADER_EXTENSION_NAME;
+	if (has_sync2)
+		ext[n_ext ++] = VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME;
+
+	info.enabledExtensionCount = n_ext;
+	info.ppEnabledExtensionNames = ext;
+
+	assert (n_ext <= CAPS_MAX_EXTENSIONS);
+	memcpy (caps.exts, ext, n_ext * sizeof (const char *));
+	caps.n_exts = n_ext;
+
+#ifdef DEBUG
+	info.enabledLayerCount = N_VALIDATION_LAYERS;
+	info.ppEnabledLayerNames = validation_layers;
+#else
+	info.enabledLayerCount = 0;
+#endif
+
+	assert (vkCreateDevice (physical_device, &info, NULL, &device) == VK_SUCCESS);
+
+	vkGetDeviceQueue (device, gfx_family, 0, &gfx_queue);
+	vkGetDeviceQueue (device, present_support, 0, &present_queue);
+
+	if (has_push_descriptor)
+	{
+		cmd_push_descriptor_set_with_tpl = (PFN_vkCmdPushDescriptorSetWithTemplateKHR) vkGetDeviceProcAddr
+		(
+			device, "vkCmdPushDescriptorSetWithTemplateKHR"
+		);
+		has_push_descriptor = cmd_push_descriptor_set_with_tpl != NULL;
+	}
+
+	if (has_mesh_shader)
+	{
+		cmd_draw_mesh_tasks = (PFN_vkCmdDrawMeshTasksEXT) vkGetDeviceProcAddr (device, "vkCmdDrawMeshTasksEXT");
+		has_mesh_shader = cmd_draw_mesh_tasks != NULL;
+	}
+
+	if (has_sync2)
+	{
+		cmd_pipeline_barrier2 = (PFN_vkCmdPipelineBarrier2KHR) vkGetDeviceProcAddr (device, "vkCmdPipelineBarrier2KHR");
+		has_sync2 = cmd_pipeline_barrier2 != NULL;
+	}
+
+#ifdef DEBUG
+	printf ("push descriptors: %s\n", has_push_descriptor ? "yes" : "no");
+	printf ("gpu driven rendering: %s\n", has_gpu_driven ? "yes" : "no");
+	printf ("buffer device address: %s\n", has_bda ? "yes" : "no");
+	printf ("mesh shaders: %s\n", has_mesh_shader ? "yes" : "no");
+	printf ("synchronization2: %s\n", has_sync2 ? "yes" : "no");
+#endif
+
+	if (gpu_driven && !has_gpu_driven)
+	{
+		fprintf (stderr, "gpu driven rendering not supported, drawing from the cpu\n");
+		gpu_driven = 0;
+	}
+
+	if (vertex_pulling && !has_bda)
+	{
+		fprintf (stderr, "buffer device address not supported, fetching vertices fixed function\n");
+		vertex_pulling = 0;
+	}
+
+	if (use_meshlets && !has_mesh_shader)
+	{
+		fprintf (stderr, "mesh shaders not supported, drawing meshes indexed\n");
+		use_meshlets = 0;
+	}
+}
+
+static QueueFamilyIndices find_queue_families (VkPhysicalDevice dev)
+{
+	QueueFamilyIndices idx;
+	queue_family_indices_init (&idx);
+
+	uint32_t count = 0;
+
+	vkGetPhysicalDeviceQueueFamilyProperties (dev, &count, NULL);
+	VkQueueFamilyProperties families[count];
+	vkGetPhysicalDeviceQueueFamilyProperties (dev, &count, families);
+
+	int i = 0;
+	for (; i < count; i ++)
+	{
+		VkQueueFamilyProperties *family = &families[i];
+		if (family->queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			idx.gfx_family = i;
+
+		VkBool32 present_support = VK_FALSE;
+		if (headless)
+			present_support = (family->queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		else
+			vkGetPhysicalDeviceSurfaceSupportKHR (dev, i, surface, &present_support);
+
+		if (present_support)
+			idx.present_family = i;
+
+		if (queue_family_indices_is_complete (&idx))
+			break;
+	}
+
+	return idx;
+}
+
+/**
+ * Fill the capability snapshot of `physical_device`. Enabled extensions are added when the
+ * logical device is created.
+ */
+static void init_device_caps ()
+{
+	vkGetPhysicalDeviceProperties (physical_device, &caps.props);
+
+	VkPhysicalDeviceIDProperties id = { 0 };
+	id.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+	VkPhysicalDeviceProperties2 props2 = { 0 };
+	props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	props2.pNext = &id;
+	vkGetPhysicalDeviceProperties2 (physical_device, &props2);
+	for (int j = 0; j < VK_UUID_SIZE; j ++)
+		sprintf (&caps.uuid[2 * j], "%02x", id.deviceUUID[j]);
+
+	caps.feats12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	caps.feats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	caps.feats.pNext = &caps.feats12;
+	vkGetPhysicalDeviceFeatures2 (physical_device, &caps.feats);
+	caps.feats.pNext = caps.feats12.pNext = NULL;
+
+	vkGetPhysicalDeviceMemoryProperties (physical_device, &caps.mem);
+
+	vkGetPhysicalDeviceQueueFamilyProperties (physical_device, &caps.n_queue_families, NULL);
+	caps.queue_families = calloc (caps.n_queue_families, sizeof (VkQueueFamilyProperties));
+	vkGetPhysicalDeviceQueueFamilyProperties (physical_device, &caps.n_queue_families, caps.queue_families);
+	caps.queues = find_queue_families (physical_device);
+
+	for (size_t i = 0; i < N_CAPS_FORMATS; i ++)
+		vkGetPhysicalDeviceFormatProperties (physical_device, caps_formats[i].fmt, &caps.fmts[i]);
+
+	caps.n_exts = 0;
+}
+
+/**
+ * Format properties from the snapshot, or straight from the device for formats that
+ * are not in `caps_formats`, like whatever the surface happens to use.
+ */
+static VkFormatProperties caps_fmt_props (VkFormat fmt)
+{
+	for (size_t i = 0; i < N_CAPS_FORMATS; i ++)
+	{
+		if (caps_formats[i].fmt == fmt)
+			return caps.fmts[i];
+	}
+
+	VkFormatProperties p;
+	vkGetPhysicalDeviceFormatProperties (physical_device, fmt, &p);
+	return p;
+}
+
+/**
+ * Write the capability snapshot as JSON, so machines can be compared with a diff.
+ */
+void device_caps_write_json (FILE *fp)
+{
+	fprintf (fp, "{\n");
+	fprintf (fp, "\t\"name\": \"%s\",\n", caps.props.deviceName);
+	fprintf (fp, "\t\"uuid\": \"%s\",\n", caps.uuid);
+	fprintf (fp, "\t\"type\": %d,\n", caps.props.deviceType);
+	fprintf (fp, "\t\"vendor_id\": %u,\n", caps.props.vendorID);
+	fprintf (fp, "\t\"device_id\": %u,\n", caps.props.deviceID);
+	fprintf
+	(
+		fp,
+		"\t\"api_version\": \"%u.%u.%u\",\n",
+		VK_VERSION_MAJOR (caps.props.apiVersion),
+		VK_VERSION_MINOR (caps.props.apiVersion),
+		VK_VERSION_PATCH (caps.props.apiVersion)
+	);
+	fprintf (fp, "\t\"driver_version\": %u,\n", caps.props.driverVersion);
+
+	const VkPhysicalDeviceLimits *l = &caps.props.limits;
+	fprintf (fp, "\t\"limits\": {\n");
+#define LIMIT(name, fmt, last) fprintf (fp, "\t\t\"" #name "\": " fmt "%s\n", l->name, last ? "" : ",")
+	LIMIT (maxImageDimension2D, "%u", 0);
+	LIMIT (maxImageArrayLayers, "%u", 0);
+	LIMIT (maxUniformBufferRange, "%u", 0);
+	LIMIT (maxStorageBufferRange, "%u", 0);
+	LIMIT (maxPushConstantsSize, "%u", 0);
+	LIMIT (maxMemoryAllocationCount, "%u", 0);
+	LIMIT (maxBoundDescriptorSets, "%u", 0);
+	LIMIT (maxVertexInputAttributes, "%u", 0);
+	LIMIT (maxVertexInputBindings, "%u", 0);
+	LIMIT (maxComputeWorkGroupInvocations, "%u", 0);
+	LIMIT (maxDrawIndexedIndexValue, "%u", 0);
+	LIMIT (maxDrawIndirectCount, "%u", 0);
+	LIMIT (maxSamplerAnisotropy, "%g", 0);
+	LIMIT (timestampPeriod, "%g", 0);
+#undef LIMIT
+#define LIMIT(name, last) \
+	fprintf (fp, "\t\t\"" #name "\": %llu%s\n", (unsigned long long) l->name, last ? "" : ",")
+	LIMIT (minUniformBufferOffsetAlignment, 0);
+	LIMIT (minStorageBufferOffsetAlignment, 0);
+	LIMIT (nonCoherentAtomSize, 1);
+#undef LIMIT
+	fprintf (fp, "\t},\n");
+
+	fprintf (fp, "\t\"features\": {\n");
+	fprintf (fp, "\t\t\"samplerAnisotropy\": %s,\n", caps.feats.features.samplerAnisotropy ? "true" : "false");
+	fprintf (fp, "\t\t\"multiDrawIndirect\": %s,\n", caps.feats.features.multiDrawIndirect ? "true" : "false");
+	fprintf
+	(
+		fp,
+		"\t\t\"drawIndirectFirstInstance\": %s,\n",
+		caps.feats.features.drawIndirectFirstInstance ? "true" : "false"
+	);
+	fprintf (fp, "\t\t\"pipelineStatisticsQuery\": %s,\n", caps.feats.features.pipelineStatisticsQuery ? "true" : "false");
+	fprintf (fp, "\t\t\"drawIndirectCount\": %s,\n", caps.feats12.drawIndirectCount ? "true" : "false");
+	fprintf (fp, "\t\t\"bufferDeviceAddress\": %s\n", caps.feats12.bufferDeviceAddress ? "true" : "false");
+	fprintf (fp, "\t},\n");
+
+	fprintf (fp, "\t\"memory_heaps\": [\n");
+	for (uint32_t i = 0; i < caps.mem.memoryHeapCount; i ++)
+		fprintf
+		(
+			fp,
+			"\t\t{ \"size\": %llu, \"flags\": %u }%s\n",
+			(unsigned long long) caps.mem.memoryHeaps[i].size,
+			caps.mem.memoryHeaps[i].flags,
+			i + 1 < caps.mem.memoryHeapCount ? "," : ""
+		);
+	fprintf (fp, "\t],\n");
+
+	fprintf (fp, "\t\"memory_types\": [\n");
+	for (uint32_t i = 0; i < caps.mem.memoryTypeCount; i ++)
+		fprintf
+		(
+			fp,
+			"\t\t{ \"heap\": %u, \"flags\": %u }%s\n",
+			caps.mem.memoryTypes[i].heapIndex,
+			caps.mem.memoryTypes[i].propertyFlags,
+			i + 1 < caps.mem.memoryTypeCount ? "," : ""
+		);
+	fprintf (fp, "\t],\n");
+
+	fprintf (fp, "\t\"queue_families\": [\n");
+	for (uint32_t i = 0; i < caps.n_queue_families; i ++)
+		fprintf
+		(
+			fp,
+			"\t\t{ \"flags\": %u, \"count\": %u, \"timestamp_bits\": %u }%s\n",
+			caps.queue_families[i].queueFlags,
+			caps.queue_families[i].queueCount,
+			caps.queue_families[i].timestampValidBits,
+			i + 1 < caps.n_queue_families ? "," : ""
+		);
+	fprintf (fp, "\t],\n");
+	fprintf (fp, "\t\"gfx_family\": %d,\n", caps.queues.gfx_family);
+	fprintf (fp, "\t\"present_family\": %d,\n", caps.queues.present_family);
+
+	fprintf (fp, "\t\"formats\": {\n");
+	for (size_t i = 0; i < N_CAPS_FORMATS; i ++)
+		fprintf
+		(
+			fp,
+			"\t\t\"%s\": { \"linear\": %u, \"optimal\": %u, \"buffer\": %u }%s\n",
+			caps_formats[i].name,
+			caps.fmts[i].linearTilingFeatures,
+			caps.fmts[i].optimalTilingFeatures,
+			caps.fmts[i].bufferFeatures,
+			i + 1 < N_CAPS_FORMATS ? "," : ""
+		);
+	fprintf (fp, "\t},\n");
+
+	fprintf (fp, "\t\"extensions\": [");
+	for (uint32_t i = 0; i < caps.n_exts; i ++)
+		fprintf (fp, "%s\"%s\"", i ? ", " : " ", caps.exts[i]);
+	fprintf (fp, " ]\n");
+	fprintf (fp, "}\n");
+}
+
+static void create_swapchain ()
+{
+	SwapChainSupportDetails sup = query_swapchain_support (physical_device);
+
+	VkSurfaceFormatKHR fmt = choose_swap_surface_format (sup.fmts, sup.nfmts);
+	VkPresentModeKHR mode = choose_swap_present_mode (sup.present_modes, sup.npresmodes);
+	VkExtent2D ext = choose_swap_extent (sup.capabilities);
+
+	uint32_t imcount = sup.capabilities.minImageCount + 1;
+	if (sup.capabilities.maxImageCount > 0 && imcount > sup.capabilities.maxImageCount)
+		imcount = sup.capabilities.maxImageCount;
+
+	VkSwapchainCreateInfoKHR info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	info.surface = surface;
+	info.minImageCount = imcount;
+	info.imageFormat = fmt.format;
+	info.imageColorSpace = fmt.colorSpace;
+	info.imageExtent = ext;
+	info.imageArrayLayers = 1;
+	info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	if (readback)
+		info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+	QueueFamilyIndices idx = caps.queues;
 	uint32_t qfamilyidx[] = { idx.gfx_family, idx.present_family };
 
-	if (idx.gfx_family != idx.present_family)
-	{
-		info.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-		info.queueFamilyIndexCount = 2;
-		info.pQueueFamilyIndices = qfamilyidx;
-	}
-	else
+	if (idx.gfx_family != idx.present_family)
+	{
+		info.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+		info.queueFamilyIndexCount = 2;
+		info.pQueueFamilyIndices = qfamilyidx;
+	}
+	else
+	{
+		info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		info.queueFamilyIndexCount = 0; // optional
+		info.pQueueFamilyIndices = NULL; // optional
+	}
+
+	info.preTransform = sup.capabilities.currentTransform;
+	info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	info.presentMode = mode;
+	info.clipped = VK_TRUE;
+	info.oldSwapchain = VK_NULL_HANDLE;
+
+	assert(vkCreateSwapchainKHR (device, &info, NULL, &swapchain) == VK_SUCCESS);
+
+	// create swapchain image handles
+
+	assert(
+		vkGetSwapchainImagesKHR (
+			device,
+			swapchain,
+			&n_swapchain_imgs,
+			NULL
+		) == VK_SUCCESS
+	);
+	swapchain_imgs = malloc (n_swapchain_imgs * sizeof (VkImage));
+	assert(
+		vkGetSwapchainImagesKHR (
+			device,
+			swapchain,
+			&n_swapchain_imgs,
+			swapchain_imgs
+		) == VK_SUCCESS
+	);
+
+	swapchain_img_fmt = fmt.format;
+	swapchain_ext = ext;
+	swapchain_support_details_free (&sup);
+}
+
+static void create_img_view_typed
+(
+	VkImageView *view,
+	VkImage img,
+	VkFormat fmt,
+	VkImageAspectFlags flags,
+	VkImageViewType type
+)
+{
+	VkImageViewCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	info.image = img;
+	info.viewType = type;
+	info.format = fmt;
+	info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	info.subresourceRange.baseMipLevel = 0;
+	info.subresourceRange.levelCount = 1;
+	info.subresourceRange.baseArrayLayer = 0;
+	info.subresourceRange.layerCount = 1;
+	info.subresourceRange.aspectMask = flags;
+
+	assert (vkCreateImageView (device, &info, NULL, view) == VK_SUCCESS);
+}
+
+static void create_img_view
+(
+	VkImageView *view,
+	VkImage img,
+	VkFormat fmt,
+	VkImageAspectFlags flags
+)
+{
+	create_img_view_typed (view, img, fmt, flags, VK_IMAGE_VIEW_TYPE_2D);
+}
+
+static void create_img_views ()
+{
+	n_swapchain_img_views = n_swapchain_imgs;
+	swapchain_img_views = (VkImageView *) calloc (n_swapchain_img_views, sizeof (VkImageView));
+
+	for (int i = 0; i < n_swapchain_img_views; i ++)
+	{
+		create_img_view (
+			&swapchain_img_views[i],
+			swapchain_imgs[i],
+			swapchain_img_fmt,
+			VK_IMAGE_ASPECT_COLOR_BIT
+		);
+	}
+}
+
+static VkFormat find_supported_fmt
+(
+	VkFormat *candidates,
+	uint32_t n_candidates,
+	VkImageTiling tiling,
+	VkFormatFeatureFlags feats
+)
+{
+	for (int i = 0; i < n_candidates; i ++)
+	{
+		VkFormat fmt = candidates[i];
+		VkFormatProperties p = caps_fmt_props (fmt);
+
+		if (tiling == VK_IMAGE_TILING_LINEAR && (p.linearTilingFeatures & feats) == feats)
+		{
+			return fmt;
+		}
+		else if (tiling == VK_IMAGE_TILING_OPTIMAL && (p.optimalTilingFeatures & feats) == feats)
+		{
+			return fmt;
+		}
+	}
+
+	fprintf (stderr, "failed to find supported format");
+	exit (1);
+}
+
+static VkFormat find_depth_fmt ()
+{
+	VkFormat candidates[] =
+	{
+		VK_FORMAT_D32_SFLOAT,
+		VK_FORMAT_D32_SFLOAT_S8_UINT,
+		VK_FORMAT_D24_UNORM_S8_UINT
+	};
+	return find_supported_fmt
+	(
+		candidates,
+		3,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+	);
+}
+
+/**
+ * Attachments of a render pass with a single subpass, the colors and maybe a depth
+ * attachment after them. Render passes with the same formats are compatible with each
+ * other and can share pipelines.
+ */
+typedef struct RenderPassDesc
+{
+	VkAttachmentDescription colors[RG_MAX_PASS_USES];
+	uint32_t n_colors;
+	VkAttachmentDescription depth;
+	int has_depth;
+} RenderPassDesc;
+
+static VkAttachmentDescription attachment_desc
+(
+	VkFormat fmt,
+	VkAttachmentLoadOp load,
+	VkAttachmentStoreOp store,
+	VkImageLayout initial,
+	VkImageLayout final
+)
+{
+	VkAttachmentDescription att = { 0 };
+	att.format = fmt;
+	att.samples = VK_SAMPLE_COUNT_1_BIT;
+	att.loadOp = load;
+	att.storeOp = store;
+	att.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	att.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	att.initialLayout = initial;
+	att.finalLayout = final;
+	return att;
+}
+
+static VkRenderPass build_render_pass (const RenderPassDesc *desc)
+{
+	// also orders depth reads and writes after those of a previous pass. Redundant inside
+	// the frame graph, but render passes are only compatible with the same dependencies
+	VkSubpassDependency dep = { 0 };
+	dep.srcSubpass = VK_SUBPASS_EXTERNAL;
+	dep.dstSubpass = 0;
+	dep.srcStageMask =
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dep.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dep.dstStageMask =
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dep.dstAccessMask =
+		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	VkAttachmentDescription attachments[RG_MAX_PASS_USES + 1];
+	VkAttachmentReference color_refs[RG_MAX_PASS_USES];
+	for (uint32_t i = 0; i < desc->n_colors; i ++)
+	{
+		attachments[i] = desc->colors[i];
+		color_refs[i].attachment = i;
+		color_refs[i].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	}
+
+	VkAttachmentReference depth_ref = { 0 };
+	depth_ref.attachment = desc->n_colors;
+	depth_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	if (desc->has_depth)
+		attachments[desc->n_colors] = desc->depth;
+
+	VkSubpassDescription subpass = { 0 };
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = desc->n_colors;
+	subpass.pColorAttachments = color_refs;
+	subpass.pDepthStencilAttachment = desc->has_depth ? &depth_ref : NULL;
+
+	VkRenderPassCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	info.attachmentCount = desc->n_colors + (desc->has_depth ? 1 : 0);
+	info.pAttachments = attachments;
+	info.subpassCount = 1;
+	info.pSubpasses = &subpass;
+	info.dependencyCount = 1;
+	info.pDependencies = &dep;
+
+	VkRenderPass pass;
+	assert (vkCreateRenderPass (device, &info, NULL, &pass) == VK_SUCCESS);
+	return pass;
+}
+
+/**
+ * Create the render passes that pipelines are built for and that draw outside the frame
+ * graph: color and depth, and depth alone for the pre-pass. Both clear what they draw on.
+ */
+void create_render_pass ()
+{
+	// offscreen images are left ready to be copied out
+	VkImageLayout final = headless ?
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL :
+		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	RenderPassDesc desc = { 0 };
+	desc.n_colors = 1;
+	desc.colors[0] = attachment_desc
+	(
+		swapchain_img_fmt,
+		VK_ATTACHMENT_LOAD_OP_CLEAR,
+		VK_ATTACHMENT_STORE_OP_STORE,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		final
+	);
+	desc.has_depth = 1;
+	desc.depth = attachment_desc
+	(
+		find_depth_fmt (),
+		VK_ATTACHMENT_LOAD_OP_CLEAR,
+		VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+	);
+	render_pass = build_render_pass (&desc);
+
+	desc.n_colors = 0;
+	depth_render_pass = build_render_pass (&desc);
+}
+
+static void create_descriptor_set_layout ()
+{
+	VkDescriptorSetLayoutBinding ubo_layout_binding = { 0 };
+	ubo_layout_binding.binding = 0;
+	ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	ubo_layout_binding.descriptorCount = 1;
+	ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	ubo_layout_binding.pImmutableSamplers = NULL; // optional
+	if (has_mesh_shader)
+		ubo_layout_binding.stageFlags |= VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+
+	VkDescriptorSetLayoutBinding sampler_layout_binding = { 0 };
+	sampler_layout_binding.binding = 1;
+	sampler_layout_binding.descriptorCount = 1;
+	sampler_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	sampler_layout_binding.pImmutableSamplers = NULL;
+	sampler_layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutBinding bindings[] =
+	{
+		ubo_layout_binding, sampler_layout_binding
+	};
+	VkDescriptorSetLayoutCreateInfo layout_info = { 0 };
+	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.bindingCount = 2;
+	layout_info.pBindings = bindings;
+
+	assert (
+		vkCreateDescriptorSetLayout (
+			device,
+			&layout_info,
+			NULL,
+			&descriptor_set_layout
+		) == VK_SUCCESS
+	);
+
+	// same bindings but pushed straight into the command buffer, for per-draw transient
+	// bindings that should not go through a descriptor pool
+
+	if (has_push_descriptor)
+	{
+		layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+		assert (
+			vkCreateDescriptorSetLayout (
+				device,
+				&layout_info,
+				NULL,
+				&push_descriptor_set_layout
+			) == VK_SUCCESS
+		);
+
+		VkPipelineLayoutCreateInfo pipeline_layout_info = { 0 };
+		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipeline_layout_info.setLayoutCount = 1;
+		pipeline_layout_info.pSetLayouts = &push_descriptor_set_layout;
+
+		assert (
+			vkCreatePipelineLayout (
+				device,
+				&pipeline_layout_info,
+				NULL,
+				&push_pipeline_layout
+			) == VK_SUCCESS
+		);
+	}
+}
+
+/**
+ * Describe how a `DescriptorData` struct maps onto the descriptor set bindings.
+ */
+static void descriptor_update_tpl_entries (VkDescriptorUpdateTemplateEntry entries[2])
+{
+	memset (entries, 0, 2 * sizeof (VkDescriptorUpdateTemplateEntry));
+
+	entries[0].dstBinding = 0;
+	entries[0].dstArrayElement = 0;
+	entries[0].descriptorCount = 1;
+	entries[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	entries[0].offset = offsetof (DescriptorData, ubo);
+	entries[0].stride = sizeof (DescriptorData);
+
+	entries[1].dstBinding = 1;
+	entries[1].dstArrayElement = 0;
+	entries[1].descriptorCount = 1;
+	entries[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	entries[1].offset = offsetof (DescriptorData, tex);
+	entries[1].stride = sizeof (DescriptorData);
+}
+
+/**
+ * Create the descriptor update templates.
+ *
+ * One for writing regular descriptor sets and, if supported, one for push descriptors.
+ * Both read from a packed `DescriptorData`, which saves building `VkWriteDescriptorSet`
+ * arrays every time descriptors change.
+ */
+static void create_descriptor_update_tpls ()
+{
+	VkDescriptorUpdateTemplateEntry entries[2];
+	descriptor_update_tpl_entries (entries);
+
+	VkDescriptorUpdateTemplateCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+	info.descriptorUpdateEntryCount = 2;
+	info.pDescriptorUpdateEntries = entries;
+	info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+	info.descriptorSetLayout = descriptor_set_layout;
+
+	assert (
+		vkCreateDescriptorUpdateTemplate (device, &info, NULL, &descriptor_update_tpl) == VK_SUCCESS
+	);
+
+	if (has_push_descriptor)
+	{
+		info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
+		info.descriptorSetLayout = VK_NULL_HANDLE;
+		info.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		info.pipelineLayout = push_pipeline_layout;
+		info.set = 0;
+
+		assert (
+			vkCreateDescriptorUpdateTemplate (device, &info, NULL, &push_descriptor_tpl) == VK_SUCCESS
+		);
+	}
+}
+
+/**
+ * Write a whole descriptor set from packed data.
+ */
+static void write_descriptor_set (VkDescriptorSet set, const DescriptorData *data)
+{
+	vkUpdateDescriptorSetWithTemplate (device, set, descriptor_update_tpl, data);
+}
+
+/**
+ * Push descriptors for the next draws in the command buffer.
+ *
+ * Requires VK_KHR_push_descriptor and a pipeline created with `push_pipeline_layout`.
+ */
+static void push_descriptors (VkCommandBuffer cmdbuf, const DescriptorData *data)
+{
+	assert (has_push_descriptor);
+	cmd_push_descriptor_set_with_tpl (cmdbuf, push_descriptor_tpl, push_pipeline_layout, 0, data);
+}
+
+static VkShaderModule create_shader_module (const char *code, size_t size)
+{
+	VkShaderModuleCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	info.codeSize = size;
+	info.pCode = (const uint32_t*) code;
+
+	VkShaderModule mod;
+	assert (vkCreateShaderModule (device, &info, NULL, &mod) == VK_SUCCESS);
+
+	return mod;
+}
+
+/**
+ * Bytes per vertex of the position stream and of everything else for `fmt`. Interleaved
+ * vertices are the two added together.
+ */
+static uint32_t vx_pos_stride (VertexFormat fmt)
+{
+	return fmt == VX_FMT_FLOAT ? sizeof (float) * 3 : sizeof (uint16_t) * 4;
+}
+
+static uint32_t vx_attr_stride (VertexFormat fmt)
+{
+	return fmt == VX_FMT_FLOAT ? sizeof (VertexAttribs) : sizeof (QVertexAttribs);
+}
+
+/**
+ * Vertex bindings for meshes stored as `fmt` in `layout`, `desc` needs room for 3. With
+ * `pos_only` the attribute stream of a split layout is left out.
+ */
+static uint32_t vx_binding_desc
+(
+	VkVertexInputBindingDescription *desc,
+	VertexFormat fmt,
+	VertexLayout layout,
+	int pos_only,
+	int instanced
+)
+{
+	memset (desc, 0, 3 * sizeof (VkVertexInputBindingDescription));
+	uint32_t n = 0;
+
+	desc[n].binding = 0;
+	desc[n].stride = layout == VX_LAYOUT_SPLIT ? vx_pos_stride (fmt) : vx_pos_stride (fmt) + vx_attr_stride (fmt);
+	desc[n].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	n ++;
+
+	if (instanced)
+	{
+		desc[n].binding = 1;
+		desc[n].stride = sizeof (InstanceData);
+		desc[n].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+		n ++;
+	}
+
+	if (layout == VX_LAYOUT_SPLIT && !pos_only)
+	{
+		desc[n].binding = 2;
+		desc[n].stride = vx_attr_stride (fmt);
+		desc[n].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		n ++;
+	}
+
+	return n;
+}
+
+/**
+ * Vertex attributes matching `vx_binding_desc`. `desc` is allocated and should be freed.
+ */
+static uint32_t vx_attrib_desc
+(
+	VkVertexInputAttributeDescription **desc,
+	VertexFormat fmt,
+	VertexLayout layout,
+	int pos_only,
+	int instanced
+)
+{
+	*desc = calloc (9, sizeof (VkVertexInputAttributeDescription));
+
+	// position, color, texture coordinate and normal
+	uint32_t locations[4] = { 0, 1, 2, 8 };
+	VkFormat fmts[4];
+	uint32_t offsets[4];
+
+	if (fmt == VX_FMT_FLOAT && layout == VX_LAYOUT_INTERLEAVED)
+	{
+		offsets[0] = offsetof (Vertex, pos);
+		offsets[1] = offsetof (Vertex, color);
+		offsets[2] = offsetof (Vertex, uv);
+		offsets[3] = offsetof (Vertex, normal);
+	}
+	else if (fmt == VX_FMT_FLOAT)
+	{
+		offsets[0] = 0;
+		offsets[1] = offsetof (VertexAttribs, color);
+		offsets[2] = offsetof (VertexAttribs, uv);
+		offsets[3] = offsetof (VertexAttribs, normal);
+	}
+	else if (layout == VX_LAYOUT_INTERLEAVED)
+	{
+		offsets[0] = offsetof (QVertex, pos);
+		offsets[1] = offsetof (QVertex, color);
+		offsets[2] = offsetof (QVertex, uv);
+		offsets[3] = offsetof (QVertex, normal);
+	}
+	else
+	{
+		offsets[0] = 0;
+		offsets[1] = offsetof (QVertexAttribs, color);
+		offsets[2] = offsetof (QVertexAttribs, uv);
+		offsets[3] = offsetof (QVertexAttribs, normal);
+	}
+
+	if (fmt == VX_FMT_FLOAT)
+	{
+		fmts[0] = VK_FORMAT_R32G32B32_SFLOAT;
+		fmts[1] = VK_FORMAT_R32G32B32_SFLOAT;
+		fmts[2] = VK_FORMAT_R32G32_SFLOAT;
+		fmts[3] = VK_FORMAT_R32G32B32_SFLOAT;
+	}
+	else
+	{
+		fmts[0] = VK_FORMAT_R16G16B16A16_UNORM;
+		fmts[1] = VK_FORMAT_R8G8B8A8_UNORM;
+		fmts[2] = fmt == VX_FMT_QUANT_HALF_UV ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R16G16_UNORM;
+		fmts[3] = VK_FORMAT_R16G16_SNORM;
+	}
+
+	uint32_t n_vx_attribs = pos_only ? 1 : 4;
+	for (uint32_t i = 0; i < n_vx_attribs; i ++)
+	{
+		(*desc)[i].binding = i > 0 && layout == VX_LAYOUT_SPLIT ? 2 : 0;
+		(*desc)[i].location = locations[i];
+		(*desc)[i].format = fmts[i];
+		(*desc)[i].offset = offsets[i];
+	}
+
+	if (!instanced) return n_vx_attribs;
+
+	VkVertexInputAttributeDescription *inst = *desc + n_vx_attribs;
+
+	// per instance model matrix, one column per location
+	for (uint32_t i = 0; i < 4; i ++)
+	{
+		inst[i].binding = 1;
+		inst[i].location = 3 + i;
+		inst[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		inst[i].offset = offsetof (InstanceData, M) + i * 4 * sizeof (float);
+	}
+
+	// per instance texture layer
+	inst[4].binding = 1;
+	inst[4].location = 7;
+	inst[4].format = VK_FORMAT_R32_UINT;
+	inst[4].offset = offsetof (InstanceData, tex);
+
+	return n_vx_attribs + 5;
+}
+
+/**
+ * The parts that differ between graphics pipelines, everything else in
+ * `build_gfx_pipeline` is shared.
+ */
+typedef struct GfxPipelineDesc
+{
+	const char *vx_shader;
+	const char *frag_shader;
+	VkPipelineLayout layout;
+	int instanced; // per instance vertex binding
+	VertexFormat vx_fmt;
+	VertexLayout vx_layout;
+	int depth_only; // no fragment shader or color writes, fetches only positions
+	int depth_equal; // shades only what matches the depth pre-pass, no depth writes
+	int pulls; // the vertex shader fetches vertices itself, only instances are vertex input
+	const char *task_shader; // with a mesh shader in `vx_shader`, and no vertex input
+	int additive; // adds onto the color without writing depth, for particles
+} GfxPipelineDesc;
+
+static VkPipeline build_gfx_pipeline (const GfxPipelineDesc *desc)
+{
+	// read shader byte code
+
+	char *vx_shader_code, *frag_shader_code = NULL;
+	size_t vx_shader_size = read_file (desc->vx_shader, &vx_shader_code);
+	assert (vx_shader_size > 0);
+
+	size_t fg_shader_size = 0;
+	if (!desc->depth_only)
+	{
+		fg_shader_size = read_file (desc->frag_shader, &frag_shader_code);
+		assert (fg_shader_size > 0);
+	}
+
+	char *task_shader_code = NULL;
+	size_t task_shader_size = 0;
+	if (desc->task_shader)
+	{
+		task_shader_size = read_file (desc->task_shader, &task_shader_code);
+		assert (task_shader_size > 0);
+	}
+
+	// create shader modules
+
+	VkShaderModule vx_shader_mod = create_shader_module (vx_shader_code, vx_shader_size);
+	VkShaderModule frag_shader_mod = VK_NULL_HANDLE;
+	if (!desc->depth_only)
+		frag_shader_mod = create_shader_module (frag_shader_code, fg_shader_size);
+	VkShaderModule task_shader_mod = VK_NULL_HANDLE;
+	if (desc->task_shader)
+		task_shader_mod = create_shader_module (task_shader_code, task_shader_size);
+
+	// create shader pipelines
+
+	// constant 0 of the vertex shader tells it normals are octahedral encoded
+	VkBool32 oct_normal = desc->vx_fmt != VX_FMT_FLOAT;
+	VkSpecializationMapEntry spec_entry = { 0, 0, sizeof (VkBool32) };
+	VkSpecializationInfo spec = { 0 };
+	spec.mapEntryCount = 1;
+	spec.pMapEntries = &spec_entry;
+	spec.dataSize = sizeof (VkBool32);
+	spec.pData = &oct_normal;
+
+	VkPipelineShaderStageCreateInfo vxinfo = { 0 };
+	vxinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vxinfo.stage = desc->task_shader ? VK_SHADER_STAGE_MESH_BIT_EXT : VK_SHADER_STAGE_VERTEX_BIT;
+	vxinfo.module = vx_shader_mod;
+	vxinfo.pName = "main";
+	vxinfo.pSpecializationInfo = &spec;
+
+	VkPipelineShaderStageCreateInfo fginfo = { 0 };
+	fginfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	fginfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	fginfo.module = frag_shader_mod;
+	fginfo.pName = "main";
+
+	VkPipelineShaderStageCreateInfo taskinfo = { 0 };
+	taskinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	taskinfo.stage = VK_SHADER_STAGE_TASK_BIT_EXT;
+	taskinfo.module = task_shader_mod;
+	taskinfo.pName = "main";
+
+	VkPipelineShaderStageCreateInfo stages[3];
+	uint32_t n_stages = 0;
+	if (desc->task_shader)
+		stages[n_stages ++] = taskinfo;
+	stages[n_stages ++] = vxinfo;
+	if (!desc->depth_only)
+		stages[n_stages ++] = fginfo;
+
+	VkVertexInputBindingDescription binding_desc[3];
+	uint32_t n_binding_desc = vx_binding_desc
+	(
+		binding_desc,
+		desc->vx_fmt,
+		desc->vx_layout,
+		desc->depth_only,
+		desc->instanced
+	);
+	VkVertexInputAttributeDescription* attrib_desc;
+	uint32_t n_attrib_desc = vx_attrib_desc
+	(
+		&attrib_desc,
+		desc->vx_fmt,
+		desc->vx_layout,
+		desc->depth_only,
+		desc->instanced
+	);
+
+	// keep only the instances, binding 1, for vertex pulling
+	if (desc->pulls)
+	{
+		uint32_t n = 0;
+		for (uint32_t i = 0; i < n_binding_desc; i ++)
+			if (binding_desc[i].binding == 1)
+				binding_desc[n ++] = binding_desc[i];
+		n_binding_desc = n;
+
+		n = 0;
+		for (uint32_t i = 0; i < n_attrib_desc; i ++)
+			if (attrib_desc[i].binding == 1)
+				attrib_desc[n ++] = attrib_desc[i];
+		n_attrib_desc = n;
+	}
+
+	VkPipelineVertexInputStateCreateInfo vxinput = { 0 };
+	vxinput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vxinput.vertexBindingDescriptionCount = n_binding_desc;
+	vxinput.pVertexBindingDescriptions = binding_desc; // optional
+	vxinput.vertexAttributeDescriptionCount = n_attrib_desc;
+	vxinput.pVertexAttributeDescriptions = attrib_desc; // optional
+
+	VkPipelineInputAssemblyStateCreateInfo inasm = { 0 };
+	inasm.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inasm.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inasm.primitiveRestartEnable = VK_FALSE;
+
+	// viewport, dynamic so that the pipeline outlives the size of the render targets
+	VkPipelineViewportStateCreateInfo viewstate = { 0 };
+	viewstate.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewstate.viewportCount = 1;
+	viewstate.pViewports = NULL;
+	viewstate.scissorCount = 1;
+	viewstate.pScissors = NULL;
+
+	VkPipelineRasterizationStateCreateInfo rasterizer = { 0 };
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.depthClampEnable = VK_FALSE;
+	rasterizer.rasterizerDiscardEnable = VK_FALSE;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterizer.depthBiasEnable = VK_FALSE;
+	rasterizer.depthBiasConstantFactor = 0.0f; // optional
+	rasterizer.depthBiasClamp = 0.0f; // optional
+	rasterizer.depthBiasSlopeFactor = 0.0f; // optional
+
+	VkPipelineMultisampleStateCreateInfo multisampling = { 0 };
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.sampleShadingEnable = VK_FALSE;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampling.minSampleShading = 1.0f; // optional
+	multisampling.pSampleMask = NULL; // optional
+	multisampling.alphaToCoverageEnable = VK_FALSE; // optional
+	multisampling.alphaToOneEnable = VK_FALSE; // optional
+
+	VkPipelineColorBlendAttachmentState blend_att = { 0 };
+	blend_att.colorWriteMask = desc->depth_only ? 0 :
+		VK_COLOR_COMPONENT_R_BIT |
+		VK_COLOR_COMPONENT_G_BIT |
+		VK_COLOR_COMPONENT_B_BIT |
+		VK_COLOR_COMPONENT_A_BIT;
+	blend_att.blendEnable = desc->additive ? VK_TRUE : VK_FALSE;
+
+	blend_att.srcColorBlendFactor = desc->additive ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_SRC_ALPHA;
+	blend_att.dstColorBlendFactor = desc->additive ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	blend_att.colorBlendOp = VK_BLEND_OP_ADD;
+	blend_att.srcAlphaBlendFactor = desc->additive ? VK_BLEND_FACTOR_ZERO : VK_BLEND_FACTOR_ONE;
+	blend_att.dstAlphaBlendFactor = desc->additive ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ZERO;
+	blend_att.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	VkPipelineColorBlendStateCreateInfo blend = { 0 };
+	blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	blend.logicOpEnable = VK_FALSE;
+	blend.logicOp = VK_LOGIC_OP_COPY; // optional
+	blend.attachmentCount = desc->depth_only ? 0 : 1; // the pre-pass has no color
+	blend.pAttachments = &blend_att;
+	blend.blendConstants[0] = 0.0f; // optional
+	blend.blendConstants[1] = 0.0f; // optional
+	blend.blendConstants[2] = 0.0f; // optional
+	blend.blendConstants[3] = 0.0f; // optional
+
+	VkDynamicState dynstates[] =
+	{
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR
+	};
+
+	VkPipelineDynamicStateCreateInfo dynstate = { 0 };
+	dynstate.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynstate.dynamicStateCount = 2;
+	dynstate.pDynamicStates = dynstates;
+
+	VkPipelineDepthStencilStateCreateInfo depth_stencil = { 0 };
+	depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depth_stencil.depthTestEnable = VK_TRUE;
+	depth_stencil.depthWriteEnable = desc->depth_equal || desc->additive ? VK_FALSE : VK_TRUE;
+	depth_stencil.depthCompareOp = desc->depth_equal ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
+	depth_stencil.depthBoundsTestEnable = VK_FALSE;
+	depth_stencil.minDepthBounds = 0.0f; // optional
+	depth_stencil.maxDepthBounds = 1.0f; // optional
+	depth_stencil.stencilTestEnable = VK_FALSE;
+	//depth_stencil.front = { 0 }; // optional
+	//depth_stencil.back = { 0 }; // optional
+
+	VkGraphicsPipelineCreateInfo pipeinfo = { 0 };
+	pipeinfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipeinfo.stageCount = n_stages;
+	pipeinfo.pStages = stages;
+	pipeinfo.pVertexInputState = desc->task_shader ? NULL : &vxinput;
+	pipeinfo.pInputAssemblyState = desc->task_shader ? NULL : &inasm;
+	pipeinfo.pViewportState = &viewstate;
+	pipeinfo.pRasterizationState = &rasterizer;
+	pipeinfo.pMultisampleState = &multisampling;
+	pipeinfo.pDepthStencilState = &depth_stencil;
+	pipeinfo.pColorBlendState = &blend;
+	pipeinfo.pDynamicState = &dynstate;
+	pipeinfo.layout = desc->layout;
+	pipeinfo.renderPass = desc->depth_only ? depth_render_pass : render_pass;
+	pipeinfo.subpass = 0;
+	pipeinfo.basePipelineHandle = VK_NULL_HANDLE; // optional
+	pipeinfo.basePipelineIndex = -1; // optional
+
+	VkPipeline pipe;
+	assert (
+		vkCreateGraphicsPipelines (
+			device,
+			VK_NULL_HANDLE,
+			1,
+			&pipeinfo,
+			NULL,
+			&pipe
+		) == VK_SUCCESS
+	);
+
+	// cleanup
+
+	vkDestroyShaderModule (device, vx_shader_mod, NULL);
+	if (frag_shader_mod != VK_NULL_HANDLE)
+		vkDestroyShaderModule (device, frag_shader_mod, NULL);
+	if (task_shader_mod != VK_NULL_HANDLE)
+		vkDestroyShaderModule (device, task_shader_mod, NULL);
+	free (vx_shader_code);
+	free (frag_shader_code);
+	free (task_shader_code);
+	free (attrib_desc);
+
+	return pipe;
+}
+
+static void create_gfx_pipeline ()
+{
+	VkPipelineLayoutCreateInfo pipeline_cinfo = { 0 };
+	pipeline_cinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_cinfo.setLayoutCount = 1; // optional
+	pipeline_cinfo.pSetLayouts = &descriptor_set_layout; // optional
+	//pipeline_cinfo.pushConstantRangeCount = 0; // optional
+	//pipeline_cinfo.pPushConstantRanges = NULL; // optional
+
+	assert (
+		vkCreatePipelineLayout (device, &pipeline_cinfo, NULL, &pipeline_layout) == VK_SUCCESS
+	);
+
+	//
+	// TODO remove hard codings towards shader source
+	//
+
+	GfxPipelineDesc desc = { 0 };
+	desc.vx_shader = "build/vert.spv";
+	desc.frag_shader = "build/frag.spv";
+	desc.layout = pipeline_layout;
+	desc.instanced = 1;
+
+	for (int l = 0; l < VX_LAYOUT_COUNT; l ++)
+	{
+		for (int i = 0; i < VX_FMT_COUNT; i ++)
+		{
+			desc.vx_fmt = i;
+			desc.vx_layout = l;
+
+			desc.vx_shader = "build/vert.spv";
+			desc.depth_only = 0;
+			desc.depth_equal = 0;
+			pipelines[l][i] = build_gfx_pipeline (&desc);
+
+			desc.depth_equal = 1;
+			equal_pipelines[l][i] = build_gfx_pipeline (&desc);
+
+			desc.vx_shader = "build/depth.spv";
+			desc.depth_only = 1;
+			desc.depth_equal = 0;
+			depth_pipelines[l][i] = build_gfx_pipeline (&desc);
+		}
+	}
+
+	if (!has_bda)
+		return;
+
+	// vertex pulling, the addresses and strides of the vertices are pushed per pool
+
+	VkPushConstantRange range = { 0 };
+	range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	range.offset = 0;
+	range.size = sizeof (PullConstants);
+
+	pipeline_cinfo.pushConstantRangeCount = 1;
+	pipeline_cinfo.pPushConstantRanges = &range;
+
+	assert (
+		vkCreatePipelineLayout (device, &pipeline_cinfo, NULL, &pull_pipeline_layout) == VK_SUCCESS
+	);
+
+	memset (&desc, 0, sizeof (desc));
+	desc.vx_shader = "build/pull.spv";
+	desc.frag_shader = "build/frag.spv";
+	desc.layout = pull_pipeline_layout;
+	desc.instanced = 1;
+	desc.pulls = 1;
+	pull_pipeline = build_gfx_pipeline (&desc);
+
+	desc.depth_equal = 1;
+	pull_equal_pipeline = build_gfx_pipeline (&desc);
+
+	// the same shader so depth matches exactly, its outputs go unused
+	desc.depth_only = 1;
+	desc.depth_equal = 0;
+	pull_depth_pipeline = build_gfx_pipeline (&desc);
+
+	if (!has_mesh_shader)
+		return;
+
+	// meshlets, culled by the task shader and drawn by the mesh shader
+
+	range.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+	range.size = sizeof (MeshletConstants);
+
+	assert (
+		vkCreatePipelineLayout (device, &pipeline_cinfo, NULL, &meshlet_pipeline_layout) == VK_SUCCESS
+	);
+
+	memset (&desc, 0, sizeof (desc));
+	desc.task_shader = "build/meshlet_task.spv";
+	desc.vx_shader = "build/meshlet_mesh.spv";
+	desc.frag_shader = "build/frag.spv";
+	desc.layout = meshlet_pipeline_layout;
+	meshlet_pipeline = build_gfx_pipeline (&desc);
+}
+
+/**
+ * Create a compute pipeline from the SPIR-V in `shader`, with its specialization
+ * constants set from `spec` if it is not NULL.
+ */
+static VkPipeline create_compute_pipeline
+(
+	const char *shader,
+	VkPipelineLayout layout,
+	const VkSpecializationInfo *spec
+)
+{
+	char *code;
+	size_t size = read_file (shader, &code);
+	assert (size > 0);
+
+	VkShaderModule mod = create_shader_module (code, size);
+
+	VkComputePipelineCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	info.stage.module = mod;
+	info.stage.pName = "main";
+	info.stage.pSpecializationInfo = spec;
+	info.layout = layout;
+
+	VkPipeline pipe;
+	assert (vkCreateComputePipelines (device, VK_NULL_HANDLE, 1, &info, NULL, &pipe) == VK_SUCCESS);
+
+	vkDestroyShaderModule (device, mod, NULL);
+	free (code);
+
+	return pipe;
+}
+
+/**
+ * Create a descriptor set with the storage buffers `bufs` at bindings 0 to n - 1, binding
+ * i used from `stages[i]`, along with its layout and a pool of its own.
+ */
+static void create_storage_set
+(
+	uint32_t n,
+	const VkBuffer *bufs,
+	const VkShaderStageFlags *stages,
+	VkDescriptorSetLayout *layout,
+	VkDescriptorPool *pool,
+	VkDescriptorSet *set
+)
+{
+	VkDescriptorSetLayoutBinding bindings[n];
+	memset (bindings, 0, sizeof (bindings));
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = stages[i];
+	}
+
+	VkDescriptorSetLayoutCreateInfo layout_info = { 0 };
+	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.bindingCount = n;
+	layout_info.pBindings = bindings;
+
+	assert (vkCreateDescriptorSetLayout (device, &layout_info, NULL, layout) == VK_SUCCESS);
+
+	VkDescriptorPoolSize pool_size = { 0 };
+	pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	pool_size.descriptorCount = n;
+
+	VkDescriptorPoolCreateInfo pool_info = { 0 };
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.poolSizeCount = 1;
+	pool_info.pPoolSizes = &pool_size;
+	pool_info.maxSets = 1;
+
+	assert (vkCreateDescriptorPool (device, &pool_info, NULL, pool) == VK_SUCCESS);
+
+	VkDescriptorSetAllocateInfo alloc_info = { 0 };
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = *pool;
+	alloc_info.descriptorSetCount = 1;
+	alloc_info.pSetLayouts = layout;
+
+	assert (vkAllocateDescriptorSets (device, &alloc_info, set) == VK_SUCCESS);
+
+	VkDescriptorBufferInfo buf_info[n];
+	VkWriteDescriptorSet writes[n];
+	memset (buf_info, 0, sizeof (buf_info));
+	memset (writes, 0, sizeof (writes));
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		buf_info[i].buffer = bufs[i];
+		buf_info[i].range = VK_WHOLE_SIZE;
+
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = *set;
+		writes[i].dstBinding = i;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].descriptorCount = 1;
+		writes[i].pBufferInfo = &buf_info[i];
+	}
+	vkUpdateDescriptorSets (device, n, writes, 0, NULL);
+}
+
+/**
+ * Global memory barrier: what `src_stage` wrote with `src_access` becomes visible to
+ * `dst_access` in `dst_stage`. Without access masks it only orders execution.
+ */
+static void memory_barrier
+(
+	VkCommandBuffer cmdbuf,
+	VkPipelineStageFlags src_stage,
+	VkAccessFlags src_access,
+	VkPipelineStageFlags dst_stage,
+	VkAccessFlags dst_access
+)
+{
+	VkMemoryBarrier barrier = { 0 };
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	vkCmdPipelineBarrier (cmdbuf, src_stage, dst_stage, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+static void create_cmd_pool ()
+{
+	QueueFamilyIndices idx = caps.queues;
+
+	VkCommandPoolCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	info.queueFamilyIndex = idx.gfx_family;
+	//info.flags = 0; // optional
+
+	assert (vkCreateCommandPool (device, &info, NULL, &cmdpool) == VK_SUCCESS);
+}
+
+static uint32_t find_mem_type (uint32_t type_filter, VkMemoryPropertyFlags props)
+{
+	for (uint32_t i = 0; i < caps.mem.memoryTypeCount; i ++)
+	{
+		if
+		(
+			(type_filter & (1 << i)) &&
+			(caps.mem.memoryTypes[i].propertyFlags & props) == props
+		)
+			return i;
+	}
+
+	fprintf (stderr, "failed to find suitable memory type!");
+	exit (1);
+}
+
+static void create_img
+(
+	uint32_t w,
+	uint32_t h,
+	VkFormat fmt,
+	VkImageTiling tiling,
+	VkImageUsageFlags usage,
+	VkMemoryPropertyFlags props,
+	VkImage *img,
+	VkDeviceMemory *img_mem
+)
+{
+	VkImageCreateInfo img_info = { 0 };
+	img_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	img_info.imageType = VK_IMAGE_TYPE_2D;
+	img_info.extent.width = w;
+	img_info.extent.height = h;
+	img_info.extent.depth = 1;
+	img_info.mipLevels = 1;
+	img_info.arrayLayers = 1;
+	img_info.format = fmt;
+	img_info.tiling = tiling;
+	img_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	img_info.usage = usage;
+	img_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	img_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	assert (vkCreateImage (device, &img_info, NULL, img) == VK_SUCCESS);
+
+	VkMemoryRequirements memreq;
+	vkGetImageMemoryRequirements (device, *img, &memreq);
+
+	VkMemoryAllocateInfo alloc_info = { 0 };
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = memreq.size;
+	alloc_info.memoryTypeIndex = find_mem_type (memreq.memoryTypeBits, props);
+
+	assert (vkAllocateMemory (device, &alloc_info, NULL, img_mem) == VK_SUCCESS);
+
+	vkBindImageMemory (device, *img, *img_mem, 0);
+}
+
+static VkCommandBuffer begin_single_time_cmds ()
+{
+	VkCommandBufferAllocateInfo alloc_info = { 0 };
+	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	alloc_info.commandPool = cmdpool;
+	alloc_info.commandBufferCount = 1;
+
+	VkCommandBuffer cmdbuf;
+	vkAllocateCommandBuffers (device, &alloc_info, &cmdbuf);
+
+	VkCommandBufferBeginInfo begin_info = { 0 };
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer (cmdbuf, &begin_info);
+
+	return cmdbuf;
+}
+
+static void end_single_time_cmds (VkCommandBuffer cmdbuf)
+{
+	vkEndCommandBuffer (cmdbuf);
+
+	VkSubmitInfo submit_info = { 0 };
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &cmdbuf;
+
+	vkQueueSubmit (gfx_queue, 1, &submit_info, VK_NULL_HANDLE);
+	vkQueueWaitIdle (gfx_queue);
+
+	vkFreeCommandBuffers (device, cmdpool, 1, &cmdbuf);
+}
+
+/**
+ * Stages of synchronization2 as they were before it, `none` if there are none.
+ */
+static VkPipelineStageFlags legacy_stages (VkPipelineStageFlags2KHR stages, VkPipelineStageFlags none)
+{
+	VkPipelineStageFlags legacy = (VkPipelineStageFlags) (stages & 0xffffffffu);
+	if
+	(
+		stages & (
+			VK_PIPELINE_STAGE_2_COPY_BIT_KHR |
+			VK_PIPELINE_STAGE_2_RESOLVE_BIT_KHR |
+			VK_PIPELINE_STAGE_2_BLIT_BIT_KHR |
+			VK_PIPELINE_STAGE_2_CLEAR_BIT_KHR
+		)
+	)
+		legacy |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+	if (stages & (VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT_KHR | VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT_KHR))
+		legacy |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+	return legacy ? legacy : none;
+}
+
+static VkAccessFlags legacy_access (VkAccessFlags2KHR access)
+{
+	VkAccessFlags legacy = (VkAccessFlags) (access & 0xffffffffu);
+	if (access & (VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR | VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR))
+		legacy |= VK_ACCESS_SHADER_READ_BIT;
+	if (access & VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR)
+		legacy |= VK_ACCESS_SHADER_WRITE_BIT;
+	return legacy;
+}
+
+/**
+ * Add what `sb` waits for and makes visible to the global memory barrier.
+ */
+static void barriers_add_memory (Barriers *b, const SyncBarrier *sb)
+{
+	b->mem.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+	b->mem.srcStageMask |= sb->src_stage;
+	b->mem.srcAccessMask |= sb->src_access;
+	b->mem.dstStageMask |= sb->dst_stage;
+	b->mem.dstAccessMask |= sb->dst_access;
+	b->has_mem = 1;
+}
+
+static int barriers_same (const VkImageMemoryBarrier2KHR *a, VkImage img, const SyncBarrier *sb)
+{
+	return
+		a->image == img &&
+		a->srcStageMask == sb->src_stage &&
+		a->srcAccessMask == sb->src_access &&
+		a->dstStageMask == sb->dst_stage &&
+		a->dstAccessMask == sb->dst_access &&
+		a->oldLayout == sb->old_layout &&
+		a->newLayout == sb->new_layout;
+}
+
+/**
+ * Add barrier `sb` of the subresources in `range` of `img`. It is merged with the barrier
+ * added last when it is the same and the two ranges make one.
+ */
+static void barriers_add_image
+(
+	Barriers *b,
+	VkImage img,
+	const VkImageSubresourceRange *range,
+	const SyncBarrier *sb
+)
+{
+	if (b->n_imgs > 0 && barriers_same (&b->imgs[b->n_imgs - 1], img, sb))
+	{
+		VkImageSubresourceRange *last = &b->imgs[b->n_imgs - 1].subresourceRange;
+
+		// the next layers of the same levels
+		if
+		(
+			last->baseMipLevel == range->baseMipLevel &&
+			last->levelCount == range->levelCount &&
+			last->baseArrayLayer + last->layerCount == range->baseArrayLayer
+		)
+		{
+			last->layerCount += range->layerCount;
+			return;
+		}
+
+		// the same layers of the next levels
+		if
+		(
+			last->baseArrayLayer == range->baseArrayLayer &&
+			last->layerCount == range->layerCount &&
+			last->baseMipLevel + last->levelCount == range->baseMipLevel
+		)
+		{
+			last->levelCount += range->levelCount;
+			return;
+		}
+	}
+
+	assert (b->n_imgs < MAX_BARRIERS);
+	VkImageMemoryBarrier2KHR *ib = &b->imgs[b->n_imgs ++];
+	memset (ib, 0, sizeof (VkImageMemoryBarrier2KHR));
+	ib->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+	ib->srcStageMask = sb->src_stage;
+	ib->srcAccessMask = sb->src_access;
+	ib->dstStageMask = sb->dst_stage;
+	ib->dstAccessMask = sb->dst_access;
+	ib->oldLayout = sb->old_layout;
+	ib->newLayout = sb->new_layout;
+	ib->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	ib->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	ib->image = img;
+	ib->subresourceRange = *range;
+}
+
+/**
+ * Record the barriers gathered in `b` with one vkCmdPipelineBarrier2, or one
+ * vkCmdPipelineBarrier waiting for all of their stages at once, and empty it.
+ */
+static void barriers_flush (VkCommandBuffer cmdbuf, Barriers *b)
+{
+	if (!b->has_mem && b->n_imgs == 0)
+		return;
+
+	if (has_sync2)
+	{
+		VkDependencyInfoKHR info = { 0 };
+		info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+		info.memoryBarrierCount = b->has_mem ? 1 : 0;
+		info.pMemoryBarriers = &b->mem;
+		info.imageMemoryBarrierCount = b->n_imgs;
+		info.pImageMemoryBarriers = b->imgs;
+
+		cmd_pipeline_barrier2 (cmdbuf, &info);
+	}
+	else
+	{
+		VkPipelineStageFlags2KHR src = b->mem.srcStageMask, dst = b->mem.dstStageMask;
+
+		VkMemoryBarrier mem = { 0 };
+		mem.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		mem.srcAccessMask = legacy_access (b->mem.srcAccessMask);
+		mem.dstAccessMask = legacy_access (b->mem.dstAccessMask);
+
+		VkImageMemoryBarrier imgs[MAX_BARRIERS];
+		for (uint32_t i = 0; i < b->n_imgs; i ++)
+		{
+			const VkImageMemoryBarrier2KHR *ib = &b->imgs[i];
+			src |= ib->srcStageMask;
+			dst |= ib->dstStageMask;
+
+			memset (&imgs[i], 0, sizeof (VkImageMemoryBarrier));
+			imgs[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			imgs[i].srcAccessMask = legacy_access (ib->srcAccessMask);
+			imgs[i].dstAccessMask = legacy_access (ib->dstAccessMask);
+			imgs[i].oldLayout = ib->oldLayout;
+			imgs[i].newLayout = ib->newLayout;
+			imgs[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imgs[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imgs[i].image = ib->image;
+			imgs[i].subresourceRange = ib->subresourceRange;
+		}
+
+		vkCmdPipelineBarrier
+		(
+			cmdbuf,
+			legacy_stages (src, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT),
+			legacy_stages (dst, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT),
+			0,
+			b->has_mem ? 1 : 0,
+			&mem,
+			0,
+			NULL,
+			b->n_imgs,
+			imgs
+		);
+	}
+
+	memset (b, 0, sizeof (Barriers));
+}
+
+/**
+ * Stand in for the swapchain when running headless: one device local color image per
+ * frame in flight, filled in where the swapchain images would be so that everything
+ * created per swapchain image works unchanged.
+ */
+static void create_offscreen_targets ()
+{
+	n_swapchain_imgs = MAX_FRAMES_IN_FLIGHT;
+	swapchain_imgs = calloc (n_swapchain_imgs, sizeof (VkImage));
+	offscreen_imgs_mem = calloc (n_swapchain_imgs, sizeof (VkDeviceMemory));
+	swapchain_img_fmt = VK_FORMAT_R8G8B8A8_SRGB;
+	swapchain_ext = headless_ext;
+
+	for (uint32_t i = 0; i < n_swapchain_imgs; i ++)
+	{
+		create_img
+		(
+			swapchain_ext.width,
+			swapchain_ext.height,
+			swapchain_img_fmt,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&swapchain_imgs[i],
+			&offscreen_imgs_mem[i]
+		);
+	}
+}
+
+static void destroy_offscreen_targets ()
+{
+	for (uint32_t i = 0; i < n_swapchain_imgs; i ++)
+	{
+		vkDestroyImage (device, swapchain_imgs[i], NULL);
+		vkFreeMemory (device, offscreen_imgs_mem[i], NULL);
+	}
+	free (offscreen_imgs_mem);
+	free (swapchain_imgs);
+	offscreen_imgs_mem = NULL;
+	swapchain_imgs = NULL;
+}
+
+/**
+ * Framebuffers for drawing outside the frame graph, on the graph's depth buffer. Must be
+ * created after the frame graph.
+ */
+static void create_framebuffers ()
+{
+	VkImageView depth_view = frame_graph.resources[frame_depth].view;
+	swapchain_framebufs = calloc (n_swapchain_img_views, sizeof (VkFramebuffer));
+
+	VkFramebufferCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	info.width = swapchain_ext.width;
+	info.height = swapchain_ext.height;
+	info.layers = 1;
+
+	for (size_t i = 0; i < n_swapchain_img_views; i ++)
+	{
+		VkImageView attachments[] = { swapchain_img_views[i], depth_view };
+
+		info.renderPass = render_pass;
+		info.attachmentCount = 2;
+		info.pAttachments = attachments;
+
+		assert (vkCreateFramebuffer (device, &info, NULL, &swapchain_framebufs[i]) == VK_SUCCESS);
+	}
+
+	info.renderPass = depth_render_pass;
+	info.attachmentCount = 1;
+	info.pAttachments = &depth_view;
+
+	assert (vkCreateFramebuffer (device, &info, NULL, &depth_framebuf) == VK_SUCCESS);
+}
+
+static void destroy_framebuffers ()
+{
+	for (size_t i = 0; i < n_swapchain_img_views; i ++)
+		vkDestroyFramebuffer (device, swapchain_framebufs[i], NULL);
+	vkDestroyFramebuffer (device, depth_framebuf, NULL);
+
+	free (swapchain_framebufs);
+	swapchain_framebufs = NULL;
+}
+
+/**
+ *		Render graph, see `RenderGraph`.
+ */
+
+/**
+ * What the usages in `usage` need together, a combination of RgUsage. For an image they
+ * must agree on the layout, buffers have none.
+ */
+static SyncUse sync_use (uint32_t usage, int image)
+{
+	// by RgUsage bit. Not static, the synchronization2 flags are not constant expressions
+	const SyncUse uses[] =
+	{
+		// RG_COLOR
+		{
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+			VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR,
+			VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR,
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+		},
+		// RG_DEPTH
+		{
+			VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR,
+			VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR,
+			VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR,
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+		},
+		// RG_SAMPLED
+		{
+			VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
+			VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR,
+			0,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		},
+		// RG_STORAGE_READ
+		{
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+			VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR,
+			0,
+			VK_IMAGE_LAYOUT_GENERAL
+		},
+		// RG_STORAGE_WRITE
+		{
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+			0,
+			VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR,
+			VK_IMAGE_LAYOUT_GENERAL
+		},
+		// RG_VERTEX_READ
+		{
+			VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT_KHR,
+			VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR,
+			0,
+			VK_IMAGE_LAYOUT_GENERAL
+		},
+		// RG_INDIRECT
+		{
+			VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR,
+			VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR,
+			0,
+			VK_IMAGE_LAYOUT_UNDEFINED
+		},
+		// RG_TRANSFER_SRC
+		{
+			VK_PIPELINE_STAGE_2_COPY_BIT_KHR,
+			VK_ACCESS_2_TRANSFER_READ_BIT_KHR,
+			0,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+		},
+		// RG_TRANSFER_DST, fills and updates of buffers are clears
+		{
+			VK_PIPELINE_STAGE_2_COPY_BIT_KHR | VK_PIPELINE_STAGE_2_CLEAR_BIT_KHR,
+			0,
+			VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+		}
+	};
+
+	SyncUse sync = { 0 };
+	for (uint32_t i = 0; i < sizeof (uses) / sizeof (uses[0]); i ++)
+	{
+		if (!(usage & (1u << i)))
+			continue;
+
+		const SyncUse *s = &uses[i];
+		assert (!image || sync.layout == VK_IMAGE_LAYOUT_UNDEFINED || sync.layout == s->layout);
+		sync.stage |= s->stage;
+		sync.read |= s->read;
+		sync.write |= s->write;
+		if (image)
+			sync.layout = s->layout;
+	}
+	return sync;
+}
+
+/**
+ * Go from state `s` to the use `sync`, returning whether that takes a barrier and which
+ * in `b`. Writes and layout transitions wait for everything before them, reads only for
+ * the last write.
+ */
+static int sync_access (SyncState *s, const SyncUse *sync, int image, SyncBarrier *b)
+{
+	int transition = image && s->layout != sync->layout;
+	int needed = 0;
+
+	b->old_layout = s->layout;
+	b->new_layout = image ? sync->layout : VK_IMAGE_LAYOUT_UNDEFINED;
+	b->dst_stage = sync->stage;
+
+	if (transition || sync->write)
+	{
+		b->src_stage = s->write_stage | s->read_stage;
+		b->src_access = s->write_access;
+		b->dst_access = sync->read | sync->write;
+		needed = transition || b->src_stage;
+
+		s->layout = b->new_layout;
+		s->write_stage = sync->stage;
+		s->write_access = sync->write;
+		s->read_stage = sync->write ? 0 : sync->stage;
+		s->visible_stage = sync->write ? 0 : sync->stage;
+		s->visible_access = sync->write ? 0 : sync->read;
+		s->written |= sync->write != 0;
+	}
+	else
+	{
+		b->src_stage = s->write_stage;
+		b->src_access = s->write_access;
+		b->dst_access = sync->read;
+		needed =
+			s->write_stage &&
+			((sync->stage & ~s->visible_stage) || (sync->read & ~s->visible_access));
+
+		if (needed)
+		{
+			s->visible_stage |= sync->stage;
+			s->visible_access |= sync->read;
+		}
+		s->read_stage |= sync->stage;
+	}
+
+	return needed;
+}
+
+static VkImageAspectFlags fmt_aspect (VkFormat fmt)
+{
+	switch (fmt)
+	{
+	case VK_FORMAT_D16_UNORM:
+	case VK_FORMAT_D32_SFLOAT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT;
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	default:
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+}
+
+static VkImage rg_image (const RgResource *r, uint32_t img)
+{
+	if (r->transient)
+		return r->img;
+	return r->imgs[r->n_imgs > 1 ? img : 0];
+}
+
+static VkImageView rg_view (const RgResource *r, uint32_t img)
+{
+	if (r->transient)
+		return r->view;
+	return r->views[r->n_imgs > 1 ? img : 0];
+}
+
+/**
+ * Start an empty graph for images of `ext`, making framebuffers for `n_imgs` swapchain
+ * images.
+ */
+static void rg_init (RenderGraph *g, VkExtent2D ext, uint32_t n_imgs)
+{
+	memset (g, 0, sizeof (RenderGraph));
+	g->ext = ext;
+	g->n_imgs = n_imgs;
+}
+
+static RgResource *rg_add_resource (RenderGraph *g, const char *name, uint32_t *index)
+{
+	assert (g->n_resources < RG_MAX_RESOURCES);
+	*index = g->n_resources ++;
+
+	RgResource *r = &g->resources[*index];
+	memset (r, 0, sizeof (RgResource));
+	r->name = name;
+	return r;
+}
+
+/**
+ * Import `n` images made outside the graph, one per swapchain image or the same for all
+ * if `n` is 1. Each frame they start out in `initial`, ready for use from `ready_stage`,
+ * the stage a semaphore was waited on in, and the graph leaves them in `final`. Passes
+ * writing them are never culled.
+ */
+static uint32_t rg_import_image
+(
+	RenderGraph *g,
+	const char *name,
+	const VkImage *imgs,
+	const VkImageView *views,
+	uint32_t n,
+	VkFormat fmt,
+	VkImageLayout initial,
+	VkPipelineStageFlags2KHR ready_stage,
+	VkImageLayout final
+)
+{
+	uint32_t index;
+	RgResource *r = rg_add_resource (g, name, &index);
+	r->image = 1;
+	r->fmt = fmt;
+	r->aspect = fmt_aspect (fmt);
+	r->imgs = imgs;
+	r->views = views;
+	r->n_imgs = n;
+	r->initial.layout = initial;
+	r->initial.write_stage = ready_stage;
+	r->final = final;
+	return index;
+}
+
+/**
+ * Import a buffer whose contents carry over from one frame to the next, so each frame
+ * is synchronized with the one before. Passes writing it are never culled.
+ */
+static uint32_t rg_import_buffer (RenderGraph *g, const char *name, VkBuffer buf)
+{
+	uint32_t index;
+	RgResource *r = rg_add_resource (g, name, &index);
+	r->buf = buf;
+	return index;
+}
+
+/**
+ * An image of the graph's size that only lives within the frame. Its contents are lost
+ * between frames and its memory is shared with images used in other levels.
+ */
+static uint32_t rg_create_image (RenderGraph *g, const char *name, VkFormat fmt)
+{
+	uint32_t index;
+	RgResource *r = rg_add_resource (g, name, &index);
+	r->image = 1;
+	r->transient = 1;
+	r->fmt = fmt;
+	r->aspect = fmt_aspect (fmt);
+	return index;
+}
+
+/**
+ * Add a pass recorded by `record`, run after the passes added before it that it depends
+ * on. Raster passes are recorded inside a render pass on their attachments.
+ */
+static uint32_t rg_add_pass (RenderGraph *g, const char *name, uint32_t flags, RgRecordFn record, void *user)
+{
+	assert (g->n_passes < RG_MAX_PASSES);
+	uint32_t index = g->n_passes ++;
+
+	RgPass *pass = &g->passes[index];
+	memset (pass, 0, sizeof (RgPass));
+	pass->name = name;
+	pass->flags = flags;
+	pass->record = record;
+	pass->user = user;
+	pass->contents = VK_SUBPASS_CONTENTS_INLINE;
+	return index;
+}
+
+/**
+ * Declare that `pass` uses resource `res` as `usage`, a combination of RgUsage.
+ */
+static void rg_use (RenderGraph *g, uint32_t pass, uint32_t res, uint32_t usage)
+{
+	RgPass *p = &g->passes[pass];
+	assert (p->n_uses < RG_MAX_PASS_USES);
+	p->uses[p->n_uses].res = res;
+	p->uses[p->n_uses].usage = usage;
+	p->n_uses ++;
+}
+
+/**
+ * Find the dependencies between the passes in the order they were added and cull those
+ * whose writes nobody reads. Then put each pass in the level after the last one it
+ * depends on.
+ */
+static void rg_schedule (RenderGraph *g)
+{
+	const uint32_t none = UINT32_MAX;
+	uint32_t last_writer[RG_MAX_RESOURCES];
+	uint32_t readers[RG_MAX_RESOURCES] = { 0 }; // since the last write
+	VkImageLayout layout[RG_MAX_RESOURCES];
+	for (uint32_t r = 0; r < g->n_resources; r ++)
+	{
+		last_writer[r] = none;
+		layout[r] = g->resources[r].initial.layout;
+	}
+
+	for (uint32_t p = 0; p < g->n_passes; p ++)
+	{
+		RgPass *pass = &g->passes[p];
+		for (uint32_t u = 0; u < pass->n_uses; u ++)
+		{
+			uint32_t res = pass->uses[u].res;
+			const RgResource *r = &g->resources[res];
+			SyncUse sync = sync_use (pass->uses[u].usage, r->image);
+
+			// a layout transition writes the image
+			int writes = sync.write || (r->image && sync.layout != layout[res]);
+			int reads = sync.read != 0;
+
+			if (last_writer[res] != none)
+			{
+				pass->deps |= 1u << last_writer[res];
+				if (reads)
+					pass->producers |= 1u << last_writer[res];
+			}
+			if (writes)
+			{
+				pass->deps |= readers[res];
+				last_writer[res] = p;
+				readers[res] = 0;
+			}
+			else
+				readers[res] |= 1u << p;
+			layout[res] = sync.layout;
+
+			if (writes && !r->transient)
+				pass->kept = 1;
+		}
+		pass->deps &= ~(1u << p);
+		pass->producers &= ~(1u << p);
+
+		if (pass->flags & RG_PASS_KEEP)
+			pass->kept = 1;
+	}
+
+	// whatever a kept pass reads from has to be kept too, producers come before
+	for (uint32_t p = g->n_passes; p -- > 0;)
+	{
+		if (!g->passes[p].kept)
+			continue;
+		for (uint32_t q = 0; q < p; q ++)
+			if (g->passes[p].producers & (1u << q))
+				g->passes[q].kept = 1;
+	}
+
+	g->n_levels = 0;
+	for (uint32_t p = 0; p < g->n_passes; p ++)
+	{
+		RgPass *pass = &g->passes[p];
+		if (!pass->kept)
+			continue;
+
+		pass->level = 0;
+		for (uint32_t q = 0; q < p; q ++)
+			if ((pass->deps & (1u << q)) && g->passes[q].kept && g->passes[q].level + 1 > pass->level)
+				pass->level = g->passes[q].level + 1;
+
+		if (pass->level + 1 > g->n_levels)
+			g->n_levels = pass->level + 1;
+	}
+
+	g->n_order = 0;
+	for (uint32_t l = 0; l < g->n_levels; l ++)
+		for (uint32_t p = 0; p < g->n_passes; p ++)
+			if (g->passes[p].kept && g->passes[p].level == l)
+				g->order[g->n_order ++] = p;
+
+	// the levels each resource is used in, and what images are used for
+
+	for (uint32_t i = 0; i < g->n_order; i ++)
+	{
+		const RgPass *pass = &g->passes[g->order[i]];
+		for (uint32_t u = 0; u < pass->n_uses; u ++)
+		{
+			RgResource *r = &g->resources[pass->uses[u].res];
+			uint32_t usage = pass->uses[u].usage;
+
+			if (!r->used || pass->level < r->first)
+				r->first = pass->level;
+			if (!r->used || pass->level > r->last)
+				r->last = pass->level;
+			r->used = 1;
+
+			if (usage & RG_COLOR)
+				r->usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+			if (usage & RG_DEPTH)
+				r->usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+			if (usage & RG_SAMPLED)
+				r->usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+			if (usage & (RG_STORAGE_READ | RG_STORAGE_WRITE))
+				r->usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+			if (usage & RG_TRANSFER_SRC)
+				r->usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			if (usage & RG_TRANSFER_DST)
+				r->usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		}
+	}
+}
+
+/**
+ * Create the transient images and give them memory. The biggest go first, each into the
+ * first block of memory whose images are all used in other levels, so images whose
+ * lifetimes do not overlap alias.
+ */
+static void rg_create_transients (RenderGraph *g)
+{
+	const uint32_t none = UINT32_MAX;
+	uint32_t order[RG_MAX_RESOURCES], n = 0;
+
+	for (uint32_t i = 0; i < g->n_resources; i ++)
+	{
+		RgResource *r = &g->resources[i];
+		r->slot = none;
+		if (!r->transient || !r->used)
+			continue;
+
+		VkImageCreateInfo info = { 0 };
+		info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		info.imageType = VK_IMAGE_TYPE_2D;
+		info.extent.width = g->ext.width;
+		info.extent.height = g->ext.height;
+		info.extent.depth = 1;
+		info.mipLevels = 1;
+		info.arrayLayers = 1;
+		info.format = r->fmt;
+		info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		info.usage = r->usage;
+		info.samples = VK_SAMPLE_COUNT_1_BIT;
+		info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		assert (vkCreateImage (device, &info, NULL, &r->img) == VK_SUCCESS);
+		vkGetImageMemoryRequirements (device, r->img, &r->mem_req);
+		g->transient_size += r->mem_req.size;
+
+		uint32_t j = n ++;
+		for (; j > 0 && g->resources[order[j - 1]].mem_req.size < r->mem_req.size; j --)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		RgResource *r = &g->resources[order[i]];
+
+		uint32_t s = 0;
+		for (; s < g->n_slots; s ++)
+		{
+			if (!(g->slot_types[s] & r->mem_req.memoryTypeBits))
+				continue;
+
+			int overlap = 0;
+			for (uint32_t j = 0; j < i; j ++)
+			{
+				const RgResource *o = &g->resources[order[j]];
+				if (o->slot == s && !(o->last < r->first || r->last < o->first))
+					overlap = 1;
+			}
+			if (!overlap)
+				break;
+		}
+
+		if (s == g->n_slots)
+		{
+			g->n_slots ++;
+			g->slot_size[s] = 0;
+			g->slot_types[s] = r->mem_req.memoryTypeBits;
+		}
+
+		// images are bound at the start of their block, which covers the biggest alignment
+		VkDeviceSize size = (r->mem_req.size + r->mem_req.alignment - 1) & ~(r->mem_req.alignment - 1);
+		r->slot = s;
+		g->slot_types[s] &= r->mem_req.memoryTypeBits;
+		if (size > g->slot_size[s])
+			g->slot_size[s] = size;
+	}
+
+	for (uint32_t s = 0; s < g->n_slots; s ++)
+	{
+		VkMemoryAllocateInfo alloc_info = { 0 };
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = g->slot_size[s];
+		alloc_info.memoryTypeIndex = find_mem_type (g->slot_types[s], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		assert (vkAllocateMemory (device, &alloc_info, NULL, &g->slots[s]) == VK_SUCCESS);
+		g->memory_size += g->slot_size[s];
+	}
+
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		RgResource *r = &g->resources[order[i]];
+		vkBindImageMemory (device, r->img, g->slots[r->slot], 0);
+
+		// views are for attachments and sampling depth, never stencil
+		VkImageAspectFlags aspect = r->aspect & VK_IMAGE_ASPECT_DEPTH_BIT ?
+			VK_IMAGE_ASPECT_DEPTH_BIT :
+			r->aspect;
+		create_img_view (&r->view, r->img, r->fmt, aspect);
+	}
+}
+
+/**
+ * Use a resource in state `s` as `sync` wants, adding the barrier that takes to `b`.
+ * Images get a barrier each, buffers share the global memory barrier.
+ */
+static void rg_access (const RgResource *r, uint32_t res, SyncState *s, const SyncUse *sync, RgBatch *b)
+{
+	SyncBarrier sb;
+	if (!sync_access (s, sync, r->image, &sb))
+		return;
+
+	if (r->image)
+	{
+		RgImageBarrier *ib = &b->imgs[b->n_imgs ++];
+		ib->res = res;
+		ib->barrier = sb;
+		return;
+	}
+
+	b->mem.src_stage |= sb.src_stage;
+	b->mem.src_access |= sb.src_access;
+	b->mem.dst_stage |= sb.dst_stage;
+	b->mem.dst_access |= sb.dst_access;
+	b->has_mem = 1;
+}
+
+/**
+ * Run through a frame from `states`, leaving them as the frame does. With `batches`, the
+ * barriers are written to them and the load operations of attachments to the passes.
+ */
+static void rg_simulate (RenderGraph *g, SyncState *states, RgBatch *batches)
+{
+	RgBatch scratch;
+
+	for (uint32_t l = 0; l < g->n_levels; l ++)
+	{
+		RgBatch *b = batches ? &batches[l] : &scratch;
+		memset (b, 0, sizeof (RgBatch));
+
+		// everything the level does to each resource at once
+		uint32_t usage[RG_MAX_RESOURCES] = { 0 };
+		for (uint32_t i = 0; i < g->n_order; i ++)
+		{
+			RgPass *pass = &g->passes[g->order[i]];
+			if (pass->level != l)
+				continue;
+
+			for (uint32_t u = 0; u < pass->n_uses; u ++)
+			{
+				uint32_t res = pass->uses[u].res;
+				usage[res] |= pass->uses[u].usage;
+				pass->load[u] = states[res].written ?
+					VK_ATTACHMENT_LOAD_OP_LOAD :
+					VK_ATTACHMENT_LOAD_OP_CLEAR;
+			}
+		}
+
+		for (uint32_t res = 0; res < g->n_resources; res ++)
+		{
+			if (!usage[res])
+				continue;
+
+			const RgResource *r = &g->resources[res];
+			SyncUse sync = sync_use (usage[res], r->image);
+			rg_access (r, res, &states[res], &sync, b);
+		}
+	}
+
+	// imported images are left the way they were asked for, for whatever comes after
+	// the frame, which waits on its own
+	RgBatch *b = batches ? &batches[g->n_levels] : &scratch;
+	memset (b, 0, sizeof (RgBatch));
+	for (uint32_t res = 0; res < g->n_resources; res ++)
+	{
+		const RgResource *r = &g->resources[res];
+		if (!r->image || r->transient || !r->used)
+			continue;
+
+		SyncUse final = { 0 };
+		final.layout = r->final;
+		rg_access (r, res, &states[res], &final, b);
+	}
+}
+
+/**
+ * Work out the barriers of a frame. The state a frame starts in is the one the previous
+ * frame left: buffers carry over, and a transient image follows whatever used its memory
+ * last. So the frame is run through once to find out how it ends.
+ */
+static void rg_build_batches (RenderGraph *g)
+{
+	SyncState states[RG_MAX_RESOURCES], end[RG_MAX_RESOURCES];
+	memset (states, 0, sizeof (states));
+	for (uint32_t i = 0; i < g->n_resources; i ++)
+		if (g->resources[i].image && !g->resources[i].transient)
+			states[i] = g->resources[i].initial;
+
+	rg_simulate (g, states, NULL);
+	memcpy (end, states, sizeof (end));
+
+	for (uint32_t i = 0; i < g->n_resources; i ++)
+	{
+		const RgResource *r = &g->resources[i];
+		if (r->image && !r->transient)
+		{
+			states[i] = r->initial;
+			continue;
+		}
+
+		uint32_t prev = i;
+		if (r->transient && r->used)
+		{
+			// the last image in the same memory before this one, or the last of all of
+			// them in the frame before
+			int found = 0;
+			for (uint32_t j = 0; j < g->n_resources; j ++)
+			{
+				const RgResource *o = &g->resources[j];
+				if (!o->transient || !o->used || o->slot != r->slot || o->last >= r->first)
+					continue;
+				if (!found || o->last > g->resources[prev].last)
+					prev = j;
+				found = 1;
+			}
+			for (uint32_t j = 0; !found && j < g->n_resources; j ++)
+			{
+				const RgResource *o = &g->resources[j];
+				if (o->transient && o->used && o->slot == r->slot && o->last > g->resources[prev].last)
+					prev = j;
+			}
+		}
+
+		states[i] = end[prev];
+		states[i].visible_stage = 0;
+		states[i].visible_access = 0;
+		states[i].written = 0;
+		if (r->transient)
+			states[i].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	}
+
+	rg_simulate (g, states, g->batches);
+}
+
+/**
+ * Render passes and framebuffers of the raster passes. Attachments are stored when a
+ * later level or the next frame uses them, and already are in their layout when the
+ * render pass begins.
+ */
+static void rg_create_render_passes (RenderGraph *g)
+{
+	for (uint32_t i = 0; i < g->n_order; i ++)
+	{
+		RgPass *pass = &g->passes[g->order[i]];
+		if (!(pass->flags & RG_PASS_RASTER))
+			continue;
+
+		RenderPassDesc desc = { 0 };
+		uint32_t atts[RG_MAX_PASS_USES];
+
+		// colors first, depth last
+		for (int depth = 0; depth <= 1; depth ++)
+		{
+			for (uint32_t u = 0; u < pass->n_uses; u ++)
+			{
+				uint32_t usage = pass->uses[u].usage;
+				if (!(usage & (depth ? RG_DEPTH : RG_COLOR)))
+					continue;
+
+				const RgResource *r = &g->resources[pass->uses[u].res];
+				VkImageLayout layout = depth ?
+					VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL :
+					VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+				VkAttachmentDescription att = attachment_desc
+				(
+					r->fmt,
+					pass->load[u],
+					!r->transient || r->last > pass->level ?
+						VK_ATTACHMENT_STORE_OP_STORE :
+						VK_ATTACHMENT_STORE_OP_DONT_CARE,
+					layout,
+					layout
+				);
+
+				VkClearValue *clear = &pass->clear[pass->n_attachments];
+				memset (clear, 0, sizeof (VkClearValue));
+				if (depth)
+				{
+					clear->depthStencil.depth = 1.0f;
+					desc.depth = att;
+					desc.has_depth = 1;
+				}
+				else
+				{
+					clear->color.float32[3] = 1.0f;
+					desc.colors[desc.n_colors ++] = att;
+				}
+				atts[pass->n_attachments ++] = pass->uses[u].res;
+			}
+		}
+
+		pass->render_pass = build_render_pass (&desc);
+
+		pass->framebufs = calloc (g->n_imgs, sizeof (VkFramebuffer));
+		for (uint32_t img = 0; img < g->n_imgs; img ++)
+		{
+			VkImageView views[RG_MAX_PASS_USES];
+			for (uint32_t a = 0; a < pass->n_attachments; a ++)
+				views[a] = rg_view (&g->resources[atts[a]], img);
+
+			VkFramebufferCreateInfo info = { 0 };
+			info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			info.renderPass = pass->render_pass;
+			info.attachmentCount = pass->n_attachments;
+			info.pAttachments = views;
+			info.width = g->ext.width;
+			info.height = g->ext.height;
+			info.layers = 1;
+
+			assert (vkCreateFramebuffer (device, &info, NULL, &pass->framebufs[img]) == VK_SUCCESS);
+		}
+	}
+}
+
+/**
+ * Turn the passes added so far into something that can be executed, with everything the
+ * graph makes for them.
+ */
+static void rg_compile (RenderGraph *g)
+{
+	rg_schedule (g);
+	rg_create_transients (g);
+	rg_build_batches (g);
+	rg_create_render_passes (g);
+
+#ifdef DEBUG
+	for (uint32_t p = 0; p < g->n_passes; p ++)
+	{
+		if (g->passes[p].kept)
+			printf ("render graph: %-16s level %u\n", g->passes[p].name, g->passes[p].level);
+		else
+			printf ("render graph: %-16s culled\n", g->passes[p].name);
+	}
+	printf
+	(
+		"render graph: %lu bytes of transient images in %lu bytes\n",
+		(unsigned long) g->transient_size,
+		(unsigned long) g->memory_size
+	);
+#endif
+}
+
+static void rg_record_batch (const RenderGraph *g, const RgBatch *b, VkCommandBuffer cmdbuf, uint32_t img)
+{
+	Barriers barriers = { 0 };
+	if (b->has_mem)
+		barriers_add_memory (&barriers, &b->mem);
+
+	for (uint32_t i = 0; i < b->n_imgs; i ++)
+	{
+		const RgResource *r = &g->resources[b->imgs[i].res];
+
+		VkImageSubresourceRange range = { 0 };
+		range.aspectMask = r->aspect;
+		range.levelCount = 1;
+		range.layerCount = 1;
+		barriers_add_image (&barriers, rg_image (r, img), &range, &b->imgs[i].barrier);
+	}
+
+	barriers_flush (cmdbuf, &barriers);
+}
+
+/**
+ * Set the viewport and scissor, dynamic in every graphics pipeline, to cover `ext`.
+ */
+static void set_viewport (VkCommandBuffer cmdbuf, VkExtent2D ext)
+{
+	VkViewport view = { 0 };
+	view.x = 0.0f;
+	view.y = 0.0f;
+	view.width = (float) ext.width;
+	view.height = (float) ext.height;
+	view.minDepth = 0.0f;
+	view.maxDepth = 1.0f;
+
+	VkOffset2D offset = { 0, 0 };
+	VkRect2D scissor = { 0 };
+	scissor.offset = offset;
+	scissor.extent = ext;
+
+	vkCmdSetViewport (cmdbuf, 0, 1, &view);
+	vkCmdSetScissor (cmdbuf, 0, 1, &scissor);
+}
+
+/**
+ * Record the compiled graph for swapchain image `img`. Must be outside a render pass.
+ */
+static void rg_execute (const RenderGraph *g, VkCommandBuffer cmdbuf, uint32_t img)
+{
+	for (uint32_t i = 0; i < g->n_order; i ++)
+	{
+		const RgPass *pass = &g->passes[g->order[i]];
+		if (i == 0 || pass->level != g->passes[g->order[i - 1]].level)
+			rg_record_batch (g, &g->batches[pass->level], cmdbuf, img);
+
+		if (!(pass->flags & RG_PASS_RASTER))
+		{
+			pass->record (cmdbuf, img, pass->user);
+			continue;
+		}
+
+		VkOffset2D offset = { 0, 0 };
+		VkRenderPassBeginInfo info = { 0 };
+		info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		info.renderPass = pass->render_pass;
+		info.framebuffer = pass->framebufs[img];
+		info.renderArea.offset = offset;
+		info.renderArea.extent = g->ext;
+		info.clearValueCount = pass->n_attachments;
+		info.pClearValues = pass->clear;
+
+		vkCmdBeginRenderPass (cmdbuf, &info, pass->contents);
+		if (pass->contents == VK_SUBPASS_CONTENTS_INLINE)
+			set_viewport (cmdbuf, g->ext);
+		pass->record (cmdbuf, img, pass->user);
+		vkCmdEndRenderPass (cmdbuf);
+	}
+
+	rg_record_batch (g, &g->batches[g->n_levels], cmdbuf, img);
+}
+
+static void rg_destroy (RenderGraph *g)
+{
+	for (uint32_t i = 0; i < g->n_order; i ++)
+	{
+		RgPass *pass = &g->passes[g->order[i]];
+		if (!(pass->flags & RG_PASS_RASTER))
+			continue;
+
+		for (uint32_t img = 0; img < g->n_imgs; img ++)
+			vkDestroyFramebuffer (device, pass->framebufs[img], NULL);
+		free (pass->framebufs);
+		vkDestroyRenderPass (device, pass->render_pass, NULL);
+	}
+
+	for (uint32_t i = 0; i < g->n_resources; i ++)
+	{
+		RgResource *r = &g->resources[i];
+		if (!r->transient || !r->used)
+			continue;
+
+		vkDestroyImageView (device, r->view, NULL);
+		vkDestroyImage (device, r->img, NULL);
+	}
+
+	for (uint32_t s = 0; s < g->n_slots; s ++)
+		vkFreeMemory (device, g->slots[s], NULL);
+
+	memset (g, 0, sizeof (RenderGraph));
+}
+
+/**
+ *		Images outside the frame graph, see `TrackedImg`.
+ */
+
+/**
+ * Track `img` from its creation, in VK_IMAGE_LAYOUT_UNDEFINED and not used yet.
+ */
+static void img_track (TrackedImg *t, VkImage img, VkFormat fmt, uint32_t n_levels, uint32_t n_layers)
+{
+	t->img = img;
+	t->aspect = fmt_aspect (fmt);
+	t->n_levels = n_levels;
+	t->n_layers = n_layers;
+	t->subs = calloc (n_levels * n_layers, sizeof (SyncState));
+}
+
+static void img_untrack (TrackedImg *t)
+{
+	free (t->subs);
+	memset (t, 0, sizeof (TrackedImg));
+}
+
+/**
+ * Use levels [level, level + n_levels) and layers [layer, layer + n_layers) of `t` as
+ * `usage`, a combination of RgUsage, adding the barriers that takes to `b`. The counts
+ * can be VK_REMAINING_MIP_LEVELS and VK_REMAINING_ARRAY_LAYERS. Subresources needing the
+ * same barrier share one.
+ */
+static void img_use
+(
+	Barriers *b,
+	TrackedImg *t,
+	uint32_t level,
+	uint32_t n_levels,
+	uint32_t layer,
+	uint32_t n_layers,
+	uint32_t usage
+)
+{
+	if (n_levels == VK_REMAINING_MIP_LEVELS)
+		n_levels = t->n_levels - level;
+	if (n_layers == VK_REMAINING_ARRAY_LAYERS)
+		n_layers = t->n_layers - layer;
+	assert (level + n_levels <= t->n_levels && layer + n_layers <= t->n_layers);
+
+	SyncUse sync = sync_use (usage, 1);
+	for (uint32_t l = level; l < level + n_levels; l ++)
+	{
+		uint32_t before = b->n_imgs;
+		for (uint32_t a = layer; a < layer + n_layers; a ++)
+		{
+			SyncBarrier sb;
+			if (!sync_access (&t->subs[l * t->n_layers + a], &sync, 1, &sb))
+				continue;
+
+			VkImageSubresourceRange range = { 0 };
+			range.aspectMask = t->aspect;
+			range.baseMipLevel = l;
+			range.levelCount = 1;
+			range.baseArrayLayer = a;
+			range.layerCount = 1;
+			barriers_add_image (b, t->img, &range, &sb);
+		}
+
+		// the layers of this level merged into one barrier, which may extend the levels
+		// of the one before
+		if (b->n_imgs == before + 1 && before > 0)
+		{
+			VkImageMemoryBarrier2KHR *ib = &b->imgs[before];
+			VkImageMemoryBarrier2KHR *prev = &b->imgs[before - 1];
+			VkImageSubresourceRange *r = &prev->subresourceRange;
+			SyncBarrier sb =
+			{
+				ib->srcStageMask,
+				ib->srcAccessMask,
+				ib->dstStageMask,
+				ib->dstAccessMask,
+				ib->oldLayout,
+				ib->newLayout
+			};
+
+			if
+			(
+				barriers_same (prev, ib->image, &sb) &&
+				r->baseArrayLayer == ib->subresourceRange.baseArrayLayer &&
+				r->layerCount == ib->subresourceRange.layerCount &&
+				r->baseMipLevel + r->levelCount == l
+			)
+			{
+				r->levelCount ++;
+				b->n_imgs --;
+			}
+		}
+	}
+}
+
+static void create_buffer
+(
+	VkDeviceSize size,
+	VkBufferUsageFlags usage,
+	VkMemoryPropertyFlags props,
+	VkBuffer *buf,
+	VkDeviceMemory *mem
+)
+{
+	VkBufferCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	info.size = size;
+	info.usage = usage;
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	assert (vkCreateBuffer (device, &info, NULL, buf) == VK_SUCCESS);
+
+	VkMemoryRequirements mem_req;
+	vkGetBufferMemoryRequirements (device, *buf, &mem_req);
+
+	VkMemoryAllocateInfo alloc_info = { 0 };
+	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	alloc_info.allocationSize = mem_req.size;
+	alloc_info.memoryTypeIndex = find_mem_type
+	(
+		mem_req.memoryTypeBits,
+		props
+	);
+
+	// buffers read by address need memory that can be
+	VkMemoryAllocateFlagsInfo flags = { 0 };
+	flags.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+	flags.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+	if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)
+		alloc_info.pNext = &flags;
+
+	assert (vkAllocateMemory (device, &alloc_info, NULL, mem) == VK_SUCCESS);
+
+	vkBindBufferMemory (device, *buf, *mem, 0);
+}
+
+/**
+ * Record copying `buf` to the first level and layer of `img`, which must be in
+ * VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL.
+ */
+static void record_cp_buf_img (VkCommandBuffer cmdbuf, VkBuffer buf, VkImage img, uint32_t w, uint32_t h)
+{
+	VkBufferImageCopy region = { 0 };
+
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+
+	VkOffset3D offset = { 0, 0, 0 };
+	VkExtent3D ext = { w, h, 1 };
+	region.imageOffset = offset;
+	region.imageExtent = ext;
+
+	vkCmdCopyBufferToImage (cmdbuf, buf, img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+}
+
+/**
+ * Decode the texture of the scene, the base color image embedded in the first glTF
+ * binary given on the command line, straight from the mapped file. Without one it is
+ * the tutorial texture.
+ */
+static stbi_uc *load_scene_tex (int *w, int *h)
+{
+	int c;
+
+	for (uint32_t i = 0; i < n_mesh_files; i ++)
+	{
+		const char *ext = strrchr (mesh_files[i], '.');
+		if (!ext || strcasecmp (ext, ".glb") != 0)
+			continue;
+
+		Glb glb;
+		const uint8_t *data;
+		uint64_t len;
+		stbi_uc *pix = NULL;
+
+		glb_open (mesh_files[i], &glb);
+		if (glb_base_color_image (&glb, &data, &len))
+			pix = stbi_load_from_memory (data, (int) len, w, h, &c, STBI_rgb_alpha);
+		glb_close (&glb);
+
+		if (pix)
+			return pix;
+	}
+
+	return stbi_load ("tutorial/textures/texture.jpg", w, h, &c, STBI_rgb_alpha);
+}
+
+static void create_tex_img ()
+{
+	int w, h;
+
+	stbi_uc *pix = load_scene_tex (&w, &h);
+	VkDeviceSize size = w * h * 4;
+
+	assert (pix);
+
+	VkBuffer staging_buf;
+	VkDeviceMemory staging_buf_mem;
+
+	create_buffer
+	(
+		size,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&staging_buf,
+		&staging_buf_mem
+	);
+
+	void *data;
+	vkMapMemory (device, staging_buf_mem, 0, size, 0, &data);
+	memcpy (data, pix, size);
+	vkUnmapMemory (device, staging_buf_mem);
+
+	stbi_image_free (pix);
+
+	create_img
+	(
+		w,
+		h,
+		VK_FORMAT_R8G8B8A8_SRGB,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&tex_img,
+		&tex_img_mem
+	);
+
+	img_track (&tex_track, tex_img, VK_FORMAT_R8G8B8A8_SRGB, 1, 1);
+
+	// the upload and its barriers in one submission
+	VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+	Barriers barriers = { 0 };
+
+	img_use (&barriers, &tex_track, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS, RG_TRANSFER_DST);
+	barriers_flush (cmdbuf, &barriers);
+
+	record_cp_buf_img (cmdbuf, staging_buf, tex_img, w, h);
+
+	img_use (&barriers, &tex_track, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS, RG_SAMPLED);
+	barriers_flush (cmdbuf, &barriers);
+
+	end_single_time_cmds (cmdbuf);
+
+	vkDestroyBuffer (device, staging_buf, NULL);
+	vkFreeMemory (device, staging_buf_mem, NULL);
+}
+
+static void create_tex_img_view ()
+{
+	// viewed as an array so instances can pick a layer
+	create_img_view_typed (
+		&tex_img_view,
+		tex_img,
+		VK_FORMAT_R8G8B8A8_SRGB,
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		VK_IMAGE_VIEW_TYPE_2D_ARRAY
+	);
+}
+
+static void create_tex_sampler ()
+{
+	VkSamplerCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	info.magFilter = VK_FILTER_LINEAR;
+	info.minFilter = VK_FILTER_LINEAR;
+	info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	info.anisotropyEnable = VK_TRUE;
+
+	info.maxAnisotropy = caps.props.limits.maxSamplerAnisotropy;
+	info.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	info.unnormalizedCoordinates = VK_FALSE;
+	info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	info.mipLodBias = 0.0f;
+	info.minLod = 0.0f;
+	info.maxLod = 0.0f;
+
+	assert (vkCreateSampler (device, &info, NULL, &tex_sampler) == VK_SUCCESS);
+}
+
+static void copy_buf (VkBuffer src, VkBuffer dst, VkDeviceSize size)
+{
+	VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+
+	VkBufferCopy copy = { 0 };
+	copy.srcOffset = 0; // optional
+	copy.dstOffset = 0; // optional
+	copy.size = size;
+	vkCmdCopyBuffer (cmdbuf, src, dst, 1, &copy);
+
+	end_single_time_cmds (cmdbuf);
+}
+
+static void copy_buf_regions (VkBuffer src, VkBuffer dst, const VkBufferCopy *regions, uint32_t n)
+{
+	VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+	vkCmdCopyBuffer (cmdbuf, src, dst, n, regions);
+	end_single_time_cmds (cmdbuf);
+}
+
+uint32_t rq_pipeline_add (VkPipeline *pipe, VkPipelineLayout *layout)
+{
+	assert (n_rq_pipelines < RQ_MAX_PIPELINES);
+	rq_pipelines[n_rq_pipelines].pipe = pipe;
+	rq_pipelines[n_rq_pipelines].layout = layout;
+	rq_pipelines[n_rq_pipelines].depth = NULL;
+	rq_pipelines[n_rq_pipelines].equal = NULL;
+	rq_pipelines[n_rq_pipelines].pulls = 0;
+	rq_pipelines[n_rq_pipelines].meshlets = 0;
+	return n_rq_pipelines ++;
+}
+
+/**
+ * Give pipeline `i` the variants drawing it with a depth pre-pass. `depth` must fetch
+ * only positions and `equal` must produce the same depth as it, see `invariant` in the
+ * vertex shaders.
+ */
+void rq_pipeline_prepass (uint32_t i, VkPipeline *depth, VkPipeline *equal)
+{
+	assert (i < n_rq_pipelines);
+	rq_pipelines[i].depth = depth;
+	rq_pipelines[i].equal = equal;
+}
+
+uint32_t rq_material_add (VkDescriptorSet **sets)
+{
+	assert (n_rq_materials < RQ_MAX_MATERIALS);
+	rq_materials[n_rq_materials].sets = sets;
+	return n_rq_materials ++;
+}
+
+uint32_t rq_mesh_add (VkBuffer *vx, VkBuffer *idx, VkIndexType idx_type)
+{
+	assert (n_rq_meshes < RQ_MAX_MESHES);
+	rq_meshes[n_rq_meshes].vx_buf = vx;
+	rq_meshes[n_rq_meshes].idx_buf = idx;
+	rq_meshes[n_rq_meshes].idx_type = idx_type;
+	return n_rq_meshes ++;
+}
+
+/**
+ * Map a new host visible staging buffer of `size` bytes to be filled in and handed to
+ * `staging_upload`.
+ */
+static void *staging_map (VkDeviceSize size, VkBuffer *staging, VkDeviceMemory *staging_mem)
+{
+	create_buffer
+	(
+		size,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		staging,
+		staging_mem
+	);
+
+	void *mapped;
+	vkMapMemory (device, *staging_mem, 0, size, 0, &mapped);
+	return mapped;
+}
+
+/**
+ * Copy a filled in staging buffer to a new device local buffer, and free it.
+ */
+static void staging_upload
+(
+	VkBuffer staging,
+	VkDeviceMemory staging_mem,
+	VkDeviceSize size,
+	VkBufferUsageFlags usage,
+	VkBuffer *buf,
+	VkDeviceMemory *mem
+)
+{
+	vkUnmapMemory (device, staging_mem);
+
+	create_buffer
+	(
+		size,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		buf,
+		mem
+	);
+
+	copy_buf (staging, *buf, size);
+
+	vkDestroyBuffer (device, staging, NULL);
+	vkFreeMemory (device, staging_mem, NULL);
+}
+
+/**
+ * Copy `regions` of the device local `buf` back into `out`, which is `size` bytes and
+ * what the regions' destination offsets are relative to.
+ */
+static void read_buf (VkBuffer buf, const VkBufferCopy *regions, uint32_t n, VkDeviceSize size, void *out)
+{
+	VkBuffer staging;
+	VkDeviceMemory staging_mem;
+
+	create_buffer
+	(
+		size,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&staging,
+		&staging_mem
+	);
+
+	copy_buf_regions (buf, staging, regions, n);
+
+	void *mapped;
+	vkMapMemory (device, staging_mem, 0, size, 0, &mapped);
+	memcpy (out, mapped, size);
+	vkUnmapMemory (device, staging_mem);
+
+	vkDestroyBuffer (device, staging, NULL);
+	vkFreeMemory (device, staging_mem, NULL);
+}
+
+/**
+ * Create a device local buffer with `data` through a staging buffer.
+ */
+static void upload_buf
+(
+	const void *data,
+	VkDeviceSize size,
+	VkBufferUsageFlags usage,
+	VkBuffer *buf,
+	VkDeviceMemory *mem
+)
+{
+	VkBuffer staging;
+	VkDeviceMemory staging_mem;
+	void *mapped = staging_map (size, &staging, &staging_mem);
+	memcpy (mapped, data, (size_t) size);
+	staging_upload (staging, staging_mem, size, usage, buf, mem);
+}
+
+static uint16_t float_to_half (float f)
+{
+	uint32_t x;
+	memcpy (&x, &f, sizeof (x));
+
+	uint32_t sign = (x >> 16) & 0x8000;
+	int32_t exp = ((x >> 23) & 0xff) - 127 + 15;
+	uint32_t mant = x & 0x7fffff;
+
+	if (((x >> 23) & 0xff) == 0xff) // inf and nan
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+	if (exp >= 31) // too large, becomes inf
+		return sign | 0x7c00;
+	if (exp <= 0) // denormal or zero
+	{
+		if (exp < -10)
+			return sign;
+		mant |= 0x800000;
+		return sign | ((mant >> (14 - exp)) + ((mant >> (13 - exp)) & 1));
+	}
+
+	// round to nearest, a carry into the exponent is what we want
+	return (sign | (exp << 10) | (mant >> 13)) + ((mant >> 12) & 1);
+}
+
+/**
+ * Octahedral encoding of the unit vector `n` into [-1, 1]^2.
+ */
+static void oct_encode (const float n[3], float e[2])
+{
+	float l1 = fabsf (n[0]) + fabsf (n[1]) + fabsf (n[2]);
+	float x = n[0] / l1, y = n[1] / l1;
+
+	if (n[2] < 0.0f)
+	{
+		float ox = x;
+		x = (1.0f - fabsf (y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - fabsf (ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	e[0] = x;
+	e[1] = y;
+}
+
+static uint16_t quant_unorm16 (float v)
+{
+	v = v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v;
+	return (uint16_t) (v * 65535.0f + 0.5f);
+}
+
+static int16_t quant_snorm16 (float v)
+{
+	v = v < -1.0f ? -1.0f : v > 1.0f ? 1.0f : v;
+	return (int16_t) roundf (v * 32767.0f);
+}
+
+/**
+ * Dequantization matrix of positions quantized within [lo, hi], and its scale per axis.
+ *
+ * The matrix scales by the extent of the bounds, so normals are stored divided by the
+ * same scale. A normal transformed by the model matrix with the dequantization folded in
+ * then comes out in the right direction.
+ */
+static void quant_bounds (const float lo[3], const float hi[3], float scale[3], float dequant[16])
+{
+	// a flat axis keeps a scale of one, its positions all quantize to zero
+	for (int c = 0; c < 3; c ++)
+		scale[c] = hi[c] > lo[c] ? hi[c] - lo[c] : 1.0f;
+
+	mat4_identity (dequant);
+	dequant[0] = scale[0];
+	dequant[5] = scale[1];
+	dequant[10] = scale[2];
+	dequant[12] = lo[0];
+	dequant[13] = lo[1];
+	dequant[14] = lo[2];
+}
+
+static void quantize_vertex
+(
+	const Vertex *v,
+	const float lo[3],
+	const float scale[3],
+	VertexFormat fmt,
+	QVertex *q
+)
+{
+	for (int c = 0; c < 3; c ++)
+		q->pos[c] = quant_unorm16 ((v->pos[c] - lo[c]) / scale[c]);
+	q->pos[3] = 0;
+
+	float nrm[3] =
+	{
+		v->normal[0] / scale[0],
+		v->normal[1] / scale[1],
+		v->normal[2] / scale[2]
+	};
+	vec3_normalize (nrm);
+	float e[2];
+	oct_encode (nrm, e);
+	q->normal[0] = quant_snorm16 (e[0]);
+	q->normal[1] = quant_snorm16 (e[1]);
+
+	for (int c = 0; c < 3; c ++)
+		q->color[c] = (uint8_t) (fminf (fmaxf (v->color[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+	q->color[3] = 255;
+
+	for (int c = 0; c < 2; c ++)
+		q->uv[c] = fmt == VX_FMT_QUANT_HALF_UV ?
+			float_to_half (v->uv[c]) :
+			quant_unorm16 (v->uv[c]);
+}
+
+/**
+ * Whether the device can fetch all attributes of `fmt` from a vertex buffer.
+ */
+static int vx_fmt_supported (VertexFormat fmt)
+{
+	VkVertexInputAttributeDescription *desc;
+	uint32_t n = vx_attrib_desc (&desc, fmt, VX_LAYOUT_INTERLEAVED, 0, 0);
+
+	int ok = 1;
+	for (uint32_t i = 0; i < n; i ++)
+		ok = ok && (caps_fmt_props (desc[i].format).bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT);
+
+	free (desc);
+	return ok;
+}
+
+/**
+ * Bytes needed for `n` vertices stored as `fmt` in either layout.
+ */
+static VkDeviceSize vx_layout_size (VertexFormat fmt, uint32_t n)
+{
+	VkDeviceSize pos_size = (VkDeviceSize) n * vx_pos_stride (fmt);
+	return ((pos_size + 15) & ~(VkDeviceSize) 15) + (VkDeviceSize) n * vx_attr_stride (fmt);
+}
+
+/**
+ * Start of the attribute stream of `n` split vertices, 16 byte aligned after the
+ * positions.
+ */
+static VkDeviceSize vx_split_offset (VertexFormat fmt, uint32_t n)
+{
+	return ((VkDeviceSize) n * vx_pos_stride (fmt) + 15) & ~(VkDeviceSize) 15;
+}
+
+/**
+ * Write vertex `i`, a `Vertex` or `QVertex` as `fmt` says, to where `layout` puts it in
+ * `out`. Both keep the attributes of the split layout right after the position.
+ */
+static void store_vertex
+(
+	uint8_t *out,
+	uint32_t i,
+	VkDeviceSize attr_offset,
+	VertexFormat fmt,
+	VertexLayout layout,
+	const void *v
+)
+{
+	uint32_t pos_stride = vx_pos_stride (fmt);
+	uint32_t attr_stride = vx_attr_stride (fmt);
+
+	if (layout == VX_LAYOUT_INTERLEAVED)
+	{
+		memcpy (out + (size_t) i * (pos_stride + attr_stride), v, pos_stride + attr_stride);
+		return;
+	}
+
+	memcpy (out + (size_t) i * pos_stride, v, pos_stride);
+	memcpy (out + attr_offset + (size_t) i * attr_stride, (const uint8_t *) v + pos_stride, attr_stride);
+}
+
+/**
+ * Read up to `n` components of vertex `i` of `s` into `out`, which holds the defaults.
+ */
+static void stream_read (const VertexStream *s, uint32_t i, float *out, uint32_t n)
+{
+	if (!s->data) return;
+
+	const uint8_t *p = s->data + (size_t) i * s->stride;
+	if (s->n_comp < n)
+		n = s->n_comp;
+
+	for (uint32_t c = 0; c < n; c ++)
+	{
+		float f;
+		uint16_t u16;
+		uint32_t u32;
+		int16_t i16;
+
+		switch (s->type)
+		{
+		case COMP_F32:
+			memcpy (&f, p + c * 4, 4);
+			out[c] = f;
+			break;
+		case COMP_U8:
+			out[c] = s->normalized ? p[c] / 255.0f : p[c];
+			break;
+		case COMP_U16:
+			memcpy (&u16, p + c * 2, 2);
+			out[c] = s->normalized ? u16 / 65535.0f : u16;
+			break;
+		case COMP_U32:
+			memcpy (&u32, p + c * 4, 4);
+			out[c] = (float) u32;
+			break;
+		case COMP_I8:
+			out[c] = s->normalized ? fmaxf ((int8_t) p[c] / 127.0f, -1.0f) : (int8_t) p[c];
+			break;
+		case COMP_I16:
+			memcpy (&i16, p + c * 2, 2);
+			out[c] = s->normalized ? fmaxf (i16 / 32767.0f, -1.0f) : i16;
+			break;
+		}
+	}
+}
+
+static uint32_t index_read (const MeshSource *src, uint32_t i)
+{
+	uint16_t u16;
+	uint32_t u32;
+
+	switch (src->idx_type)
+	{
+	case COMP_U8:
+		return src->idx[i];
+	case COMP_U16:
+		memcpy (&u16, src->idx + (size_t) i * 2, 2);
+		return u16;
+	default:
+		memcpy (&u32, src->idx + (size_t) i * 4, 4);
+		return u32;
+	}
+}
+
+/**
+ * Vertex `i` of `src`, with the defaults for attributes it does not have.
+ */
+static void source_vertex (const MeshSource *src, uint32_t i, Vertex *v)
+{
+	Vertex def = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f } };
+	*v = def;
+	stream_read (&src->pos, i, v->pos, 3);
+	stream_read (&src->normal, i, v->normal, 3);
+	stream_read (&src->color, i, v->color, 3);
+	stream_read (&src->uv, i, v->uv, 2);
+}
+
+/**
+ *		Mesh optimization.
+ *
+ * With `--optimize` meshes are reordered on their way to the GPU, see `optimize_mesh`.
+ * Cooked scenes keep the order they were cooked with, so cooking with `--optimize` does
+ * the work once.
+ */
+#define MESH_OPT_CACHE 16 // post-transform cache entries assumed
+
+typedef struct MeshOpt
+{
+	uint32_t *idx;       // indices into the optimized vertices
+	uint32_t *vx;        // source vertex of each optimized vertex
+	uint32_t n_vertices;
+	uint32_t n_indices;
+} MeshOpt;
+
+typedef struct MeshCluster
+{
+	uint32_t first, n; // triangles
+	float score;
+} MeshCluster;
+
+/**
+ * Average cache miss ratio, misses per triangle, and average transform to vertex ratio,
+ * misses per vertex used, of drawing `idx` through a FIFO cache of MESH_OPT_CACHE entries.
+ */
+static void mesh_cache_stats (const uint32_t *idx, uint32_t n_idx, uint32_t n_vx, float *acmr, float *atvr)
+{
+	uint32_t *stamp = calloc (n_vx, sizeof (uint32_t));
+	uint8_t *used = calloc (n_vx, 1);
+	uint32_t t = MESH_OPT_CACHE + 1, misses = 0, n_used = 0;
+
+	for (uint32_t i = 0; i < n_idx; i ++)
+	{
+		uint32_t v = idx[i];
+		if (t - stamp[v] > MESH_OPT_CACHE)
+		{
+			stamp[v] = t ++;
+			misses ++;
+		}
+		if (!used[v])
+		{
+			used[v] = 1;
+			n_used ++;
+		}
+	}
+
+	*acmr = n_idx ? misses * 3.0f / n_idx : 0.0f;
+	*atvr = n_used ? (float) misses / n_used : 0.0f;
+
+	free (stamp);
+	free (used);
+}
+
+/**
+ * Weld vertices of `vx` that are identical, returning how many are left. `remap` gets
+ * the welded vertex of each vertex and `first` the first vertex welded into each.
+ */
+static uint32_t dedup_vertices (const Vertex *vx, uint32_t n, uint32_t *remap, uint32_t *first)
+{
+	uint32_t cap = 1;
+	while (cap < n * 2)
+		cap <<= 1;
+
+	uint32_t *table = malloc (cap * sizeof (uint32_t));
+	memset (table, 0xff, cap * sizeof (uint32_t));
+	uint32_t n_unique = 0;
+
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		// FNV-1a over the attributes, probed linearly
+		const uint8_t *p = (const uint8_t *) &vx[i];
+		uint32_t h = 2166136261u;
+		for (size_t b = 0; b < sizeof (Vertex); b ++)
+			h = (h ^ p[b]) * 16777619u;
+
+		uint32_t slot = h & (cap - 1);
+		while (table[slot] != UINT32_MAX && memcmp (&vx[first[table[slot]]], &vx[i], sizeof (Vertex)) != 0)
+			slot = (slot + 1) & (cap - 1);
+
+		if (table[slot] == UINT32_MAX)
+		{
+			table[slot] = n_unique;
+			first[n_unique ++] = i;
+		}
+		remap[i] = table[slot];
+	}
+
+	free (table);
+	return n_unique;
+}
+
+/**
+ * Tipsify, Sander, Nehab and Barczak 2007: reorder the triangles of `idx` into `out` by
+ * fanning around vertices that are still in the cache. Vertices that run out of
+ * triangles are skipped past through a stack of recently used ones, and the order
+ * breaks into a new cluster when it has to jump elsewhere, which is written to
+ * `clusters`, at most one per triangle. Returns the number of clusters.
+ */
+static uint32_t tipsify (const uint32_t *idx, uint32_t n_idx, uint32_t n_vx, uint32_t *out, MeshCluster *clusters)
+{
+	uint32_t n_tris = n_idx / 3;
+
+	// triangles around each vertex
+	uint32_t *live = calloc (n_vx, sizeof (uint32_t));
+	uint32_t *adj_first = malloc ((n_vx + 1) * sizeof (uint32_t));
+	uint32_t *adj = malloc (n_idx * sizeof (uint32_t));
+
+	for (uint32_t i = 0; i < n_idx; i ++)
+		live[idx[i]] ++;
+	adj_first[0] = 0;
+	for (uint32_t v = 0; v < n_vx; v ++)
+		adj_first[v + 1] = adj_first[v] + live[v];
+	uint32_t *fill = calloc (n_vx, sizeof (uint32_t));
+	for (uint32_t i = 0; i < n_idx; i ++)
+		adj[adj_first[idx[i]] + fill[idx[i]] ++] = i / 3;
+	free (fill);
+
+	uint32_t *stamp = calloc (n_vx, sizeof (uint32_t));
+	uint8_t *emitted = calloc (n_tris ? n_tris : 1, 1);
+	uint32_t *dead_end = malloc (n_idx * sizeof (uint32_t));
+	uint32_t *cand = malloc (n_idx * sizeof (uint32_t));
+	uint32_t n_dead_end = 0, n_out = 0, n_clusters = 0, cursor = 0;
+	uint32_t t = MESH_OPT_CACHE + 1;
+	int64_t fan = -1;
+
+	for (;;)
+	{
+		if (fan < 0)
+		{
+			// skip the dead end, back to a recent vertex or on to the next unfinished one
+			while (n_dead_end > 0 && fan < 0)
+			{
+				uint32_t d = dead_end[-- n_dead_end];
+				if (live[d] > 0)
+					fan = d;
+			}
+			while (fan < 0 && cursor < n_vx)
+			{
+				if (live[cursor] > 0)
+					fan = cursor;
+				cursor ++;
+			}
+			if (fan < 0)
+				break;
+
+			clusters[n_clusters].first = n_out / 3;
+			clusters[n_clusters].n = 0;
+			n_clusters ++;
+		}
+
+		uint32_t n_cand = 0;
+		for (uint32_t a = adj_first[fan]; a < adj_first[fan + 1]; a ++)
+		{
+			uint32_t tri = adj[a];
+			if (emitted[tri]) continue;
+			emitted[tri] = 1;
+
+			for (int k = 0; k < 3; k ++)
+			{
+				uint32_t v = idx[tri * 3 + k];
+				out[n_out ++] = v;
+				dead_end[n_dead_end ++] = v;
+				cand[n_cand ++] = v;
+				live[v] --;
+				if (t - stamp[v] > MESH_OPT_CACHE)
+					stamp[v] = t ++;
+			}
+			clusters[n_clusters - 1].n ++;
+		}
+
+		// fan next around the candidate that will stay in the cache the longest
+		fan = -1;
+		int64_t best = -1;
+		for (uint32_t c = 0; c < n_cand; c ++)
+		{
+			uint32_t v = cand[c];
+			if (live[v] == 0) continue;
+
+			int64_t p = 0;
+			if (t - stamp[v] + 2 * live[v] <= MESH_OPT_CACHE)
+				p = t - stamp[v];
+			if (p > best)
+			{
+				best = p;
+				fan = v;
+			}
+		}
+	}
+
+	free (live);
+	free (adj_first);
+	free (adj);
+	free (stamp);
+	free (emitted);
+	free (dead_end);
+	free (cand);
+
+	return n_clusters;
+}
+
+static int cmp_clusters (const void *a, const void *b)
+{
+	const MeshCluster *x = a, *y = b;
+	if (x->score != y->score)
+		return x->score > y->score ? -1 : 1;
+	return x->first < y->first ? -1 : x->first > y->first;
+}
+
+/**
+ * Order the clusters of `idx` so ones facing away from the middle of the mesh come
+ * first, into `out`. On mostly convex meshes those are the ones in front whatever the
+ * view, so later clusters fail the depth test more often instead of being overdrawn.
+ * The cluster insides keep their order, so the cache does about as well as before.
+ */
+static void order_overdraw
+(
+	const uint32_t *idx,
+	const Vertex *vx,
+	const uint32_t *first,
+	MeshCluster *clusters,
+	uint32_t n_clusters,
+	uint32_t *out
+)
+{
+	// area weighted centroids and normals, of the clusters and of the whole mesh
+	float *cc = calloc (n_clusters * 6, sizeof (float));
+	float mc[3] = { 0.0f, 0.0f, 0.0f }, area = 0.0f;
+
+	for (uint32_t c = 0; c < n_clusters; c ++)
+	{
+		float *centroid = &cc[c * 6], *normal = &cc[c * 6 + 3], a_sum = 0.0f;
+
+		for (uint32_t tri = clusters[c].first; tri < clusters[c].first + clusters[c].n; tri ++)
+		{
+			const float *a = vx[first[idx[tri * 3]]].pos;
+			const float *b = vx[first[idx[tri * 3 + 1]]].pos;
+			const float *d = vx[first[idx[tri * 3 + 2]]].pos;
+			float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e1[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+			float n[3];
+			vec3_cross (n, e0, e1);
+			float w = sqrtf (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (int k = 0; k < 3; k ++)
+			{
+				centroid[k] += w * (a[k] + b[k] + d[k]) / 3.0f;
+				normal[k] += n[k];
+			}
+			a_sum += w;
+		}
+
+		for (int k = 0; k < 3; k ++)
+			mc[k] += centroid[k];
+		area += a_sum;
+
+		if (a_sum > 0.0f)
+			for (int k = 0; k < 3; k ++)
+				centroid[k] /= a_sum;
+	}
+
+	if (area > 0.0f)
+		for (int k = 0; k < 3; k ++)
+			mc[k] /= area;
+
+	for (uint32_t c = 0; c < n_clusters; c ++)
+	{
+		float *centroid = &cc[c * 6], *normal = &cc[c * 6 + 3];
+		float d[3] = { centroid[0] - mc[0], centroid[1] - mc[1], centroid[2] - mc[2] };
+		vec3_normalize (normal);
+		clusters[c].score = d[0] * normal[0] + d[1] * normal[1] + d[2] * normal[2];
+	}
+
+	qsort (clusters, n_clusters, sizeof (MeshCluster), cmp_clusters);
+
+	uint32_t n_out = 0;
+	for (uint32_t c = 0; c < n_clusters; c ++)
+	{
+		memcpy (&out[n_out], &idx[clusters[c].first * 3], clusters[c].n * 3 * sizeof (uint32_t));
+		n_out += clusters[c].n * 3;
+	}
+
+	free (cc);
+}
+
+/**
+ * Reorder `src` for the GPU: weld identical vertices, reorder triangles for the
+ * post-transform cache with Tipsify and then their clusters for less overdraw, and
+ * finally number the vertices in the order they are first used so fetches walk the
+ * vertex buffer forward. Prints the cache statistics before and after.
+ */
+static void optimize_mesh (const MeshSource *src, MeshOpt *opt)
+{
+	uint32_t n_vx = src->n_vertices;
+	uint32_t n_idx = src->idx ? src->n_indices : n_vx;
+	n_idx -= n_idx % 3;
+
+	Vertex *vx = malloc (n_vx * sizeof (Vertex));
+	for (uint32_t i = 0; i < n_vx; i ++)
+		source_vertex (src, i, &vx[i]);
+
+	uint32_t *idx = malloc ((n_idx ? n_idx : 1) * sizeof (uint32_t));
+	for (uint32_t i = 0; i < n_idx; i ++)
+	{
+		idx[i] = src->idx ? index_read (src, i) : i;
+		if (idx[i] >= n_vx)
+		{
+			fprintf (stderr, "mesh index %u out of range of %u vertices!\n", idx[i], n_vx);
+			exit (1);
+		}
+	}
+
+	float acmr_before, atvr_before;
+	mesh_cache_stats (idx, n_idx, n_vx, &acmr_before, &atvr_before);
+
+	uint32_t *remap = malloc (n_vx * sizeof (uint32_t));
+	uint32_t *first = malloc (n_vx * sizeof (uint32_t));
+	uint32_t n_unique = dedup_vertices (vx, n_vx, remap, first);
+	for (uint32_t i = 0; i < n_idx; i ++)
+		idx[i] = remap[idx[i]];
+
+	uint32_t *tmp = malloc ((n_idx ? n_idx : 1) * sizeof (uint32_t));
+	MeshCluster *clusters = malloc ((n_idx / 3 + 1) * sizeof (MeshCluster));
+	uint32_t n_clusters = tipsify (idx, n_idx, n_unique, tmp, clusters);
+	order_overdraw (tmp, vx, first, clusters, n_clusters, idx);
+
+	// vertices in the order they are first used, unused ones dropped
+	uint32_t *order = remap;
+	memset (order, 0xff, n_unique * sizeof (uint32_t));
+	opt->vx = malloc (n_unique * sizeof (uint32_t));
+	opt->n_vertices = 0;
+	for (uint32_t i = 0; i < n_idx; i ++)
+	{
+		uint32_t v = idx[i];
+		if (order[v] == UINT32_MAX)
+		{
+			order[v] = opt->n_vertices;
+			opt->vx[opt->n_vertices ++] = first[v];
+		}
+		idx[i] = order[v];
+	}
+	opt->idx = idx;
+	opt->n_indices = n_idx;
+
+	float acmr_after, atvr_after;
+	mesh_cache_stats (idx, n_idx, opt->n_vertices, &acmr_after, &atvr_after);
+
+	fprintf
+	(
+		stderr,
+		"mesh optimized: %u -> %u vertices, %u clusters, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+		n_vx,
+		opt->n_vertices,
+		n_clusters,
+		acmr_before,
+		acmr_after,
+		atvr_before,
+		atvr_after
+	);
+
+	free (vx);
+	free (remap);
+	free (first);
+	free (tmp);
+	free (clusters);
+}
+
+/**
+ *		Levels of detail.
+ *
+ * With `--lod` each mesh gets a chain of coarser versions made by quadric error
+ * simplification, Garland and Heckbert 1997. Edges are collapsed into one of their
+ * vertices, so every level shares the vertex buffer and only adds indices. Each instance
+ * is then drawn with the coarsest level whose error covers less than a pixel or so on
+ * screen, see `select_lods`.
+ */
+#define LOD_MIN_TRIANGLES 32
+#define LOD_PIXEL_ERROR 1.0f
+
+typedef struct LodEdge
+{
+	uint32_t from, to; // collapse `from` into `to`
+	float cost;
+} LodEdge;
+
+/**
+ * Plane `n` . p + d = 0 as a quadric, the squared distance to it, added to `q` with
+ * weight `w`. The last of the LOD_QUADRIC values sums the weights.
+ */
+#define LOD_QUADRIC 11
+
+static void quadric_add_plane (double q[LOD_QUADRIC], const double n[3], double d, double w)
+{
+	q[0] += w * n[0] * n[0]; q[1] += w * n[0] * n[1]; q[2] += w * n[0] * n[2]; q[3] += w * n[0] * d;
+	q[4] += w * n[1] * n[1]; q[5] += w * n[1] * n[2]; q[6] += w * n[1] * d;
+	q[7] += w * n[2] * n[2]; q[8] += w * n[2] * d;
+	q[9] += w * d * d;
+	q[10] += w;
+}
+
+/**
+ * Weighted mean squared distance of `p` to the planes of `q`.
+ */
+static double quadric_eval (const double q[LOD_QUADRIC], const float p[3])
+{
+	double x = p[0], y = p[1], z = p[2];
+	double e =
+		q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+		q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+		q[7] * z * z + 2 * q[8] * z +
+		q[9];
+	return q[10] > 0.0 ? e / q[10] : 0.0;
+}
+
+static int cmp_lod_edges (const void *a, const void *b)
+{
+	const LodEdge *x = a, *y = b;
+	return x->cost < y->cost ? -1 : x->cost > y->cost;
+}
+
+/**
+ * Vertices that must stay where they are: those sharing a position with another vertex,
+ * the seams where normals or texture coordinates change, and those on open borders,
+ * which would otherwise pull the outline of the mesh in.
+ */
+static uint8_t *lod_locked (const float *pos, uint32_t n_vx, const uint32_t *idx, uint32_t n_idx)
+{
+	uint8_t *locked = calloc (n_vx, 1);
+
+	// vertices by position
+	uint32_t cap = 1;
+	while (cap < n_vx * 2)
+		cap <<= 1;
+	uint32_t *table = malloc (cap * sizeof (uint32_t));
+	memset (table, 0xff, cap * sizeof (uint32_t));
+	uint32_t *weld = malloc (n_vx * sizeof (uint32_t));
+
+	for (uint32_t i = 0; i < n_vx; i ++)
+	{
+		const uint8_t *p = (const uint8_t *) &pos[i * 3];
+		uint32_t h = 2166136261u;
+		for (int b = 0; b < 12; b ++)
+			h = (h ^ p[b]) * 16777619u;
+
+		uint32_t slot = h & (cap - 1);
+		while (table[slot] != UINT32_MAX && memcmp (&pos[table[slot] * 3], &pos[i * 3], 12) != 0)
+			slot = (slot + 1) & (cap - 1);
+
+		if (table[slot] == UINT32_MAX)
+			table[slot] = i;
+		else
+			locked[i] = locked[table[slot]] = 1;
+		weld[i] = table[slot];
+	}
+	free (table);
+
+	// an edge used by a single triangle is on a border; count the other ends of each
+	// vertex's edges, by welded position so seams do not look like borders
+	uint32_t *adj_first = calloc (n_vx + 1, sizeof (uint32_t));
+	for (uint32_t i = 0; i < n_idx; i ++)
+		adj_first[weld[idx[i]] + 1] += 2;
+	for (uint32_t v = 0; v < n_vx; v ++)
+		adj_first[v + 1] += adj_first[v];
+
+	uint32_t *fill = calloc (n_vx, sizeof (uint32_t));
+	uint32_t *ends = malloc ((n_idx ? n_idx : 1) * 2 * sizeof (uint32_t));
+	for (uint32_t t = 0; t < n_idx; t += 3)
+		for (int k = 0; k < 3; k ++)
+		{
+			uint32_t v = weld[idx[t + k]];
+			ends[adj_first[v] + fill[v] ++] = weld[idx[t + (k + 1) % 3]];
+			ends[adj_first[v] + fill[v] ++] = weld[idx[t + (k + 2) % 3]];
+		}
+
+	uint8_t *border = calloc (n_vx, 1);
+	for (uint32_t v = 0; v < n_vx; v ++)
+		for (uint32_t a = adj_first[v]; a < adj_first[v + 1] && !border[v]; a ++)
+		{
+			uint32_t n = 0;
+			for (uint32_t b = adj_first[v]; b < adj_first[v + 1]; b ++)
+				n += ends[b] == ends[a];
+			if (n == 1)
+				border[v] = 1;
+		}
+
+	for (uint32_t i = 0; i < n_vx; i ++)
+		locked[i] |= border[weld[i]];
+
+	free (weld);
+	free (adj_first);
+	free (fill);
+	free (ends);
+	free (border);
+
+	return locked;
+}
+
+/**
+ * Collapse edges of the triangles `idx` until at most `target` triangles are left or no
+ * edge can go, writing what is left to `out` and returning its index count. Each pass
+ * collapses the cheapest edges whose surroundings no earlier collapse of the pass
+ * touched, without flipping triangles. `q` are the quadrics of the vertices, updated as
+ * they collapse, and `*error` grows to the largest root mean square distance off the
+ * surface of a collapse.
+ */
+static uint32_t simplify
+(
+	const float *pos,
+	uint32_t n_vx,
+	const uint32_t *idx,
+	uint32_t n_idx,
+	uint32_t target,
+	const uint8_t *locked,
+	double *q,
+	uint32_t *out,
+	float *error
+)
+{
+	uint32_t *remap = malloc (n_vx * sizeof (uint32_t));
+	uint8_t *touched = malloc (n_vx);
+	uint32_t *adj_first = malloc ((n_vx + 1) * sizeof (uint32_t));
+	uint32_t *fill = malloc (n_vx * sizeof (uint32_t));
+	uint32_t *adj = malloc ((n_idx ? n_idx : 1) * sizeof (uint32_t));
+	LodEdge *edges = malloc ((n_idx ? n_idx : 1) * 2 * sizeof (LodEdge));
+
+	memcpy (out, idx, n_idx * sizeof (uint32_t));
+
+	while (n_idx / 3 > target)
+	{
+		// triangles around each vertex
+		memset (adj_first, 0, (n_vx + 1) * sizeof (uint32_t));
+		memset (fill, 0, n_vx * sizeof (uint32_t));
+		for (uint32_t i = 0; i < n_idx; i ++)
+			adj_first[out[i] + 1] ++;
+		for (uint32_t v = 0; v < n_vx; v ++)
+			adj_first[v + 1] += adj_first[v];
+		for (uint32_t i = 0; i < n_idx; i ++)
+			adj[adj_first[out[i]] + fill[out[i]] ++] = i / 3;
+
+		// both directions of each edge that may collapse
+		uint32_t n_edges = 0;
+		for (uint32_t t = 0; t < n_idx; t += 3)
+			for (int k = 0; k < 3; k ++)
+			{
+				uint32_t a = out[t + k], b = out[t + (k + 1) % 3];
+				uint32_t ends[2][2] = { { a, b }, { b, a } };
+				for (int e = 0; e < 2; e ++)
+				{
+					uint32_t from = ends[e][0], to = ends[e][1];
+					if (locked[from]) continue;
+					double qs[LOD_QUADRIC];
+					for (int c = 0; c < LOD_QUADRIC; c ++)
+						qs[c] = q[from * LOD_QUADRIC + c] + q[to * LOD_QUADRIC + c];
+					edges[n_edges].from = from;
+					edges[n_edges].to = to;
+					edges[n_edges].cost = (float) fmax (quadric_eval (qs, &pos[to * 3]), 0.0);
+					n_edges ++;
+				}
+			}
+		qsort (edges, n_edges, sizeof (LodEdge), cmp_lod_edges);
+
+		for (uint32_t v = 0; v < n_vx; v ++)
+			remap[v] = v;
+		memset (touched, 0, n_vx);
+
+		uint32_t n_tris = n_idx / 3, collapsed = 0;
+		for (uint32_t e = 0; e < n_edges && n_tris > target; e ++)
+		{
+			uint32_t from = edges[e].from, to = edges[e].to;
+			if (touched[from] || touched[to])
+				continue;
+
+			// triangles that lose `from` to `to` must keep facing the same way
+			uint32_t removed = 0;
+			int flips = 0;
+			for (uint32_t a = adj_first[from]; a < adj_first[from + 1] && !flips; a ++)
+			{
+				const uint32_t *tri = &out[adj[a] * 3];
+				if (tri[0] == to || tri[1] == to || tri[2] == to)
+				{
+					removed ++;
+					continue;
+				}
+
+				const float *p[3], *moved[3];
+				for (int k = 0; k < 3; k ++)
+				{
+					p[k] = &pos[tri[k] * 3];
+					moved[k] = tri[k] == from ? &pos[to * 3] : p[k];
+				}
+
+				float e0[3], e1[3], n0[3], n1[3];
+				for (int c = 0; c < 3; c ++)
+				{
+					e0[c] = p[1][c] - p[0][c];
+					e1[c] = p[2][c] - p[0][c];
+				}
+				vec3_cross (n0, e0, e1);
+				for (int c = 0; c < 3; c ++)
+				{
+					e0[c] = moved[1][c] - moved[0][c];
+					e1[c] = moved[2][c] - moved[0][c];
+				}
+				vec3_cross (n1, e0, e1);
+				flips = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0f;
+			}
+			if (flips || removed == 0)
+				continue;
+
+			remap[from] = to;
+			for (int c = 0; c < LOD_QUADRIC; c ++)
+				q[to * LOD_QUADRIC + c] += q[from * LOD_QUADRIC + c];
+			for (uint32_t a = adj_first[from]; a < adj_first[from + 1]; a ++)
+				for (int k = 0; k < 3; k ++)
+					touched[out[adj[a] * 3 + k]] = 1;
+
+			*error = fmaxf (*error, sqrtf (edges[e].cost));
+			n_tris -= removed;
+			collapsed ++;
+		}
+
+		if (collapsed == 0)
+			break;
+
+		// rewrite the triangles, dropping the ones that collapsed
+		uint32_t n = 0;
+		for (uint32_t t = 0; t < n_idx; t += 3)
+		{
+			uint32_t a = remap[out[t]], b = remap[out[t + 1]], c = remap[out[t + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			out[n ++] = a;
+			out[n ++] = b;
+			out[n ++] = c;
+		}
+		n_idx = n;
+	}
+
+	free (remap);
+	free (touched);
+	free (adj_first);
+	free (fill);
+	free (adj);
+	free (edges);
+
+	return n_idx;
+}
+
+/**
+ * The indices of `m`, `n_indices` of them from `src` as `opt` reordered them, followed
+ * by a chain of levels of detail each with about half the triangles of the one before.
+ * The chain ends when simplification gets stuck or the triangles run low. Fills in the
+ * levels of `m` and returns all the indices, `*n_total` of them.
+ */
+static uint32_t *mesh_lods (const MeshSource *src, const MeshOpt *opt, Mesh *m, uint32_t n_indices, uint32_t *n_total)
+{
+	uint32_t n_vx = m->n_vertices;
+
+	float *pos = malloc (n_vx * 3 * sizeof (float));
+	for (uint32_t i = 0; i < n_vx; i ++)
+	{
+		float *p = &pos[i * 3];
+		p[0] = p[1] = p[2] = 0.0f;
+		stream_read (&src->pos, opt->vx ? opt->vx[i] : i, p, 3);
+	}
+
+	uint32_t cap = n_indices * 2;
+	uint32_t *idx = malloc (cap * sizeof (uint32_t));
+	for (uint32_t i = 0; i < n_indices; i ++)
+	{
+		idx[i] = opt->idx ? opt->idx[i] : src->idx ? index_read (src, i) : i;
+		if (idx[i] >= n_vx)
+		{
+			fprintf (stderr, "mesh index %u out of range of %u vertices!\n", idx[i], n_vx);
+			exit (1);
+		}
+	}
+
+	double *q = calloc (n_vx * LOD_QUADRIC, sizeof (double));
+	for (uint32_t t = 0; t < n_indices; t += 3)
+	{
+		const float *a = &pos[idx[t] * 3], *b = &pos[idx[t + 1] * 3], *c = &pos[idx[t + 2] * 3];
+		float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		float n[3];
+		vec3_cross (n, e0, e1);
+		float area = sqrtf (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (area == 0.0f)
+			continue;
+		vec3_normalize (n);
+
+		// weighted by area, so small triangles do not pull as hard as big ones
+		double nd[3] = { n[0], n[1], n[2] };
+		double d = -(nd[0] * a[0] + nd[1] * a[1] + nd[2] * a[2]);
+		for (int k = 0; k < 3; k ++)
+			quadric_add_plane (&q[idx[t + k] * LOD_QUADRIC], nd, d, area);
+	}
+
+	uint8_t *locked = lod_locked (pos, n_vx, idx, n_indices);
+
+	// errors are kept in stored units, which is what instance matrices scale
+	float to_stored = 1.0f / fminf (m->dequant[0], fminf (m->dequant[5], m->dequant[10]));
+
+	m->lods[0].first_index = 0;
+	m->lods[0].n_indices = n_indices;
+	m->lods[0].error = 0.0f;
+	m->n_lods = 1;
+
+	float error = 0.0f;
+	uint32_t n = n_indices;
+	while (m->n_lods < MESH_MAX_LODS && n / 3 >= 2 * LOD_MIN_TRIANGLES)
+	{
+		const MeshLod *prev = &m->lods[m->n_lods - 1];
+		uint32_t end = prev->first_index + prev->n_indices;
+		if (end + prev->n_indices > cap)
+		{
+			cap = end + prev->n_indices * 2;
+			idx = realloc (idx, cap * sizeof (uint32_t));
+		}
+		uint32_t *lod = &idx[end];
+
+		n = simplify (pos, n_vx, &idx[prev->first_index], prev->n_indices, prev->n_indices / 6, locked, q, lod, &error);
+		if (n > prev->n_indices * 9 / 10)
+			break;
+
+		if (optimize_meshes && n > 0)
+		{
+			uint32_t *tmp = malloc (n * sizeof (uint32_t));
+			MeshCluster *clusters = malloc ((n / 3 + 1) * sizeof (MeshCluster));
+			tipsify (lod, n, n_vx, tmp, clusters);
+			memcpy (lod, tmp, n * sizeof (uint32_t));
+			free (tmp);
+			free (clusters);
+		}
+
+		MeshLod *l = &m->lods[m->n_lods ++];
+		l->first_index = end;
+		l->n_indices = n;
+		l->error = error * to_stored;
+	}
+
+	const MeshLod *last = &m->lods[m->n_lods - 1];
+	*n_total = last->first_index + last->n_indices;
+
+	free (pos);
+	free (q);
+	free (locked);
+
+	return idx;
+}
+
+/**
+ * Indices in the index buffer of `m`, of all its levels of detail.
+ */
+static uint32_t mesh_index_count (const Mesh *m)
+{
+	const MeshLod *last = &m->lods[m->n_lods - 1];
+	return last->first_index + last->n_indices;
+}
+
+/**
+ * Bounding sphere and normal cone of meshlet `ml`, from the positions `pos` of the mesh.
+ */
+static void meshlet_bounds (Meshlet *ml, const float *pos, const uint32_t *verts, const uint32_t *tris)
+{
+	float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+	for (uint32_t i = 0; i < ml->vertex_count; i ++)
+	{
+		const float *p = &pos[verts[i] * 3];
+		for (int k = 0; k < 3; k ++)
+		{
+			lo[k] = fminf (lo[k], p[k]);
+			hi[k] = fmaxf (hi[k], p[k]);
+		}
+	}
+
+	float r2 = 0.0f;
+	for (int k = 0; k < 3; k ++)
+		ml->center[k] = 0.5f * (lo[k] + hi[k]);
+	for (uint32_t i = 0; i < ml->vertex_count; i ++)
+	{
+		const float *p = &pos[verts[i] * 3];
+		float d[3] = { p[0] - ml->center[0], p[1] - ml->center[1], p[2] - ml->center[2] };
+		r2 = fmaxf (r2, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+	ml->radius = sqrtf (r2);
+
+	// the cone axis is the mean of the triangle normals, the cutoff the sine of how far
+	// the farthest strays from it; past ~85 degrees the cone is not worth testing
+
+	float n[MESHLET_MAX_TRIANGLES][3], axis[3] = { 0.0f, 0.0f, 0.0f };
+	uint32_t n_normals = 0;
+	for (uint32_t t = 0; t < ml->triangle_count; t ++)
+	{
+		uint32_t packed = tris[t];
+		const float *a = &pos[verts[packed & 0xff] * 3];
+		const float *b = &pos[verts[(packed >> 8) & 0xff] * 3];
+		const float *c = &pos[verts[(packed >> 16) & 0xff] * 3];
+		float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		float *nt = n[n_normals];
+		vec3_cross (nt, e0, e1);
+
+		float len = sqrtf (nt[0] * nt[0] + nt[1] * nt[1] + nt[2] * nt[2]);
+		if (len == 0.0f)
+			continue;
+		for (int k = 0; k < 3; k ++)
+		{
+			nt[k] /= len;
+			axis[k] += nt[k];
+		}
+		n_normals ++;
+	}
+
+	ml->cone_cutoff = 1.0f;
+	memset (ml->cone_axis, 0, sizeof (ml->cone_axis));
+	if (axis[0] == 0.0f && axis[1] == 0.0f && axis[2] == 0.0f)
+		return;
+	vec3_normalize (axis);
+
+	float min_dot = 1.0f;
+	for (uint32_t t = 0; t < n_normals; t ++)
+		min_dot = fminf (min_dot, n[t][0] * axis[0] + n[t][1] * axis[1] + n[t][2] * axis[2]);
+
+	memcpy (ml->cone_axis, axis, sizeof (axis));
+	if (min_dot > 0.1f)
+		ml->cone_cutoff = sqrtf (1.0f - min_dot * min_dot);
+}
+
+/**
+ * Split the triangles `idx` of a mesh with `n_vx` vertices at `pos`, in stored units,
+ * into meshlets of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES
+ * triangles. Each grows from the first triangle left by adding the neighbouring triangle
+ * that brings the fewest new vertices, so meshlets come out compact and their normal
+ * cones narrow. Returns the blob, of `size` bytes, see `Meshlet`.
+ */
+static uint32_t *build_meshlets
+(
+	const float *pos,
+	uint32_t n_vx,
+	const uint32_t *idx,
+	uint32_t n_idx,
+	uint32_t *n_meshlets,
+	VkDeviceSize *size
+)
+{
+	uint32_t n_tris = n_idx / 3;
+
+	// triangles around each vertex
+	uint32_t *adj_first = calloc (n_vx + 1, sizeof (uint32_t));
+	uint32_t *adj = malloc (n_idx * sizeof (uint32_t));
+	for (uint32_t i = 0; i < n_idx; i ++)
+		adj_first[idx[i] + 1] ++;
+	for (uint32_t v = 0; v < n_vx; v ++)
+		adj_first[v + 1] += adj_first[v];
+	uint32_t *fill = calloc (n_vx, sizeof (uint32_t));
+	for (uint32_t i = 0; i < n_idx; i ++)
+		adj[adj_first[idx[i]] + fill[idx[i]] ++] = i / 3;
+	free (fill);
+
+	uint32_t n = 0, cap = 64, n_verts = 0, n_out = 0, cursor = 0;
+	Meshlet *ml = malloc (cap * sizeof (Meshlet));
+	uint32_t *verts = malloc (n_idx * sizeof (uint32_t));
+	uint32_t *tris = malloc (n_tris * sizeof (uint32_t));
+	uint8_t *emitted = calloc (n_tris ? n_tris : 1, 1);
+
+	// index of each vertex in the meshlet being built, 0xff if not in it
+	uint8_t *local = malloc (n_vx);
+	memset (local, 0xff, n_vx);
+
+	Meshlet *cur = NULL;
+	float sum[3] = { 0.0f, 0.0f, 0.0f }; // of the meshlet's vertices
+	for (;;)
+	{
+		// the neighbour of the meshlet adding the fewest vertices, then the one nearest its
+		// middle, if it still fits
+		int64_t best = -1;
+		uint32_t best_new = 4;
+		float best_dist = INFINITY, mid[3];
+		for (int k = 0; k < 3 && cur; k ++)
+			mid[k] = sum[k] / cur->vertex_count;
+
+		for (uint32_t i = 0; cur && i < cur->vertex_count; i ++)
+		{
+			uint32_t v = verts[cur->vertex_offset + i];
+			for (uint32_t a = adj_first[v]; a < adj_first[v + 1]; a ++)
+			{
+				uint32_t t = adj[a];
+				if (emitted[t])
+					continue;
+
+				const uint32_t *tv = &idx[t * 3];
+				uint32_t new_vx = (local[tv[0]] == 0xff) + (local[tv[1]] == 0xff) + (local[tv[2]] == 0xff);
+				if (new_vx > best_new)
+					continue;
+
+				float dist = 0.0f;
+				for (int k = 0; k < 3; k ++)
+				{
+					float c = (pos[tv[0] * 3 + k] + pos[tv[1] * 3 + k] + pos[tv[2] * 3 + k]) / 3.0f - mid[k];
+					dist += c * c;
+				}
+				if (new_vx < best_new || dist < best_dist)
+				{
+					best = t;
+					best_new = new_vx;
+					best_dist = dist;
+				}
+			}
+		}
+
+		if
+		(
+			best < 0 ||
+			cur->vertex_count + best_new > MESHLET_MAX_VERTICES ||
+			cur->triangle_count == MESHLET_MAX_TRIANGLES
+		)
+		{
+			// start the next meshlet from the first triangle left
+			while (cursor < n_tris && emitted[cursor])
+				cursor ++;
+			if (cursor == n_tris)
+				break;
+			best = cursor;
+
+			if (cur)
+				for (uint32_t i = 0; i < cur->vertex_count; i ++)
+					local[verts[cur->vertex_offset + i]] = 0xff;
+
+			if (n == cap)
+			{
+				cap *= 2;
+				ml = realloc (ml, cap * sizeof (Meshlet));
+			}
+			cur = &ml[n ++];
+			memset (cur, 0, sizeof (Meshlet));
+			cur->vertex_offset = n_verts;
+			cur->triangle_offset = n_out;
+			sum[0] = sum[1] = sum[2] = 0.0f;
+		}
+
+		const uint32_t *v = &idx[best * 3];
+		uint32_t packed = 0;
+		for (int k = 0; k < 3; k ++)
+		{
+			if (local[v[k]] == 0xff)
+			{
+				local[v[k]] = (uint8_t) cur->vertex_count ++;
+				verts[n_verts ++] = v[k];
+				for (int c = 0; c < 3; c ++)
+					sum[c] += pos[v[k] * 3 + c];
+			}
+			packed |= (uint32_t) local[v[k]] << (8 * k);
+		}
+		tris[n_out ++] = packed;
+		cur->triangle_count ++;
+		emitted[best] = 1;
+	}
+
+	for (uint32_t i = 0; i < n; i ++)
+		meshlet_bounds (&ml[i], pos, &verts[ml[i].vertex_offset], &tris[ml[i].triangle_offset]);
+
+	// one blob, offsets from its start
+
+	uint32_t meshlet_words = n * sizeof (Meshlet) / 4;
+	*size = (VkDeviceSize) (meshlet_words + n_verts + n_out) * 4;
+	uint32_t *blob = malloc (*size);
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		ml[i].vertex_offset += meshlet_words;
+		ml[i].triangle_offset += meshlet_words + n_verts;
+	}
+	memcpy (blob, ml, n * sizeof (Meshlet));
+	memcpy (blob + meshlet_words, verts, n_verts * sizeof (uint32_t));
+	memcpy (blob + meshlet_words + n_verts, tris, n_out * sizeof (uint32_t));
+
+	free (adj_first);
+	free (adj);
+	free (ml);
+	free (verts);
+	free (tris);
+	free (emitted);
+	free (local);
+
+	*n_meshlets = n;
+	return blob;
+}
+
+/**
+ *		Geometry pools.
+ *
+ * Meshes are sub-allocated from shared device local buffers rather than getting buffers
+ * of their own: a vertex buffer per vertex layout and format, since the meshes in one
+ * must have the strides its pipelines fetch with, and one index buffer for all of them.
+ * Draws address their mesh with the vertex offset and first index, so the buffers stay
+ * bound from one mesh to the next. Space is handed out front to back, and given back
+ * only when the newest meshes are destroyed. A mesh that does not fit gets buffers of
+ * its own.
+ */
+#define POOL_VERTICES (1 << 18)
+#define POOL_INDEX_BYTES (16 << 20)
+
+typedef struct GeometryPool
+{
+	VkBuffer buf;
+	VkDeviceMemory mem;
+	VkDeviceSize attr_offset; // start of the attribute stream when split
+	VkDeviceSize cap, used;   // in vertices, or bytes for indices
+} GeometryPool;
+
+static GeometryPool vx_pools[VX_LAYOUT_COUNT][VX_FMT_COUNT];
+static GeometryPool idx_pool;
+
+/**
+ * Take `n` units of `pool`, aligned to `align`, creating it with `cap` units of `size`
+ * bytes first if need be. Returns where they start, or -1 if they do not fit.
+ */
+static int64_t pool_alloc
+(
+	GeometryPool *pool,
+	VkDeviceSize n,
+	VkDeviceSize align,
+	VkDeviceSize cap,
+	VkDeviceSize size,
+	VkBufferUsageFlags usage
+)
+{
+	if (pool->buf == VK_NULL_HANDLE)
+	{
+		create_buffer
+		(
+			size,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&pool->buf,
+			&pool->mem
+		);
+		pool->cap = cap;
+		pool->used = 0;
+	}
+
+	VkDeviceSize at = (pool->used + align - 1) / align * align;
+	if (at + n > pool->cap)
+		return -1;
+
+	pool->used = at + n;
+	return (int64_t) at;
+}
+
+/**
+ * Give back `n` units at `at` of `pool` if they are the last taken.
+ */
+static void pool_free (GeometryPool *pool, VkDeviceSize at, VkDeviceSize n)
+{
+	if (pool->buf != VK_NULL_HANDLE && at + n == pool->used)
+		pool->used = at;
+}
+
+static void destroy_geometry_pools ()
+{
+	for (int l = 0; l < VX_LAYOUT_COUNT; l ++)
+		for (int f = 0; f < VX_FMT_COUNT; f ++)
+		{
+			GeometryPool *pool = &vx_pools[l][f];
+			if (pool->buf == VK_NULL_HANDLE) continue;
+			vkDestroyBuffer (device, pool->buf, NULL);
+			vkFreeMemory (device, pool->mem, NULL);
+			memset (pool, 0, sizeof (GeometryPool));
+		}
+
+	if (idx_pool.buf != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer (device, idx_pool.buf, NULL);
+		vkFreeMemory (device, idx_pool.mem, NULL);
+		memset (&idx_pool, 0, sizeof (GeometryPool));
+	}
+}
+
+static uint32_t mesh_index_size (const Mesh *m)
+{
+	return m->idx_type == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+}
+
+/**
+ * Where the vertices of `m` are in its buffer, as copies from the layout of a single mesh
+ * that `vx_layout_size` and `vx_split_offset` describe. Returns how many regions.
+ */
+static uint32_t mesh_vertex_regions (const Mesh *m, VkBufferCopy r[2])
+{
+	VkDeviceSize base = (VkDeviceSize) m->base_vertex;
+	VkDeviceSize pos_stride = vx_pos_stride (m->fmt), attr_stride = vx_attr_stride (m->fmt);
+
+	memset (r, 0, 2 * sizeof (VkBufferCopy));
+	if (m->layout == VX_LAYOUT_INTERLEAVED)
+	{
+		r[0].dstOffset = base * (pos_stride + attr_stride);
+		r[0].size = m->n_vertices * (pos_stride + attr_stride);
+		return 1;
+	}
+
+	r[0].dstOffset = base * pos_stride;
+	r[0].size = m->n_vertices * pos_stride;
+	r[1].srcOffset = vx_split_offset (m->fmt, m->n_vertices);
+	r[1].dstOffset = m->attr_offset + base * attr_stride;
+	r[1].size = m->n_vertices * attr_stride;
+	return 2;
+}
+
+/**
+ * Find room for the vertices and indices of `m`, in the pools if they fit and in buffers
+ * of its own if not.
+ */
+static void mesh_alloc (Mesh *m)
+{
+	VkDeviceSize idx_bytes = (VkDeviceSize) mesh_index_count (m) * mesh_index_size (m);
+	GeometryPool *pool = &vx_pools[m->layout][m->fmt];
+
+	// vertex pulling reads the vertices as storage by address
+	VkBufferUsageFlags vx_usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	if (has_bda)
+		vx_usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+	int64_t vx = pool_alloc
+	(
+		pool,
+		m->n_vertices,
+		1,
+		POOL_VERTICES,
+		vx_layout_size (m->fmt, POOL_VERTICES),
+		vx_usage
+	);
+	if (pool->buf != VK_NULL_HANDLE)
+		pool->attr_offset = m->layout == VX_LAYOUT_SPLIT ? vx_split_offset (m->fmt, POOL_VERTICES) : 0;
+
+	// indices aligned so the buffer can be bound at 0 as either type
+	int64_t idx = vx < 0 ? -1 : pool_alloc
+	(
+		&idx_pool,
+		idx_bytes,
+		4,
+		POOL_INDEX_BYTES,
+		POOL_INDEX_BYTES,
+		VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+	);
+
+	if (vx >= 0 && idx >= 0)
+	{
+		m->pooled = 1;
+		m->vx_buf = pool->buf;
+		m->idx_buf = idx_pool.buf;
+		m->base_vertex = (int32_t) vx;
+		m->base_index = (uint32_t) (idx / mesh_index_size (m));
+		m->attr_offset = pool->attr_offset;
+		return;
+	}
+
+	if (vx >= 0)
+		pool_free (pool, (VkDeviceSize) vx, m->n_vertices);
+
+#ifdef DEBUG
+	printf ("mesh of %u vertices does not fit the geometry pools, giving it its own buffers\n", m->n_vertices);
+#endif
+
+	m->pooled = 0;
+	m->base_vertex = 0;
+	m->base_index = 0;
+	m->attr_offset = m->layout == VX_LAYOUT_SPLIT ? vx_split_offset (m->fmt, m->n_vertices) : 0;
+
+	create_buffer
+	(
+		vx_layout_size (m->fmt, m->n_vertices),
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | vx_usage,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&m->vx_buf,
+		&m->vx_buf_mem
+	);
+	create_buffer
+	(
+		idx_bytes,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&m->idx_buf,
+		&m->idx_buf_mem
+	);
+}
+
+/**
+ * Allocate `m` and copy its vertices and indices from filled in staging buffers, which
+ * are freed. The vertices are laid out as for a single mesh, see `mesh_vertex_regions`.
+ */
+static void mesh_upload
+(
+	Mesh *m,
+	VkBuffer vx_staging,
+	VkDeviceMemory vx_staging_mem,
+	VkBuffer idx_staging,
+	VkDeviceMemory idx_staging_mem
+)
+{
+	mesh_alloc (m);
+
+	vkUnmapMemory (device, vx_staging_mem);
+	vkUnmapMemory (device, idx_staging_mem);
+
+	VkBufferCopy vx[2];
+	uint32_t n = mesh_vertex_regions (m, vx);
+
+	VkBufferCopy idx = { 0 };
+	idx.dstOffset = (VkDeviceSize) m->base_index * mesh_index_size (m);
+	idx.size = (VkDeviceSize) mesh_index_count (m) * mesh_index_size (m);
+
+	VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+	vkCmdCopyBuffer (cmdbuf, vx_staging, m->vx_buf, n, vx);
+	vkCmdCopyBuffer (cmdbuf, idx_staging, m->idx_buf, 1, &idx);
+	end_single_time_cmds (cmdbuf);
+
+	vkDestroyBuffer (device, vx_staging, NULL);
+	vkFreeMemory (device, vx_staging_mem, NULL);
+	vkDestroyBuffer (device, idx_staging, NULL);
+	vkFreeMemory (device, idx_staging_mem, NULL);
+}
+
+/**
+ * Read the vertices and indices of `m` back from the device, in the layout of a single
+ * mesh, into `vx` and `idx`.
+ */
+static void mesh_read (const Mesh *m, void *vx, void *idx)
+{
+	VkBufferCopy r[2];
+	uint32_t n = mesh_vertex_regions (m, r);
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		VkDeviceSize t = r[i].srcOffset;
+		r[i].srcOffset = r[i].dstOffset;
+		r[i].dstOffset = t;
+	}
+	read_buf (m->vx_buf, r, n, vx_layout_size (m->fmt, m->n_vertices), vx);
+
+	VkBufferCopy ir = { 0 };
+	ir.srcOffset = (VkDeviceSize) m->base_index * mesh_index_size (m);
+	ir.size = (VkDeviceSize) mesh_index_count (m) * mesh_index_size (m);
+	read_buf (m->idx_buf, &ir, 1, ir.size, idx);
+}
+
+/**
+ * Device address of `buf`, which must have been created for it.
+ */
+static VkDeviceAddress buffer_address (VkBuffer buf)
+{
+	VkBufferDeviceAddressInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+	info.buffer = buf;
+	return vkGetBufferDeviceAddress (device, &info);
+}
+
+/**
+ * Give `m` its meshlets, a blob of `size` bytes as `build_meshlets` lays them out.
+ */
+static void mesh_meshlets_upload (Mesh *m, const void *blob, VkDeviceSize size, uint32_t n)
+{
+	VkBuffer staging;
+	VkDeviceMemory staging_mem;
+	memcpy (staging_map (size, &staging, &staging_mem), blob, size);
+	vkUnmapMemory (device, staging_mem);
+
+	VkBufferUsageFlags usage =
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	if (has_bda)
+		usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+	create_buffer (size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &m->meshlet_buf, &m->meshlet_mem);
+	copy_buf (staging, m->meshlet_buf, size);
+
+	vkDestroyBuffer (device, staging, NULL);
+	vkFreeMemory (device, staging_mem, NULL);
+
+	m->meshlet_size = size;
+	m->n_meshlets = n;
+}
+
+/**
+ * Where the vertex pulling pipeline finds the vertices of `m`. Draws address the mesh
+ * with their vertex offset as for fixed function fetch, so these are the same for every
+ * mesh in a pool.
+ */
+static void mesh_pull_constants (const Mesh *m, PullConstants *pull)
+{
+	VkDeviceAddress addr = buffer_address (m->vx_buf);
+
+	pull->fmt = m->fmt;
+	pull->pos = addr;
+	if (m->layout == VX_LAYOUT_SPLIT)
+	{
+		pull->attr = addr + m->attr_offset;
+		pull->pos_stride = vx_pos_stride (m->fmt) / 4;
+		pull->attr_stride = vx_attr_stride (m->fmt) / 4;
+	}
+	else
+	{
+		pull->attr = addr + vx_pos_stride (m->fmt);
+		pull->pos_stride = pull->attr_stride = (vx_pos_stride (m->fmt) + vx_attr_stride (m->fmt)) / 4;
+	}
+}
+
+/**
+ * Hand an uploaded mesh over to the render queue, returning its index there.
+ */
+static uint32_t mesh_register (Mesh *m)
+{
+	uint32_t i = rq_mesh_add (&m->vx_buf, &m->idx_buf, m->idx_type);
+	rq_meshes[i].attr_offset = m->attr_offset;
+	rq_meshes[i].base_vertex = m->base_vertex;
+	rq_meshes[i].base_index = m->base_index;
+	rq_meshes[i].lods = m->lods;
+	rq_meshes[i].n_lods = m->n_lods;
+	memset (&rq_meshes[i].pull, 0, sizeof (PullConstants));
+	if (has_bda)
+		mesh_pull_constants (m, &rq_meshes[i].pull);
+	rq_meshes[i].meshlets = has_bda && m->n_meshlets ? buffer_address (m->meshlet_buf) : 0;
+	rq_meshes[i].n_meshlets = m->n_meshlets;
+	meshes[i] = m;
+	return i;
+}
+
+/**
+ * Upload a mesh read from `src`, stored as `fmt` in `layout`, and register it with the
+ * render queue, returning its index there. Asking for VX_FMT_QUANT gets half float
+ * texture coordinates if they do not fit in [0, 1], and formats the device can not fetch
+ * fall back to VX_FMT_FLOAT. Indices are stored as 16 bit if there are at most 65536
+ * vertices.
+ *
+ * Each vertex is converted from the source straight into the mapped staging buffer, so
+ * whatever `src` points at, a file mapped into memory say, is read once and not copied
+ * anywhere else.
+ *
+ * With `--optimize` the vertices and triangles are reordered first, see `optimize_mesh`.
+ * The mesh ends up in the geometry pools, see `mesh_alloc`.
+ *
+ * Draws of the mesh use the pipeline `mesh_pipeline` returns.
+ */
+uint32_t mesh_add_source (const MeshSource *src, VertexFormat fmt, VertexLayout layout)
+{
+	uint32_t n_vertices = src->n_vertices;
+	uint32_t n_indices = src->idx ? src->n_indices : n_vertices;
+
+	if (n_vertices == 0 || n_vertices - 1 > caps.props.limits.maxDrawIndexedIndexValue)
+	{
+		fprintf (stderr, "mesh of %u vertices can not be drawn by the device!\n", n_vertices);
+		exit (1);
+	}
+
+	float lo[3], hi[3];
+	if (src->has_bounds)
+	{
+		memcpy (lo, src->min, sizeof (lo));
+		memcpy (hi, src->max, sizeof (hi));
+	}
+	else
+	{
+		for (int c = 0; c < 3; c ++)
+		{
+			lo[c] = INFINITY;
+			hi[c] = -INFINITY;
+		}
+		for (uint32_t i = 0; i < n_vertices; i ++)
+		{
+			float p[3] = { 0.0f, 0.0f, 0.0f };
+			stream_read (&src->pos, i, p, 3);
+			for (int c = 0; c < 3; c ++)
+			{
+				lo[c] = fminf (lo[c], p[c]);
+				hi[c] = fmaxf (hi[c], p[c]);
+			}
+		}
+	}
+
+	// normalized unsigned texture coordinates are in [0, 1] by definition
+	int uv_unorm = src->uv.normalized && (src->uv.type == COMP_U8 || src->uv.type == COMP_U16);
+	if (fmt == VX_FMT_QUANT && src->uv.data && !uv_unorm)
+	{
+		for (uint32_t i = 0; i < n_vertices && fmt == VX_FMT_QUANT; i ++)
+		{
+			float uv[2] = { 0.0f, 0.0f };
+			stream_read (&src->uv, i, uv, 2);
+			if (uv[0] < 0.0f || uv[0] > 1.0f || uv[1] < 0.0f || uv[1] > 1.0f)
+				fmt = VX_FMT_QUANT_HALF_UV;
+		}
+	}
+
+	if (!vx_fmt_supported (fmt))
+	{
+		fprintf (stderr, "vertex format %d not supported, storing mesh as floats\n", fmt);
+		fmt = VX_FMT_FLOAT;
+	}
+
+	MeshOpt opt = { 0 };
+	if (optimize_meshes && n_indices >= 3)
+	{
+		optimize_mesh (src, &opt);
+		n_vertices = opt.n_vertices;
+		n_indices = opt.n_indices;
+	}
+
+	Mesh *m = calloc (1, sizeof (Mesh));
+	m->fmt = fmt;
+	m->layout = layout;
+	m->n_vertices = n_vertices;
+	m->n_indices = n_indices;
+	m->idx_type = n_vertices <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	memcpy (m->min, lo, sizeof (lo));
+	memcpy (m->max, hi, sizeof (hi));
+
+	float scale[3];
+	if (fmt == VX_FMT_FLOAT)
+		mat4_identity (m->dequant);
+	else
+		quant_bounds (lo, hi, scale, m->dequant);
+
+	// vertices
+
+	VkDeviceSize size = vx_layout_size (fmt, n_vertices);
+	VkDeviceSize attr_offset = 0;
+	VkBuffer staging;
+	VkDeviceMemory staging_mem;
+	uint8_t *out = staging_map (size, &staging, &staging_mem);
+
+	if (layout == VX_LAYOUT_SPLIT)
+	{
+		attr_offset = vx_split_offset (fmt, n_vertices);
+		VkDeviceSize pos_size = (VkDeviceSize) n_vertices * vx_pos_stride (fmt);
+		memset (out + pos_size, 0, attr_offset - pos_size);
+	}
+
+	// meshlets are built from the positions as stored, and cooked scenes always get them
+	int meshlets = (use_meshlets || cook_file) && n_indices >= 3 && n_indices % 3 == 0;
+	float *stored_pos = meshlets ? malloc (n_vertices * 3 * sizeof (float)) : NULL;
+	uint32_t *meshlet_idx = meshlets ? malloc (n_indices * sizeof (uint32_t)) : NULL;
+
+	for (uint32_t i = 0; i < n_vertices; i ++)
+	{
+		Vertex v;
+		source_vertex (src, opt.vx ? opt.vx[i] : i, &v);
+
+		if (fmt == VX_FMT_FLOAT)
+		{
+			store_vertex (out, i, attr_offset, fmt, layout, &v);
+			if (stored_pos)
+				memcpy (&stored_pos[i * 3], v.pos, sizeof (v.pos));
+		}
+		else
+		{
+			QVertex q;
+			quantize_vertex (&v, lo, scale, fmt, &q);
+			store_vertex (out, i, attr_offset, fmt, layout, &q);
+			for (int k = 0; k < 3 && stored_pos; k ++)
+				stored_pos[i * 3 + k] = q.pos[k] / 65535.0f;
+		}
+	}
+
+	// indices, narrowed on the way if they fit in 16 bits, and the levels of detail
+
+	uint32_t *lod_idx = NULL;
+	uint32_t n_total = n_indices;
+	m->lods[0].n_indices = n_indices;
+	m->n_lods = 1;
+	if (use_lods && n_indices % 3 == 0 && n_indices / 3 >= 2 * LOD_MIN_TRIANGLES)
+		lod_idx = mesh_lods (src, &opt, m, n_indices, &n_total);
+
+	VkDeviceSize idx_size = (VkDeviceSize) n_total * mesh_index_size (m);
+	VkBuffer idx_staging;
+	VkDeviceMemory idx_staging_mem;
+	uint8_t *idx_out = staging_map (idx_size, &idx_staging, &idx_staging_mem);
+
+	for (uint32_t i = 0; i < n_total; i ++)
+	{
+		uint32_t x = lod_idx ? lod_idx[i] : opt.idx ? opt.idx[i] : src->idx ? index_read (src, i) : i;
+		if (x >= n_vertices)
+		{
+			fprintf (stderr, "mesh index %u out of range of %u vertices!\n", x, n_vertices);
+			exit (1);
+		}
+
+		if (m->idx_type == VK_INDEX_TYPE_UINT16)
+			((uint16_t *) idx_out)[i] = (uint16_t) x;
+		else
+			((uint32_t *) idx_out)[i] = x;
+		if (meshlet_idx && i < n_indices)
+			meshlet_idx[i] = x;
+	}
+
+	mesh_upload (m, staging, staging_mem, idx_staging, idx_staging_mem);
+	free (opt.idx);
+	free (opt.vx);
+	free (lod_idx);
+
+	if (meshlets)
+	{
+		uint32_t n_meshlets;
+		VkDeviceSize blob_size;
+		uint32_t *blob = build_meshlets (stored_pos, n_vertices, meshlet_idx, n_indices, &n_meshlets, &blob_size);
+		mesh_meshlets_upload (m, blob, blob_size, n_meshlets);
+		free (blob);
+	}
+	free (stored_pos);
+	free (meshlet_idx);
+
+	uint32_t i = mesh_register (m);
+
+#ifdef DEBUG
+	printf
+	(
+		"mesh %u: %u vertices as format %d, layout %d, %lu bytes, %u %s indices, %u levels of detail, %u meshlets\n",
+		i,
+		n_vertices,
+		fmt,
+		layout,
+		(unsigned long) size,
+		n_indices,
+		m->idx_type == VK_INDEX_TYPE_UINT16 ? "16 bit" : "32 bit",
+		m->n_lods,
+		m->n_meshlets
+	);
+#endif
+
+	return i;
+}
+
+static VertexStream f32_stream (const float *first, uint32_t stride, uint32_t n_comp)
+{
+	VertexStream s = { 0 };
+	s.data = (const uint8_t *) first;
+	s.stride = stride;
+	s.type = COMP_F32;
+	s.n_comp = n_comp;
+	return s;
+}
+
+/**
+ * Upload `n_vertices` vertices and `n_indices` indices as a mesh, see `mesh_add_source`.
+ */
+uint32_t mesh_add
+(
+	const Vertex *vx,
+	uint32_t n_vertices,
+	const uint32_t *idx,
+	uint32_t n_indices,
+	VertexFormat fmt,
+	VertexLayout layout
+)
+{
+	MeshSource src = { 0 };
+	src.n_vertices = n_vertices;
+	src.pos = f32_stream (vx->pos, sizeof (Vertex), 3);
+	src.normal = f32_stream (vx->normal, sizeof (Vertex), 3);
+	src.color = f32_stream (vx->color, sizeof (Vertex), 3);
+	src.uv = f32_stream (vx->uv, sizeof (Vertex), 2);
+	src.idx = (const uint8_t *) idx;
+	src.idx_type = COMP_U32;
+	src.n_indices = n_indices;
+
+	return mesh_add_source (&src, fmt, layout);
+}
+
+/**
+ * Index of the render queue pipeline drawing a range of the indices of `mesh`: the vertex
+ * pulling one with `--pull`, else the one for its vertex format and layout.
+ */
+static uint32_t mesh_indexed_pipeline (uint32_t mesh)
+{
+	if (vertex_pulling)
+		return rq_pull_pipeline;
+	return meshes[mesh]->layout * VX_FMT_COUNT + meshes[mesh]->fmt;
+}
+
+/**
+ * Index of the render queue pipeline drawing `mesh`: the meshlet one with `--meshlets`
+ * for meshes that have them, else `mesh_indexed_pipeline`. Meshlets always cover the
+ * whole mesh, `draw_list_add` falls back to the indexed pipeline for draws of a range.
+ */
+uint32_t mesh_pipeline (uint32_t mesh)
+{
+	if (use_meshlets && meshes[mesh]->n_meshlets > 0)
+		return rq_meshlet_pipeline;
+	return mesh_indexed_pipeline (mesh);
+}
+
+/**
+ * Bind the vertex streams of a mesh, positions at binding 0 and the attributes at binding
+ * 2 if it is split. Attributes are left out with `pos_only`.
+ */
+static void bind_vx_streams (VkCommandBuffer cmdbuf, VkBuffer buf, VkDeviceSize attr_offset, int pos_only)
+{
+	VkDeviceSize zero = 0;
+	vkCmdBindVertexBuffers (cmdbuf, 0, 1, &buf, &zero);
+
+	if (attr_offset > 0 && !pos_only)
+		vkCmdBindVertexBuffers (cmdbuf, 2, 1, &buf, &attr_offset);
+}
+
+/**
+ * Model matrix `M` of an instance of `mesh`, with the dequantization of its positions
+ * folded in.
+ */
+void mesh_model_matrix (uint32_t mesh, const float M[16], float out[16])
+{
+	mat4_mul (out, M, meshes[mesh]->dequant);
+}
+
+/**
+ * Destroy the meshes from `first` on and give their render queue slots back, newest
+ * first so their pool space is given back too.
+ */
+static void destroy_meshes_from (uint32_t first)
+{
+	for (uint32_t i = n_rq_meshes; i -- > first; )
+	{
+		Mesh *m = meshes[i];
+		if (!m) continue;
+
+		if (m->pooled)
+		{
+			pool_free (&vx_pools[m->layout][m->fmt], m->base_vertex, m->n_vertices);
+			pool_free
+			(
+				&idx_pool,
+				(VkDeviceSize) m->base_index * mesh_index_size (m),
+				(VkDeviceSize) mesh_index_count (m) * mesh_index_size (m)
+			);
+		}
+		else
+		{
+			vkDestroyBuffer (device, m->vx_buf, NULL);
+			vkFreeMemory (device, m->vx_buf_mem, NULL);
+			vkDestroyBuffer (device, m->idx_buf, NULL);
+			vkFreeMemory (device, m->idx_buf_mem, NULL);
+		}
+		if (m->meshlet_buf != VK_NULL_HANDLE)
+		{
+			vkDestroyBuffer (device, m->meshlet_buf, NULL);
+			vkFreeMemory (device, m->meshlet_mem, NULL);
+		}
+		free (m);
+		meshes[i] = NULL;
+	}
+
+	if (first < n_rq_meshes)
+		n_rq_meshes = first;
+}
+
+static void destroy_meshes ()
+{
+	destroy_meshes_from (0);
+	destroy_geometry_pools ();
+}
+
+/**
+ * Upload the hardcoded geometry as mesh 0.
+ */
+static void create_builtin_mesh ()
+{
+	Vertex vx[8];
+	for (int i = 0; i < 8; i ++)
+	{
+		memcpy (vx[i].pos, vertices[i], sizeof (vx[i].pos));
+		memcpy (vx[i].color, colors[i], sizeof (vx[i].color));
+		memcpy (vx[i].uv, tex_coords[i], sizeof (vx[i].uv));
+		vx[i].normal[0] = 0.0f;
+		vx[i].normal[1] = 0.0f;
+		vx[i].normal[2] = 1.0f;
+	}
+
+	uint32_t i = mesh_add
+	(
+		vx,
+		8,
+		indices,
+		sizeof (indices) / sizeof (indices[0]),
+		builtin_vx_fmt,
+		builtin_vx_layout
+	);
+	assert (i == 0);
+}
+
+/**
+ *		Mesh files.
+ *
+ * Wavefront OBJ: positions (with optional vertex colors), texture coordinates, normals
+ * and polygonal faces, which are triangulated as fans. Each distinct v/vt/vn triple of
+ * the faces becomes a vertex. Normals missing from the file are computed from the faces.
+ * Materials, groups and everything else is skipped.
+ */
+
+typedef struct ObjArray
+{
+	float *v;
+	uint32_t n; // in elements of `dim` floats
+	uint32_t cap;
+	uint32_t dim;
+} ObjArray;
+
+static void obj_push (ObjArray *a, const float *v)
+{
+	if (a->n == a->cap)
+	{
+		a->cap = a->cap ? a->cap * 2 : 1024;
+		a->v = realloc (a->v, (size_t) a->cap * a->dim * sizeof (float));
+	}
+	memcpy (&a->v[(size_t) a->n * a->dim], v, a->dim * sizeof (float));
+	a->n ++;
+}
+
+/**
+ * v/vt/vn triples to vertex indices, open addressing.
+ */
+typedef struct ObjVertexMap
+{
+	uint32_t (*keys)[3];
+	uint32_t *vals;
+	uint32_t cap; // power of two
+	uint32_t n;
+} ObjVertexMap;
+
+static uint32_t obj_hash (const uint32_t key[3])
+{
+	uint32_t h = key[0] * 73856093u ^ key[1] * 19349663u ^ key[2] * 83492791u;
+	return h ^ (h >> 15);
+}
+
+static uint32_t *obj_map_slot (ObjVertexMap *map, const uint32_t key[3])
+{
+	uint32_t i = obj_hash (key) & (map->cap - 1);
+	while (map->vals[i] != UINT32_MAX && memcmp (map->keys[i], key, sizeof (map->keys[i])) != 0)
+		i = (i + 1) & (map->cap - 1);
+	memcpy (map->keys[i], key, sizeof (map->keys[i]));
+	return &map->vals[i];
+}
+
+static void obj_map_grow (ObjVertexMap *map)
+{
+	ObjVertexMap old = *map;
+
+	map->cap = old.cap ? old.cap * 2 : 4096;
+	map->keys = malloc (map->cap * sizeof (map->keys[0]));
+	map->vals = malloc (map->cap * sizeof (uint32_t));
+	memset (map->vals, 0xff, map->cap * sizeof (uint32_t));
+
+	for (uint32_t i = 0; i < old.cap; i ++)
+		if (old.vals[i] != UINT32_MAX)
+			*obj_map_slot (map, old.keys[i]) = old.vals[i];
+
+	free (old.keys);
+	free (old.vals);
+}
+
+/**
+ * Resolve a 1-based or negative relative OBJ index against `n` elements, 0 if absent.
+ */
+static uint32_t obj_index (long i, uint32_t n, const char *fname, uint32_t lineno)
+{
+	if (i < 0)
+		i += (long) n + 1;
+	if (i < 1 || i > (long) n)
+	{
+		fprintf (stderr, "%s:%u: index out of range\n", fname, lineno);
+		exit (1);
+	}
+	return (uint32_t) i;
+}
+
+/**
+ * Load the OBJ file `fname` into `*vx` and `*idx`, both allocated.
+ */
+static void load_obj
+(
+	const char *fname,
+	Vertex **vx,
+	uint32_t *n_vertices,
+	uint32_t **idx,
+	uint32_t *n_indices
+)
+{
+	FILE *fp = fopen (fname, "r");
+	if (!fp)
+	{
+		fprintf (stderr, "could not open mesh %s!\n", fname);
+		exit (1);
+	}
+
+	ObjArray pos = { NULL, 0, 0, 6 }; // position and color
+	ObjArray uv = { NULL, 0, 0, 2 };
+	ObjArray normal = { NULL, 0, 0, 3 };
+	ObjVertexMap map = { 0 };
+	obj_map_grow (&map);
+
+	Vertex *out = NULL;
+	uint32_t n_out = 0, out_cap = 0;
+	uint32_t *tris = NULL;
+	uint32_t n_tris = 0, tris_cap = 0;
+	int has_normals = 1;
+
+	char line[4096];
+	for (uint32_t lineno = 1; fgets (line, sizeof (line), fp); lineno ++)
+	{
+		char *p = line;
+		while (*p == ' ' || *p == '\t')
+			p ++;
+
+		if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			float v[6] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+			int n = sscanf (p + 2, "%f %f %f %f %f %f", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]);
+			if (n < 3)
+			{
+				fprintf (stderr, "%s:%u: malformed vertex\n", fname, lineno);
+				exit (1);
+			}
+			// 4 or 5 components are x y z w, only 6 or more carry a color
+			if (n < 6)
+			{
+				if (n > 3 && v[3] != 0.0f)
+					for (int c = 0; c < 3; c ++)
+						v[c] /= v[3];
+				v[3] = v[4] = v[5] = 1.0f;
+			}
+			obj_push (&pos, v);
+		}
+		else if (p[0] == 'v' && p[1] == 't')
+		{
+			float v[2] = { 0.0f, 0.0f };
+			sscanf (p + 2, "%f %f", &v[0], &v[1]);
+			v[1] = 1.0f - v[1]; // OBJ has the origin bottom left
+			obj_push (&uv, v);
+		}
+		else if (p[0] == 'v' && p[1] == 'n')
+		{
+			float v[3] = { 0.0f, 0.0f, 1.0f };
+			sscanf (p + 2, "%f %f %f", &v[0], &v[1], &v[2]);
+			obj_push (&normal, v);
+		}
+		else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			uint32_t first = 0, prev = 0, corner = 0;
+			char *tok = p + 2;
+
+			for (;;)
+			{
+				while (*tok == ' ' || *tok == '\t')
+					tok ++;
+				if (*tok == '\0' || *tok == '\n' || *tok == '\r')
+					break;
+
+				// v, v/vt, v//vn or v/vt/vn
+				uint32_t key[3] = { 0, 0, 0 };
+				char *end;
+				key[0] = obj_index (strtol (tok, &end, 10), pos.n, fname, lineno);
+				tok = end;
+				if (*tok == '/')
+				{
+					tok ++;
+					if (*tok != '/')
+					{
+						key[1] = obj_index (strtol (tok, &end, 10), uv.n, fname, lineno);
+						tok = end;
+					}
+					if (*tok == '/')
+					{
+						key[2] = obj_index (strtol (tok + 1, &end, 10), normal.n, fname, lineno);
+						tok = end;
+					}
+				}
+				has_normals = has_normals && key[2] != 0;
+
+				if (map.n * 2 >= map.cap)
+					obj_map_grow (&map);
+
+				uint32_t *slot = obj_map_slot (&map, key);
+				if (*slot == UINT32_MAX)
+				{
+					if (n_out == out_cap)
+					{
+						out_cap = out_cap ? out_cap * 2 : 1024;
+						out = realloc (out, out_cap * sizeof (Vertex));
+					}
+
+					Vertex *v = &out[n_out];
+					memset (v, 0, sizeof (Vertex));
+					memcpy (v->pos, &pos.v[(key[0] - 1) * 6], sizeof (v->pos));
+					memcpy (v->color, &pos.v[(key[0] - 1) * 6 + 3], sizeof (v->color));
+					if (key[1])
+						memcpy (v->uv, &uv.v[(key[1] - 1) * 2], sizeof (v->uv));
+					if (key[2])
+						memcpy (v->normal, &normal.v[(key[2] - 1) * 3], sizeof (v->normal));
+
+					*slot = n_out ++;
+					map.n ++;
+				}
+
+				// fan from the first corner
+				if (corner == 0)
+					first = *slot;
+				else if (corner >= 2)
+				{
+					if (n_tris + 3 > tris_cap)
+					{
+						tris_cap = tris_cap ? tris_cap * 2 : 3072;
+						tris = realloc (tris, tris_cap * sizeof (uint32_t));
+					}
+					tris[n_tris ++] = first;
+					tris[n_tris ++] = prev;
+					tris[n_tris ++] = *slot;
+				}
+				prev = *slot;
+				corner ++;
+			}
+		}
+	}
+
+	fclose (fp);
+	free (pos.v);
+	free (uv.v);
+	free (normal.v);
+	free (map.keys);
+	free (map.vals);
+
+	if (n_tris == 0)
+	{
+		fprintf (stderr, "no faces in %s!\n", fname);
+		exit (1);
+	}
+
+	// area weighted face normals for files without them
+	if (!has_normals)
+	{
+		for (uint32_t i = 0; i < n_out; i ++)
+			memset (out[i].normal, 0, sizeof (out[i].normal));
+
+		for (uint32_t i = 0; i < n_tris; i += 3)
+		{
+			const float *a = out[tris[i]].pos, *b = out[tris[i + 1]].pos, *c = out[tris[i + 2]].pos;
+			float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3];
+			vec3_cross (n, e0, e1);
+			for (int k = 0; k < 3; k ++)
+				for (int j = 0; j < 3; j ++)
+					out[tris[i + k]].normal[j] += n[j];
+		}
+
+		for (uint32_t i = 0; i < n_out; i ++)
+			vec3_normalize (out[i].normal);
+	}
+
+	*vx = out;
+	*n_vertices = n_out;
+	*idx = tris;
+	*n_indices = n_tris;
+}
+
+/**
+ * Add each triangle primitive of the meshes in the glTF binary `fname` as a mesh of
+ * `fmt` in `layout`, returning the index of the first and the number added in `*count`.
+ * Vertices are read straight from the mapped file while they are converted, and node
+ * transforms are not applied.
+ */
+static uint32_t load_glb (const char *fname, VertexFormat fmt, VertexLayout layout, uint32_t *count)
+{
+	Glb glb;
+	glb_open (fname, &glb);
+	const Json *j = &glb.json;
+
+	uint32_t first = 0;
+	*count = 0;
+
+	uint32_t *gltf_meshes;
+	uint32_t n_gltf_meshes = json_elements (j, json_find (j, 0, "meshes"), &gltf_meshes);
+
+	for (uint32_t mi = 0; mi < n_gltf_meshes; mi ++)
+	{
+		uint32_t *prims;
+		uint32_t n_prims = json_elements (j, json_find (j, gltf_meshes[mi], "primitives"), &prims);
+
+		for (uint32_t pi = 0; pi < n_prims; pi ++)
+		{
+			int prim = prims[pi];
+			if (json_num (j, json_find (j, prim, "mode"), 4) != 4)
+			{
+				fprintf (stderr, "%s: skipping mesh %u primitive %u, not triangles\n", fname, mi, pi);
+				continue;
+			}
+
+			int attr = json_find (j, prim, "attributes");
+			int pos = json_find (j, attr, "POSITION");
+			if (pos < 0)
+			{
+				fprintf (stderr, "%s: skipping mesh %u primitive %u, no positions\n", fname, mi, pi);
+				continue;
+			}
+
+			MeshSource src = { 0 };
+			uint32_t pos_acc = (uint32_t) glb_uint (&glb, pos, 0, UINT32_MAX);
+			src.n_vertices = glb_accessor (&glb, pos_acc, &src.pos);
+
+			// POSITION must have its bounds, but take care of files that leave them out
+			int acc = glb.accessors[pos_acc];
+			int lo = json_find (j, acc, "min"), hi = json_find (j, acc, "max");
+			if (lo >= 0 && hi >= 0 && j->tok[lo].size == 3 && j->tok[hi].size == 3)
+			{
+				src.has_bounds = 1;
+				for (uint32_t c = 0; c < 3; c ++)
+				{
+					src.min[c] = json_num (j, json_at (j, lo, c), 0);
+					src.max[c] = json_num (j, json_at (j, hi, c), 0);
+				}
+			}
+
+			struct { const char *name; VertexStream *s; } streams[] =
+			{
+				{ "NORMAL", &src.normal },
+				{ "COLOR_0", &src.color },
+				{ "TEXCOORD_0", &src.uv },
+			};
+			for (uint32_t k = 0; k < sizeof (streams) / sizeof (streams[0]); k ++)
+			{
+				int a = json_find (j, attr, streams[k].name);
+				if (a >= 0 && glb_accessor (&glb, (uint32_t) glb_uint (&glb, a, 0, UINT32_MAX), streams[k].s) != src.n_vertices)
+					glb_fail (&glb, "attribute count differs from positions");
+			}
+
+			int idx = json_find (j, prim, "indices");
+			if (idx >= 0)
+			{
+				VertexStream s;
+				src.n_indices = glb_accessor (&glb, (uint32_t) glb_uint (&glb, idx, 0, UINT32_MAX), &s);
+				if (s.n_comp != 1 || (s.type != COMP_U8 && s.type != COMP_U16 && s.type != COMP_U32))
+					glb_fail (&glb, "indices must be unsigned scalars");
+				// not a fall back to drawing without indices
+				if (!s.data)
+					glb_fail (&glb, "indices without a buffer view or empty");
+				src.idx = s.data;
+				src.idx_type = s.type;
+			}
+
+			uint32_t i = mesh_add_source (&src, fmt, layout);
+			if ((*count) ++ == 0)
+				first = i;
+		}
+
+		free (prims);
+	}
+
+	free (gltf_meshes);
+	glb_close (&glb);
+
+	if (*count == 0)
+	{
+		fprintf (stderr, "no triangle meshes in %s!\n", fname);
+		exit (1);
+	}
+
+	return first;
+}
+
+/**
+ * Load a mesh file and add it as `fmt` in `layout`, returning the index of its first
+ * mesh and how many there are in `*count`. The format is taken from the file extension;
+ * an OBJ file is always one mesh, a glTF binary one per primitive.
+ */
+uint32_t mesh_load (const char *fname, VertexFormat fmt, VertexLayout layout, uint32_t *count)
+{
+	const char *ext = strrchr (fname, '.');
+
+	Vertex *vx;
+	uint32_t *idx;
+	uint32_t n_vertices, n_indices;
+
+	if (ext && strcasecmp (ext, ".glb") == 0)
+		return load_glb (fname, fmt, layout, count);
+	else if (ext && strcasecmp (ext, ".obj") == 0)
+		load_obj (fname, &vx, &n_vertices, &idx, &n_indices);
+	else
+	{
+		fprintf (stderr, "unknown mesh format %s!\n", fname);
+		exit (1);
+	}
+
+	uint32_t i = mesh_add (vx, n_vertices, idx, n_indices, fmt, layout);
+	*count = 1;
+
+	free (vx);
+	free (idx);
+
+	return i;
+}
+
+static void cooked_fail (const char *fname, const char *what)
+{
+	fprintf (stderr, "%s: %s!\n", fname, what);
+	exit (1);
+}
+
+/**
+ * Pointer to `count` elements of `size` bytes at `offset` in the mapped file, checked to
+ * be inside it.
+ */
+static const void *cooked_at (const Cooked *c, const char *fname, uint64_t offset, uint64_t count, uint64_t size)
+{
+	if (offset > c->size || (size && count > (c->size - offset) / size))
+		cooked_fail (fname, "table or blob outside the file");
+	return c->map + offset;
+}
+
+/**
+ * Map the cooked scene `fname` and upload its meshes, which are registered with the
+ * render queue one after the other from `c->first_mesh`. The file stays mapped for the
+ * draws and instances until `cooked_close`.
+ */
+static void load_cooked (const char *fname, Cooked *c)
+{
+	memset (c, 0, sizeof (Cooked));
+
+	int fd = open (fname, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat (fd, &st) != 0)
+		cooked_fail (fname, "could not open");
+	c->size = (size_t) st.st_size;
+	if (c->size < sizeof (CookedHeader))
+		cooked_fail (fname, "too short to be a cooked scene");
+
+	c->map = mmap (NULL, c->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (c->map == MAP_FAILED)
+		cooked_fail (fname, "could not map");
+	madvise (c->map, c->size, MADV_SEQUENTIAL);
+
+	// turn the offsets into pointers
+
+	c->hdr = (const CookedHeader *) c->map;
+	if (c->hdr->magic != COOKED_MAGIC || c->hdr->version != COOKED_VERSION)
+		cooked_fail (fname, "not a cooked scene of this version, cook it again");
+	if (c->hdr->size != c->size || c->hdr->instance_size != sizeof (InstanceData))
+		cooked_fail (fname, "truncated or cooked by a different build");
+
+	c->meshes = cooked_at (c, fname, c->hdr->meshes, c->hdr->n_meshes, sizeof (CookedMesh));
+	c->draws = cooked_at (c, fname, c->hdr->draws, c->hdr->n_draws, sizeof (CookedDraw));
+	c->instances = cooked_at (c, fname, c->hdr->instances, c->hdr->n_instances, sizeof (InstanceData));
+
+	// each blob goes from the mapped file into a staging buffer and on to the device
+
+	// largest vertex index of each mesh, for checking the draws' vertex offsets
+	uint32_t *max_vertex = calloc (c->hdr->n_meshes, sizeof (uint32_t));
+
+	for (uint32_t i = 0; i < c->hdr->n_meshes; i ++)
+	{
+		const CookedMesh *cm = &c->meshes[i];
+
+		if (cm->fmt >= VX_FMT_COUNT || cm->layout >= VX_LAYOUT_COUNT || cm->n_vertices == 0 || cm->n_indices == 0)
+			cooked_fail (fname, "malformed mesh");
+		if (!vx_fmt_supported (cm->fmt))
+			cooked_fail (fname, "vertex format not supported by the device");
+
+		if (cm->n_lods == 0 || cm->n_lods > MESH_MAX_LODS || cm->lods[0].first_index != 0 || cm->lods[0].n_indices != cm->n_indices)
+			cooked_fail (fname, "malformed mesh");
+		const MeshLod *last = &cm->lods[cm->n_lods - 1];
+		uint64_t n_total = (uint64_t) last->first_index + last->n_indices;
+		for (uint32_t l = 1; l < cm->n_lods; l ++)
+			if (cm->lods[l].first_index != cm->lods[l - 1].first_index + cm->lods[l - 1].n_indices)
+				cooked_fail (fname, "malformed mesh");
+
+		uint64_t idx_size = n_total * (cm->idx_type == VK_INDEX_TYPE_UINT16 ? 2 : 4);
+		if
+		(
+			(cm->idx_type != VK_INDEX_TYPE_UINT16 && cm->idx_type != VK_INDEX_TYPE_UINT32) ||
+			cm->vx_size != vx_layout_size (cm->fmt, cm->n_vertices) ||
+			cm->idx_size != idx_size ||
+			cm->attr_offset != (cm->layout == VX_LAYOUT_SPLIT ? vx_split_offset (cm->fmt, cm->n_vertices) : 0)
+		)
+			cooked_fail (fname, "malformed mesh");
+
+		const void *vx = cooked_at (c, fname, cm->vx, 1, cm->vx_size);
+		const void *idx = cooked_at (c, fname, cm->idx, 1, cm->idx_size);
+
+		// every index must be a vertex of the mesh
+		for (uint64_t k = 0; k < n_total; k ++)
+		{
+			uint32_t v = cm->idx_type == VK_INDEX_TYPE_UINT16 ? ((const uint16_t *) idx)[k] : ((const uint32_t *) idx)[k];
+			if (v >= cm->n_vertices)
+				cooked_fail (fname, "malformed mesh");
+			if (v > max_vertex[i])
+				max_vertex[i] = v;
+		}
+
+		Mesh *m = calloc (1, sizeof (Mesh));
+		m->fmt = cm->fmt;
+		m->layout = cm->layout;
+		m->idx_type = cm->idx_type;
+		m->attr_offset = cm->attr_offset;
+		m->n_vertices = cm->n_vertices;
+		m->n_indices = cm->n_indices;
+		memcpy (m->min, cm->min, sizeof (m->min));
+		memcpy (m->max, cm->max, sizeof (m->max));
+		memcpy (m->dequant, cm->dequant, sizeof (m->dequant));
+		memcpy (m->lods, cm->lods, sizeof (m->lods));
+		m->n_lods = cm->n_lods;
+
+		VkBuffer vx_staging, idx_staging;
+		VkDeviceMemory vx_staging_mem, idx_staging_mem;
+
+		memcpy (staging_map (cm->vx_size, &vx_staging, &vx_staging_mem), vx, cm->vx_size);
+		memcpy (staging_map (cm->idx_size, &idx_staging, &idx_staging_mem), idx, cm->idx_size);
+		mesh_upload (m, vx_staging, vx_staging_mem, idx_staging, idx_staging_mem);
+
+		if (cm->n_meshlets > 0)
+		{
+			const Meshlet *ml = cooked_at (c, fname, cm->meshlets, cm->n_meshlets, sizeof (Meshlet));
+			cooked_at (c, fname, cm->meshlets, 1, cm->meshlets_size);
+
+			// the task shader reads all n_meshlets records from the uploaded blob
+			if (cm->meshlets_size < (uint64_t) cm->n_meshlets * sizeof (Meshlet))
+				cooked_fail (fname, "malformed meshlets");
+
+			// what the mesh shader reads must be in the blob, and the vertices it indexes
+			// in the mesh and the meshlet
+			const uint32_t *blob = (const uint32_t *) ml;
+			uint64_t words = cm->meshlets_size / 4;
+			for (uint32_t j = 0; j < cm->n_meshlets; j ++)
+			{
+				if
+				(
+					ml[j].vertex_count > MESHLET_MAX_VERTICES ||
+					ml[j].triangle_count > MESHLET_MAX_TRIANGLES ||
+					(uint64_t) ml[j].vertex_offset + ml[j].vertex_count > words ||
+					(uint64_t) ml[j].triangle_offset + ml[j].triangle_count > words
+				)
+					cooked_fail (fname, "malformed meshlets");
+
+				for (uint32_t k = 0; k < ml[j].vertex_count; k ++)
+					if (blob[ml[j].vertex_offset + k] >= cm->n_vertices)
+						cooked_fail (fname, "malformed meshlets");
+
+				for (uint32_t k = 0; k < ml[j].triangle_count; k ++)
+				{
+					uint32_t packed = blob[ml[j].triangle_offset + k];
+					for (int v = 0; v < 3; v ++)
+						if (((packed >> (8 * v)) & 0xff) >= ml[j].vertex_count)
+							cooked_fail (fname, "malformed meshlets");
+				}
+			}
+
+			mesh_meshlets_upload (m, ml, cm->meshlets_size, cm->n_meshlets);
+		}
+
+		uint32_t j = mesh_register (m);
+		if (i == 0)
+			c->first_mesh = j;
+	}
+
+	for (uint32_t i = 0; i < c->hdr->n_draws; i ++)
+	{
+		const CookedDraw *d = &c->draws[i];
+		if
+		(
+			d->mesh >= c->hdr->n_meshes ||
+			d->first_instance > c->hdr->n_instances ||
+			d->n_instances > c->hdr->n_instances - d->first_instance
+		)
+			cooked_fail (fname, "malformed draw");
+
+		// the indices drawn, offset by vx_offset, must stay inside the mesh
+		const CookedMesh *cm = &c->meshes[d->mesh];
+		uint64_t n_total = cm->idx_size / (cm->idx_type == VK_INDEX_TYPE_UINT16 ? 2 : 4);
+		if
+		(
+			(uint64_t) d->first_index + d->n_indices > n_total ||
+			d->vx_offset < 0 ||
+			(uint64_t) d->vx_offset + max_vertex[d->mesh] >= cm->n_vertices
+		)
+			cooked_fail (fname, "malformed draw");
+	}
+
+	free (max_vertex);
+}
+
+static void cooked_close (Cooked *c)
+{
+	if (c->map)
+		munmap (c->map, c->size);
+	memset (c, 0, sizeof (Cooked));
+}
+
+/**
+ * Load the meshes given on the command line, or the cooked scene, after the builtin one.
+ */
+static void load_scene_meshes ()
+{
+	for (uint32_t i = 0; i < n_mesh_files; i ++)
+		mesh_file_first[i] = mesh_load
+		(
+			mesh_files[i],
+			builtin_vx_fmt,
+			builtin_vx_layout,
+			&mesh_file_count[i]
+		);
+
+	if (scene_file)
+		load_cooked (scene_file, &scene);
+}
+
+static void create_uniform_buf ()
+{
+	// TODO
+	// this is 3 4x4 matrices - should it be like this?
+	VkDeviceSize size = sizeof (float) * 4 * 4 * 3;
+
+	unif_buf = calloc (n_swapchain_imgs, sizeof (VkBuffer));
+	unif_buf_mem = calloc (n_swapchain_imgs, sizeof (VkDeviceMemory));
+
+	for (size_t i = 0; i < n_swapchain_imgs; i ++)
+		create_buffer
+		(
+			size,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&unif_buf[i],
+			&unif_buf_mem[i]
+		);
+}
+
+static void create_inst_bufs ()
+{
+	inst_bufs = calloc (n_swapchain_imgs, sizeof (VkBuffer));
+	inst_bufs_mem = calloc (n_swapchain_imgs, sizeof (VkDeviceMemory));
+	inst_bufs_mapped = calloc (n_swapchain_imgs, sizeof (InstanceData *));
+
+	VkDeviceSize size = inst_bufs_cap * sizeof (InstanceData);
+
+	// the meshlet task and mesh shaders read them by address
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	if (has_mesh_shader)
+		usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+	for (size_t i = 0; i < n_swapchain_imgs; i ++)
+	{
+		create_buffer
+		(
+			size,
+			usage,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&inst_bufs[i],
+			&inst_bufs_mem[i]
+		);
+		vkMapMemory (device, inst_bufs_mem[i], 0, size, 0, (void **) &inst_bufs_mapped[i]);
+	}
+}
+
+static void destroy_inst_bufs ()
+{
+	for (size_t i = 0; i < n_swapchain_imgs; i ++)
+	{
+		vkUnmapMemory (device, inst_bufs_mem[i]);
+		vkDestroyBuffer (device, inst_bufs[i], NULL);
+		vkFreeMemory (device, inst_bufs_mem[i], NULL);
+	}
+
+	free (inst_bufs);
+	free (inst_bufs_mem);
+	free (inst_bufs_mapped);
+}
+
+/**
+ * Whether any memory type has all of `props`.
+ */
+static int has_mem_type (VkMemoryPropertyFlags props)
+{
+	for (uint32_t i = 0; i < caps.mem.memoryTypeCount; i ++)
+	{
+		if ((caps.mem.memoryTypes[i].propertyFlags & props) == props)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Create a persistently mapped buffer per swapchain image that the color image is
+ * copied to after rendering. Host cached memory is preferred since the CPU reads all
+ * of it back, which is slow from write combined memory.
+ */
+static void create_readback_bufs ()
+{
+	if (!readback)
+		return;
+
+	if
+	(
+		swapchain_img_fmt != VK_FORMAT_R8G8B8A8_SRGB &&
+		swapchain_img_fmt != VK_FORMAT_R8G8B8A8_UNORM &&
+		swapchain_img_fmt != VK_FORMAT_B8G8R8A8_SRGB &&
+		swapchain_img_fmt != VK_FORMAT_B8G8R8A8_UNORM
+	)
+	{
+		fprintf (stderr, "readback of color format %d not supported!\n", swapchain_img_fmt);
+		exit (1);
+	}
+
+	VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	if (!has_mem_type (props))
+		props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+	VkDeviceSize size = swapchain_ext.width * swapchain_ext.height * 4;
+
+	readback_bufs = calloc (n_swapchain_imgs, sizeof (VkBuffer));
+	readback_bufs_mem = calloc (n_swapchain_imgs, sizeof (VkDeviceMemory));
+	readback_bufs_mapped = calloc (n_swapchain_imgs, sizeof (uint8_t *));
+	readback_rgba = malloc (size);
+
+	for (size_t i = 0; i < n_swapchain_imgs; i ++)
+	{
+		create_buffer
+		(
+			size,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			props,
+			&readback_bufs[i],
+			&readback_bufs_mem[i]
+		);
+		vkMapMemory (device, readback_bufs_mem[i], 0, size, 0, (void **) &readback_bufs_mapped[i]);
+	}
+}
+
+static void destroy_readback_bufs ()
+{
+	if (!readback)
+		return;
+
+	for (size_t i = 0; i < n_swapchain_imgs; i ++)
+	{
+		vkUnmapMemory (device, readback_bufs_mem[i]);
+		vkDestroyBuffer (device, readback_bufs[i], NULL);
+		vkFreeMemory (device, readback_bufs_mem[i], NULL);
+	}
+
+	free (readback_bufs);
+	free (readback_bufs_mem);
+	free (readback_bufs_mapped);
+	free (readback_rgba);
+}
+
+/**
+ * A pipeline statistics query per swapchain image counting the fragment shader
+ * invocations of its frames, if the device supports them.
+ */
+static void create_frame_stats ()
+{
+	frame_stats_pending = calloc (n_swapchain_imgs, sizeof (int));
+	if (!has_pipeline_stats)
+		return;
+
+	VkQueryPoolCreateInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	info.queryCount = n_swapchain_imgs;
+	info.pipelineStatistics =
+		VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+		VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+	assert (vkCreateQueryPool (device, &info, NULL, &frame_stats_pool) == VK_SUCCESS);
+}
+
+static void destroy_frame_stats ()
+{
+	if (frame_stats_pool != VK_NULL_HANDLE)
+		vkDestroyQueryPool (device, frame_stats_pool, NULL);
+	frame_stats_pool = VK_NULL_HANDLE;
+	free (frame_stats_pending);
+}
+
+/**
+ * Pick up the statistics of the last frame rendered to `img`, which must have finished.
+ */
+static void read_frame_stats (uint32_t img)
+{
+	if (!frame_stats_pending[img])
+		return;
+	frame_stats_pending[img] = 0;
+
+	// in the order of the statistic bits
+	uint64_t n[2];
+	VkResult res = vkGetQueryPoolResults
+	(
+		device,
+		frame_stats_pool,
+		img,
+		1,
+		sizeof (n),
+		n,
+		sizeof (n),
+		VK_QUERY_RESULT_64_BIT
+	);
+	if (res == VK_SUCCESS)
+	{
+		vx_invocations = n[0];
+		frag_invocations = n[1];
+	}
+}
+
+/**
+ * Vertex shader invocations of the last finished frame, 0 if they are not counted.
+ */
+uint64_t vertex_invocations ()
+{
+	return vx_invocations;
+}
+
+/**
+ * Fragment shader invocations of the last finished frame, 0 if they are not counted.
+ */
+uint64_t fragment_invocations ()
+{
+	return frag_invocations;
+}
+
+static void create_descriptor_pool ()
+{
+	VkDescriptorPoolSize pool_sizes[2] = { 0 };
+
+	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	pool_sizes[0].descriptorCount = n_swapchain_imgs;
+	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	pool_sizes[1].descriptorCount = n_swapchain_imgs;
+
+	VkDescriptorPoolCreateInfo pool_info = { 0 };
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.poolSizeCount = 2;
+	pool_info.pPoolSizes = pool_sizes;
+	pool_info.maxSets = n_swapchain_imgs;
+
+	assert (vkCreateDescriptorPool (device, &pool_info, NULL, &descriptor_pool) == VK_SUCCESS);
+}
+
+static void create_descriptor_sets ()
+{
+	//std::vector<VkDescriptorSetLayout> layouts (swapchain_images.size (), descriptor_set_layout);
+	VkDescriptorSetLayout layouts[n_swapchain_imgs];
+	for (size_t i = 0; i < n_swapchain_imgs; i ++)
+		memcpy
+		(
+			&layouts[i],
+			&descriptor_set_layout,
+			sizeof (VkDescriptorSetLayout)
+		);
+
+	VkDescriptorSetAllocateInfo alloc_info = { 0 };
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.descriptorPool = descriptor_pool;
+	alloc_info.descriptorSetCount = n_swapchain_imgs;
+	alloc_info.pSetLayouts = layouts;
+
+	//descriptor_sets.resize (n_swapchain_imgs);
+	descriptor_sets = malloc (n_swapchain_imgs * sizeof (VkDescriptorSet));
+	assert (vkAllocateDescriptorSets (device, &alloc_info, descriptor_sets) == VK_SUCCESS);
+
+	for (size_t i = 0; i < n_swapchain_imgs; i ++)
+	{
+		DescriptorData data = { 0 };
+
+		data.ubo.buffer = unif_buf[i];
+		data.ubo.offset = 0;
+		// TODO what should this be?
+		//data.ubo.range = sizeof (UniformBufferObject);
+		data.ubo.range = VK_WHOLE_SIZE;
+
+		data.tex.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		data.tex.imageView = tex_img_view;
+		data.tex.sampler = tex_sampler;
+
+		write_descriptor_set (descriptor_sets[i], &data);
+	}
+}
+
+/**
+ *		GPU driven rendering.
+ *
+ * Objects are uploaded once to a storage buffer. Each frame a compute pass culls them
+ * against the frustum and writes the visible ones to an indirect buffer, which is drawn
+ * with a single vkCmdDrawIndexedIndirectCount. Command buffers therefore do not depend
+ * on the scene and never need to be re-recorded for it.
+ *
+ * The object buffer is shared by all frames in flight, so the objects should be changed
+ * between frames, not while one is being recorded.
+ */
+
+static void create_gpu_resources ()
+{
+	// objects: header followed by the objects, host visible so they can be streamed
+
+	VkDeviceSize obj_size = sizeof (GpuObjectsHeader) + GPU_MAX_OBJECTS * sizeof (GpuObject);
+	create_buffer
+	(
+		obj_size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&gpu_obj_buf,
+		&gpu_obj_buf_mem
+	);
+
+	void *data;
+	vkMapMemory (device, gpu_obj_buf_mem, 0, obj_size, 0, &data);
+	gpu_objs_header = (GpuObjectsHeader *) data;
+	gpu_objs = (GpuObject *) ((char *) data + sizeof (GpuObjectsHeader));
+
+	// until a frustum is given, planes that accept everything
+	memset (gpu_objs_header, 0, sizeof (GpuObjectsHeader));
+	for (int i = 0; i < 6; i ++)
+		gpu_objs_header->planes[i][3] = 1.0f;
+	gpu_objs_header->dispatch[1] = 1;
+	gpu_objs_header->dispatch[2] = 1;
+
+	create_buffer
+	(
+		GPU_MAX_OBJECTS * sizeof (VkDrawIndexedIndirectCommand),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&gpu_indirect_buf,
+		&gpu_indirect_buf_mem
+	);
+
+	create_buffer
+	(
+		sizeof (uint32_t),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+		VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&gpu_count_buf,
+		&gpu_count_buf_mem
+	);
+
+	// descriptors: objects, draws and draw count
+
+	VkBuffer bufs[3] = { gpu_obj_buf, gpu_indirect_buf, gpu_count_buf };
+	VkShaderStageFlags stages[3] =
+	{
+		VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		VK_SHADER_STAGE_COMPUTE_BIT
+	};
+	create_storage_set (3, bufs, stages, &gpu_set_layout, &gpu_descriptor_pool, &gpu_descriptor_set);
+
+	// cull pipeline
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = { 0 };
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = 1;
+	pipeline_layout_info.pSetLayouts = &gpu_set_layout;
+
+	assert (
+		vkCreatePipelineLayout (device, &pipeline_layout_info, NULL, &cull_pipeline_layout) == VK_SUCCESS
+	);
+	cull_pipeline = create_compute_pipeline ("build/cull.spv", cull_pipeline_layout, NULL);
+
+	// graphics pipeline layout, the regular set plus the objects
+
+	VkDescriptorSetLayout set_layouts[2] = { descriptor_set_layout, gpu_set_layout };
+	pipeline_layout_info.setLayoutCount = 2;
+	pipeline_layout_info.pSetLayouts = set_layouts;
+
+	assert (
+		vkCreatePipelineLayout (device, &pipeline_layout_info, NULL, &gpu_pipeline_layout) == VK_SUCCESS
+	);
+}
+
+/**
+ * The GPU driven graphics pipeline depends on the render pass, so it is recreated with
+ * the swapchain.
+ */
+static void create_gpu_pipeline ()
+{
+	GfxPipelineDesc desc = { 0 };
+	desc.vx_shader = "build/indirect.spv";
+	desc.frag_shader = "build/frag.spv";
+	desc.layout = gpu_pipeline_layout;
+	desc.vx_fmt = meshes[0]->fmt;
+	desc.vx_layout = meshes[0]->layout;
+
+	gpu_pipeline = build_gfx_pipeline (&desc);
+}
+
+static void destroy_gpu_resources ()
+{
+	vkDestroyPipeline (device, cull_pipeline, NULL);
+	vkDestroyPipelineLayout (device, cull_pipeline_layout, NULL);
+	vkDestroyPipelineLayout (device, gpu_pipeline_layout, NULL);
+	vkDestroyDescriptorPool (device, gpu_descriptor_pool, NULL);
+	vkDestroyDescriptorSetLayout (device, gpu_set_layout, NULL);
+
+	vkUnmapMemory (device, gpu_obj_buf_mem);
+	vkDestroyBuffer (device, gpu_obj_buf, NULL);
+	vkFreeMemory (device, gpu_obj_buf_mem, NULL);
+	vkDestroyBuffer (device, gpu_indirect_buf, NULL);
+	vkFreeMemory (device, gpu_indirect_buf_mem, NULL);
+	vkDestroyBuffer (device, gpu_count_buf, NULL);
+	vkFreeMemory (device, gpu_count_buf_mem, NULL);
+}
+
+/**
+ * Add an object to the GPU driven scene and return its index.
+ *
+ * `M` is the column major model matrix and `center`/`radius` the bounding sphere in
+ * world space.
+ */
+uint32_t gpu_object_add
+(
+	const float M[16],
+	const float center[3],
+	float radius,
+	uint32_t n_indices,
+	uint32_t first_index,
+	int32_t vx_offset
+)
+{
+	assert (gpu_objs_header->count < GPU_MAX_OBJECTS);
+
+	uint32_t i = gpu_objs_header->count;
+	GpuObject *obj = &gpu_objs[i];
+
+	memcpy (obj->M, M, sizeof (obj->M));
+	obj->sphere[0] = center[0];
+	obj->sphere[1] = center[1];
+	obj->sphere[2] = center[2];
+	obj->sphere[3] = radius;
+	obj->n_indices = n_indices;
+	obj->first_index = first_index;
+	obj->vx_offset = vx_offset;
+
+	gpu_objs_header->count = i + 1;
+	gpu_objs_header->dispatch[0] = (i + 1 + 63) / 64;
+	return i;
+}
+
+void gpu_objects_clear ()
+{
+	gpu_objs_header->count = 0;
+	gpu_objs_header->dispatch[0] = 0;
+}
+
+/**
+ * Extract the six frustum planes from a column major view projection matrix and give
+ * them to the cull pass. Planes point inwards and are normalized.
+ */
+void gpu_set_frustum (const float VP[16])
+{
+	// row i of the matrix is (VP[i], VP[4 + i], VP[8 + i], VP[12 + i])
+	for (int p = 0; p < 6; p ++)
+	{
+		int row = p / 2;
+		float sign = (p % 2) ? -1.0f : 1.0f;
+		float *plane = gpu_objs_header->planes[p];
+
+		for (int c = 0; c < 4; c ++)
+			plane[c] = VP[c * 4 + 3] + sign * VP[c * 4 + row];
+
+		// vulkan clip space depth is [0, w], the near plane is just row 2
+		if (p == 4)
+			for (int c = 0; c < 4; c ++)
+				plane[c] = VP[c * 4 + 2];
+
+		float len = sqrtf (plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		for (int c = 0; c < 4; c ++)
+			plane[c] /= len;
+	}
+}
+
+/**
+ * Put the hardcoded geometry in the GPU driven scene.
+ */
+static void init_gpu_objects ()
+{
+	const float identity[16] =
+	{
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f
+	};
+	const float center[3] = { 0.0f, 0.0f, -0.25f };
+	float M[16];
+	mesh_model_matrix (0, identity, M);
+
+	gpu_objects_clear ();
+	gpu_object_add (M, center, 0.75f, meshes[0]->n_indices, meshes[0]->base_index, meshes[0]->base_vertex);
+}
+
+/**
+ * Record the cull pass. Must be outside a render pass, the frame graph synchronizes it
+ * with the draws before and after.
+ */
+static void record_gpu_cull (VkCommandBuffer cmdbuf)
+{
+	vkCmdFillBuffer (cmdbuf, gpu_count_buf, 0, sizeof (uint32_t), 0);
+
+	memory_barrier
+	(
+		cmdbuf,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	);
+
+	vkCmdBindPipeline (cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+	vkCmdBindDescriptorSets
+	(
+		cmdbuf,
+		VK_PIPELINE_BIND_POINT_COMPUTE,
+		cull_pipeline_layout,
+		0,
+		1,
+		&gpu_descriptor_set,
+		0,
+		NULL
+	);
+
+	// a thread per live object, sized from the header so the command buffer does not
+	// depend on the object count
+	vkCmdDispatchIndirect (cmdbuf, gpu_obj_buf, offsetof (GpuObjectsHeader, dispatch));
+}
+
+/**
+ * Draw whatever survived the cull pass. Must be inside the render pass.
+ */
+static void record_gpu_draws (VkCommandBuffer cmdbuf, uint32_t img)
+{
+	vkCmdBindPipeline (cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, gpu_pipeline);
+
+	bind_vx_streams (cmdbuf, meshes[0]->vx_buf, meshes[0]->attr_offset, 0);
+
+	vkCmdBindIndexBuffer (cmdbuf, meshes[0]->idx_buf, 0, meshes[0]->idx_type);
+
+	VkDescriptorSet sets[2] = { descriptor_sets[img], gpu_descriptor_set };
+	vkCmdBindDescriptorSets
+	(
+		cmdbuf,
+		VK_PIPELINE_BIND_POINT_GRAPHICS,
+		gpu_pipeline_layout,
+		0,
+		2,
+		sets,
+		0,
+		NULL
+	);
+
+	vkCmdDrawIndexedIndirectCount
+	(
+		cmdbuf,
+		gpu_indirect_buf,
+		0,
+		gpu_count_buf,
+		0,
+		GPU_MAX_OBJECTS,
+		sizeof (VkDrawIndexedIndirectCommand)
+	);
+}
+
+/**
+ *		GPU particles.
+ *
+ * Every frame three compute passes update the particles before the render pass:
+ * simulate ages and moves the live half into the other one, emit appends new particles
+ * to it and swap makes it the live half and writes the indirect arguments. The particles
+ * are then drawn as camera facing quads with a single vkCmdDrawIndirect over the scene.
+ */
+
+/**
+ * Kill every particle. Must be outside a render pass.
+ */
+static void record_particles_reset (VkCommandBuffer cmdbuf)
+{
+	memory_barrier
+	(
+		cmdbuf,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0
+	);
+
+	vkCmdFillBuffer (cmdbuf, particle_state_buf, 0, VK_WHOLE_SIZE, 0);
+
+	memory_barrier
+	(
+		cmdbuf,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	);
+}
+
+/**
+ * Set where and how fast particles are emitted. `per_frame` particles are emitted each
+ * frame, as many as fit. Takes effect from the next frame on.
+ */
+void particles_set_emitter
+(
+	const float pos[3],
+	float radius,
+	const float vel[3],
+	float spread,
+	uint32_t per_frame
+)
+{
+	for (int i = 0; i < 3; i ++)
+	{
+		particle_params->emitter[i] = pos[i];
+		particle_params->velocity[i] = vel[i];
+	}
+	particle_params->emitter[3] = radius;
+	particle_params->velocity[3] = spread;
+	particle_params->emit = per_frame;
+}
+
+/**
+ * Create the particle buffers and compute passes for up to `capacity` live particles,
+ * and start with none. The emitter is a fountain at the origin that keeps about three
+ * quarters of them alive.
+ */
+static void create_particles (uint32_t capacity)
+{
+	// both halves must fit in one storage buffer binding
+	VkDeviceSize max = caps.props.limits.maxStorageBufferRange / (2 * sizeof (Particle));
+	if (capacity > max)
+	{
+		fprintf (stderr, "particles: %u do not fit in a storage buffer, using %u\n", capacity, (uint32_t) max);
+		capacity = (uint32_t) max;
+	}
+	n_particles = capacity;
+
+	create_buffer
+	(
+		2 * (VkDeviceSize) capacity * sizeof (Particle),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&particle_buf,
+		&particle_buf_mem
+	);
+
+	create_buffer
+	(
+		sizeof (ParticleState),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+		VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&particle_state_buf,
+		&particle_state_buf_mem
+	);
+
+	create_buffer
+	(
+		sizeof (ParticleParams),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&particle_params_buf,
+		&particle_params_buf_mem
+	);
+
+	void *data;
+	vkMapMemory (device, particle_params_buf_mem, 0, sizeof (ParticleParams), 0, &data);
+	particle_params = (ParticleParams *) data;
+
+	memset (particle_params, 0, sizeof (ParticleParams));
+	particle_params->gravity[1] = -3.0f;
+	particle_params->gravity[3] = 0.1f;
+	particle_params->color[0] = 1.0f;
+	particle_params->color[1] = 0.6f;
+	particle_params->color[2] = 0.2f;
+	particle_params->color[3] = 1.0f;
+	particle_params->lifetime = 2.0f;
+	particle_params->dt = 1.0f / 60.0f;
+	particle_params->size = 0.01f;
+	particle_params->capacity = capacity;
+
+	// particles live three quarters of the lifetime on average
+	const float pos[3] = { 0.0f, -0.5f, 0.0f }, vel[3] = { 0.0f, 2.5f, 0.0f };
+	uint32_t per_frame = (uint32_t) (capacity * particle_params->dt / particle_params->lifetime);
+	particles_set_emitter (pos, 0.05f, vel, 0.8f, per_frame > 0 ? per_frame : 1);
+
+	VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+	record_particles_reset (cmdbuf);
+	end_single_time_cmds (cmdbuf);
+
+	// descriptors: particles, state and parameters, all read by the draw
+
+	VkBuffer bufs[3] = { particle_buf, particle_state_buf, particle_params_buf };
+	VkShaderStageFlags stages[3];
+	for (int i = 0; i < 3; i ++)
+		stages[i] = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+	create_storage_set
+	(
+		3,
+		bufs,
+		stages,
+		&particle_set_layout,
+		&particle_descriptor_pool,
+		&particle_descriptor_set
+	);
+
+	// one pipeline per step of the same shader
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = { 0 };
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = 1;
+	pipeline_layout_info.pSetLayouts = &particle_set_layout;
+
+	assert (
+		vkCreatePipelineLayout (device, &pipeline_layout_info, NULL, &particle_compute_layout) == VK_SUCCESS
+	);
+
+	VkSpecializationMapEntry spec_entry = { 0, 0, sizeof (uint32_t) };
+	VkSpecializationInfo spec = { 0 };
+	spec.mapEntryCount = 1;
+	spec.pMapEntries = &spec_entry;
+	spec.dataSize = sizeof (uint32_t);
+
+	for (uint32_t step = 0; step < N_PARTICLE_STEPS; step ++)
+	{
+		spec.pData = &step;
+		particle_steps[step] = create_compute_pipeline
+		(
+			"build/particles.spv",
+			particle_compute_layout,
+			&spec
+		);
+	}
+
+	// graphics pipeline layout, the regular set plus the particles
+
+	VkDescriptorSetLayout set_layouts[2] = { descriptor_set_layout, particle_set_layout };
+	pipeline_layout_info.setLayoutCount = 2;
+	pipeline_layout_info.pSetLayouts = set_layouts;
+
+	assert (
+		vkCreatePipelineLayout (device, &pipeline_layout_info, NULL, &particle_pipeline_layout) == VK_SUCCESS
+	);
+}
+
+/**
+ * The particle graphics pipeline depends on the render pass, so it is recreated with
+ * the swapchain.
+ */
+static void create_particle_pipeline ()
+{
+	// no vertex input at all, the quads are made from the particle buffer
+	GfxPipelineDesc desc = { 0 };
+	desc.vx_shader = "build/particle_vert.spv";
+	desc.frag_shader = "build/particle_frag.spv";
+	desc.layout = particle_pipeline_layout;
+	desc.pulls = 1;
+	desc.additive = 1;
+
+	particle_pipeline = build_gfx_pipeline (&desc);
+}
+
+static void destroy_particles ()
+{
+	for (uint32_t step = 0; step < N_PARTICLE_STEPS; step ++)
+		vkDestroyPipeline (device, particle_steps[step], NULL);
+	vkDestroyPipelineLayout (device, particle_compute_layout, NULL);
+	vkDestroyPipelineLayout (device, particle_pipeline_layout, NULL);
+	vkDestroyDescriptorPool (device, particle_descriptor_pool, NULL);
+	vkDestroyDescriptorSetLayout (device, particle_set_layout, NULL);
+
+	vkUnmapMemory (device, particle_params_buf_mem);
+	vkDestroyBuffer (device, particle_params_buf, NULL);
+	vkFreeMemory (device, particle_params_buf_mem, NULL);
+	vkDestroyBuffer (device, particle_state_buf, NULL);
+	vkFreeMemory (device, particle_state_buf_mem, NULL);
+	vkDestroyBuffer (device, particle_buf, NULL);
+	vkFreeMemory (device, particle_buf_mem, NULL);
+
+	n_particles = 0;
+}
+
+/**
+ * Record the particle update of one frame. Must be outside a render pass, the frame graph
+ * synchronizes it with the previous frame's draw and this one's.
+ */
+static void record_particles_update (VkCommandBuffer cmdbuf)
+{
+	vkCmdBindDescriptorSets
+	(
+		cmdbuf,
+		VK_PIPELINE_BIND_POINT_COMPUTE,
+		particle_compute_layout,
+		0,
+		1,
+		&particle_descriptor_set,
+		0,
+		NULL
+	);
+
+	// simulate and emit are sized by the previous swap, swap is a single thread
+	vkCmdBindPipeline (cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, particle_steps[PARTICLE_SIMULATE]);
+	vkCmdDispatchIndirect (cmdbuf, particle_state_buf, offsetof (ParticleState, simulate));
+
+	memory_barrier
+	(
+		cmdbuf,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	);
+
+	vkCmdBindPipeline (cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, particle_steps[PARTICLE_EMIT]);
+	vkCmdDispatchIndirect (cmdbuf, particle_state_buf, offsetof (ParticleState, emit));
+
+	memory_barrier
+	(
+		cmdbuf,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	);
+
+	vkCmdBindPipeline (cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, particle_steps[PARTICLE_SWAP]);
+	vkCmdDispatch (cmdbuf, 1, 1, 1);
+}
+
+/**
+ * Draw the live particles. Must be inside the render pass, after the opaque draws as the
+ * particles test depth but do not write it.
+ */
+static void record_particles_draw (VkCommandBuffer cmdbuf, uint32_t img)
+{
+	vkCmdBindPipeline (cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, particle_pipeline);
+
+	VkDescriptorSet sets[2] = { descriptor_sets[img], particle_descriptor_set };
+	vkCmdBindDescriptorSets
+	(
+		cmdbuf,
+		VK_PIPELINE_BIND_POINT_GRAPHICS,
+		particle_pipeline_layout,
+		0,
+		2,
+		sets,
+		0,
+		NULL
+	);
+
+	// six vertices per particle, one instance each
+	vkCmdDrawIndirect (cmdbuf, particle_state_buf, offsetof (ParticleState, draw), 1, 0);
+}
+
+/**
+ * Remove all draws from the draw list.
+ */
+void draw_list_clear ()
+{
+	n_draws = 0;
+	draw_list_gen ++;
+}
+
+/**
+ * Append a draw to the draw list.
+ */
+void draw_list_add (const DrawCmd *cmd)
+{
+	if (n_draws == draw_list_cap)
+	{
+		draw_list_cap = draw_list_cap ? draw_list_cap * 2 : 16;
+		draw_list = realloc (draw_list, draw_list_cap * sizeof (DrawCmd));
+		draw_keys = realloc (draw_keys, 2 * draw_list_cap * sizeof (uint64_t));
+		draw_order = realloc (draw_order, 2 * draw_list_cap * sizeof (uint32_t));
+	}
+
+	draw_list[n_draws ++] = *cmd;
+	draw_list_gen ++;
+
+	// meshlets draw the whole mesh, a range of its indices is drawn indexed
+	DrawCmd *added = &draw_list[n_draws - 1];
+	if
+	(
+		rq_pipelines[added->pipeline].meshlets &&
+		(added->first_index != 0 || added->n_indices != rq_meshes[added->mesh].lods[0].n_indices)
+	)
+		added->pipeline = mesh_indexed_pipeline (added->mesh);
+}
+
+/**
+ * Mark the draw list as changed without changing it, e.g. after it has been edited in
+ * place, so command buffers are re-recorded.
+ */
+void draw_list_touch ()
+{
+	draw_list_gen ++;
+}
+
+/**
+ * Register the pipelines and descriptor sets the template itself creates. There is a
+ * pipeline per vertex layout and format, registered as `pipelines` is ordered, see
+ * `mesh_pipeline`. Meshes register themselves in `mesh_add`.
+ */
+static void init_render_queue ()
+{
+	n_rq_pipelines = n_rq_materials = 0;
+	for (int l = 0; l < VX_LAYOUT_COUNT; l ++)
+	{
+		for (int i = 0; i < VX_FMT_COUNT; i ++)
+		{
+			uint32_t p = rq_pipeline_add (&pipelines[l][i], &pipeline_layout);
+			rq_pipeline_prepass (p, &depth_pipelines[l][i], &equal_pipelines[l][i]);
+		}
+	}
+
+	if (has_bda)
+	{
+		rq_pull_pipeline = rq_pipeline_add (&pull_pipeline, &pull_pipeline_layout);
+		rq_pipeline_prepass (rq_pull_pipeline, &pull_depth_pipeline, &pull_equal_pipeline);
+		rq_pipelines[rq_pull_pipeline].pulls = 1;
+	}
+
+	// no pre-pass variants, meshlets are shaded with their own depth test after it
+	if (has_mesh_shader)
+	{
+		rq_meshlet_pipeline = rq_pipeline_add (&meshlet_pipeline, &meshlet_pipeline_layout);
+		rq_pipelines[rq_meshlet_pipeline].meshlets = 1;
+	}
+	rq_material_add (&descriptor_sets);
+}
+
+static uint64_t rq_key (const DrawCmd *cmd)
+{
+	float d = cmd->depth < 0.0f ? 0.0f : cmd->depth > 1.0f ? 1.0f : cmd->depth;
+	if (cmd->pass >= RQ_PASS_TRANSPARENT)
+		d = 1.0f - d;
+
+	uint64_t depth = (uint64_t) (d * ((1 << RQ_DEPTH_BITS) - 1));
+	uint64_t key = cmd->pass;
+	key = (key << RQ_PIPELINE_BITS) | cmd->pipeline;
+	key = (key << RQ_MATERIAL_BITS) | cmd->material;
+	key = (key << RQ_MESH_BITS) | cmd->mesh;
+	key = (key << RQ_DEPTH_BITS) | depth;
+
+	return key;
+}
+
+/**
+ * LSD radix sort of keys with their values, one byte at a time. Bytes that are the same
+ * for every key, which is most of them for a typical scene, are skipped.
+ */
+static void radix_sort (uint64_t *keys, uint32_t *vals, uint64_t *tmp_keys, uint32_t *tmp_vals, uint32_t n)
+{
+	uint64_t *src_k = keys, *dst_k = tmp_keys;
+	uint32_t *src_v = vals, *dst_v = tmp_vals;
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		uint32_t count[256] = { 0 };
+		for (uint32_t i = 0; i < n; i ++)
+			count[(src_k[i] >> shift) & 0xff] ++;
+
+		if (count[(src_k[0] >> shift) & 0xff] == n)
+			continue;
+
+		uint32_t sum = 0;
+		for (int b = 0; b < 256; b ++)
+		{
+			uint32_t c = count[b];
+			count[b] = sum;
+			sum += c;
+		}
+
+		for (uint32_t i = 0; i < n; i ++)
+		{
+			uint32_t j = count[(src_k[i] >> shift) & 0xff] ++;
+			dst_k[j] = src_k[i];
+			dst_v[j] = src_v[i];
+		}
+
+		uint64_t *tk = src_k; src_k = dst_k; dst_k = tk;
+		uint32_t *tv = src_v; src_v = dst_v; dst_v = tv;
+	}
+
+	if (src_k != keys)
+	{
+		memcpy (keys, src_k, n * sizeof (uint64_t));
+		memcpy (vals, src_v, n * sizeof (uint32_t));
+	}
+}
+
+/**
+ * Sort the draw list into `draw_order` if it changed since the last sort.
+ */
+static void render_queue_sort ()
+{
+	if (draw_sorted_gen == draw_list_gen || n_draws == 0)
+		return;
+
+	for (uint32_t i = 0; i < n_draws; i ++)
+	{
+		draw_keys[i] = rq_key (&draw_list[i]);
+		draw_order[i] = i;
+	}
+
+	// the second half of the arrays is scratch space
+	radix_sort (draw_keys, draw_order, draw_keys + draw_list_cap, draw_order + draw_list_cap, n_draws);
+	draw_sorted_gen = draw_list_gen;
+}
+
+static void rq_stats_add (RenderQueueStats *dst, const RenderQueueStats *src)
+{
+	dst->draws += src->draws;
+	dst->pipeline_binds += src->pipeline_binds;
+	dst->descriptor_binds += src->descriptor_binds;
+	dst->vertex_binds += src->vertex_binds;
+	dst->index_binds += src->index_binds;
+	dst->binds_eliminated += src->binds_eliminated;
+}
+
+/**
+ * Bind counters of the last recorded command buffer.
+ */
+RenderQueueStats render_queue_stats ()
+{
+	return rq_stats;
+}
+
+void instances_clear ()
+{
+	n_instances = 0;
+}
+
+/**
+ * Append an instance and return its index, to be used as `first_instance` in a draw.
+ *
+ * `M` is the column major model matrix and `tex` the texture layer. Instances are
+ * streamed to the GPU every frame, so they can be changed freely between frames.
+ */
+uint32_t instance_add (const float M[16], uint32_t tex)
+{
+	if (n_instances == instances_cap)
+	{
+		instances_cap = instances_cap ? instances_cap * 2 : 64;
+		instances = realloc (instances, instances_cap * sizeof (InstanceData));
+		inst_lods = realloc (inst_lods, instances_cap);
+	}
+
+	InstanceData *inst = &instances[n_instances];
+	memcpy (inst->M, M, sizeof (inst->M));
+	inst->tex = tex;
+	inst_lods[n_instances] = 0;
+
+	return n_instances ++;
+}
+
+InstanceData *instance_get (uint32_t i)
+{
+	assert (i < n_instances);
+	return &instances[i];
+}
+
+/**
+ * Coarsest level of detail of `m` that instance `inst` can be drawn with from the
+ * current camera, the first whose error covers at most LOD_PIXEL_ERROR pixels.
+ */
+static uint32_t instance_lod (const Mesh *m, const InstanceData *inst)
+{
+	const float *MQ = inst->M, *V = camera.V, *P = camera.P;
+
+	// middle of the bounds in stored units, then in view space
+	float c[4] = { 0.0f, 0.0f, 0.0f, 1.0f }, w[4], v[4];
+	for (int k = 0; k < 3; k ++)
+		c[k] = (0.5f * (m->min[k] + m->max[k]) - m->dequant[12 + k]) / m->dequant[k * 5];
+	mat4_mul_vec4 (w, MQ, c);
+	mat4_mul_vec4 (v, V, w);
+
+	// stored units to world, the longest axis of the instance, and the bounding radius
+	float scale = 0.0f;
+	for (int k = 0; k < 3; k ++)
+		scale = fmaxf (scale, sqrtf (MQ[k * 4] * MQ[k * 4] + MQ[k * 4 + 1] * MQ[k * 4 + 1] + MQ[k * 4 + 2] * MQ[k * 4 + 2]));
+	float radius = 0.0f;
+	for (int k = 0; k < 3; k ++)
+		radius += (m->max[k] - m->min[k]) * (m->max[k] - m->min[k]) / (m->dequant[k * 5] * m->dequant[k * 5]);
+	radius = 0.5f * sqrtf (radius) * scale;
+
+	// world units to pixels at the nearest point of the bounds, flat for orthographic
+	float px = 0.5f * swapchain_ext.height * fabsf (P[5]);
+	if (P[11] != 0.0f)
+	{
+		float dist = -v[2] - radius;
+		if (dist <= 0.0f)
+			return 0;
+		px /= dist;
+	}
+
+	uint32_t l = 0;
+	while (l + 1 < m->n_lods && m->lods[l + 1].error * scale * px <= LOD_PIXEL_ERROR)
+		l ++;
+	return l;
+}
+
+/**
+ * Fill the draw list with the loaded mesh files side by side, each fit into its share of
+ * the view by the bounds of all its meshes.
+ */
+static void init_mesh_draw_list ()
+{
+	float cell = 2.0f / n_mesh_files;
+
+	instances_clear ();
+	draw_list_clear ();
+
+	for (uint32_t f = 0; f < n_mesh_files; f ++)
+	{
+		float lo[3], hi[3];
+		for (int k = 0; k < 3; k ++)
+		{
+			lo[k] = INFINITY;
+			hi[k] = -INFINITY;
+		}
+		for (uint32_t i = mesh_file_first[f]; i < mesh_file_first[f] + mesh_file_count[f]; i ++)
+			for (int k = 0; k < 3; k ++)
+			{
+				lo[k] = fminf (lo[k], meshes[i]->min[k]);
+				hi[k] = fmaxf (hi[k], meshes[i]->max[k]);
+			}
+
+		float extent = 0.0f;
+		for (int k = 0; k < 3; k ++)
+			extent = fmaxf (extent, hi[k] - lo[k]);
+		float s = 0.9f * fminf (cell, 1.0f) / (extent > 0.0f ? extent : 1.0f);
+
+		float M[16];
+		mat4_identity (M);
+		M[0] = M[5] = M[10] = s;
+		M[12] = -1.0f + cell * (f + 0.5f) - s * 0.5f * (lo[0] + hi[0]);
+		M[13] = -s * 0.5f * (lo[1] + hi[1]);
+		M[14] = 0.5f - s * 0.5f * (lo[2] + hi[2]);
+
+		for (uint32_t i = mesh_file_first[f]; i < mesh_file_first[f] + mesh_file_count[f]; i ++)
+		{
+			float MQ[16];
+			mesh_model_matrix (i, M, MQ);
+
+			DrawCmd cmd = { 0 };
+			cmd.n_indices = meshes[i]->n_indices;
+			cmd.n_instances = 1;
+			cmd.first_instance = instance_add (MQ, 0);
+			cmd.mesh = i;
+			cmd.pipeline = mesh_pipeline (i);
+			draw_list_add (&cmd);
+		}
+	}
+}
+
+/**
+ * Fill the draw list with the draws of the cooked scene.
+ */
+static void init_cooked_draw_list ()
+{
+	instances_clear ();
+	draw_list_clear ();
+
+	for (uint32_t i = 0; i < scene.hdr->n_instances; i ++)
+		instance_add (scene.instances[i].M, scene.instances[i].tex);
+
+	for (uint32_t i = 0; i < scene.hdr->n_draws; i ++)
+	{
+		const CookedDraw *d = &scene.draws[i];
+
+		DrawCmd cmd = { 0 };
+		cmd.n_indices = d->n_indices;
+		cmd.n_instances = d->n_instances;
+		cmd.first_index = d->first_index;
+		cmd.vx_offset = d->vx_offset;
+		cmd.first_instance = d->first_instance;
+		cmd.mesh = scene.first_mesh + d->mesh;
+		cmd.pipeline = mesh_pipeline (cmd.mesh);
+		draw_list_add (&cmd);
+	}
+}
+
+/**
+ * Pad `fp` with zeros up to the next multiple of COOKED_ALIGN and write `size` bytes of
+ * `data` there, returning their offset.
+ */
+static uint64_t cook_blob (FILE *fp, const void *data, uint64_t size)
+{
+	static const uint8_t zeros[COOKED_ALIGN] = { 0 };
+
+	uint64_t at = (uint64_t) ftell (fp);
+	uint64_t pad = (COOKED_ALIGN - at % COOKED_ALIGN) % COOKED_ALIGN;
+	fwrite (zeros, 1, pad, fp);
+	if (size)
+		fwrite (data, 1, size, fp);
+
+	return at + pad;
+}
+
+/**
+ * Write meshes `first` up to `first + count` and the draws of them in the draw list to
+ * `fname` as a cooked scene. The meshes are read back from the device, so the file holds
+ * exactly what was uploaded.
+ */
+static void cook_scene (const char *fname, uint32_t first, uint32_t count)
+{
+	FILE *fp = fopen (fname, "wb");
+	if (!fp)
+	{
+		fprintf (stderr, "could not write %s!\n", fname);
+		exit (1);
+	}
+
+	CookedHeader hdr = { 0 };
+	hdr.magic = COOKED_MAGIC;
+	hdr.version = COOKED_VERSION;
+	hdr.n_meshes = count;
+	hdr.instance_size = sizeof (InstanceData);
+
+	CookedMesh *cm = calloc (count ? count : 1, sizeof (CookedMesh));
+	CookedDraw *cd = calloc (n_draws ? n_draws : 1, sizeof (CookedDraw));
+	InstanceData *inst = malloc ((n_instances ? n_instances : 1) * sizeof (InstanceData));
+
+	// draws of the meshes, with the instances they use packed together
+
+	for (uint32_t i = 0; i < n_draws; i ++)
+	{
+		const DrawCmd *cmd = &draw_list[i];
+		if (cmd->mesh < first || cmd->mesh >= first + count)
+			continue;
+
+		CookedDraw *d = &cd[hdr.n_draws ++];
+		d->mesh = cmd->mesh - first;
+		d->n_indices = cmd->n_indices;
+		d->n_instances = cmd->n_instances;
+		d->first_index = cmd->first_index;
+		d->vx_offset = cmd->vx_offset;
+		d->first_instance = hdr.n_instances;
+
+		memcpy (&inst[hdr.n_instances], &instances[cmd->first_instance], cmd->n_instances * sizeof (InstanceData));
+		hdr.n_instances += cmd->n_instances;
+	}
+
+	// the tables are written once the blob offsets are known, leave room for them first
+
+	fwrite (&hdr, sizeof (hdr), 1, fp);
+	hdr.meshes = cook_blob (fp, cm, count * sizeof (CookedMesh));
+	hdr.draws = cook_blob (fp, cd, hdr.n_draws * sizeof (CookedDraw));
+	hdr.instances = cook_blob (fp, inst, hdr.n_instances * sizeof (InstanceData));
+
+	for (uint32_t i = 0; i < count; i ++)
+	{
+		const Mesh *m = meshes[first + i];
+		CookedMesh *c = &cm[i];
+
+		c->fmt = m->fmt;
+		c->layout = m->layout;
+		c->idx_type = m->idx_type;
+		c->n_vertices = m->n_vertices;
+		c->n_indices = m->n_indices;
+		c->attr_offset = m->layout == VX_LAYOUT_SPLIT ? vx_split_offset (m->fmt, m->n_vertices) : 0;
+		memcpy (c->min, m->min, sizeof (c->min));
+		memcpy (c->max, m->max, sizeof (c->max));
+		memcpy (c->dequant, m->dequant, sizeof (c->dequant));
+		memcpy (c->lods, m->lods, sizeof (c->lods));
+		c->n_lods = m->n_lods;
+		c->vx_size = vx_layout_size (m->fmt, m->n_vertices);
+		c->idx_size = (uint64_t) mesh_index_count (m) * mesh_index_size (m);
+
+		void *vx = malloc (c->vx_size), *idx = malloc (c->idx_size);
+		mesh_read (m, vx, idx);
+		c->vx = cook_blob (fp, vx, c->vx_size);
+		c->idx = cook_blob (fp, idx, c->idx_size);
+		free (vx);
+		free (idx);
+
+		if (m->n_meshlets > 0)
+		{
+			c->n_meshlets = m->n_meshlets;
+			c->meshlets_size = m->meshlet_size;
+
+			VkBufferCopy r = { 0 };
+			r.size = m->meshlet_size;
+			void *blob = malloc (m->meshlet_size);
+			read_buf (m->meshlet_buf, &r, 1, m->meshlet_size, blob);
+			c->meshlets = cook_blob (fp, blob, c->meshlets_size);
+			free (blob);
+		}
+	}
+
+	cook_blob (fp, NULL, 0);
+	hdr.size = (uint64_t) ftell (fp);
+
+	fseek (fp, 0, SEEK_SET);
+	fwrite (&hdr, sizeof (hdr), 1, fp);
+	fseek (fp, (long) hdr.meshes, SEEK_SET);
+	fwrite (cm, sizeof (CookedMesh), count, fp);
+
+	if (ferror (fp) | fclose (fp))
+	{
+		fprintf (stderr, "could not write %s!\n", fname);
+		exit (1);
+	}
+
+#ifdef DEBUG
+	printf ("cooked %u meshes and %u draws into %s, %lu bytes\n", count, hdr.n_draws, fname, (unsigned long) hdr.size);
+#endif
+
+	free (cm);
+	free (cd);
+	free (inst);
+}
+
+/**
+ * Fill the draw list with the hardcoded geometry, or the cooked scene or meshes given on
+ * the command line if there are any.
+ *
+ * Both squares are the same quad, so it is drawn once with two instances.
+ */
+static void init_draw_list ()
+{
+	if (scene_file)
+	{
+		init_cooked_draw_list ();
+		return;
+	}
+	else if (n_mesh_files > 0)
+	{
+		init_mesh_draw_list ();
+		return;
+	}
+
+	float M[16] =
+	{
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f
+	};
+
+	float MQ[16];
+
+	instances_clear ();
+	mesh_model_matrix (0, M, MQ);
+	uint32_t first = instance_add (MQ, 0);
+	M[14] = -0.5f; // second square sits behind the first
+	mesh_model_matrix (0, M, MQ);
+	instance_add (MQ, 0);
+
+	DrawCmd cmd = { 0 };
+	cmd.n_indices = 6; // one quad
+	cmd.n_instances = 2;
+	cmd.first_instance = first;
+	cmd.mesh = 0;
+	cmd.pipeline = mesh_pipeline (0);
+
+	draw_list_clear ();
+	draw_list_add (&cmd);
+}
+
+/**
+ * Begin `render_pass` or `depth_render_pass` outside the frame graph, on swapchain image
+ * `img` and the graph's depth buffer.
+ */
+static void begin_render_pass
+(
+	VkCommandBuffer cmdbuf,
+	VkRenderPass pass,
+	uint32_t img,
+	VkSubpassContents contents
+)
+{
+	int depth_only = pass == depth_render_pass;
+
+	VkClearColorValue clclrv = { 0.0f, 0.0f, 0.0f, 1.0f };
+	VkClearDepthStencilValue clstencilv = { 1.0f, 0.f };
+	VkClearValue clear_values[2] = { 0 };
+	clear_values[0].color = clclrv;
+	clear_values[1].depthStencil = clstencilv;
+
+	VkOffset2D offset = { 0, 0 };
+	VkRenderPassBeginInfo render_pass_info = { 0 };
+	render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	render_pass_info.renderPass = pass;
+	render_pass_info.framebuffer = depth_only ? depth_framebuf : swapchain_framebufs[img];
+	render_pass_info.renderArea.offset = offset;
+	render_pass_info.renderArea.extent = swapchain_ext;
+	render_pass_info.clearValueCount = depth_only ? 1 : 2;
+	render_pass_info.pClearValues = depth_only ? &clear_values[1] : clear_values;
+
+	vkCmdBeginRenderPass (cmdbuf, &render_pass_info, contents);
+	if (contents == VK_SUBPASS_CONTENTS_INLINE)
+		set_viewport (cmdbuf, swapchain_ext);
+}
+
+/**
+ * Record draws [first, first + count) of the sorted draw list with the `variant` of their
+ * pipelines, binding state only when it differs from the previous draw.
+ *
+ * The depth variant leaves out transparent draws and those whose pipeline has no depth
+ * variant, they are shaded with their own depth test after the pre-pass.
+ */
+static void record_draws
+(
+	VkCommandBuffer cmdbuf,
+	uint32_t img,
+	uint32_t first,
+	uint32_t count,
+	RqDrawVariant variant,
+	RenderQueueStats *stats
+)
+{
+	VkPipeline cur_pipe = VK_NULL_HANDLE;
+	VkPipelineLayout cur_layout = VK_NULL_HANDLE;
+	VkDescriptorSet cur_set = VK_NULL_HANDLE;
+	VkBuffer cur_vx = VK_NULL_HANDLE;
+	VkBuffer cur_idx = VK_NULL_HANDLE;
+	VkIndexType cur_idx_type = VK_INDEX_TYPE_UINT16;
+	const PullConstants *cur_pull = NULL;
+
+	memset (stats, 0, sizeof (RenderQueueStats));
+
+	// instances are shared by every draw, meshlet draws read them by address
+	VkDeviceSize zero = 0;
+	vkCmdBindVertexBuffers (cmdbuf, 1, 1, &inst_bufs[img], &zero);
+	VkDeviceAddress inst_addr = has_mesh_shader ? buffer_address (inst_bufs[img]) : 0;
+
+	for (uint32_t i = first; i < first + count; i ++)
+	{
+		const DrawCmd *cmd = &draw_list[draw_order[i]];
+		const RqPipeline *pipe = &rq_pipelines[cmd->pipeline];
+		const RqMesh *mesh = &rq_meshes[cmd->mesh];
+		VkDescriptorSet set = (*rq_materials[cmd->material].sets)[img];
+
+		VkPipeline p = *pipe->pipe;
+		if (variant == RQ_DRAW_DEPTH)
+		{
+			if (!pipe->depth || cmd->pass >= RQ_PASS_TRANSPARENT)
+				continue;
+			p = *pipe->depth;
+		}
+		else if (variant == RQ_DRAW_EQUAL && pipe->equal && cmd->pass < RQ_PASS_TRANSPARENT)
+			p = *pipe->equal;
+
+		if (p != cur_pipe)
+		{
+			vkCmdBindPipeline (cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, p);
+			cur_pipe = p;
+			stats->pipeline_binds ++;
+		}
+
+		if (set != cur_set || *pipe->layout != cur_layout)
+		{
+			vkCmdBindDescriptorSets
+			(
+				cmdbuf,
+				VK_PIPELINE_BIND_POINT_GRAPHICS,
+				*pipe->layout,
+				0,
+				1,
+				&set,
+				0,
+				NULL
+			);
+			cur_set = set;
+			cur_layout = *pipe->layout;
+			cur_pull = NULL;
+			stats->descriptor_binds ++;
+		}
+
+		// a task shader workgroup per MESHLET_TASK_SIZE meshlets of each instance
+		if (pipe->meshlets)
+		{
+			MeshletConstants c = { 0 };
+			c.pull = mesh->pull;
+			c.meshlets = mesh->meshlets;
+			c.instances = inst_addr;
+			c.base_vertex = mesh->base_vertex + cmd->vx_offset;
+			c.n_meshlets = mesh->n_meshlets;
+			c.first_instance = cmd->first_instance;
+
+			vkCmdPushConstants
+			(
+				cmdbuf,
+				*pipe->layout,
+				VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT,
+				0,
+				sizeof (MeshletConstants),
+				&c
+			);
+			cur_pull = NULL;
+			stats->vertex_binds ++;
+
+			cmd_draw_mesh_tasks
+			(
+				cmdbuf,
+				(mesh->n_meshlets + MESHLET_TASK_SIZE - 1) / MESHLET_TASK_SIZE,
+				cmd->n_instances,
+				1
+			);
+			stats->draws ++;
+			continue;
+		}
+
+		// pulling pipelines get the vertices by push constants instead of bound buffers
+		if (pipe->pulls)
+		{
+			if (!cur_pull || memcmp (cur_pull, &mesh->pull, sizeof (PullConstants)) != 0)
+			{
+				vkCmdPushConstants
+				(
+					cmdbuf,
+					*pipe->layout,
+					VK_SHADER_STAGE_VERTEX_BIT,
+					0,
+					sizeof (PullConstants),
+					&mesh->pull
+				);
+				cur_pull = &mesh->pull;
+				stats->vertex_binds ++;
+			}
+		}
+		else if (*mesh->vx_buf != cur_vx)
+		{
+			bind_vx_streams (cmdbuf, *mesh->vx_buf, mesh->attr_offset, variant == RQ_DRAW_DEPTH);
+			cur_vx = *mesh->vx_buf;
+			stats->vertex_binds ++;
+		}
+
+		if (*mesh->idx_buf != cur_idx || mesh->idx_type != cur_idx_type)
+		{
+			vkCmdBindIndexBuffer (cmdbuf, *mesh->idx_buf, 0, mesh->idx_type);
+			cur_idx = *mesh->idx_buf;
+			cur_idx_type = mesh->idx_type;
+			stats->index_binds ++;
+		}
+
+		if (!use_lods || mesh->n_lods < 2 || cmd->first_index != 0 || cmd->n_indices != mesh->lods[0].n_indices)
+		{
+			vkCmdDrawIndexed
+			(
+				cmdbuf,
+				cmd->n_indices,
+				cmd->n_instances,
+				mesh->base_index + cmd->first_index,
+				mesh->base_vertex + cmd->vx_offset,
+				cmd->first_instance
+			);
+			stats->draws ++;
+			continue;
+		}
+
+		// a draw per run of instances at the same level of detail
+		uint32_t end = cmd->first_instance + cmd->n_instances;
+		for (uint32_t j = cmd->first_instance; j < end; )
+		{
+			uint32_t run = j + 1;
+			while (run < end && inst_lods[run] == inst_lods[j])
+				run ++;
+
+			const MeshLod *lod = &mesh->lods[inst_lods[j]];
+			vkCmdDrawIndexed
+			(
+				cmdbuf,
+				lod->n_indices,
+				run - j,
+				mesh->base_index + lod->first_index,
+				mesh->base_vertex + cmd->vx_offset,
+				j
+			);
+			stats->draws ++;
+			j = run;
+		}
+	}
+
+	stats->binds_eliminated = 4 * stats->draws - (
+		stats->pipeline_binds +
+		stats->descriptor_binds +
+		stats->vertex_binds +
+		stats->index_binds
+	);
+}
+
+/**
+ * Copy the rendered color image `img` to its readback buffer. The frame graph has it in
+ * TRANSFER_SRC_OPTIMAL and takes it on to its final layout after.
+ */
+static void record_readback (VkCommandBuffer cmdbuf, uint32_t img)
+{
+	VkBufferImageCopy region = { 0 };
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent.width = swapchain_ext.width;
+	region.imageExtent.height = swapchain_ext.height;
+	region.imageExtent.depth = 1;
+
+	vkCmdCopyImageToBuffer
+	(
+		cmdbuf,
+		swapchain_imgs[img],
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		readback_bufs[img],
+		1,
+		&region
+	);
+
+	// make the copy visible to the host once the fence signals
+	VkBufferMemoryBarrier host = { 0 };
+	host.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	host.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	host.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	host.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	host.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	host.buffer = readback_bufs[img];
+	host.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier
+	(
+		cmdbuf,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT,
+		0, 0, NULL, 1, &host, 0, NULL
+	);
+}
+
+/**
+ * Whether frames count their fragment shader invocations. It needs pipeline statistics,
+ * and inherited queries if the draws are in secondary command buffers.
+ */
+static int frame_stats_enabled (int secondaries)
+{
+	return frame_stats_pool != VK_NULL_HANDLE && (!secondaries || has_inherited_queries);
+}
+
+static void begin_frame_stats (VkCommandBuffer cmdbuf, uint32_t img, int secondaries)
+{
+	if (!frame_stats_enabled (secondaries)) return;
+
+	vkCmdResetQueryPool (cmdbuf, frame_stats_pool, img, 1);
+	vkCmdBeginQuery (cmdbuf, frame_stats_pool, img, 0);
+}
+
+static void end_frame_stats (VkCommandBuffer cmdbuf, uint32_t img, int secondaries)
+{
+	if (!frame_stats_enabled (secondaries)) return;
+
+	vkCmdEndQuery (cmdbuf, frame_stats_pool, img);
+}
+
+/**
+ *		Frame graph passes, `user` is unused.
+ */
+
+static void pass_cull (VkCommandBuffer cmdbuf, uint32_t img, void *user)
+{
+	record_gpu_cull (cmdbuf);
+}
+
+static void pass_particles (VkCommandBuffer cmdbuf, uint32_t img, void *user)
+{
+	record_particles_update (cmdbuf);
+}
+
+/**
+ * The opaque draws of the sorted draw list, the shading pass then starts from their
+ * depth.
+ */
+static void pass_depth_prepass (VkCommandBuffer cmdbuf, uint32_t img, void *user)
+{
+	record_draws (cmdbuf, img, 0, n_draws, RQ_DRAW_DEPTH, &prepass_stats);
+}
+
+/**
+ * Everything in the draw list, or the secondary command buffers it was recorded into on
+ * the recording threads.
+ */
+static void pass_shading (VkCommandBuffer cmdbuf, uint32_t img, void *user)
+{
+	if (frame_graph.passes[frame_pass_shading].contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+	{
+		uint32_t n = n_record_threads;
+		vkCmdExecuteCommands (cmdbuf, n, &thread_cmdbufs[img * n]);
+		return;
+	}
+
+	if (gpu_driven)
+		record_gpu_draws (cmdbuf, img);
+	else
+		record_draws
+		(
+			cmdbuf,
+			img,
+			0,
+			n_draws,
+			depth_prepass ? RQ_DRAW_EQUAL : RQ_DRAW_SHADED,
+			&rq_stats
+		);
+	if (n_particles)
+		record_particles_draw (cmdbuf, img);
+}
+
+static void pass_readback (VkCommandBuffer cmdbuf, uint32_t img, void *user)
+{
+	record_readback (cmdbuf, img);
+}
+
+/**
+ * Declare the frame to the frame graph and compile it: the cull and particle updates,
+ * the depth pre-pass if it is on, shading the swapchain image and copying it out. The
+ * depth buffer is the graph's. The GPU driven path always draws in one pass.
+ */
+static void create_frame_graph ()
+{
+	RenderGraph *g = &frame_graph;
+	int prepass = depth_prepass && !gpu_driven;
+
+	rg_init (g, swapchain_ext, n_swapchain_img_views);
+
+	uint32_t color = rg_import_image
+	(
+		g,
+		"color",
+		swapchain_imgs,
+		swapchain_img_views,
+		n_swapchain_img_views,
+		swapchain_img_fmt,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, // where the acquire is waited on
+		headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+	);
+	frame_depth = rg_create_image (g, "depth", find_depth_fmt ());
+
+	uint32_t draws = 0, count = 0, particles = 0, state = 0;
+	if (gpu_driven)
+	{
+		draws = rg_import_buffer (g, "indirect draws", gpu_indirect_buf);
+		count = rg_import_buffer (g, "draw count", gpu_count_buf);
+
+		uint32_t cull = rg_add_pass (g, "cull", 0, pass_cull, NULL);
+		rg_use (g, cull, draws, RG_STORAGE_WRITE);
+		rg_use (g, cull, count, RG_TRANSFER_DST | RG_STORAGE_READ | RG_STORAGE_WRITE);
+	}
+	if (n_particles)
+	{
+		particles = rg_import_buffer (g, "particles", particle_buf);
+		state = rg_import_buffer (g, "particle state", particle_state_buf);
+
+		uint32_t update = rg_add_pass (g, "particles", 0, pass_particles, NULL);
+		rg_use (g, update, particles, RG_STORAGE_READ | RG_STORAGE_WRITE);
+		rg_use (g, update, state, RG_STORAGE_READ | RG_STORAGE_WRITE | RG_INDIRECT);
+	}
+
+	if (prepass)
+	{
+		uint32_t pre = rg_add_pass (g, "depth prepass", RG_PASS_RASTER, pass_depth_prepass, NULL);
+		rg_use (g, pre, frame_depth, RG_DEPTH);
+	}
+
+	frame_pass_shading = rg_add_pass (g, "shading", RG_PASS_RASTER, pass_shading, NULL);
+	rg_use (g, frame_pass_shading, color, RG_COLOR);
+	rg_use (g, frame_pass_shading, frame_depth, RG_DEPTH);
+	if (gpu_driven)
+	{
+		rg_use (g, frame_pass_shading, draws, RG_INDIRECT);
+		rg_use (g, frame_pass_shading, count, RG_INDIRECT);
+	}
+	if (n_particles)
+	{
+		rg_use (g, frame_pass_shading, particles, RG_VERTEX_READ);
+		rg_use (g, frame_pass_shading, state, RG_VERTEX_READ | RG_INDIRECT);
+	}
+
+	if (readback)
+	{
+		uint32_t copy = rg_add_pass (g, "readback", RG_PASS_KEEP, pass_readback, NULL);
+		rg_use (g, copy, color, RG_TRANSFER_SRC);
+	}
+
+	rg_compile (g);
+}
+
+/**
+ * Record the frame graph for the swapchain image `img` with everything in the draw list.
+ */
+static void record_cmdbuf (VkCommandBuffer cmdbuf, uint32_t img)
+{
+	if (!gpu_driven)
+		render_queue_sort ();
+
+	frame_graph.passes[frame_pass_shading].contents = VK_SUBPASS_CONTENTS_INLINE;
+	memset (&prepass_stats, 0, sizeof (prepass_stats));
+
+	begin_frame_stats (cmdbuf, img, 0);
+	rg_execute (&frame_graph, cmdbuf, img);
+	end_frame_stats (cmdbuf, img, 0);
+
+	rq_stats_add (&rq_stats, &prepass_stats);
+}
+
+/**
+ * Record a slice of the draw list into a secondary command buffer that continues the
+ * render pass. Runs on a worker thread; the pool belongs to that thread alone.
+ */
+static void record_secondary (RecordJob *job)
+{
+	assert (vkResetCommandPool (device, job->pool, 0) == VK_SUCCESS);
+
+	VkCommandBufferInheritanceInfo inherit = { 0 };
+	inherit.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	// any render pass compatible with the graph's shading pass, the framebuffer is not known
+	inherit.renderPass = render_pass;
+	inherit.subpass = 0;
+	inherit.framebuffer = VK_NULL_HANDLE;
+	if (frame_stats_enabled (1))
+		inherit.pipelineStatistics =
+			VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+	VkCommandBufferBeginInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	// not one time submit, the primary executing it is resubmitted until the draw list changes
+	info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	info.pInheritanceInfo = &inherit;
+
+	assert (vkBeginCommandBuffer (job->cmdbuf, &info) == VK_SUCCESS);
+	// secondaries inherit no dynamic state from the primary
+	set_viewport (job->cmdbuf, swapchain_ext);
+	record_draws
+	(
+		job->cmdbuf,
+		job->img,
+		job->first,
+		job->count,
+		depth_prepass ? RQ_DRAW_EQUAL : RQ_DRAW_SHADED,
+		&job->stats
+	);
+	// the last slice is executed last, the particles go over everything in it
+	if (n_particles && job == &record_jobs[n_record_threads - 1])
+		record_particles_draw (job->cmdbuf, job->img);
+	assert (vkEndCommandBuffer (job->cmdbuf) == VK_SUCCESS);
+}
+
+static void *record_worker (void *arg)
+{
+	RecordJob *job = (RecordJob *) arg;
+	uint64_t seen = 0;
+
+	pthread_mutex_lock (&record_mutex);
+	for (;;)
+	{
+		while (record_batch == seen && !record_quit)
+			pthread_cond_wait (&record_start, &record_mutex);
+
+		if (record_quit)
+			break;
+
+		seen = record_batch;
+		pthread_mutex_unlock (&record_mutex);
+
+		record_secondary (job);
+
+		pthread_mutex_lock (&record_mutex);
+		if (-- record_pending == 0)
+			pthread_cond_signal (&record_done);
+	}
+	pthread_mutex_unlock (&record_mutex);
+
+	return NULL;
+}
+
+/**
+ * A command pool and secondary command buffer per recording thread per swapchain image.
+ * Secondaries are kept per image like the primaries executing them, so re-recording one
+ * image's never invalidates another's.
+ */
+static void create_thread_cmdbufs ()
+{
+	uint32_t n = n_record_threads * n_swapchain_imgs;
+	if (n == 0) return;
+
+	QueueFamilyIndices idx = caps.queues;
+
+	thread_cmdpools = calloc (n, sizeof (VkCommandPool));
+	thread_cmdbufs = calloc (n, sizeof (VkCommandBuffer));
+
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		VkCommandPoolCreateInfo info = { 0 };
+		info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		info.queueFamilyIndex = idx.gfx_family;
+		info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+		assert (vkCreateCommandPool (device, &info, NULL, &thread_cmdpools[i]) == VK_SUCCESS);
+
+		VkCommandBufferAllocateInfo allocinfo = { 0 };
+		allocinfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocinfo.commandPool = thread_cmdpools[i];
+		allocinfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocinfo.commandBufferCount = 1;
+
+		assert (vkAllocateCommandBuffers (device, &allocinfo, &thread_cmdbufs[i]) == VK_SUCCESS);
+	}
+}
+
+static void destroy_thread_cmdbufs ()
+{
+	if (!thread_cmdpools) return;
+
+	for (uint32_t i = 0; i < n_record_threads * n_swapchain_imgs; i ++)
+		vkDestroyCommandPool (device, thread_cmdpools[i], NULL);
+
+	free (thread_cmdpools);
+	free (thread_cmdbufs);
+	thread_cmdpools = NULL;
+	thread_cmdbufs = NULL;
+}
+
+/**
+ * Start `n` recording threads and their command buffers.
+ */
+static void create_record_threads (uint32_t n)
+{
+	// cached primaries execute the secondaries of the previous threads, or none
+	draw_list_touch ();
+
+	n_record_threads = n;
+	if (n == 0) return;
+
+	record_threads = calloc (n, sizeof (pthread_t));
+	record_jobs = calloc (n, sizeof (RecordJob));
+	create_thread_cmdbufs ();
+
+	// workers start from batch 0, counting from where earlier threads left off would
+	// have them record before any job is set
+	record_quit = 0;
+	record_batch = 0;
+	for (uint32_t i = 0; i < n; i ++)
+		assert (pthread_create (&record_threads[i], NULL, record_worker, &record_jobs[i]) == 0);
+}
+
+static void destroy_record_threads ()
+{
+	if (n_record_threads == 0) return;
+
+	pthread_mutex_lock (&record_mutex);
+	record_quit = 1;
+	pthread_cond_broadcast (&record_start);
+	pthread_mutex_unlock (&record_mutex);
+
+	for (uint32_t i = 0; i < n_record_threads; i ++)
+		pthread_join (record_threads[i], NULL);
+
+	destroy_thread_cmdbufs ();
+	free (record_threads);
+	free (record_jobs);
+	n_record_threads = 0;
+}
+
+/**
+ * Record the frame graph with the draw list of the shading pass split evenly over the
+ * recording threads. The primary command buffer records the other passes and executes
+ * the secondaries in the shading pass.
+ */
+static void record_cmdbuf_parallel (VkCommandBuffer cmdbuf, uint32_t img)
+{
+	uint32_t n = n_record_threads;
+	uint32_t slice = (n_draws + n - 1) / n;
+	VkCommandBuffer *secondaries = &thread_cmdbufs[img * n];
+
+	render_queue_sort ();
+
+	pthread_mutex_lock (&record_mutex);
+	for (uint32_t i = 0; i < n; i ++)
+	{
+		RecordJob *job = &record_jobs[i];
+		job->pool = thread_cmdpools[img * n + i];
+		job->cmdbuf = secondaries[i];
+		job->img = img;
+		job->first = i * slice < n_draws ? i * slice : n_draws;
+		job->count = job->first + slice < n_draws ? slice : n_draws - job->first;
+	}
+	record_pending = n;
+	record_batch ++;
+	pthread_cond_broadcast (&record_start);
+
+	while (record_pending > 0)
+		pthread_cond_wait (&record_done, &record_mutex);
+	pthread_mutex_unlock (&record_mutex);
+
+	memset (&rq_stats, 0, sizeof (rq_stats));
+	for (uint32_t i = 0; i < n; i ++)
+		rq_stats_add (&rq_stats, &record_jobs[i].stats);
+
+	// the rest of the graph is cheap to record, it stays on this thread
+	frame_graph.passes[frame_pass_shading].contents = VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS;
+	memset (&prepass_stats, 0, sizeof (prepass_stats));
+
+	begin_frame_stats (cmdbuf, img, 1);
+	rg_execute (&frame_graph, cmdbuf, img);
+	end_frame_stats (cmdbuf, img, 1);
+
+	rq_stats_add (&rq_stats, &prepass_stats);
+}
+
+static void create_cmdbufs ()
+{
+	// dynamic mode records per frame, just make sure nothing stale gets submitted
+	if (record_mode == RECORD_DYNAMIC)
+	{
+		draw_list_touch ();
+		return;
+	}
+
+	uint32_t n_cmdbufs = n_swapchain_img_views;
+	cmdbufs = calloc (n_cmdbufs, sizeof (VkCommandBuffer));
+
+	VkCommandBufferAllocateInfo allocinfo = { 0 };
+	allocinfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocinfo.commandPool = cmdpool;
+	allocinfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocinfo.commandBufferCount = n_cmdbufs;
+
+	assert (vkAllocateCommandBuffers (device, &allocinfo, cmdbufs) == VK_SUCCESS);
+
+	for (size_t i = 0; i < n_cmdbufs; i ++)
+	{
+		VkCommandBufferBeginInfo info = { 0 };
+		info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		//info.flags = 0; // optional
+		//info.pInheritanceInfo = nullptr; // optional
+
+		assert (vkBeginCommandBuffer (cmdbufs[i], &info) == VK_SUCCESS);
+		record_cmdbuf (cmdbufs[i], i);
+		assert (vkEndCommandBuffer (cmdbufs[i]) == VK_SUCCESS);
+	}
+
+#ifdef DEBUG
+	printf
+	(
+		"render queue: %u draws, %u pipeline, %u descriptor, %u vertex, %u index binds, %u eliminated\n",
+		rq_stats.draws,
+		rq_stats.pipeline_binds,
+		rq_stats.descriptor_binds,
+		rq_stats.vertex_binds,
+		rq_stats.index_binds,
+		rq_stats.binds_eliminated
+	);
+#endif
+}
+
+/**
+ * Pick the level of detail of every instance drawn with a mesh that has several, for the
+ * current camera. Draws of part of a mesh are always drawn in full. Command buffers are
+ * re-recorded only if a choice changed, which for static ones waits for the device.
+ */
+static void select_lods ()
+{
+	if (!use_lods)
+		return;
+
+	int changed = 0;
+	for (uint32_t i = 0; i < n_draws; i ++)
+	{
+		const DrawCmd *cmd = &draw_list[i];
+		const Mesh *m = meshes[cmd->mesh];
+		if (m->n_lods < 2 || cmd->first_index != 0 || cmd->n_indices != m->lods[0].n_indices)
+			continue;
+
+		for (uint32_t j = cmd->first_instance; j < cmd->first_instance + cmd->n_instances; j ++)
+		{
+			uint8_t l = instance_lod (m, &instances[j]);
+			changed |= l != inst_lods[j];
+			inst_lods[j] = l;
+		}
+	}
+
+	if (!changed)
+		return;
+
+	if (record_mode == RECORD_STATIC && cmdbufs)
+	{
+		vkDeviceWaitIdle (device);
+		vkFreeCommandBuffers (device, cmdpool, n_swapchain_img_views, cmdbufs);
+		free (cmdbufs);
+		create_cmdbufs ();
+	}
+	else
+		draw_list_touch ();
+}
+
+/**
+ * Create a transient command pool and a command buffer for each swapchain image, used
+ * by the dynamic recording mode.
+ */
+static void create_frame_cmdbufs ()
+{
+	frame_cmdpools = calloc (n_swapchain_imgs, sizeof (VkCommandPool));
+	frame_cmdbufs = calloc (n_swapchain_imgs, sizeof (VkCommandBuffer));
+	frame_recorded_gen = calloc (n_swapchain_imgs, sizeof (uint64_t));
+
+	QueueFamilyIndices idx = caps.queues;
+
+	for (size_t i = 0; i < n_swapchain_imgs; i ++)
+	{
+		VkCommandPoolCreateInfo info = { 0 };
+		info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		info.queueFamilyIndex = idx.gfx_family;
+		info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+		assert (vkCreateCommandPool (device, &info, NULL, &frame_cmdpools[i]) == VK_SUCCESS);
+
+		VkCommandBufferAllocateInfo allocinfo = { 0 };
+		allocinfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocinfo.commandPool = frame_cmdpools[i];
+		allocinfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocinfo.commandBufferCount = 1;
+
+		assert (vkAllocateCommandBuffers (device, &allocinfo, &frame_cmdbufs[i]) == VK_SUCCESS);
+	}
+}
+
+static void destroy_frame_cmdbufs ()
+{
+	for (size_t i = 0; i < n_swapchain_imgs; i ++)
+		vkDestroyCommandPool (device, frame_cmdpools[i], NULL);
+	free (frame_cmdpools);
+	free (frame_cmdbufs);
+	free (frame_recorded_gen);
+}
+
+static int frame_in_secondaries ()
+{
+	return record_mode == RECORD_DYNAMIC && n_record_threads > 0 && !gpu_driven;
+}
+
+/**
+ * Get the command buffer to submit for swapchain image `img`.
+ *
+ * In dynamic mode each image keeps the command buffer last recorded for it, and its pool
+ * is reset and the command buffer re-recorded only if the draw list changed since.
+ * Must be called after the image's fence has been waited on.
+ */
+static VkCommandBuffer frame_cmdbuf (uint32_t img)
+{
+	if (record_mode == RECORD_STATIC)
+		return cmdbufs[img];
+
+	VkCommandBuffer cmdbuf = frame_cmdbufs[img];
+
+	if (frame_recorded_gen[img] == draw_list_gen)
+		return cmdbuf;
+
+	assert (vkResetCommandPool (device, frame_cmdpools[img], 0) == VK_SUCCESS);
+
+	VkCommandBufferBeginInfo info = { 0 };
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	assert (vkBeginCommandBuffer (cmdbuf, &info) == VK_SUCCESS);
+	if (frame_in_secondaries ())
+		record_cmdbuf_parallel (cmdbuf, img);
+	else
+		record_cmdbuf (cmdbuf, img);
+	assert (vkEndCommandBuffer (cmdbuf) == VK_SUCCESS);
+
+	frame_recorded_gen[img] = draw_list_gen;
+
+	return cmdbuf;
+}
+
+static void create_sync ()
+{
+	img_available = calloc (MAX_FRAMES_IN_FLIGHT, sizeof (VkSemaphore));
+	render_finished = calloc (MAX_FRAMES_IN_FLIGHT, sizeof (VkSemaphore));
+	in_flight_fences = calloc (MAX_FRAMES_IN_FLIGHT, sizeof (VkFence));
+	imgs_in_flight = calloc (n_swapchain_imgs, sizeof (VkFence));
+
+	VkSemaphoreCreateInfo semaphore_info = { 0 };
+	semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	VkFenceCreateInfo fence_info = { 0 };
+	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i ++)
+		assert
+		(
+			vkCreateSemaphore (device, &semaphore_info, NULL, &img_available[i]) == VK_SUCCESS &&
+			vkCreateSemaphore (device, &semaphore_info, NULL, &render_finished[i]) == VK_SUCCESS &&
+			vkCreateFence (device, &fence_info, NULL, &in_flight_fences[i]) == VK_SUCCESS
+		);
+}
+
+static int init_vulkan ()
+{
+	create_instance ();
+#ifdef DEBUG
+	setup_debugger ();
+#endif
+	if (!headless)
+		create_surface ();
+	pick_physical_device ();
+	init_device_caps ();
+	create_logical_device ();
+	if (headless)
+		create_offscreen_targets ();
+	else
+		create_swapchain ();
+	create_img_views ();
+	create_render_pass ();
+	create_descriptor_set_layout ();
+	create_descriptor_update_tpls ();
+	create_gfx_pipeline ();
+	create_cmd_pool ();
+	create_tex_img ();
+	create_tex_img_view ();
+	create_tex_sampler ();
+	create_builtin_mesh ();
+	load_scene_meshes ();
+	create_uniform_buf ();
+	create_inst_bufs ();
+	create_readback_bufs ();
+	create_frame_stats ();
+	create_descriptor_pool ();
+	create_descriptor_sets ();
+	init_render_queue ();
+	init_draw_list ();
+	if (gpu_driven)
+	{
+		create_gpu_resources ();
+		create_gpu_pipeline ();
+		init_gpu_objects ();
+	}
+	if (n_particles)
+	{
+		create_particles (n_particles);
+		create_particle_pipeline ();
+	}
+	create_frame_graph ();
+	create_framebuffers ();
+	create_frame_cmdbufs ();
+	create_record_threads (n_record_threads);
+	create_cmdbufs ();
+	create_sync ();
+
+	return 0;
+}
+
+void init ()
+{
+	if (!headless)
+		init_window ();
+	init_vulkan ();
+}
+
+/**
+ * update the uniform buffers with new data?
+ */
+static void update_unif_buf (uint32_t img)
+{
+	/*
+	in the tutorial there was quite a lot of code here about rotating the
+	square in the scene based on the time so it followed a uniform
+	update cycle. this feels a little unnecessary here.
+
+	this function should in general be to send the updated information about
+	the scene to the gpu.
+	*/
+	void *data;
+	vkMapMemory (device, unif_buf_mem[img], 0, sizeof (camera), 0, &data);
+	memcpy (data, &camera, sizeof (camera));
+	vkUnmapMemory (device, unif_buf_mem[img]);
+}
+
+/**
+ * Set the view and projection used from the next frame on.
+ */
+void set_camera (const float V[16], const float P[16])
+{
+	memcpy (camera.V, V, sizeof (camera.V));
+	memcpy (camera.P, P, sizeof (camera.P));
+
+	if (gpu_driven && gpu_objs_header)
 	{
-		info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		info.queueFamilyIndexCount = 0; // optional
-		info.pQueueFamilyIndices = NULL; // optional
+		float VP[16];
+		mat4_mul (VP, P, V);
+		gpu_set_frustum (VP);
 	}
+}
 
-	info.preTransform = sup.capabilities.currentTransform;
-	info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-	info.presentMode = mode;
-	info.clipped = VK_TRUE;
-	info.oldSwapchain = VK_NULL_HANDLE;
+/**
+ * Turn the depth pre-pass on or off, for scenes with enough overdraw that shading each
+ * pixel once pays for drawing the opaque geometry twice.
+ */
+void set_depth_prepass (int on)
+{
+	if (on == depth_prepass)
+		return;
+	depth_prepass = on;
 
-	assert(vkCreateSwapchainKHR (device, &info, NULL, &swapchain) == VK_SUCCESS);
+	if (!device)
+		return;
 
-	// create swapchain image handles
+	// the frame graph has a pass more or less, and frames in flight may use its depth
+	vkDeviceWaitIdle (device);
+	destroy_framebuffers ();
+	rg_destroy (&frame_graph);
+	create_frame_graph ();
+	create_framebuffers ();
 
-	assert(
-		vkGetSwapchainImagesKHR (
-			device,
-			swapchain,
-			&n_swapchain_imgs,
-			NULL
-		) == VK_SUCCESS
-	);
-	swapchain_imgs = malloc (n_swapchain_imgs * sizeof (VkImage));
-	assert(
-		vkGetSwapchainImagesKHR (
-			device,
-			swapchain,
-			&n_swapchain_imgs,
-			swapchain_imgs
-		) == VK_SUCCESS
-	);
+	if (record_mode == RECORD_STATIC && cmdbufs)
+	{
+		vkFreeCommandBuffers (device, cmdpool, n_swapchain_img_views, cmdbufs);
+		free (cmdbufs);
+		create_cmdbufs ();
+	}
+	else
+		draw_list_touch ();
+}
 
-	swapchain_img_fmt = fmt.format;
-	swapchain_ext = ext;
-	swapchain_support_details_free (&sup);
+/**
+ * Set the function handed the pixels of every rendered frame.
+ */
+void readback_set_callback (ReadbackFn fn, void *user)
+{
+	readback_fn = fn;
+	readback_user = user;
 }
 
-static void create_img_view
-(
-	VkImageView *view,
-	VkImage img,
-	VkFormat fmt,
-	VkImageAspectFlags flags
-)
+/**
+ * Queue the readback of a frame rendering to `img`, submitted with `fence`.
+ */
+static void readback_push (uint32_t img, VkFence fence)
 {
-	VkImageViewCreateInfo info = { 0 };
-	info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	info.image = img;
-	info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	info.format = fmt;
-	info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-	info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-	info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-	info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-	info.subresourceRange.baseMipLevel = 0;
-	info.subresourceRange.levelCount = 1;
-	info.subresourceRange.baseArrayLayer = 0;
-	info.subresourceRange.layerCount = 1;
-	info.subresourceRange.aspectMask = flags;
+	assert (n_readback_pending < READBACK_MAX_PENDING);
 
-	assert (vkCreateImageView (device, &info, NULL, view) == VK_SUCCESS);
+	ReadbackPending *p = &readback_queue[(readback_head + n_readback_pending) % READBACK_MAX_PENDING];
+	p->img = img;
+	p->fence = fence;
+	p->frame = readback_frame ++;
+	n_readback_pending ++;
 }
 
-static void create_img_views ()
+/**
+ * Hand finished frames to the readback callback in the order they were submitted.
+ *
+ * Without `wait` this stops at the first frame whose fence has not signaled, so it never
+ * blocks. It must be called after waiting on a fence and before resetting it, at which
+ * point the frame that used the fence is the oldest pending one and gets delivered.
+ */
+static void readback_drain (int wait)
 {
-	n_swapchain_img_views = n_swapchain_imgs;
-	swapchain_img_views = (VkImageView *) calloc (n_swapchain_img_views, sizeof (VkImageView));
-
-	for (int i = 0; i < n_swapchain_img_views; i ++)
+	while (n_readback_pending > 0)
 	{
-		create_img_view (
-			&swapchain_img_views[i],
-			swapchain_imgs[i],
-			swapchain_img_fmt,
-			VK_IMAGE_ASPECT_COLOR_BIT
-		);
+		ReadbackPending *p = &readback_queue[readback_head];
+
+		if (wait)
+			vkWaitForFences (device, 1, &p->fence, VK_TRUE, UINT64_MAX);
+		else if (vkGetFenceStatus (device, p->fence) != VK_SUCCESS)
+			break;
+
+		uint32_t w = swapchain_ext.width, h = swapchain_ext.height;
+		size_t size = (size_t) w * h * 4;
+
+		VkMappedMemoryRange range = { 0 };
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = readback_bufs_mem[p->img];
+		range.size = VK_WHOLE_SIZE;
+		vkInvalidateMappedMemoryRanges (device, 1, &range);
+
+		const uint8_t *px = readback_bufs_mapped[p->img];
+		if
+		(
+			swapchain_img_fmt == VK_FORMAT_B8G8R8A8_SRGB ||
+			swapchain_img_fmt == VK_FORMAT_B8G8R8A8_UNORM
+		)
+		{
+			for (size_t i = 0; i < size; i += 4)
+			{
+				readback_rgba[i + 0] = px[i + 2];
+				readback_rgba[i + 1] = px[i + 1];
+				readback_rgba[i + 2] = px[i + 0];
+				readback_rgba[i + 3] = px[i + 3];
+			}
+			px = readback_rgba;
+		}
+
+		if (readback_fn)
+			readback_fn (px, w, h, p->frame, readback_user);
+
+		readback_head = (readback_head + 1) % READBACK_MAX_PENDING;
+		n_readback_pending --;
 	}
 }
 
-static VkFormat find_supported_fmt
-(
-	VkFormat *candidates,
-	uint32_t n_candidates,
-	VkImageTiling tiling,
-	VkFormatFeatureFlags feats
-)
+/**
+ * Write all of `data` to `fd`, exiting if the reader went away.
+ */
+static void stream_write (int fd, const void *data, size_t n)
 {
-	for (int i = 0; i < n_candidates; i ++)
+	const uint8_t *p = data;
+	while (n > 0)
 	{
-		VkFormat fmt = candidates[i];
-		VkFormatProperties p;
-		vkGetPhysicalDeviceFormatProperties (physical_device, fmt, &p);
-
-		if (tiling == VK_IMAGE_TILING_LINEAR && (p.linearTilingFeatures & feats) == feats)
+		ssize_t r = write (fd, p, n);
+		if (r < 0)
 		{
-			return fmt;
+			fprintf (stderr, "failed to write video stream!\n");
+			exit (1);
 		}
-		else if (tiling == VK_IMAGE_TILING_OPTIMAL && (p.optimalTilingFeatures & feats) == feats)
+		p += r;
+		n -= r;
+	}
+}
+
+/**
+ * Readback callback writing the frame to the video stream. The size is set by the first
+ * frame and frames of any other size, after a window resize, are dropped.
+ */
+static void stream_frame (const uint8_t *rgba, uint32_t w, uint32_t h, uint64_t frame, void *user)
+{
+	if (stream_w == 0)
+	{
+		stream_w = w;
+		stream_h = h;
+
+		if (stream_fmt == STREAM_Y4M)
 		{
-			return fmt;
+			char header[128];
+			int n = snprintf (header, sizeof (header), "YUV4MPEG2 W%u H%u F60:1 Ip A1:1 C444\n", w, h);
+			stream_write (stream_fd, header, n);
+			stream_planes = malloc ((size_t) w * h * 3);
 		}
 	}
 
-	fprintf (stderr, "failed to find supported format");
-	exit (1);
+	if (w != stream_w || h != stream_h)
+	{
+		fprintf
+		(
+			stderr,
+			"frame %llu is %ux%u, stream is %ux%u, dropped\n",
+			(unsigned long long) frame, w, h, stream_w, stream_h
+		);
+		return;
+	}
+
+	size_t n = (size_t) w * h;
+
+	if (stream_fmt == STREAM_RAW)
+	{
+		stream_write (stream_fd, rgba, n * 4);
+		return;
+	}
+
+	// BT.601 studio swing
+	uint8_t *Y = stream_planes, *U = stream_planes + n, *V = stream_planes + 2 * n;
+	for (size_t i = 0; i < n; i ++)
+	{
+		int r = rgba[4 * i + 0], g = rgba[4 * i + 1], b = rgba[4 * i + 2];
+		Y[i] = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+		U[i] = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+		V[i] = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+	}
+
+	stream_write (stream_fd, "FRAME\n", 6);
+	stream_write (stream_fd, stream_planes, n * 3);
 }
 
-static VkFormat find_depth_fmt ()
+/**
+ * Stream every rendered frame to `fd` in `fmt`.
+ *
+ * If that is stdout, the stream gets a private copy of it and stdout is pointed at
+ * stderr so log output can not end up in the middle of a frame.
+ */
+static void stream_open (StreamFmt fmt, int fd)
 {
-	VkFormat candidates[] =
+	if (fd == STDOUT_FILENO)
 	{
-		VK_FORMAT_D32_SFLOAT,
-		VK_FORMAT_D32_SFLOAT_S8_UINT,
-		VK_FORMAT_D24_UNORM_S8_UINT
-	};
-	return find_supported_fmt
-	(
-		candidates,
-		3,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
-	);
+		fflush (stdout);
+		fd = dup (STDOUT_FILENO);
+		dup2 (STDERR_FILENO, STDOUT_FILENO);
+	}
+
+	stream_fmt = fmt;
+	stream_fd = fd;
+	readback = 1;
+	readback_set_callback (stream_frame, NULL);
 }
 
-void create_render_pass ()
+static void stream_close ()
 {
-	VkSubpassDependency dep = { 0 };
-	dep.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dep.dstSubpass = 0;
-	dep.srcStageMask =
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	dep.srcAccessMask = 0;
-	dep.dstStageMask =
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	dep.dstAccessMask =
-		VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
-		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-	VkAttachmentDescription color = { 0 };
-	color.format = swapchain_img_fmt;
-	color.samples = VK_SAMPLE_COUNT_1_BIT;
-	color.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	color.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	color.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	color.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	color.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	color.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-	VkAttachmentReference color_ref = { 0 };
-	color_ref.attachment = 0;
-	color_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentDescription depth = { 0 };
-	depth.format = find_depth_fmt ();
-	depth.samples = VK_SAMPLE_COUNT_1_BIT;
-	depth.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depth.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depth.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	depth.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depth.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depth.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	if (stream_fmt == STREAM_NONE)
+		return;
 
-	VkAttachmentReference depth_ref = { 0 };
-	depth_ref.attachment = 1;
-	depth_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	close (stream_fd);
+	free (stream_planes);
+}
 
-	VkSubpassDescription subpass = { 0 };
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &color_ref;
-	subpass.pDepthStencilAttachment = &depth_ref;
+void cleanup_swapchain ()
+{
+	destroy_framebuffers ();
+	rg_destroy (&frame_graph);
+	destroy_thread_cmdbufs ();
+	destroy_frame_cmdbufs ();
 
-	VkAttachmentDescription attachments[2] = { color, depth };
-	VkRenderPassCreateInfo info = { 0 };
-	info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	info.attachmentCount = 2;
-	info.pAttachments = attachments;
-	info.subpassCount = 1;
-	info.pSubpasses = &subpass;
-	info.dependencyCount = 1;
-	info.pDependencies = &dep;
+	if (record_mode == RECORD_STATIC)
+	{
+		vkFreeCommandBuffers (device, cmdpool, n_swapchain_img_views, cmdbufs);
+		free (cmdbufs);
+		cmdbufs = NULL;
+	}
 
-	assert (vkCreateRenderPass (device, &info, NULL, &render_pass) == VK_SUCCESS);
-}
+	for (int l = 0; l < VX_LAYOUT_COUNT; l ++)
+	{
+		for (int i = 0; i < VX_FMT_COUNT; i ++)
+		{
+			vkDestroyPipeline (device, pipelines[l][i], NULL);
+			vkDestroyPipeline (device, depth_pipelines[l][i], NULL);
+			vkDestroyPipeline (device, equal_pipelines[l][i], NULL);
+		}
+	}
+	vkDestroyPipelineLayout (device, pipeline_layout, NULL);
+	if (has_bda)
+	{
+		vkDestroyPipeline (device, pull_pipeline, NULL);
+		vkDestroyPipeline (device, pull_depth_pipeline, NULL);
+		vkDestroyPipeline (device, pull_equal_pipeline, NULL);
+		vkDestroyPipelineLayout (device, pull_pipeline_layout, NULL);
+	}
+	if (has_mesh_shader)
+	{
+		vkDestroyPipeline (device, meshlet_pipeline, NULL);
+		vkDestroyPipelineLayout (device, meshlet_pipeline_layout, NULL);
+	}
+	if (gpu_driven)
+		vkDestroyPipeline (device, gpu_pipeline, NULL);
+	if (n_particles)
+		vkDestroyPipeline (device, particle_pipeline, NULL);
+	vkDestroyRenderPass (device, render_pass, NULL);
+	vkDestroyRenderPass (device, depth_render_pass, NULL);
 
-static void create_descriptor_set_layout ()
-{
-	VkDescriptorSetLayoutBinding ubo_layout_binding = { 0 };
-	ubo_layout_binding.binding = 0;
-	ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	ubo_layout_binding.descriptorCount = 1;
-	ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	ubo_layout_binding.pImmutableSamplers = NULL; // optional
+	for (int i = 0; i < n_swapchain_img_views; i++)
+		vkDestroyImageView (device, swapchain_img_views[i], NULL);
 
-	VkDescriptorSetLayoutBinding sampler_layout_binding = { 0 };
-	sampler_layout_binding.binding = 1;
-	sampler_layout_binding.descriptorCount = 1;
-	sampler_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	sampler_layout_binding.pImmutableSamplers = NULL;
-	sampler_layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	if (headless)
+		destroy_offscreen_targets ();
+	else
+		vkDestroySwapchainKHR (device, swapchain, NULL);
 
-	VkDescriptorSetLayoutBinding bindings[] =
+	for (int i = 0; i < n_swapchain_imgs; i++)
 	{
-		ubo_layout_binding, sampler_layout_binding
-	};
-	VkDescriptorSetLayoutCreateInfo layout_info = { 0 };
-	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layout_info.bindingCount = 2;
-	layout_info.pBindings = bindings;
+		vkDestroyBuffer (device, unif_buf[i], NULL);
+		vkFreeMemory (device, unif_buf_mem[i], NULL);
+	}
 
-	assert (
-		vkCreateDescriptorSetLayout (
-			device,
-			&layout_info,
-			NULL,
-			&descriptor_set_layout
-		) == VK_SUCCESS
-	);
+	destroy_inst_bufs ();
+	destroy_readback_bufs ();
+	destroy_frame_stats ();
+
+	vkDestroyDescriptorPool (device, descriptor_pool, NULL);
 }
 
-static VkShaderModule create_shader_module (const char *code, size_t size)
+
+void recreate_swapchain ()
 {
-	VkShaderModuleCreateInfo info = { 0 };
-	info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	info.codeSize = size;
-	info.pCode = (const uint32_t*) code;
+	// wait until the window is a size other than 0
 
-	VkShaderModule mod;
-	assert (vkCreateShaderModule (device, &info, NULL, &mod) == VK_SUCCESS);
+	int w = 0, h = 0;
+	while (!headless && (w == 0 || h == 0))
+	{
+		glfwGetFramebufferSize (win, &w, &h);
+		if (w == 0 || h == 0)
+			glfwWaitEvents ();
+	}
 
-	return mod;
+	vkDeviceWaitIdle (device);
+	readback_drain (1);
+
+	cleanup_swapchain ();
+	if (headless)
+		create_offscreen_targets ();
+	else
+		create_swapchain ();
+	create_img_views ();
+	create_render_pass ();
+	create_gfx_pipeline ();
+	if (gpu_driven)
+		create_gpu_pipeline ();
+	if (n_particles)
+		create_particle_pipeline ();
+	create_frame_graph ();
+	create_framebuffers ();
+	create_uniform_buf ();
+	create_inst_bufs ();
+	create_readback_bufs ();
+	create_frame_stats ();
+	create_descriptor_pool ();
+	create_descriptor_sets ();
+	create_frame_cmdbufs ();
+	create_thread_cmdbufs ();
+	create_cmdbufs ();
 }
 
-static VkVertexInputBindingDescription vx_binding_desc ()
+/**
+ * Resize the offscreen targets to `headless_ext`. Only what has their size is recreated:
+ * the targets, the frame graph with its transients, the framebuffers and the readback
+ * buffers. Pipelines take the viewport as dynamic state and the render passes and
+ * descriptor sets do not depend on the size, so they live on. Command buffers recorded
+ * against the old framebuffers are re-recorded.
+ */
+static void resize_offscreen_targets ()
 {
-	VkVertexInputBindingDescription desc = { 0 };
-	desc.binding = 0;
-	desc.stride = 3 * sizeof (float);
-	desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	vkDeviceWaitIdle (device);
+	readback_drain (1);
 
-	return desc;
-}
+	destroy_framebuffers ();
+	rg_destroy (&frame_graph);
+	destroy_readback_bufs ();
+	for (int i = 0; i < n_swapchain_img_views; i++)
+		vkDestroyImageView (device, swapchain_img_views[i], NULL);
+	free (swapchain_img_views);
+	destroy_offscreen_targets ();
 
-static uint32_t vx_attrib_desc (VkVertexInputAttributeDescription **desc)
-{
-	*desc = calloc (3, sizeof (VkVertexInputAttributeDescription));
+	create_offscreen_targets ();
+	create_img_views ();
+	create_frame_graph ();
+	create_framebuffers ();
+	create_readback_bufs ();
 
-	// TODO
-	// i am unsure about these offsets
+	if (record_mode == RECORD_STATIC)
+	{
+		vkFreeCommandBuffers (device, cmdpool, n_swapchain_img_views, cmdbufs);
+		free (cmdbufs);
+		create_cmdbufs ();
+	}
+	else
+		draw_list_touch ();
+}
 
-	// position
-	(*desc)[0].binding = 0;
-	(*desc)[0].location = 0;
-	(*desc)[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-	(*desc)[0].offset = 0;
+/**
+ * Stream the instances into the instance buffer of the swapchain image, which must not
+ * be in use by the GPU.
+ *
+ * When they no longer fit all instance buffers are reallocated with twice the capacity.
+ * That waits for the device and re-records command buffers, but only happens as the
+ * scene grows.
+ */
+static void update_inst_buf (uint32_t img)
+{
+	if (n_instances > inst_bufs_cap)
+	{
+		vkDeviceWaitIdle (device);
+		destroy_inst_bufs ();
 
-	// color
-	(*desc)[1].binding = 0;
-	(*desc)[1].location = 1;
-	(*desc)[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-	(*desc)[1].offset = 3 * sizeof (float);
+		while (inst_bufs_cap < n_instances)
+			inst_bufs_cap *= 2;
+		create_inst_bufs ();
 
-	// texture coordinate
-	(*desc)[2].binding = 0;
-	(*desc)[2].location = 2;
-	(*desc)[2].format = VK_FORMAT_R32G32_SFLOAT;
-	(*desc)[2].offset = 6 * sizeof (float);
+		if (record_mode == RECORD_STATIC)
+		{
+			vkFreeCommandBuffers (device, cmdpool, n_swapchain_img_views, cmdbufs);
+			free (cmdbufs);
+			create_cmdbufs ();
+		}
+		else
+			draw_list_touch ();
+	}
 
-	return 3;
+	memcpy (inst_bufs_mapped[img], instances, n_instances * sizeof (InstanceData));
 }
 
-static void create_gfx_pipeline ()
+void draw ()
 {
-	// read shader byte code
+	vkWaitForFences (device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+	readback_drain (0);
+	uint32_t img_idx;
+	VkResult res = vkAcquireNextImageKHR
+	(
+		device,
+		swapchain,
+		UINT64_MAX,
+		img_available[current_frame],
+		VK_NULL_HANDLE,
+		&img_idx
+	);
 
-	//
-	// TODO remove hard codings towards shader source
-	//
+	if (res == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		recreate_swapchain ();
+		return;
+	}
+	else if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR)
+	{
+		fprintf (stderr, "failed to acquire swapchain image: %d\n", res);
+		exit (1);
+	}
 
-	char *vx_shader_code, *frag_shader_code;
-	size_t vx_shader_size = read_file ("build/vert.spv", &vx_shader_code);
-	size_t fg_shader_size = read_file ("build/frag.spv", &frag_shader_code);
+	// an older frame may still be rendering to this image
+	if (imgs_in_flight[img_idx] != VK_NULL_HANDLE)
+		vkWaitForFences (device, 1, &imgs_in_flight[img_idx], VK_TRUE, UINT64_MAX);
+	imgs_in_flight[img_idx] = in_flight_fences[current_frame];
+	readback_drain (0);
+	read_frame_stats (img_idx);
 
-	assert (vx_shader_size > 0);
-	assert (fg_shader_size > 0);
+	update_unif_buf (img_idx);
+	update_inst_buf (img_idx);
 
-	// create shader modules
+	select_lods ();
+	VkCommandBuffer cmdbuf = frame_cmdbuf (img_idx);
 
-	VkShaderModule vx_shader_mod = create_shader_module (vx_shader_code, vx_shader_size);
-	VkShaderModule frag_shader_mod = create_shader_module (frag_shader_code, fg_shader_size);
+	VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	VkSubmitInfo submit_info = { 0 };
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.waitSemaphoreCount = 1;
+	submit_info.pWaitSemaphores = &img_available[current_frame];
+	submit_info.pWaitDstStageMask = &wait_stage;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &cmdbuf;
+	submit_info.signalSemaphoreCount = 1;
+	submit_info.pSignalSemaphores = &render_finished[current_frame];
+
+	vkResetFences (device, 1, &in_flight_fences[current_frame]);
+	assert (vkQueueSubmit (gfx_queue, 1, &submit_info, in_flight_fences[current_frame]) == VK_SUCCESS);
+	frame_stats_pending[img_idx] = frame_stats_enabled (frame_in_secondaries ());
+	if (readback)
+		readback_push (img_idx, in_flight_fences[current_frame]);
+
+	VkPresentInfoKHR present_info = { 0 };
+	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	present_info.waitSemaphoreCount = 1;
+	present_info.pWaitSemaphores = &render_finished[current_frame];
+	present_info.swapchainCount = 1;
+	present_info.pSwapchains = &swapchain;
+	present_info.pImageIndices = &img_idx;
+
+	res = vkQueuePresentKHR (present_queue, &present_info);
+	if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR || framebuf_resized)
+	{
+		framebuf_resized = 0;
+		recreate_swapchain ();
+	}
 
-	// create shader pipelines
+	current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+}
 
-	VkPipelineShaderStageCreateInfo vxinfo = { 0 };
-	vxinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vxinfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vxinfo.module = vx_shader_mod;
-	vxinfo.pName = "main";
+/**
+ * Render one frame headless. Frames in flight map one to one onto the offscreen images
+ * so there is nothing to acquire or present, only the frame's fence to wait on.
+ */
+void draw_offscreen ()
+{
+	uint32_t img_idx = current_frame;
 
-	VkPipelineShaderStageCreateInfo fginfo = { 0 };
-	fginfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fginfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fginfo.module = frag_shader_mod;
-	fginfo.pName = "main";
+	vkWaitForFences (device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+	readback_drain (0);
+	read_frame_stats (img_idx);
 
-	VkPipelineShaderStageCreateInfo stages[] = { vxinfo, fginfo };
+	update_unif_buf (img_idx);
+	update_inst_buf (img_idx);
 
-	VkVertexInputBindingDescription binding_desc = vx_binding_desc ();
-	VkVertexInputAttributeDescription* attrib_desc;
-	uint32_t n_attrib_desc = vx_attrib_desc (&attrib_desc);
+	select_lods ();
+	VkCommandBuffer cmdbuf = frame_cmdbuf (img_idx);
 
-	VkPipelineVertexInputStateCreateInfo vxinput = { 0 };
-	vxinput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vxinput.vertexBindingDescriptionCount = 1;
-	vxinput.pVertexBindingDescriptions = &binding_desc; // optional
-	vxinput.vertexAttributeDescriptionCount = n_attrib_desc;
-	vxinput.pVertexAttributeDescriptions = attrib_desc; // optional
+	VkSubmitInfo submit_info = { 0 };
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &cmdbuf;
 
-	VkPipelineInputAssemblyStateCreateInfo inasm = { 0 };
-	inasm.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inasm.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inasm.primitiveRestartEnable = VK_FALSE;
+	vkResetFences (device, 1, &in_flight_fences[current_frame]);
+	assert (vkQueueSubmit (gfx_queue, 1, &submit_info, in_flight_fences[current_frame]) == VK_SUCCESS);
+	frame_stats_pending[img_idx] = frame_stats_enabled (frame_in_secondaries ());
+	if (readback)
+		readback_push (img_idx, in_flight_fences[current_frame]);
 
-	// viewport
-	VkViewport view = { 0 };
-	view.x = 0.0f;
-	view.y = 0.0f;
-	view.width = (float) swapchain_ext.width;
-	view.height = (float) swapchain_ext.height;
-	view.minDepth = 0.0f;
-	view.maxDepth = 1.0f;
+	current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+}
 
-	VkOffset2D offset = { 0, 0 };
-	VkRect2D scissor = { 0 };
-	scissor.offset = offset;
-	scissor.extent = swapchain_ext;
+/**
+ * Read a batch job file. Each line is a job
+ *
+ *	WxH eye_x eye_y eye_z center_x center_y center_z fovy [out.ppm]
+ *
+ * and empty lines and lines starting with # are skipped.
+ */
+static void load_batch (const char *fname)
+{
+	FILE *fp = fopen (fname, "r");
+	if (!fp)
+	{
+		fprintf (stderr, "could not open batch file %s!\n", fname);
+		exit (1);
+	}
 
-	VkPipelineViewportStateCreateInfo viewstate = { 0 };
-	viewstate.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewstate.viewportCount = 1;
-	viewstate.pViewports = &view;
-	viewstate.scissorCount = 1;
-	viewstate.pScissors = &scissor;
+	uint32_t cap = 0;
+	char line[512];
+	for (uint32_t lineno = 1; fgets (line, sizeof (line), fp); lineno ++)
+	{
+		char *p = line;
+		while (*p == ' ' || *p == '\t')
+			p ++;
+		if (*p == '#' || *p == '\n' || *p == '\0')
+			continue;
 
-	VkPipelineRasterizationStateCreateInfo rasterizer = { 0 };
-	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizer.depthClampEnable = VK_FALSE;
-	rasterizer.rasterizerDiscardEnable = VK_FALSE;
-	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-	rasterizer.lineWidth = 1.0f;
-	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-	rasterizer.depthBiasEnable = VK_FALSE;
-	rasterizer.depthBiasConstantFactor = 0.0f; // optional
-	rasterizer.depthBiasClamp = 0.0f; // optional
-	rasterizer.depthBiasSlopeFactor = 0.0f; // optional
+		if (n_batch_jobs == cap)
+		{
+			cap = cap ? cap * 2 : 16;
+			batch_jobs = realloc (batch_jobs, cap * sizeof (BatchJob));
+		}
 
-	VkPipelineMultisampleStateCreateInfo multisampling = { 0 };
-	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable = VK_FALSE;
-	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-	multisampling.minSampleShading = 1.0f; // optional
-	multisampling.pSampleMask = NULL; // optional
-	multisampling.alphaToCoverageEnable = VK_FALSE; // optional
-	multisampling.alphaToOneEnable = VK_FALSE; // optional
+		BatchJob *job = &batch_jobs[n_batch_jobs];
+		memset (job, 0, sizeof (BatchJob));
 
-	VkPipelineColorBlendAttachmentState blend_att = { 0 };
-	blend_att.colorWriteMask =
-		VK_COLOR_COMPONENT_R_BIT |
-		VK_COLOR_COMPONENT_G_BIT |
-		VK_COLOR_COMPONENT_B_BIT |
-		VK_COLOR_COMPONENT_A_BIT;
-	blend_att.blendEnable = VK_FALSE;
+		int n = sscanf
+		(
+			p,
+			"%ux%u %f %f %f %f %f %f %f %255s",
+			&job->w, &job->h,
+			&job->eye[0], &job->eye[1], &job->eye[2],
+			&job->center[0], &job->center[1], &job->center[2],
+			&job->fovy,
+			job->out
+		);
+		if (n < 9 || job->w == 0 || job->h == 0)
+		{
+			fprintf (stderr, "%s:%u: malformed job\n", fname, lineno);
+			exit (1);
+		}
 
-	blend_att.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-	blend_att.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-	blend_att.colorBlendOp = VK_BLEND_OP_ADD;
-	blend_att.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-	blend_att.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-	blend_att.alphaBlendOp = VK_BLEND_OP_ADD;
+		n_batch_jobs ++;
+	}
 
-	VkPipelineColorBlendStateCreateInfo blend = { 0 };
-	blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	blend.logicOpEnable = VK_FALSE;
-	blend.logicOp = VK_LOGIC_OP_COPY; // optional
-	blend.attachmentCount = 1;
-	blend.pAttachments = &blend_att;
-	blend.blendConstants[0] = 0.0f; // optional
-	blend.blendConstants[1] = 0.0f; // optional
-	blend.blendConstants[2] = 0.0f; // optional
-	blend.blendConstants[3] = 0.0f; // optional
+	fclose (fp);
 
-	VkDynamicState dynstates[] =
+	if (n_batch_jobs == 0)
 	{
-		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
-	};
+		fprintf (stderr, "no jobs in %s!\n", fname);
+		exit (1);
+	}
+}
 
-	VkPipelineDynamicStateCreateInfo dynstate = { 0 };
-	dynstate.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynstate.dynamicStateCount = 2;
-	dynstate.pDynamicStates = dynstates;
+static void write_ppm (const char *fname, const uint8_t *rgba, uint32_t w, uint32_t h)
+{
+	FILE *fp = fopen (fname, "wb");
+	if (!fp)
+	{
+		fprintf (stderr, "could not write %s!\n", fname);
+		return;
+	}
 
-	VkPipelineLayoutCreateInfo pipeline_cinfo = { 0 };
-	pipeline_cinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipeline_cinfo.setLayoutCount = 1; // optional
-	pipeline_cinfo.pSetLayouts = &descriptor_set_layout; // optional
-	//pipeline_cinfo.pushConstantRangeCount = 0; // optional
-	//pipeline_cinfo.pPushConstantRanges = NULL; // optional
+	fprintf (fp, "P6\n%u %u\n255\n", w, h);
+	uint8_t *row = malloc (w * 3);
+	for (uint32_t y = 0; y < h; y ++)
+	{
+		for (uint32_t x = 0; x < w; x ++)
+			memcpy (&row[x * 3], &rgba[(y * w + x) * 4], 3);
+		fwrite (row, 3, w, fp);
+	}
+	free (row);
+	fclose (fp);
+}
 
-	assert (
-		vkCreatePipelineLayout (device, &pipeline_cinfo, NULL, &pipeline_layout) == VK_SUCCESS
-	);
+/**
+ * Readback callback of the batch, finishing the job rendered in `frame`.
+ */
+static void batch_frame (const uint8_t *rgba, uint32_t w, uint32_t h, uint64_t frame, void *user)
+{
+	uint32_t i = frame - batch_first_frame;
+	assert (i < n_batch_jobs);
 
-	VkPipelineDepthStencilStateCreateInfo depth_stencil = { 0 };
-	depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-	depth_stencil.depthTestEnable = VK_TRUE;
-	depth_stencil.depthWriteEnable = VK_TRUE;
-	depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
-	depth_stencil.depthBoundsTestEnable = VK_FALSE;
-	depth_stencil.minDepthBounds = 0.0f; // optional
-	depth_stencil.maxDepthBounds = 1.0f; // optional
-	depth_stencil.stencilTestEnable = VK_FALSE;
-	//depth_stencil.front = { 0 }; // optional
-	//depth_stencil.back = { 0 }; // optional
+	if (batch_jobs[i].out[0])
+		write_ppm (batch_jobs[i].out, rgba, w, h);
+	if (stream_fmt != STREAM_NONE)
+		stream_frame (rgba, w, h, frame, user);
 
-	VkGraphicsPipelineCreateInfo pipeinfo = { 0 };
-	pipeinfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipeinfo.stageCount = 2;
-	pipeinfo.pStages = stages;
-	pipeinfo.pVertexInputState = &vxinput;
-	pipeinfo.pInputAssemblyState = &inasm;
-	pipeinfo.pViewportState = &viewstate;
-	pipeinfo.pRasterizationState = &rasterizer;
-	pipeinfo.pMultisampleState = &multisampling;
-	pipeinfo.pDepthStencilState = &depth_stencil;
-	pipeinfo.pColorBlendState = &blend;
-	pipeinfo.pDynamicState = NULL; // optional
-	pipeinfo.layout = pipeline_layout;
-	pipeinfo.renderPass = render_pass;
-	pipeinfo.subpass = 0;
-	pipeinfo.basePipelineHandle = VK_NULL_HANDLE; // optional
-	pipeinfo.basePipelineIndex = -1; // optional
+	batch_latency_ms[i] = now_ms () - batch_start_ms[i];
+	n_batch_done ++;
+}
 
-	assert (
-		vkCreateGraphicsPipelines (
-			device,
-			VK_NULL_HANDLE,
-			1,
-			&pipeinfo,
-			NULL,
-			&pipeline
-		) == VK_SUCCESS
-	);
+static int cmp_double (const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Render all jobs back to back with the offscreen path.
+ *
+ * Jobs are submitted as frames, so as many are in flight as there are frames in flight,
+ * and each one is finished when its readback arrives. Everything but what has the size of
+ * the render targets lives across jobs, see `resize_offscreen_targets`. That is only
+ * recreated when a job has another size than the one before it, so jobs are best grouped
+ * by size in the file.
+ */
+static void run_batch ()
+{
+	batch_start_ms = calloc (n_batch_jobs, sizeof (double));
+	batch_latency_ms = calloc (n_batch_jobs, sizeof (double));
+	batch_first_frame = readback_frame;
+	readback_set_callback (batch_frame, NULL);
+
+	uint32_t n_retargets = 0;
+	double t0 = now_ms ();
+
+	for (uint32_t i = 0; i < n_batch_jobs; i ++)
+	{
+		const BatchJob *job = &batch_jobs[i];
+		batch_start_ms[i] = now_ms ();
+
+		if (job->w != swapchain_ext.width || job->h != swapchain_ext.height)
+		{
+			headless_ext.width = job->w;
+			headless_ext.height = job->h;
+			resize_offscreen_targets ();
+			n_retargets ++;
+		}
+
+		float V[16], P[16];
+		mat4_look_at (V, job->eye, job->center);
+		mat4_perspective (P, job->fovy * (float) M_PI / 180.0f, (float) job->w / job->h, 0.1f, 100.0f);
+		set_camera (V, P);
 
-	// cleanup
+		draw_offscreen ();
+	}
 
-	vkDestroyShaderModule (device, vx_shader_mod, NULL);
-	vkDestroyShaderModule (device, frag_shader_mod, NULL);
-	free (vx_shader_code);
-	free (frag_shader_code);
-	free (attrib_desc);
-}
+	vkDeviceWaitIdle (device);
+	readback_drain (1);
 
-static void create_cmd_pool ()
-{
-	QueueFamilyIndices idx = find_queue_families (physical_device);
+	double total = now_ms () - t0;
+	assert (n_batch_done == n_batch_jobs);
 
-	VkCommandPoolCreateInfo info = { 0 };
-	info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	info.queueFamilyIndex = idx.gfx_family;
-	//info.flags = 0; // optional
+	qsort (batch_latency_ms, n_batch_jobs, sizeof (double), cmp_double);
+#define PCT(p) batch_latency_ms[(uint32_t) ((p) * (n_batch_jobs - 1))]
+	fprintf
+	(
+		stderr,
+		"batch: %u jobs in %.1f ms, %.1f jobs/s, %u retargets\n"
+		"latency ms: p50 %.2f p90 %.2f p99 %.2f max %.2f\n",
+		n_batch_jobs,
+		total,
+		n_batch_jobs * 1e3 / total,
+		n_retargets,
+		PCT (0.5), PCT (0.9), PCT (0.99), PCT (1.0)
+	);
+#undef PCT
 
-	assert (vkCreateCommandPool (device, &info, NULL, &cmdpool) == VK_SUCCESS);
+	free (batch_start_ms);
+	free (batch_latency_ms);
 }
 
-static uint32_t find_mem_type (uint32_t type_filter, VkMemoryPropertyFlags props)
+static void deinit_vulkan ()
 {
-	VkPhysicalDeviceMemoryProperties mem_props;
-	vkGetPhysicalDeviceMemoryProperties (physical_device, &mem_props);
+	destroy_record_threads ();
+	if (gpu_driven)
+		destroy_gpu_resources ();
+	if (n_particles)
+		destroy_particles ();
+	destroy_meshes ();
 
-	for (uint32_t i = 0; i < mem_props.memoryTypeCount; i ++)
+	destroy_frame_cmdbufs ();
+
+	vkDestroyDescriptorUpdateTemplate (device, descriptor_update_tpl, NULL);
+	if (has_push_descriptor)
 	{
-		if
-		(
-			(type_filter & (1 << i)) &&
-			(mem_props.memoryTypes[i].propertyFlags & props) == props
-		)
-			return i;
+		vkDestroyDescriptorUpdateTemplate (device, push_descriptor_tpl, NULL);
+		vkDestroyPipelineLayout (device, push_pipeline_layout, NULL);
+		vkDestroyDescriptorSetLayout (device, push_descriptor_set_layout, NULL);
 	}
 
-	fprintf (stderr, "failed to find suitable memory type!");
-	exit (1);
+	free (unif_buf);
+	free (unif_buf_mem);
+	free (swapchain_imgs);
+	free (swapchain_img_views);
+	free (swapchain_framebufs);
+	free (cmdbufs);
+	img_untrack (&tex_track);
+	free (draw_list);
+	free (draw_keys);
+	free (draw_order);
+	free (instances);
+	free (inst_lods);
+	free (img_available);
+	free (render_finished);
+	free (in_flight_fences);
+	free (imgs_in_flight);
+	free (caps.queue_families);
 }
 
-static void create_img
-(
-	uint32_t w,
-	uint32_t h,
-	VkFormat fmt,
-	VkImageTiling tiling,
-	VkImageUsageFlags usage,
-	VkMemoryPropertyFlags props,
-	VkImage *img,
-	VkDeviceMemory *img_mem
-)
+void deinit ()
 {
-	VkImageCreateInfo img_info = { 0 };
-	img_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	img_info.imageType = VK_IMAGE_TYPE_2D;
-	img_info.extent.width = w;
-	img_info.extent.height = h;
-	img_info.extent.depth = 1;
-	img_info.mipLevels = 1;
-	img_info.arrayLayers = 1;
-	img_info.format = fmt;
-	img_info.tiling = tiling;
-	img_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	img_info.usage = usage;
-	img_info.samples = VK_SAMPLE_COUNT_1_BIT;
-	img_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-	assert (vkCreateImage (device, &img_info, NULL, img) == VK_SUCCESS);
+	deinit_vulkan ();
+	cooked_close (&scene);
+}
 
-	VkMemoryRequirements memreq;
-	vkGetImageMemoryRequirements (device, *img, &memreq);
+#ifdef BENCH
+/**
+ *	BENCHMARKS -------------------------------------------------------------------------------------------------
+ *
+ * Compiled in with `make bench`. They run after init against the real device and print
+ * their results to stdout.
+ */
 
-	VkMemoryAllocateInfo alloc_info = { 0 };
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.allocationSize = memreq.size;
-	alloc_info.memoryTypeIndex = find_mem_type (memreq.memoryTypeBits, props);
+#define BENCH_DESCRIPTOR_UPDATES 10000
 
-	assert (vkAllocateMemory (device, &alloc_info, NULL, img_mem) == VK_SUCCESS);
+/**
+ * CPU cost of writing descriptors: hand built `VkWriteDescriptorSet` arrays against
+ * update templates and push descriptors.
+ */
+static void bench_descriptor_updates ()
+{
+	const int n = BENCH_DESCRIPTOR_UPDATES;
+	double t;
 
-	vkBindImageMemory (device, *img, *img_mem, 0);
-}
+	DescriptorData data = { 0 };
+	data.ubo.buffer = unif_buf[0];
+	data.ubo.range = VK_WHOLE_SIZE;
+	data.tex.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	data.tex.imageView = tex_img_view;
+	data.tex.sampler = tex_sampler;
 
-static VkCommandBuffer begin_single_time_cmds ()
-{
-	VkCommandBufferAllocateInfo alloc_info = { 0 };
-	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	alloc_info.commandPool = cmdpool;
-	alloc_info.commandBufferCount = 1;
+	// VkWriteDescriptorSet, the way create_descriptor_sets used to do it
 
-	VkCommandBuffer cmdbuf;
-	vkAllocateCommandBuffers (device, &alloc_info, &cmdbuf);
+	t = now_ms ();
+	for (int i = 0; i < n; i ++)
+	{
+		VkWriteDescriptorSet writes[2] = { 0 };
 
-	VkCommandBufferBeginInfo begin_info = { 0 };
-	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[0].dstSet = descriptor_sets[0];
+		writes[0].dstBinding = 0;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		writes[0].descriptorCount = 1;
+		writes[0].pBufferInfo = &data.ubo;
 
-	vkBeginCommandBuffer (cmdbuf, &begin_info);
+		writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[1].dstSet = descriptor_sets[0];
+		writes[1].dstBinding = 1;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[1].descriptorCount = 1;
+		writes[1].pImageInfo = &data.tex;
 
-	return cmdbuf;
-}
+		vkUpdateDescriptorSets (device, 2, writes, 0, NULL);
+	}
+	printf ("descriptor updates (%d): write sets  %8.3f ms\n", n, now_ms () - t);
 
-static void end_single_time_cmds (VkCommandBuffer cmdbuf)
-{
-	vkEndCommandBuffer (cmdbuf);
+	// update template
 
-	VkSubmitInfo submit_info = { 0 };
-	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &cmdbuf;
+	t = now_ms ();
+	for (int i = 0; i < n; i ++)
+		write_descriptor_set (descriptor_sets[0], &data);
+	printf ("descriptor updates (%d): template    %8.3f ms\n", n, now_ms () - t);
 
-	vkQueueSubmit (gfx_queue, 1, &submit_info, VK_NULL_HANDLE);
-	vkQueueWaitIdle (gfx_queue);
+	// push descriptors recorded into a command buffer
 
-	vkFreeCommandBuffers (device, cmdpool, 1, &cmdbuf);
+	if (has_push_descriptor)
+	{
+		VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+		t = now_ms ();
+		for (int i = 0; i < n; i ++)
+			push_descriptors (cmdbuf, &data);
+		printf ("descriptor updates (%d): push        %8.3f ms\n", n, now_ms () - t);
+		end_single_time_cmds (cmdbuf);
+	}
 }
 
-#define HAS_STENCIL_COMPONENT(fmt) \
-	( fmt == VK_FORMAT_D32_SFLOAT_S8_UINT || fmt == VK_FORMAT_D24_UNORM_S8_UINT )
+#define BENCH_RECORD_DRAWS 100000
+#define BENCH_RECORD_ITERATIONS 10
 
-static void transition_img_layout
-(
-	VkImage img,
-	VkFormat fmt,
-	VkImageLayout old_layout,
-	VkImageLayout new_layout
-)
+/**
+ * CPU recording throughput of a 100k draw scene over 1..N recording threads, N being the
+ * number of online cores.
+ */
+static void bench_parallel_recording ()
 {
-	VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+	uint32_t max_threads = (uint32_t) sysconf (_SC_NPROCESSORS_ONLN);
+	uint32_t threads = n_record_threads;
+	RecordMode mode = record_mode;
 
-	VkImageMemoryBarrier barrier = { 0 };
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = old_layout;
-	barrier.newLayout = new_layout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = img;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.srcAccessMask = 0; // TODO
-	barrier.dstAccessMask = 0; // TODO
+	DrawCmd *saved = malloc (n_draws * sizeof (DrawCmd));
+	uint32_t n_saved = n_draws;
+	memcpy (saved, draw_list, n_draws * sizeof (DrawCmd));
 
-	if (new_layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+	draw_list_clear ();
+	for (uint32_t i = 0; i < BENCH_RECORD_DRAWS; i ++)
 	{
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-
-		if (HAS_STENCIL_COMPONENT (fmt))
-			barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+		DrawCmd cmd = { 0 };
+		cmd.n_indices = 6;
+		cmd.n_instances = 1;
+		cmd.pipeline = mesh_pipeline (0);
+		draw_list_add (&cmd);
 	}
 
-	VkPipelineStageFlags src_stage;
-	VkPipelineStageFlags dst_stage;
+	record_mode = RECORD_DYNAMIC;
+	destroy_record_threads ();
 
-	if (old_layout == VK_IMAGE_LAYOUT_UNDEFINED && new_layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+	for (uint32_t t = 1; t <= max_threads; t ++)
 	{
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		src_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		dst_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		create_record_threads (t);
+
+		double start = now_ms ();
+		for (int i = 0; i < BENCH_RECORD_ITERATIONS; i ++)
+		{
+			draw_list_touch ();
+			frame_cmdbuf (0);
+		}
+		double ms = (now_ms () - start) / BENCH_RECORD_ITERATIONS;
+
+		printf
+		(
+			"recording %d draws: %2u threads %8.3f ms/frame %10.0f draws/ms\n",
+			BENCH_RECORD_DRAWS, t, ms, BENCH_RECORD_DRAWS / ms
+		);
+
+		destroy_record_threads ();
 	}
-	else if
-	(
-		old_layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-		new_layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-	)
+
+	// restore the scene
+
+	draw_list_clear ();
+	for (uint32_t i = 0; i < n_saved; i ++)
+		draw_list_add (&saved[i]);
+	free (saved);
+
+	record_mode = mode;
+	create_record_threads (threads);
+}
+
+#define BENCH_VX_GRID 256
+#define BENCH_VX_INSTANCES 16
+#define BENCH_VX_ITERATIONS 10
+
+/**
+ * A `g` by `g` grid of vertices covering the viewport, returning the number of indices.
+ */
+static uint32_t bench_grid (uint32_t g, Vertex **vx, uint32_t **idx)
+{
+	uint32_t n_idx = (g - 1) * (g - 1) * 6;
+	*vx = calloc (g * g, sizeof (Vertex));
+	*idx = malloc (n_idx * sizeof (uint32_t));
+
+	for (uint32_t y = 0; y < g; y ++)
 	{
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		src_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		for (uint32_t x = 0; x < g; x ++)
+		{
+			Vertex *v = &(*vx)[y * g + x];
+			v->pos[0] = 2.0f * x / (g - 1) - 1.0f;
+			v->pos[1] = 2.0f * y / (g - 1) - 1.0f;
+			v->pos[2] = 0.5f;
+			v->normal[2] = 1.0f;
+			v->color[0] = v->color[1] = v->color[2] = 1.0f;
+			v->uv[0] = (float) x / (g - 1);
+			v->uv[1] = (float) y / (g - 1);
+		}
 	}
-	else if
-	(
-		old_layout == VK_IMAGE_LAYOUT_UNDEFINED &&
-		new_layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
-	)
+
+	uint32_t *p = *idx;
+	for (uint32_t y = 0; y + 1 < g; y ++)
 	{
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask =
-			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
-			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		src_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		dst_stage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		for (uint32_t x = 0; x + 1 < g; x ++)
+		{
+			uint32_t i = y * g + x;
+			*p ++ = i; *p ++ = i + 1; *p ++ = i + g + 1;
+			*p ++ = i + g + 1; *p ++ = i + g; *p ++ = i;
+		}
 	}
-	else
+
+	return n_idx;
+}
+
+/**
+ * GPU time of drawing a 256x256 vertex grid with interleaved and split vertex layouts,
+ * once depth only and once fully shaded. The depth pass fetches only positions, which is
+ * where splitting them out should pay off, while full shading should cost about the same.
+ * Vertices are stored in the format of the builtin mesh, see `--quantize`.
+ */
+static void bench_vertex_layouts ()
+{
+	if (caps.queue_families[caps.queues.gfx_family].timestampValidBits == 0)
 	{
-		fprintf (stderr, "unsupported layout transition");
-		exit (1);
+		printf ("vertex layouts: no timestamps on the graphics queue\n");
+		return;
 	}
 
-	vkCmdPipelineBarrier (cmdbuf, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+	// grid covering the viewport
 
-	end_single_time_cmds (cmdbuf);
-}
+	Vertex *vx;
+	uint32_t *idx;
+	uint32_t n_vx = BENCH_VX_GRID * BENCH_VX_GRID;
+	uint32_t n_idx = bench_grid (BENCH_VX_GRID, &vx, &idx);
 
-static void create_depth_buffer ()
-{
-	VkFormat depth_fmt = find_depth_fmt ();
-	create_img
-	(
-		swapchain_ext.width,
-		swapchain_ext.height,
-		depth_fmt,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		&depth_img,
-		&depth_img_mem
-	);
-	create_img_view (&depth_img_view, depth_img, depth_fmt, VK_IMAGE_ASPECT_DEPTH_BIT);
-	transition_img_layout
-	(
-		depth_img,
-		depth_fmt,
-		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
-	);
-}
+	uint32_t mesh[VX_LAYOUT_COUNT];
+	for (int l = 0; l < VX_LAYOUT_COUNT; l ++)
+		mesh[l] = mesh_add (vx, n_vx, idx, n_idx, builtin_vx_fmt, l);
+	free (vx);
+	free (idx);
 
-static void create_framebuffers ()
-{
-	swapchain_framebufs = calloc (n_swapchain_img_views, sizeof (VkFramebuffer));
+	// instances and camera of their own, the scene gets them back every frame
 
-	for (size_t i = 0; i < n_swapchain_img_views; i ++)
+	InstanceData *saved = malloc (n_instances * sizeof (InstanceData));
+	uint32_t n_saved = n_instances;
+	memcpy (saved, instances, n_instances * sizeof (InstanceData));
+	UniformBufferObject saved_camera = camera;
+
+	float I[16], M[16];
+	mat4_identity (I);
+	mesh_model_matrix (mesh[0], I, M);
+	instances_clear ();
+	for (uint32_t i = 0; i < BENCH_VX_INSTANCES; i ++)
+		instance_add (M, 0);
+	update_inst_buf (0);
+	set_camera (I, I);
+	update_unif_buf (0);
+
+	VkQueryPoolCreateInfo qinfo = { 0 };
+	qinfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	qinfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	qinfo.queryCount = 2;
+
+	VkQueryPool pool;
+	assert (vkCreateQueryPool (device, &qinfo, NULL, &pool) == VK_SUCCESS);
+
+	const char *layout_names[VX_LAYOUT_COUNT] = { "interleaved", "split" };
+
+	for (int depth_only = 1; depth_only >= 0; depth_only --)
 	{
-		VkImageView attachments[] = { swapchain_img_views[i], depth_img_view };
+		for (int l = 0; l < VX_LAYOUT_COUNT; l ++)
+		{
+			const Mesh *m = meshes[mesh[l]];
+			VkPipeline pipe = depth_only ? depth_pipelines[l][m->fmt] : pipelines[l][m->fmt];
+			double best = 1e30;
 
-		VkFramebufferCreateInfo info = { 0 };
-		info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		info.renderPass = render_pass;
-		info.attachmentCount = 2;
-		info.pAttachments = attachments;
-		info.width = swapchain_ext.width;
-		info.height = swapchain_ext.height;
-		info.layers = 1;
+			for (int it = 0; it < BENCH_VX_ITERATIONS; it ++)
+			{
+				VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+				vkCmdResetQueryPool (cmdbuf, pool, 0, 2);
+				vkCmdWriteTimestamp (cmdbuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool, 0);
+
+				begin_render_pass
+				(
+					cmdbuf,
+					depth_only ? depth_render_pass : render_pass,
+					0,
+					VK_SUBPASS_CONTENTS_INLINE
+				);
+				vkCmdBindPipeline (cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipe);
+				vkCmdBindDescriptorSets
+				(
+					cmdbuf,
+					VK_PIPELINE_BIND_POINT_GRAPHICS,
+					pipeline_layout,
+					0,
+					1,
+					&descriptor_sets[0],
+					0,
+					NULL
+				);
+
+				VkDeviceSize zero = 0;
+				vkCmdBindVertexBuffers (cmdbuf, 1, 1, &inst_bufs[0], &zero);
+				bind_vx_streams (cmdbuf, m->vx_buf, m->attr_offset, depth_only);
+				vkCmdBindIndexBuffer (cmdbuf, m->idx_buf, 0, m->idx_type);
+				vkCmdDrawIndexed (cmdbuf, n_idx, BENCH_VX_INSTANCES, m->base_index, m->base_vertex, 0);
+				vkCmdEndRenderPass (cmdbuf);
+
+				vkCmdWriteTimestamp (cmdbuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool, 1);
+				end_single_time_cmds (cmdbuf);
+
+				uint64_t ts[2];
+				assert (
+					vkGetQueryPoolResults
+					(
+						device,
+						pool,
+						0,
+						2,
+						sizeof (ts),
+						ts,
+						sizeof (uint64_t),
+						VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT
+					) == VK_SUCCESS
+				);
+
+				double ms = (ts[1] - ts[0]) * caps.props.limits.timestampPeriod / 1e6;
+				if (ms < best)
+					best = ms;
+			}
 
-		assert (vkCreateFramebuffer (device, &info, NULL, &swapchain_framebufs[i]) == VK_SUCCESS);
+			// bytes behind each vertex the pass actually reads
+			uint32_t stride = vx_pos_stride (m->fmt);
+			if (!depth_only || l == VX_LAYOUT_INTERLEAVED)
+				stride += vx_attr_stride (m->fmt);
+
+			printf
+			(
+				"vertex layouts: %-6s %-11s %2u B/vertex %8.3f ms %8.1f Mindices/s\n",
+				depth_only ? "depth" : "shaded",
+				layout_names[l],
+				stride,
+				best,
+				(double) n_idx * BENCH_VX_INSTANCES / best / 1e3
+			);
+		}
 	}
+
+	vkDestroyQueryPool (device, pool, NULL);
+
+	// restore the scene
+
+	instances_clear ();
+	for (uint32_t i = 0; i < n_saved; i ++)
+		instance_add (saved[i].M, saved[i].tex);
+	free (saved);
+	camera = saved_camera;
 }
 
-static void create_buffer
-(
-	VkDeviceSize size,
-	VkBufferUsageFlags usage,
-	VkMemoryPropertyFlags props,
-	VkBuffer *buf,
-	VkDeviceMemory *mem
-)
+/**
+ * The grid of `bench_vertex_layouts` in every vertex format and layout, drawn with the
+ * fixed function vertex input pipeline of each and with the one vertex pulling pipeline.
+ */
+static void bench_vertex_pulling ()
 {
-	VkBufferCreateInfo info = { 0 };
-	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	info.size = size;
-	info.usage = usage;
-	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (!has_bda)
+	{
+		printf ("vertex pulling: no buffer device address on this device\n");
+		return;
+	}
+	if (caps.queue_families[caps.queues.gfx_family].timestampValidBits == 0)
+	{
+		printf ("vertex pulling: no timestamps on the graphics queue\n");
+		return;
+	}
 
-	assert (vkCreateBuffer (device, &info, NULL, buf) == VK_SUCCESS);
+	Vertex *vx;
+	uint32_t *idx;
+	uint32_t n_vx = BENCH_VX_GRID * BENCH_VX_GRID;
+	uint32_t n_idx = bench_grid (BENCH_VX_GRID, &vx, &idx);
 
-	VkMemoryRequirements mem_req;
-	vkGetBufferMemoryRequirements (device, *buf, &mem_req);
+	InstanceData *saved = malloc (n_instances * sizeof (InstanceData));
+	uint32_t n_saved = n_instances;
+	memcpy (saved, instances, n_instances * sizeof (InstanceData));
+	UniformBufferObject saved_camera = camera;
 
-	VkMemoryAllocateInfo alloc_info = { 0 };
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.allocationSize = mem_req.size;
-	alloc_info.memoryTypeIndex = find_mem_type
-	(
-		mem_req.memoryTypeBits,
-		props
-	);
+	float I[16];
+	mat4_identity (I);
+	set_camera (I, I);
+	update_unif_buf (0);
 
-	assert (vkAllocateMemory (device, &alloc_info, NULL, mem) == VK_SUCCESS);
+	VkQueryPoolCreateInfo qinfo = { 0 };
+	qinfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	qinfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	qinfo.queryCount = 2;
 
-	vkBindBufferMemory (device, *buf, *mem, 0);
-}
+	VkQueryPool pool;
+	assert (vkCreateQueryPool (device, &qinfo, NULL, &pool) == VK_SUCCESS);
 
-static void cp_buf_img (VkBuffer buf, VkImage img, uint32_t w, uint32_t h)
-{
-	VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+	const char *layout_names[VX_LAYOUT_COUNT] = { "interleaved", "split" };
+	const char *fmt_names[VX_FMT_COUNT] = { "float", "quant", "quant-half-uv" };
+	uint32_t mark = n_rq_meshes;
 
-	VkBufferImageCopy region = { 0 };
+	for (int l = 0; l < VX_LAYOUT_COUNT; l ++)
+	{
+		for (int f = 0; f < VX_FMT_COUNT; f ++)
+		{
+			uint32_t mesh = mesh_add (vx, n_vx, idx, n_idx, f, l);
+			const Mesh *m = meshes[mesh];
+			if (m->fmt != f)
+			{
+				printf ("vertex pulling: %-11s %-13s not supported\n", layout_names[l], fmt_names[f]);
+				continue;
+			}
 
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
+			float M[16];
+			mesh_model_matrix (mesh, I, M);
+			instances_clear ();
+			for (uint32_t i = 0; i < BENCH_VX_INSTANCES; i ++)
+				instance_add (M, 0);
+			update_inst_buf (0);
 
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
+			double best[2] = { 1e30, 1e30 };
+			for (int pull = 0; pull <= 1; pull ++)
+			{
+				VkPipelineLayout layout = pull ? pull_pipeline_layout : pipeline_layout;
+
+				for (int it = 0; it < BENCH_VX_ITERATIONS; it ++)
+				{
+					VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+					vkCmdResetQueryPool (cmdbuf, pool, 0, 2);
+					vkCmdWriteTimestamp (cmdbuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool, 0);
+
+					begin_render_pass (cmdbuf, render_pass, 0, VK_SUBPASS_CONTENTS_INLINE);
+					vkCmdBindPipeline
+					(
+						cmdbuf,
+						VK_PIPELINE_BIND_POINT_GRAPHICS,
+						pull ? pull_pipeline : pipelines[l][f]
+					);
+					vkCmdBindDescriptorSets
+					(
+						cmdbuf,
+						VK_PIPELINE_BIND_POINT_GRAPHICS,
+						layout,
+						0,
+						1,
+						&descriptor_sets[0],
+						0,
+						NULL
+					);
+
+					VkDeviceSize zero = 0;
+					vkCmdBindVertexBuffers (cmdbuf, 1, 1, &inst_bufs[0], &zero);
+					if (pull)
+						vkCmdPushConstants
+						(
+							cmdbuf,
+							layout,
+							VK_SHADER_STAGE_VERTEX_BIT,
+							0,
+							sizeof (PullConstants),
+							&rq_meshes[mesh].pull
+						);
+					else
+						bind_vx_streams (cmdbuf, m->vx_buf, m->attr_offset, 0);
+					vkCmdBindIndexBuffer (cmdbuf, m->idx_buf, 0, m->idx_type);
+					vkCmdDrawIndexed (cmdbuf, n_idx, BENCH_VX_INSTANCES, m->base_index, m->base_vertex, 0);
+					vkCmdEndRenderPass (cmdbuf);
+
+					vkCmdWriteTimestamp (cmdbuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool, 1);
+					end_single_time_cmds (cmdbuf);
+
+					uint64_t ts[2];
+					assert (
+						vkGetQueryPoolResults
+						(
+							device,
+							pool,
+							0,
+							2,
+							sizeof (ts),
+							ts,
+							sizeof (uint64_t),
+							VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT
+						) == VK_SUCCESS
+					);
+
+					double ms = (ts[1] - ts[0]) * caps.props.limits.timestampPeriod / 1e6;
+					if (ms < best[pull])
+						best[pull] = ms;
+				}
+			}
 
-	VkOffset3D offset = { 0, 0, 0 };
-	VkExtent3D ext = { w, h, 1 };
-	region.imageOffset = offset;
-	region.imageExtent = ext;
+			printf
+			(
+				"vertex pulling: %-11s %-13s fixed %8.3f ms pulled %8.3f ms (%+.1f%%)\n",
+				layout_names[l],
+				fmt_names[f],
+				best[0],
+				best[1],
+				100.0 * (best[1] - best[0]) / best[0]
+			);
+		}
+	}
 
-	vkCmdCopyBufferToImage (cmdbuf, buf, img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	vkDestroyQueryPool (device, pool, NULL);
+	free (vx);
+	free (idx);
 
-	end_single_time_cmds (cmdbuf);
+	// restore the scene
+
+	destroy_meshes_from (mark);
+	instances_clear ();
+	for (uint32_t i = 0; i < n_saved; i ++)
+		instance_add (saved[i].M, saved[i].tex);
+	free (saved);
+	camera = saved_camera;
 }
 
-static void create_tex_img ()
+#define BENCH_PREPASS_LAYERS 32
+#define BENCH_PREPASS_ITERATIONS 10
+
+/**
+ * Full screen quads drawn back to front, the worst case for overdraw, with the depth
+ * pre-pass off and on. Prints the time of a frame and how many fragments were shaded.
+ */
+static void bench_depth_prepass ()
 {
-	int w, h, c;
+	if (gpu_driven)
+	{
+		printf ("depth prepass: not used by the GPU driven path\n");
+		return;
+	}
 
-	stbi_uc *pix = stbi_load ("tutorial/textures/texture.jpg", &w, &h, &c, STBI_rgb_alpha);
-	VkDeviceSize size = w * h * 4;
+	int prepass = depth_prepass;
+	UniformBufferObject saved_camera = camera;
 
-	assert (pix);
+	DrawCmd *saved = malloc (n_draws * sizeof (DrawCmd));
+	uint32_t n_saved = n_draws;
+	memcpy (saved, draw_list, n_draws * sizeof (DrawCmd));
 
-	VkBuffer staging_buf;
-	VkDeviceMemory staging_buf_mem;
+	InstanceData *saved_inst = malloc (n_instances * sizeof (InstanceData));
+	uint32_t n_saved_inst = n_instances;
+	memcpy (saved_inst, instances, n_instances * sizeof (InstanceData));
 
-	create_buffer
-	(
-		size,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&staging_buf,
-		&staging_buf_mem
-	);
+	// the first quad of the builtin mesh scaled to cover the viewport
 
-	void *data;
-	vkMapMemory (device, staging_buf_mem, 0, size, 0, &data);
-	memcpy (data, pix, size);
-	vkUnmapMemory (device, staging_buf_mem);
+	float M[16], MQ[16];
+	mat4_identity (M);
+	M[0] = M[5] = 4.0f;
 
-	stbi_image_free (pix);
+	instances_clear ();
+	for (uint32_t i = 0; i < BENCH_PREPASS_LAYERS; i ++)
+	{
+		M[14] = 0.9f - 0.8f * i / (BENCH_PREPASS_LAYERS - 1);
+		mesh_model_matrix (0, M, MQ);
+		instance_add (MQ, 0);
+	}
 
-	create_img
-	(
-		w,
-		h,
-		VK_FORMAT_R8G8B8A8_SRGB,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		&tex_img,
-		&tex_img_mem
-	);
+	DrawCmd cmd = { 0 };
+	cmd.n_indices = 6;
+	cmd.n_instances = BENCH_PREPASS_LAYERS;
+	cmd.mesh = 0;
+	cmd.pipeline = mesh_pipeline (0);
 
-	transition_img_layout
-	(
-		tex_img,
-		VK_FORMAT_R8G8B8A8_SRGB,
-		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-	);
+	draw_list_clear ();
+	draw_list_add (&cmd);
 
-	cp_buf_img
-	(
-		staging_buf,
-		tex_img,
-		w,
-		h
-	);
+	float I[16];
+	mat4_identity (I);
+	set_camera (I, I);
+	update_unif_buf (0);
+	update_inst_buf (0);
 
-	transition_img_layout
-	(
-		tex_img,
-		VK_FORMAT_R8G8B8A8_SRGB,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-	);
+	for (int on = 0; on <= 1; on ++)
+	{
+		set_depth_prepass (on);
+		double best = 1e30;
 
-	vkDestroyBuffer (device, staging_buf, NULL);
-	vkFreeMemory (device, staging_buf_mem, NULL);
-}
+		for (int it = 0; it < BENCH_PREPASS_ITERATIONS; it ++)
+		{
+			double t = now_ms ();
+			VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+			record_cmdbuf (cmdbuf, 0);
+			end_single_time_cmds (cmdbuf);
+			t = now_ms () - t;
+
+			if (t < best)
+				best = t;
+		}
 
-static void create_tex_img_view ()
-{
-	create_img_view (
-		&tex_img_view, tex_img, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT
-	);
-}
+		frame_stats_pending[0] = frame_stats_enabled (0);
+		read_frame_stats (0);
 
-static void create_tex_sampler ()
-{
-	VkSamplerCreateInfo info = { 0 };
-	info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	info.magFilter = VK_FILTER_LINEAR;
-	info.minFilter = VK_FILTER_LINEAR;
-	info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	info.anisotropyEnable = VK_TRUE;
+		printf
+		(
+			"depth prepass %-3s: %2d layers %8.3f ms/frame %12llu fragment invocations\n",
+			on ? "on" : "off",
+			BENCH_PREPASS_LAYERS,
+			best,
+			(unsigned long long) fragment_invocations ()
+		);
+	}
 
-	VkPhysicalDeviceProperties props = { 0 };
-	vkGetPhysicalDeviceProperties (physical_device, &props);
+	// restore the scene
 
-	info.maxAnisotropy = props.limits.maxSamplerAnisotropy;
-	info.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-	info.unnormalizedCoordinates = VK_FALSE;
-	info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-	info.mipLodBias = 0.0f;
-	info.minLod = 0.0f;
-	info.maxLod = 0.0f;
+	set_depth_prepass (prepass);
+	camera = saved_camera;
 
-	assert (vkCreateSampler (device, &info, NULL, &tex_sampler) == VK_SUCCESS);
+	instances_clear ();
+	for (uint32_t i = 0; i < n_saved_inst; i ++)
+		instance_add (saved_inst[i].M, saved_inst[i].tex);
+	free (saved_inst);
+
+	draw_list_clear ();
+	for (uint32_t i = 0; i < n_saved; i ++)
+		draw_list_add (&saved[i]);
+	free (saved);
 }
 
-static void copy_buf (VkBuffer src, VkBuffer dst, VkDeviceSize size)
+#define BENCH_OPT_GRID 256
+#define BENCH_OPT_ITERATIONS 10
+
+/**
+ * A grid covering the viewport with every triangle its own three vertices, in random
+ * order, drawn as is and after `optimize_mesh`. The vertex shader invocations show what
+ * the cache makes of each.
+ */
+static void bench_mesh_optimization ()
 {
-	VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+	if (gpu_driven)
+	{
+		printf ("mesh optimization: the GPU driven path draws only the builtin mesh\n");
+		return;
+	}
+	if (frame_stats_pool == VK_NULL_HANDLE)
+	{
+		printf ("mesh optimization: no pipeline statistics on this device\n");
+		return;
+	}
 
-	VkBufferCopy copy = { 0 };
-	copy.srcOffset = 0; // optional
-	copy.dstOffset = 0; // optional
-	copy.size = size;
-	vkCmdCopyBuffer (cmdbuf, src, dst, 1, &copy);
+	int optimize = optimize_meshes;
+	UniformBufferObject saved_camera = camera;
 
-	end_single_time_cmds (cmdbuf);
-}
+	DrawCmd *saved = malloc (n_draws * sizeof (DrawCmd));
+	uint32_t n_saved = n_draws;
+	memcpy (saved, draw_list, n_draws * sizeof (DrawCmd));
 
-static void create_vx_buf ()
-{
-	VkDeviceSize size = sizeof (float) * 8 * 3;
+	InstanceData *saved_inst = malloc (n_instances * sizeof (InstanceData));
+	uint32_t n_saved_inst = n_instances;
+	memcpy (saved_inst, instances, n_instances * sizeof (InstanceData));
 
-	VkBuffer staging_buf;
-	VkDeviceMemory staging_buf_mem;
-	create_buffer
-	(
-		size,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&staging_buf,
-		&staging_buf_mem
-	);
+	const uint32_t g = BENCH_OPT_GRID;
+	uint32_t n_tris = (g - 1) * (g - 1) * 2;
+	uint32_t *order = malloc (n_tris * sizeof (uint32_t));
+	for (uint32_t i = 0; i < n_tris; i ++)
+		order[i] = i;
+	srand (1);
+	for (uint32_t i = n_tris - 1; i > 0; i --)
+	{
+		uint32_t j = rand () % (i + 1);
+		uint32_t t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
 
-	void *data;
-	vkMapMemory (device, staging_buf_mem, 0, size, 0, &data);
-	memcpy (data, vertices, (size_t) size);
-	vkUnmapMemory (device, staging_buf_mem);
+	static const uint32_t corners[2][3][2] = { { { 0, 0 }, { 1, 0 }, { 1, 1 } }, { { 0, 0 }, { 1, 1 }, { 0, 1 } } };
+	Vertex *vx = calloc (n_tris * 3, sizeof (Vertex));
+	for (uint32_t i = 0; i < n_tris; i ++)
+	{
+		uint32_t q = order[i] / 2, x = q % (g - 1), y = q / (g - 1);
+		for (int k = 0; k < 3; k ++)
+		{
+			Vertex *v = &vx[i * 3 + k];
+			v->pos[0] = -1.0f + 2.0f * (x + corners[order[i] & 1][k][0]) / (g - 1);
+			v->pos[1] = -1.0f + 2.0f * (y + corners[order[i] & 1][k][1]) / (g - 1);
+			v->pos[2] = 0.5f;
+			v->normal[2] = 1.0f;
+			v->color[0] = v->color[1] = v->color[2] = 1.0f;
+		}
+	}
 
-	create_buffer
-	(
-		size,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		&vx_buf,
-		&vx_buf_mem
-	);
+	float I[16];
+	mat4_identity (I);
+	set_camera (I, I);
+	update_unif_buf (0);
 
-	copy_buf (staging_buf, vx_buf, size);
+	for (int on = 0; on <= 1; on ++)
+	{
+		optimize_meshes = on;
+		uint32_t mark = n_rq_meshes;
+		uint32_t mesh = mesh_add (vx, n_tris * 3, NULL, 0, builtin_vx_fmt, builtin_vx_layout);
+
+		float MQ[16];
+		mesh_model_matrix (mesh, I, MQ);
+		instances_clear ();
+		instance_add (MQ, 0);
+		update_inst_buf (0);
+
+		DrawCmd cmd = { 0 };
+		cmd.n_indices = meshes[mesh]->n_indices;
+		cmd.n_instances = 1;
+		cmd.mesh = mesh;
+		cmd.pipeline = mesh_pipeline (mesh);
+		draw_list_clear ();
+		draw_list_add (&cmd);
+
+		double best = 1e30;
+		for (int it = 0; it < BENCH_OPT_ITERATIONS; it ++)
+		{
+			double t = now_ms ();
+			VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+			record_cmdbuf (cmdbuf, 0);
+			end_single_time_cmds (cmdbuf);
+			t = now_ms () - t;
+
+			if (t < best)
+				best = t;
+		}
 
-	vkDestroyBuffer (device, staging_buf, NULL);
-	vkFreeMemory (device, staging_buf_mem, NULL);
-}
+		frame_stats_pending[0] = frame_stats_enabled (0);
+		read_frame_stats (0);
 
-static void create_idx_buf ()
-{
-	VkDeviceSize size = sizeof (uint16_t) * 12;
+		printf
+		(
+			"mesh optimization %-3s: %u triangles %8.3f ms/frame %10llu vertex invocations\n",
+			on ? "on" : "off",
+			n_tris,
+			best,
+			(unsigned long long) vertex_invocations ()
+		);
 
-	VkBuffer staging_buf;
-	VkDeviceMemory staging_buf_mem;
-	create_buffer
-	(
-		size,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&staging_buf,
-		&staging_buf_mem
-	);
+		draw_list_clear ();
+		destroy_meshes_from (mark);
+	}
 
-	void *data;
-	vkMapMemory (device, staging_buf_mem, 0, size, 0, &data);
-	memcpy (data, indices, (size_t) size);
-	vkUnmapMemory (device, staging_buf_mem);
+	free (order);
+	free (vx);
 
-	create_buffer
-	(
-		size,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		&idx_buf,
-		&idx_buf_mem
-	);
+	// restore the scene
 
-	copy_buf (staging_buf, idx_buf, size);
+	optimize_meshes = optimize;
+	camera = saved_camera;
 
-	vkDestroyBuffer (device, staging_buf, NULL);
-	vkFreeMemory (device, staging_buf_mem, NULL);
+	instances_clear ();
+	for (uint32_t i = 0; i < n_saved_inst; i ++)
+		instance_add (saved_inst[i].M, saved_inst[i].tex);
+	free (saved_inst);
+
+	draw_list_clear ();
+	for (uint32_t i = 0; i < n_saved; i ++)
+		draw_list_add (&saved[i]);
+	free (saved);
 }
 
-static void create_uniform_buf ()
+#define BENCH_LOD_SPHERE 256
+#define BENCH_LOD_INSTANCES 64
+#define BENCH_LOD_ITERATIONS 10
+
+/**
+ * Unit sphere of `seg` segments around and half as many rings from pole to pole,
+ * returning the number of indices.
+ */
+static uint32_t bench_sphere (uint32_t seg, Vertex **vx, uint32_t *n_vx, uint32_t **idx)
 {
-	// TODO
-	// this is 3 4x4 matrices - should it be like this?
-	VkDeviceSize size = sizeof (float) * 4 * 4 * 3;
+	const uint32_t rings = seg / 2;
+	uint32_t n_idx = seg * rings * 6;
+	*n_vx = (seg + 1) * (rings + 1);
+	*vx = calloc (*n_vx, sizeof (Vertex));
+	*idx = malloc (n_idx * sizeof (uint32_t));
+
+	for (uint32_t r = 0; r <= rings; r ++)
+		for (uint32_t s = 0; s <= seg; s ++)
+		{
+			float theta = (float) M_PI * r / rings, phi = 2.0f * (float) M_PI * s / seg;
+			Vertex *v = &(*vx)[r * (seg + 1) + s];
+			v->pos[0] = v->normal[0] = sinf (theta) * cosf (phi);
+			v->pos[1] = v->normal[1] = cosf (theta);
+			v->pos[2] = v->normal[2] = sinf (theta) * sinf (phi);
+			v->color[0] = v->color[1] = v->color[2] = 1.0f;
+			v->uv[0] = (float) s / seg;
+			v->uv[1] = (float) r / rings;
+		}
 
-	unif_buf = calloc (n_swapchain_imgs, sizeof (VkBuffer));
-	unif_buf_mem = calloc (n_swapchain_imgs, sizeof (VkDeviceMemory));
+	uint32_t k = 0;
+	for (uint32_t r = 0; r < rings; r ++)
+		for (uint32_t s = 0; s < seg; s ++)
+		{
+			uint32_t a = r * (seg + 1) + s, b = a + seg + 1;
+			(*idx)[k ++] = a; (*idx)[k ++] = a + 1; (*idx)[k ++] = b;
+			(*idx)[k ++] = a + 1; (*idx)[k ++] = b + 1; (*idx)[k ++] = b;
+		}
 
-	for (size_t i = 0; i < n_swapchain_imgs; i ++)
-		create_buffer
-		(
-			size,
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&unif_buf[i],
-			&unif_buf_mem[i]
-		);
+	return n_idx;
 }
 
-static void create_descriptor_pool ()
+/**
+ * A row of spheres going off into the distance, drawn in full and with levels of
+ * detail. Prints how many triangles each draws and the time of a frame.
+ */
+static void bench_lods ()
 {
-	VkDescriptorPoolSize pool_sizes[2] = { 0 };
+	if (gpu_driven)
+	{
+		printf ("levels of detail: the GPU driven path draws only the builtin mesh\n");
+		return;
+	}
 
-	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	pool_sizes[0].descriptorCount = n_swapchain_imgs;
-	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	pool_sizes[1].descriptorCount = n_swapchain_imgs;
+	int lods = use_lods;
+	UniformBufferObject saved_camera = camera;
 
-	VkDescriptorPoolCreateInfo pool_info = { 0 };
-	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	pool_info.poolSizeCount = 2;
-	pool_info.pPoolSizes = pool_sizes;
-	pool_info.maxSets = n_swapchain_imgs;
+	DrawCmd *saved = malloc (n_draws * sizeof (DrawCmd));
+	uint32_t n_saved = n_draws;
+	memcpy (saved, draw_list, n_draws * sizeof (DrawCmd));
 
-	assert (vkCreateDescriptorPool (device, &pool_info, NULL, &descriptor_pool) == VK_SUCCESS);
-}
+	InstanceData *saved_inst = malloc (n_instances * sizeof (InstanceData));
+	uint32_t n_saved_inst = n_instances;
+	memcpy (saved_inst, instances, n_instances * sizeof (InstanceData));
 
-static void create_descriptor_sets ()
-{
-	//std::vector<VkDescriptorSetLayout> layouts (swapchain_images.size (), descriptor_set_layout);
-	VkDescriptorSetLayout layouts[n_swapchain_imgs];
-	for (size_t i = 0; i < n_swapchain_imgs; i ++)
-		memcpy
-		(
-			&layouts[i],
-			&descriptor_set_layout,
-			sizeof (VkDescriptorSetLayout)
-		);
+	Vertex *vx;
+	uint32_t *idx, n_vx;
+	uint32_t n_idx = bench_sphere (BENCH_LOD_SPHERE, &vx, &n_vx, &idx);
 
-	VkDescriptorSetAllocateInfo alloc_info = { 0 };
-	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	alloc_info.descriptorPool = descriptor_pool;
-	alloc_info.descriptorSetCount = n_swapchain_imgs;
-	alloc_info.pSetLayouts = layouts;
+	uint32_t mark = n_rq_meshes;
+	use_lods = 1;
+	uint32_t mesh = mesh_add (vx, n_vx, idx, n_idx, builtin_vx_fmt, builtin_vx_layout);
+	free (vx);
+	free (idx);
 
-	//descriptor_sets.resize (n_swapchain_imgs);
-	descriptor_sets = malloc (n_swapchain_imgs * sizeof (VkDescriptorSet));
-	assert (vkAllocateDescriptorSets (device, &alloc_info, descriptor_sets) == VK_SUCCESS);
+	instances_clear ();
+	for (uint32_t i = 0; i < BENCH_LOD_INSTANCES; i ++)
+	{
+		float M[16], MQ[16];
+		mat4_identity (M);
+		M[12] = (i % 2) ? 1.5f : -1.5f;
+		M[14] = -4.0f * i;
+		mesh_model_matrix (mesh, M, MQ);
+		instance_add (MQ, 0);
+	}
 
-	for (size_t i = 0; i < n_swapchain_imgs; i ++)
+	DrawCmd cmd = { 0 };
+	cmd.n_indices = meshes[mesh]->n_indices;
+	cmd.n_instances = BENCH_LOD_INSTANCES;
+	cmd.mesh = mesh;
+	cmd.pipeline = mesh_pipeline (mesh);
+	draw_list_clear ();
+	draw_list_add (&cmd);
+
+	float V[16], P[16];
+	float eye[3] = { 0.0f, 1.0f, 6.0f }, center[3] = { 0.0f, 0.0f, 0.0f };
+	mat4_look_at (V, eye, center);
+	mat4_perspective (P, (float) M_PI / 3.0f, (float) swapchain_ext.width / swapchain_ext.height, 0.1f, 1000.0f);
+	set_camera (V, P);
+	update_unif_buf (0);
+	update_inst_buf (0);
+
+	for (int on = 0; on <= 1; on ++)
 	{
-		VkDescriptorBufferInfo buffer_info = { 0 };
-		buffer_info.buffer = unif_buf[i];
-		buffer_info.offset = 0;
-		// TODO what should this be?
-		//buffer_info.range = sizeof (UniformBufferObject);
-		buffer_info.range = VK_WHOLE_SIZE;
+		use_lods = on;
+		memset (inst_lods, 0, n_instances);
+		select_lods ();
+		draw_list_touch ();
 
-		VkDescriptorImageInfo img_info = { 0 };
-		img_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		img_info.imageView = tex_img_view;
-		img_info.sampler = tex_sampler;
+		uint64_t tris = 0;
+		for (uint32_t i = 0; i < n_instances; i ++)
+			tris += meshes[mesh]->lods[inst_lods[i]].n_indices / 3;
 
-		VkWriteDescriptorSet writes[2] = { 0 };
+		double best = 1e30;
+		for (int it = 0; it < BENCH_LOD_ITERATIONS; it ++)
+		{
+			double t = now_ms ();
+			VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+			record_cmdbuf (cmdbuf, 0);
+			end_single_time_cmds (cmdbuf);
+			t = now_ms () - t;
+
+			if (t < best)
+				best = t;
+		}
 
-		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		writes[0].dstSet = descriptor_sets[i];
-		writes[0].dstBinding = 0;
-		writes[0].dstArrayElement = 0;
-		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		writes[0].descriptorCount = 1;
-		writes[0].pBufferInfo = &buffer_info;
-		writes[0].pImageInfo = NULL; // optional
-		writes[0].pTexelBufferView = NULL; // optional
+		printf
+		(
+			"levels of detail %-3s: %u spheres, %u levels, %10llu triangles %8.3f ms/frame\n",
+			on ? "on" : "off",
+			BENCH_LOD_INSTANCES,
+			meshes[mesh]->n_lods,
+			(unsigned long long) tris,
+			best
+		);
+	}
 
-		writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		writes[1].dstSet = descriptor_sets[i];
-		writes[1].dstBinding = 1;
-		writes[1].dstArrayElement = 0;
-		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		writes[1].descriptorCount = 1;
-		writes[1].pBufferInfo = NULL;
-		writes[1].pImageInfo = &img_info; // optional
-		writes[1].pTexelBufferView = NULL; // optional
+	// restore the scene
 
-		vkUpdateDescriptorSets (device, 2, writes, 0, NULL);
+	use_lods = lods;
+	camera = saved_camera;
+
+	instances_clear ();
+	for (uint32_t i = 0; i < n_saved_inst; i ++)
+		instance_add (saved_inst[i].M, saved_inst[i].tex);
+	free (saved_inst);
+
+	draw_list_clear ();
+	for (uint32_t i = 0; i < n_saved; i ++)
+		draw_list_add (&saved[i]);
+	free (saved);
+	destroy_meshes_from (mark);
+}
+
+#define BENCH_MESHLET_SPHERE 512
+#define BENCH_MESHLET_GRID 8
+#define BENCH_MESHLET_ITERATIONS 10
+
+/**
+ * Dense spheres in a grid wider than the view, drawn indexed and as meshlets, where the
+ * task shader culls those out of view and those facing away.
+ */
+static void bench_meshlets ()
+{
+	if (gpu_driven)
+	{
+		printf ("meshlets: the GPU driven path draws only the builtin mesh\n");
+		return;
+	}
+	if (!has_mesh_shader)
+	{
+		printf ("meshlets: no mesh shaders on this device\n");
+		return;
 	}
-}
 
-static void create_cmdbufs ()
-{
-	uint32_t n_cmdbufs = n_swapchain_img_views;
-	cmdbufs = calloc (n_cmdbufs, sizeof (VkCommandBuffer));
+	int meshlets = use_meshlets;
+	UniformBufferObject saved_camera = camera;
 
-	VkCommandBufferAllocateInfo allocinfo = { 0 };
-	allocinfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocinfo.commandPool = cmdpool;
-	allocinfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocinfo.commandBufferCount = n_cmdbufs;
+	DrawCmd *saved = malloc (n_draws * sizeof (DrawCmd));
+	uint32_t n_saved = n_draws;
+	memcpy (saved, draw_list, n_draws * sizeof (DrawCmd));
 
-	assert (vkAllocateCommandBuffers (device, &allocinfo, cmdbufs) == VK_SUCCESS);
+	InstanceData *saved_inst = malloc (n_instances * sizeof (InstanceData));
+	uint32_t n_saved_inst = n_instances;
+	memcpy (saved_inst, instances, n_instances * sizeof (InstanceData));
 
-	for (size_t i = 0; i < n_cmdbufs; i ++)
-	{
-		VkCommandBufferBeginInfo info = { 0 };
-		info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		//info.flags = 0; // optional
-		//info.pInheritanceInfo = nullptr; // optional
+	Vertex *vx;
+	uint32_t *idx, n_vx;
+	uint32_t n_idx = bench_sphere (BENCH_MESHLET_SPHERE, &vx, &n_vx, &idx);
 
-		assert (vkBeginCommandBuffer (cmdbufs[i], &info) == VK_SUCCESS);
+	uint32_t mark = n_rq_meshes;
+	use_meshlets = 1;
+	uint32_t mesh = mesh_add (vx, n_vx, idx, n_idx, builtin_vx_fmt, builtin_vx_layout);
+	free (vx);
+	free (idx);
 
-		VkClearColorValue clclrv = { 0.0f, 0.0f, 0.0f, 1.0f };
-		VkClearDepthStencilValue clstencilv = { 1.0f, 0.f };
-		VkClearValue clear_values[2] = { 0 };
-		clear_values[0].color = clclrv;
-		clear_values[1].depthStencil = clstencilv;
+	const uint32_t g = BENCH_MESHLET_GRID;
+	instances_clear ();
+	for (uint32_t i = 0; i < g * g; i ++)
+	{
+		float M[16], MQ[16];
+		mat4_identity (M);
+		M[12] = 3.0f * ((float) (i % g) - 0.5f * (g - 1));
+		M[14] = -3.0f * (float) (i / g);
+		mesh_model_matrix (mesh, M, MQ);
+		instance_add (MQ, 0);
+	}
 
-		VkOffset2D offset = { 0, 0 };
-		VkRenderPassBeginInfo render_pass_info = { 0 };
-		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		render_pass_info.renderPass = render_pass;
-		render_pass_info.framebuffer = swapchain_framebufs[i];
-		render_pass_info.renderArea.offset = offset;
-		render_pass_info.renderArea.extent = swapchain_ext;
-		render_pass_info.clearValueCount = 2;
-		render_pass_info.pClearValues = clear_values;
+	DrawCmd cmd = { 0 };
+	cmd.n_indices = meshes[mesh]->n_indices;
+	cmd.n_instances = g * g;
+	cmd.mesh = mesh;
 
-		vkCmdBeginRenderPass (cmdbufs[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline (cmdbufs[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	float V[16], P[16];
+	float eye[3] = { 0.0f, 2.0f, 6.0f }, center[3] = { 0.0f, 0.0f, -6.0f };
+	mat4_look_at (V, eye, center);
+	mat4_perspective (P, (float) M_PI / 3.0f, (float) swapchain_ext.width / swapchain_ext.height, 0.1f, 1000.0f);
+	set_camera (V, P);
+	update_unif_buf (0);
+	update_inst_buf (0);
 
-		VkBuffer vx_bufs[] = { vx_buf };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers (cmdbufs[i], 0, 1, vx_bufs, offsets);
+	for (int on = 0; on <= 1; on ++)
+	{
+		use_meshlets = on;
+		cmd.pipeline = mesh_pipeline (mesh);
+		draw_list_clear ();
+		draw_list_add (&cmd);
 
-		vkCmdBindIndexBuffer (cmdbufs[i], idx_buf, 0, VK_INDEX_TYPE_UINT16);
+		double best = 1e30;
+		for (int it = 0; it < BENCH_MESHLET_ITERATIONS; it ++)
+		{
+			double t = now_ms ();
+			VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+			record_cmdbuf (cmdbuf, 0);
+			end_single_time_cmds (cmdbuf);
+			t = now_ms () - t;
+
+			if (t < best)
+				best = t;
+		}
 
-		vkCmdBindDescriptorSets
+		printf
 		(
-			cmdbufs[i],
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			pipeline_layout,
-			0,
-			1,
-			&descriptor_sets[i],
-			0,
-			NULL
+			"meshlets %-3s: %u spheres of %u triangles, %u meshlets each %8.3f ms/frame\n",
+			on ? "on" : "off",
+			g * g,
+			n_idx / 3,
+			meshes[mesh]->n_meshlets,
+			best
 		);
-		// TODO solve this hard coding for number of indices
-		vkCmdDrawIndexed (cmdbufs[i], 12, 1, 0, 0, 0);  // number of indices = 12
-		vkCmdEndRenderPass (cmdbufs[i]);
-
-		assert (vkEndCommandBuffer (cmdbufs[i]) == VK_SUCCESS);
 	}
-}
 
-static void create_sync ()
-{
-	img_available = calloc (MAX_FRAMES_IN_FLIGHT, sizeof (VkSemaphore));
-	render_finished = calloc (MAX_FRAMES_IN_FLIGHT, sizeof (VkSemaphore));
-	in_flight_fences = calloc (MAX_FRAMES_IN_FLIGHT, sizeof (VkFence));
-	imgs_in_flight = calloc (n_swapchain_imgs, sizeof (VkFence));
+	// restore the scene
 
-	VkSemaphoreCreateInfo semaphore_info = { 0 };
-	semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	use_meshlets = meshlets;
+	camera = saved_camera;
 
-	VkFenceCreateInfo fence_info = { 0 };
-	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	instances_clear ();
+	for (uint32_t i = 0; i < n_saved_inst; i ++)
+		instance_add (saved_inst[i].M, saved_inst[i].tex);
+	free (saved_inst);
 
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i ++)
-		assert
-		(
-			vkCreateSemaphore (device, &semaphore_info, NULL, &img_available[i]) == VK_SUCCESS &&
-			vkCreateSemaphore (device, &semaphore_info, NULL, &render_finished[i]) == VK_SUCCESS &&
-			vkCreateFence (device, &fence_info, NULL, &in_flight_fences[i]) == VK_SUCCESS
-		);
+	draw_list_clear ();
+	for (uint32_t i = 0; i < n_saved; i ++)
+		draw_list_add (&saved[i]);
+	free (saved);
+	destroy_meshes_from (mark);
 }
 
-static int init_vulkan ()
-{
-	create_instance ();
-#ifdef DEBUG
-	setup_debugger ();
-#endif
-	create_surface (); // TODO what about offscreen rendering?
-	pick_physical_device ();
-	create_logical_device ();
-	create_swapchain ();
-	create_img_views ();
-	create_render_pass ();
-	create_descriptor_set_layout ();
-	create_gfx_pipeline ();
-	create_cmd_pool ();
-	create_depth_buffer ();
-	create_framebuffers ();
-	create_tex_img ();
-	create_tex_img_view ();
-	create_tex_sampler ();
-	create_vx_buf ();
-	create_idx_buf ();
-	create_uniform_buf ();
-	create_descriptor_pool ();
-	create_descriptor_sets ();
-	create_cmdbufs ();
-	create_sync ();
-
-	return 0;
-}
+#define BENCH_PARTICLES (1 << 21)
+#define BENCH_PARTICLE_WARMUP 240 // two lifetimes, the live count has settled by then
+#define BENCH_PARTICLE_FRAMES 60
+#define BENCH_PARTICLE_ITERATIONS 5
 
-void init ()
+/**
+ * One frame of particle updates, ordered after the previous one as the frame graph would.
+ */
+static void bench_particles_update (VkCommandBuffer cmdbuf)
 {
-	init_window ();
-	init_vulkan ();
+	memory_barrier
+	(
+		cmdbuf,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	);
+	record_particles_update (cmdbuf);
 }
 
 /**
- * update the uniform buffers with new data?
+ * Time of the particle update by how many particles are alive, set through the emission
+ * rate. Only the compute passes are timed, nothing is drawn. With `--particles` the
+ * running system is measured and its particles are killed at the end.
  */
-static void update_unif_buf (uint32_t img)
+static void bench_particles ()
 {
-	/*
-	in the tutorial there was quite a lot of code here about rotating the
-	square in the scene based on the time so it followed a uniform
-	update cycle. this feels a little unnecessary here.
+	int own = n_particles == 0;
+	if (own)
+		create_particles (BENCH_PARTICLES);
 
-	this function should in general be to send the updated information about
-	the scene to the gpu.
-	*/
-}
+	ParticleParams saved = *particle_params;
+	uint32_t full = (uint32_t) (n_particles * saved.dt / saved.lifetime);
 
-void cleanup_swapchain ()
-{
-	vkDestroyImageView (device, depth_img_view, NULL);
-	vkDestroyImage (device, depth_img, NULL);
-	vkFreeMemory (device, depth_img_mem, NULL);
+	VkBuffer state_buf;
+	VkDeviceMemory state_mem;
+	create_buffer
+	(
+		sizeof (ParticleState),
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&state_buf,
+		&state_mem
+	);
 
-	for (int i = 0; i < n_swapchain_imgs; i++)
-		vkDestroyFramebuffer (device, swapchain_framebufs[i], NULL);
+	// emission rates for 1/64, 1/16, 1/4 and 3/4 of the particles alive
+	const uint32_t div[] = { 64, 16, 4, 1 };
+	for (size_t d = 0; d < sizeof (div) / sizeof (div[0]); d ++)
+	{
+		particle_params->emit = full / div[d] > 0 ? full / div[d] : 1;
 
-	vkFreeCommandBuffers (device, cmdpool, n_swapchain_img_views, cmdbufs);
+		VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+		record_particles_reset (cmdbuf);
+		for (int f = 0; f < BENCH_PARTICLE_WARMUP; f ++)
+			bench_particles_update (cmdbuf);
+		end_single_time_cmds (cmdbuf);
 
-	vkDestroyPipeline (device, pipeline, NULL);
-	vkDestroyPipelineLayout (device, pipeline_layout, NULL);
-	vkDestroyRenderPass (device, render_pass, NULL);
+		double best = 1e30;
+		for (int it = 0; it < BENCH_PARTICLE_ITERATIONS; it ++)
+		{
+			double t = now_ms ();
+			cmdbuf = begin_single_time_cmds ();
+			for (int f = 0; f < BENCH_PARTICLE_FRAMES; f ++)
+				bench_particles_update (cmdbuf);
+			end_single_time_cmds (cmdbuf);
+			t = now_ms () - t;
+
+			if (t < best)
+				best = t;
+		}
 
-	for (int i = 0; i < n_swapchain_img_views; i++)
-		vkDestroyImageView (device, swapchain_img_views[i], NULL);
+		cmdbuf = begin_single_time_cmds ();
+		memory_barrier
+		(
+			cmdbuf,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT
+		);
+		VkBufferCopy region = { 0, 0, sizeof (ParticleState) };
+		vkCmdCopyBuffer (cmdbuf, particle_state_buf, state_buf, 1, &region);
+		end_single_time_cmds (cmdbuf);
 
-	vkDestroySwapchainKHR (device, swapchain, NULL);
+		ParticleState state;
+		void *data;
+		vkMapMemory (device, state_mem, 0, sizeof (ParticleState), 0, &data);
+		memcpy (&state, data, sizeof (ParticleState));
+		vkUnmapMemory (device, state_mem);
 
-	for (int i = 0; i < n_swapchain_imgs; i++)
-	{
-		vkDestroyBuffer (device, unif_buf[i], NULL);
-		vkFreeMemory (device, unif_buf_mem[i], NULL);
+		printf
+		(
+			"particles: %8u alive, %6u emitted per frame %8.3f ms/frame\n",
+			state.draw.instanceCount,
+			particle_params->emit,
+			best / BENCH_PARTICLE_FRAMES
+		);
 	}
 
-	vkDestroyDescriptorPool (device, descriptor_pool, NULL);
+	vkDestroyBuffer (device, state_buf, NULL);
+	vkFreeMemory (device, state_mem, NULL);
+
+	*particle_params = saved;
+	if (own)
+		destroy_particles ();
+	else
+	{
+		VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+		record_particles_reset (cmdbuf);
+		end_single_time_cmds (cmdbuf);
+	}
 }
 
+#define BENCH_RG_CHAIN 4
 
-void recreate_swapchain ()
+static void bench_rg_pass (VkCommandBuffer cmdbuf, uint32_t img, void *user)
 {
-	// wait until the window is a size other than 0
+}
 
-	int w = 0, h = 0;
-	glfwGetFramebufferSize (win, &w, &h);
-	while (w == 0 || h == 0)
+/**
+ * Compile a chain of full screen compute passes over storage images, each reading what
+ * the one before wrote, and a pass whose output nobody reads. Reports what was culled
+ * and how much memory the intermediates take with and without aliasing.
+ */
+static void bench_render_graph ()
+{
+	static RenderGraph g;
+	static const char *names[BENCH_RG_CHAIN] = { "blur 0", "blur 1", "blur 2", "blur 3" };
+
+	double t = now_ms ();
+	rg_init (&g, swapchain_ext, 1);
+
+	uint32_t imgs[BENCH_RG_CHAIN];
+	for (int i = 0; i < BENCH_RG_CHAIN; i ++)
 	{
-		glfwWaitEvents ();
-		glfwGetFramebufferSize (win, &w, &h);
+		imgs[i] = rg_create_image (&g, names[i], VK_FORMAT_R8G8B8A8_UNORM);
+
+		uint32_t pass = rg_add_pass (&g, names[i], 0, bench_rg_pass, NULL);
+		if (i > 0)
+			rg_use (&g, pass, imgs[i - 1], RG_STORAGE_READ);
+		rg_use (&g, pass, imgs[i], RG_STORAGE_WRITE);
 	}
 
-	vkDeviceWaitIdle (device);
+	uint32_t unused = rg_create_image (&g, "unused", VK_FORMAT_R8G8B8A8_UNORM);
+	uint32_t pass = rg_add_pass (&g, "unused", 0, bench_rg_pass, NULL);
+	rg_use (&g, pass, imgs[0], RG_STORAGE_READ);
+	rg_use (&g, pass, unused, RG_STORAGE_WRITE);
 
-	cleanup_swapchain ();
-	create_swapchain ();
-	create_img_views ();
-	create_render_pass ();
-	create_gfx_pipeline ();
-	create_framebuffers ();
-	create_uniform_buf ();
-	create_descriptor_pool ();
-	create_descriptor_sets ();
-	create_cmdbufs ();
-}
+	pass = rg_add_pass (&g, "composite", RG_PASS_KEEP, bench_rg_pass, NULL);
+	rg_use (&g, pass, imgs[BENCH_RG_CHAIN - 1], RG_STORAGE_READ);
 
-void draw ()
-{
-	vkWaitForFences (device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
-	uint32_t img_idx;
-	VkResult res = vkAcquireNextImageKHR
+	rg_compile (&g);
+	t = now_ms () - t;
+
+	// only the barriers are recorded, which is enough for validation to check them
+	VkCommandBuffer cmdbuf = begin_single_time_cmds ();
+	rg_execute (&g, cmdbuf, 0);
+	end_single_time_cmds (cmdbuf);
+
+	printf
 	(
-		device,
-		swapchain,
-		UINT64_MAX,
-		img_available[current_frame],
-		VK_NULL_HANDLE,
-		&img_idx
+		"render graph: %u of %u passes culled, %u levels, %lu KiB of transients in %lu KiB %8.3f ms to compile\n",
+		g.n_passes - g.n_order,
+		g.n_passes,
+		g.n_levels,
+		(unsigned long) (g.transient_size / 1024),
+		(unsigned long) (g.memory_size / 1024),
+		t
 	);
 
-	if (res == VK_ERROR_OUT_OF_DATE_KHR)
+	rg_destroy (&g);
+}
+
+#define BENCH_SCENE_ITERATIONS 5
+
+/**
+ * Time to load the meshes given with `--mesh` by importing the files, and by loading the
+ * same meshes cooked. Both read from the page cache after the first iteration, so this
+ * compares parsing and conversion against plain copies.
+ */
+static void bench_scene_load ()
+{
+	if (n_mesh_files == 0)
 	{
-		recreate_swapchain ();
+		printf ("scene load: no meshes given with --mesh\n");
 		return;
 	}
+
+	uint32_t first = mesh_file_first[0], count = 0;
+	uint64_t src_size = 0;
+	for (uint32_t i = 0; i < n_mesh_files; i ++)
+	{
+		struct stat st;
+		if (stat (mesh_files[i], &st) == 0)
+			src_size += (uint64_t) st.st_size;
+		count += mesh_file_count[i];
+	}
+
+	char fname[] = "/tmp/vkscene-XXXXXX";
+	int fd = mkstemp (fname);
+	assert (fd >= 0);
+	close (fd);
+	cook_scene (fname, first, count);
+
+	struct stat st;
+	stat (fname, &st);
+
+	double import = 1e30, cooked = 1e30;
+	for (int it = 0; it < BENCH_SCENE_ITERATIONS; it ++)
+	{
+		uint32_t mark = n_rq_meshes;
+		uint32_t n;
+
+		double t = now_ms ();
+		for (uint32_t i = 0; i < n_mesh_files; i ++)
+			mesh_load (mesh_files[i], builtin_vx_fmt, builtin_vx_layout, &n);
+		t = now_ms () - t;
+		destroy_meshes_from (mark);
+		if (t < import)
+			import = t;
+
+		Cooked c;
+		t = now_ms ();
+		load_cooked (fname, &c);
+		cooked_close (&c);
+		t = now_ms () - t;
+		destroy_meshes_from (mark);
+		if (t < cooked)
+			cooked = t;
+	}
+
+	unlink (fname);
+
+	printf
+	(
+		"scene load: %u meshes, import %8.3f ms from %lu bytes, cooked %8.3f ms from %lu bytes\n",
+		count,
+		import,
+		(unsigned long) src_size,
+		cooked,
+		(unsigned long) st.st_size
+	);
 }
 
-static void deinit_vulkan ()
+static void bench ()
 {
-	free (unif_buf);
-	free (unif_buf_mem);
-	free (swapchain_imgs);
-	free (swapchain_img_views);
-	free (swapchain_framebufs);
-	free (cmdbufs);
-	free (img_available);
-	free (render_finished);
-	free (in_flight_fences);
-	free (imgs_in_flight);
+	bench_descriptor_updates ();
+	bench_parallel_recording ();
+	bench_vertex_layouts ();
+	bench_vertex_pulling ();
+	bench_depth_prepass ();
+	bench_mesh_optimization ();
+	bench_lods ();
+	bench_meshlets ();
+	bench_particles ();
+	bench_render_graph ();
+	bench_scene_load ();
 }
+#endif
 
-void deinit ()
+/**
+ * The integer argument `arg` of option `opt`, which must be all digits and in
+ * [`min`, `max`]. Anything else exits with a message.
+ */
+static long arg_int (const char *opt, const char *arg, long min, long max)
 {
-	deinit_vulkan ();
+	char *end;
+	errno = 0;
+	long v = strtol (arg, &end, 10);
+	if (errno != 0 || end == arg || *end != '\0' || v < min || v > max)
+	{
+		fprintf (stderr, "%s needs a number from %ld to %ld, got %s\n", opt, min, max, arg);
+		exit (1);
+	}
+	return v;
 }
 
 // TODO this is to be removed later when we know things work
-int main ()
+int main (int argc, char **argv)
 {
+	for (int i = 1; i < argc; i ++)
+	{
+		if (strcmp (argv[i], "--dynamic") == 0)
+			record_mode = RECORD_DYNAMIC;
+		else if (strcmp (argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			// secondary command buffers are recorded per frame
+			record_mode = RECORD_DYNAMIC;
+			n_record_threads = arg_int (argv[i], argv[i + 1], 1, RECORD_MAX_THREADS);
+			i ++;
+		}
+		else if (strcmp (argv[i], "--gpu-driven") == 0)
+			gpu_driven = 1;
+		else if (strcmp (argv[i], "--quantize") == 0)
+			builtin_vx_fmt = VX_FMT_QUANT;
+		else if (strcmp (argv[i], "--interleaved") == 0)
+			builtin_vx_layout = VX_LAYOUT_INTERLEAVED;
+		else if (strcmp (argv[i], "--depth-prepass") == 0)
+			depth_prepass = 1;
+		else if (strcmp (argv[i], "--optimize") == 0)
+			optimize_meshes = 1;
+		else if (strcmp (argv[i], "--lod") == 0)
+		{
+			// choices change as the camera moves, static command buffers would stall
+			record_mode = RECORD_DYNAMIC;
+			use_lods = 1;
+		}
+		else if (strcmp (argv[i], "--pull") == 0)
+			vertex_pulling = 1;
+		else if (strcmp (argv[i], "--meshlets") == 0)
+			use_meshlets = 1;
+		else if (strcmp (argv[i], "--particles") == 0 && i + 1 < argc)
+		{
+			int n = atoi (argv[++ i]);
+			if (n <= 0)
+			{
+				fprintf (stderr, "--particles needs a positive count, got %s\n", argv[i]);
+				return 1;
+			}
+			n_particles = n;
+		}
+		else if (strcmp (argv[i], "--mesh") == 0 && i + 1 < argc && n_mesh_files < MAX_MESH_FILES)
+			mesh_files[n_mesh_files ++] = argv[++ i];
+		else if (strcmp (argv[i], "--scene") == 0 && i + 1 < argc)
+			scene_file = argv[++ i];
+		else if (strcmp (argv[i], "--cook") == 0 && i + 1 < argc)
+		{
+			// nothing is drawn, the meshes are loaded, written and that is it
+			cook_file = argv[++ i];
+			headless = 1;
+		}
+		else if
+		(
+			strcmp (argv[i], "--headless") == 0 && i + 1 < argc &&
+			sscanf (argv[i + 1], "%ux%u", &headless_ext.width, &headless_ext.height) == 2 &&
+			headless_ext.width > 0 && headless_ext.height > 0
+		)
+		{
+			headless = 1;
+			i ++;
+		}
+		else if (strcmp (argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			headless_frames = arg_int (argv[i], argv[i + 1], 1, INT32_MAX);
+			i ++;
+		}
+		else if (strcmp (argv[i], "--stream") == 0 && i + 1 < argc)
+		{
+			i ++;
+			if (strcmp (argv[i], "raw") == 0)
+				stream_fmt = STREAM_RAW;
+			else if (strcmp (argv[i], "y4m") == 0)
+				stream_fmt = STREAM_Y4M;
+			else
+			{
+				fprintf (stderr, "unknown stream format %s, expected raw or y4m\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp (argv[i], "--stream-fd") == 0 && i + 1 < argc)
+		{
+			stream_fd = arg_int (argv[i], argv[i + 1], 0, INT32_MAX);
+			i ++;
+		}
+		else if (strcmp (argv[i], "--device") == 0 && i + 1 < argc)
+			device_override = argv[++ i];
+		else if (strcmp (argv[i], "--probe-devices") == 0)
+			probe_devices = 1;
+		else if (strcmp (argv[i], "--caps") == 0 && i + 1 < argc)
+			caps_json = argv[++ i];
+		else if (strcmp (argv[i], "--batch") == 0 && i + 1 < argc)
+		{
+			load_batch (argv[++ i]);
+			headless = 1;
+			readback = 1;
+			headless_ext.width = batch_jobs[0].w;
+			headless_ext.height = batch_jobs[0].h;
+		}
+		else
+		{
+			fprintf
+			(
+				stderr,
+				"usage: %s [--dynamic] [--threads N] [--gpu-driven] [--quantize] [--interleaved]"
+				" [--depth-prepass] [--optimize] [--lod] [--pull] [--meshlets] [--particles N]"
+				" [--mesh FILE.obj|FILE.glb]... [--scene FILE] [--cook FILE] [--headless WxH [--frames N]]"
+				" [--stream raw|y4m [--stream-fd FD]] [--batch FILE]"
+				" [--device INDEX|UUID|NAME] [--probe-devices] [--caps FILE|-]\n",
+				argv[0]
+			);
+			return 1;
+		}
+	}
+
+	if (scene_file && n_mesh_files > 0)
+	{
+		fprintf (stderr, "--scene and --mesh can not be combined, cook the meshes into the scene\n");
+		return 1;
+	}
+
+	if (cook_file && headless_ext.width == 0)
+	{
+		headless_ext.width = 1;
+		headless_ext.height = 1;
+	}
+
+	if (stream_fmt != STREAM_NONE)
+		stream_open (stream_fmt, stream_fd < 0 ? STDOUT_FILENO : stream_fd);
+
 	init ();
+
+	if (caps_json)
+	{
+		FILE *fp = strcmp (caps_json, "-") == 0 ? stdout : fopen (caps_json, "w");
+		if (!fp)
+		{
+			fprintf (stderr, "could not write %s!\n", caps_json);
+			return 1;
+		}
+		device_caps_write_json (fp);
+		if (fp != stdout)
+			fclose (fp);
+	}
+
+	if (cook_file)
+	{
+		cook_scene (cook_file, 1, n_rq_meshes - 1);
+		deinit ();
+		return 0;
+	}
+
+#ifdef BENCH
+	bench ();
+#else
+	if (n_batch_jobs > 0)
+		run_batch ();
+	else if (headless)
+	{
+		for (uint32_t i = 0; i < headless_frames; i ++)
+			draw_offscreen ();
+	}
+	else
+	{
+		while (!glfwWindowShouldClose (win))
+		{
+			glfwPollEvents ();
+			draw ();
+		}
+	}
+	vkDeviceWaitIdle (device);
+	readback_drain (1);
+#endif
 	deinit ();
+	stream_close ();
 }